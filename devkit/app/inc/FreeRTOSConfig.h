@@ -83,8 +83,19 @@
 #if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
  #include <stdint.h>
  extern uint32_t SystemCoreClock;
+ extern volatile uint32_t ulTaskSwitchCount;
+ extern volatile uint32_t ulIdleCycles;
+ extern volatile uint32_t ulIdleSwitchedIn;
+ #include "dwt.h"
 #endif
 
+/* Context switch counter for the network benchmarks (console 'nb'), and the
+   DWT cycles the idle task has run for, for the CPU load (snmp_agent.h). These
+   expand inside vTaskSwitchContext(), where pxCurrentTCB is the task being
+   switched out or in. */
+#define traceTASK_SWITCHED_IN()           do { ulTaskSwitchCount++; if(pxCurrentTCB == xIdleTaskHandle) ulIdleSwitchedIn = DWT->CYCCNT; } while(0)
+#define traceTASK_SWITCHED_OUT()          do { if(pxCurrentTCB == xIdleTaskHandle) ulIdleCycles += DWT->CYCCNT - ulIdleSwitchedIn; } while(0)
+
 #define configUSE_PREEMPTION              1
 #define configUSE_IDLE_HOOK               0
 #define configUSE_TICK_HOOK               0
@@ -92,7 +103,8 @@
 #define configTICK_RATE_HZ                ((TickType_t)1000)
 #define configMAX_PRIORITIES              (7)
 #define configMINIMAL_STACK_SIZE          ((uint16_t)256)
-#define configTOTAL_HEAP_SIZE             ((size_t)(30 * 1024))
+#define configTOTAL_HEAP_SIZE             ((size_t)(56 * 1024))
+#define configAPPLICATION_ALLOCATED_HEAP  1     /* ucHeap is in CCM, see main.c */
 #define configMAX_TASK_NAME_LEN           (16)
 #define configUSE_TRACE_FACILITY          1
 #define configUSE_16_BIT_TICKS            0
@@ -127,6 +139,7 @@ to exclude the API function. */
 #define INCLUDE_vTaskDelayUntil        1
 #define INCLUDE_vTaskDelay             1
 #define INCLUDE_xTaskGetSchedulerState 1
+#define INCLUDE_xTaskGetIdleTaskHandle 1
 
 /* Cortex-M specific definitions. */
 #ifdef __NVIC_PRIO_BITS
@@ -0,0 +1,111 @@
+#ifndef __CELLULAR_H
+#define __CELLULAR_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+
+// PPP over serial to a cellular modem, for gateways without Ethernet. The
+// PPP netif sits next to the Ethernet one and becomes the default route while
+// it is up; the Ethernet netif gets it back when the link goes down.
+//
+// The modem is on USART6, both directions by DMA:
+//
+//  - RX: a circular DMA buffer the modem writes into without CPU involvement.
+//    The half, full and USART idle line interrupts wake the cellular task,
+//    which hands what arrived to PPPoS in one piece.
+//  - TX: PPPoS frames are copied into a ring the DMA drains; each transfer
+//    takes everything queued up to the end of the ring, so frames queued
+//    while one is going out leave together in the next transfer.
+//
+// The task dials with AT commands (echo off, PDP context with the APN, ATD)
+// and starts PPP on CONNECT; 'cd 0' skips the dialing for a peer that speaks
+// PPP right away. IPCP negotiates VJ header compression (lwipopts.h).
+//
+// Metered mode is for links billed or powered by the packet: telemetry holds
+// its reports until a datagram is full (TELEMETRY_METERED_FLUSH_MS), and the
+// LCP keepalive drops to one echo every CELLULAR_METERED_ECHO_S, each of which
+// would wake the modem's radio. It applies from the next connection on.
+//
+// tools/modem-standin.py stands in for the modem on the host: it answers the
+// AT commands on a USB serial adapter and runs pppd on a pty behind CONNECT.
+#define MODEM_USART                      USART6
+#define MODEM_USART_CLK_ENABLE()         RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART6, ENABLE)
+#define MODEM_GPIO_CLK_ENABLE()          RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOC, ENABLE)
+#define MODEM_DMA_CLK_ENABLE()           RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE)
+
+/* Definition for the modem USART pins */
+#define MODEM_TX_PIN                     GPIO_Pin_6
+#define MODEM_TX_PIN_SOURCE              GPIO_PinSource6
+#define MODEM_RX_PIN                     GPIO_Pin_7
+#define MODEM_RX_PIN_SOURCE              GPIO_PinSource7
+#define MODEM_GPIO_PORT                  GPIOC
+#define MODEM_AF                         GPIO_AF_USART6
+
+/* DMA2 channel 5: stream 1 receives, stream 6 transmits */
+#define MODEM_DMA_CHANNEL                DMA_Channel_5
+#define MODEM_RX_DMA_STREAM              DMA2_Stream1
+#define MODEM_RX_DMA_IRQn                DMA2_Stream1_IRQn
+#define MODEM_RX_DMA_Handler             DMA2_Stream1_IRQHandler
+#define MODEM_RX_DMA_FLAGS               (DMA_FLAG_TCIF1 | DMA_FLAG_HTIF1 | DMA_FLAG_TEIF1 | DMA_FLAG_DMEIF1 | DMA_FLAG_FEIF1)
+#define MODEM_TX_DMA_STREAM              DMA2_Stream6
+#define MODEM_TX_DMA_IRQn                DMA2_Stream6_IRQn
+#define MODEM_TX_DMA_Handler             DMA2_Stream6_IRQHandler
+#define MODEM_TX_DMA_FLAGS               (DMA_FLAG_TCIF6 | DMA_FLAG_HTIF6 | DMA_FLAG_TEIF6 | DMA_FLAG_DMEIF6 | DMA_FLAG_FEIF6)
+
+/* Definition for the modem USART's NVIC */
+#define MODEM_USART_IRQn                 USART6_IRQn
+#define MODEM_USART_Handler              USART6_IRQHandler
+
+#define CELLULAR_BAUD_RATE               115200
+#define CELLULAR_RX_BUF_SIZE             1024       // Circular DMA buffer, ~90 ms of data at the baud rate
+#define CELLULAR_TX_BUF_SIZE             2048       // Room for a full size frame escaped, and then some
+
+#define CELLULAR_AT_TIMEOUT_MS           2000
+#define CELLULAR_CONNECT_TIMEOUT_MS      30000
+#define CELLULAR_RETRY_MS                10000      // Doubles after each failed attempt...
+#define CELLULAR_MAX_RETRY_MS            (10 * 60 * 1000)   // ...up to this
+#define CELLULAR_METERED_ECHO_S          240        // LCP echo interval in metered mode
+
+// Link settings used at boot, change them with the 'c' console commands
+#define CELLULAR_DEFAULT_ENABLED         0
+#define CELLULAR_DEFAULT_DIAL            1
+#define CELLULAR_DEFAULT_METERED         1
+#define CELLULAR_DEFAULT_APN             "internet"
+#define CELLULAR_APN_LEN                 32
+
+typedef enum CELLULAR_STATE_T {
+    CELLULAR_DISABLED,
+    CELLULAR_DIALING,
+    CELLULAR_NEGOTIATING,       // PPP LCP, authentication and IPCP
+    CELLULAR_UP,
+    CELLULAR_WAITING            // For the next attempt
+} CELLULAR_STATE;
+
+typedef struct CELLULAR_STATS_T {
+    uint32_t connects;          // Times the link came up
+    uint32_t failures;          // Dial or PPP attempts that failed, links that went down
+    uint32_t rx_bytes;          // Serial bytes in and out, PPP framing included
+    uint32_t tx_bytes;
+    uint32_t tx_dmas;           // DMA transfers those went out in
+    uint32_t tx_full;           // Times PPPoS had to wait for room in the TX ring
+    uint32_t tx_dropped;        // Bytes it waited too long for
+    uint32_t rx_dropped;        // Bytes PPPoS had no pbufs for
+    uint32_t rx_overruns;       // USART overrun, framing and noise errors
+    uint32_t up_ms;             // When the current link came up
+} CELLULAR_STATS;
+
+void        CellularHwInit(void);
+void        CellularOSInit(void);
+void        CellularTask(void);
+void        CellularEnable(bool enable);
+void        CellularSetDial(bool dial);
+void        CellularSetMetered(bool metered);
+bool        CellularSetApn(const char* apn);
+bool        CellularIsUp(void);
+void        CellularGetStats(CELLULAR_STATS* out);
+void        CellularPrintStatus(void);
+void        CellularUsartIRQ(void);
+void        CellularRxDmaIRQ(void);
+void        CellularTxDmaIRQ(void);
+
+#endif // __CELLULAR_H
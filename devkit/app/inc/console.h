@@ -24,6 +24,10 @@
 #define CONSOLE_MSG_Q_SIZE               8
 #define CONSOLE_MAX_MSG_SIZE             64
 
+#define NETCONN_BENCH_CALLS              1000
+#define CHKSUM_BENCH_LEN                 1460
+#define CHKSUM_BENCH_ROUNDS              10000
+
 void ConsoleTaskHwInit(void);
 void ConsoleTaskOSInit(void);
 void ConsolePrint(char* text);
@@ -3,6 +3,24 @@
 
 #include "stm32f4xx.h"
 
+// CRC32 implementations, selected at build time with CRC32_METHOD.
+// All of them produce the same result as python's zlib.crc32.
+//
+//  CRC32_BITWISE       no table, 8 shift/xor steps per byte
+//  CRC32_NIBBLE        64 byte table in flash, 2 lookups per byte (bootloader)
+//  CRC32_BYTE          1k table in RAM, 1 lookup per byte
+//  CRC32_SLICE_BY_4    4k table in RAM, 4 bytes per step
+//  CRC32_SLICE_BY_8    8k table in RAM, 8 bytes per step
+#define CRC32_BITWISE       0
+#define CRC32_NIBBLE        1
+#define CRC32_BYTE          2
+#define CRC32_SLICE_BY_4    3
+#define CRC32_SLICE_BY_8    4
+
+#ifndef CRC32_METHOD
+#define CRC32_METHOD        CRC32_SLICE_BY_4
+#endif
+
 uint32_t crc32(uint32_t crc, uint8_t *buf, uint32_t len);
 
 #endif //_CRC_H
@@ -0,0 +1,31 @@
+#ifndef __DWT_H
+#define __DWT_H
+
+#include "stm32f4xx.h"
+
+// DWT cycle counter, counting core clock cycles (168 per us) and wrapping
+// every ~25 s. It backs the CPU load (snmp_agent.h, FreeRTOSConfig.h), the
+// Ethernet driver statistics and the console benchmarks.
+//
+// The CMSIS core header used by this project (V2.10) has no DWT block, this
+// is the part of it the counter needs. A newer core header defines it all.
+#ifndef DWT_BASE
+typedef struct
+{
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+#define DWT_BASE                (0xE0001000UL)
+#define DWT                     ((DWT_Type *) DWT_BASE)
+#define DWT_CTRL_CYCCNTENA_Msk  (1UL << 0)
+#endif
+
+// Enable the trace block and start the counter, if it isn't running yet
+#define DWT_CYCCNT_START()                                  \
+    do {                                                    \
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;     \
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;                \
+    } while(0)
+
+#endif //__DWT_H
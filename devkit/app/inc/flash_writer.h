@@ -0,0 +1,40 @@
+#ifndef __FLASH_WRITER_H
+#define __FLASH_WRITER_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+
+// The flash writer task programs image data in the background so the TCP
+// receiver can keep accepting chunks while the previous ones are written.
+// Producers copy data into one of a small pool of page buffers and queue it;
+// the task erases sectors of the target region ahead of the write pointer
+// whenever it has nothing else to do.
+#define FLASH_WRITER_PAGE_SIZE      256
+#define FLASH_WRITER_NUM_PAGES      4
+
+// Supply voltage range of the board (RM0090 table 5), sets the programming
+// parallelism: 1 = x8, 2 = x16, 3 = x32, 4 = x64 (needs external Vpp)
+#define FLASH_WRITER_VOLTAGE_RANGE  3
+
+typedef struct FLASH_WRITER_STATS_T {
+    uint32_t bytes_programmed;
+    uint32_t pages;
+    uint32_t erases;
+    uint32_t program_ms;        // Time spent programming pages
+    uint32_t erase_ms;          // Time spent erasing sectors
+    uint32_t stalls;            // Producer had to wait for a free page buffer
+    uint32_t write_errors;      // Program or read-back verify failures
+} FLASH_WRITER_STATS;
+
+void FlashWriterOSInit(void);
+void FlashWriterTask(void);
+bool FlashWriterBegin(uint32_t start, uint32_t size, bool erase);
+bool FlashWriterWrite(uint32_t address, const uint8_t* data, uint16_t len);
+bool FlashWriterWriteRecord(uint32_t address, const uint8_t* data, uint16_t len);
+bool FlashWriterErase(uint32_t address);
+bool FlashWriterWaitErased(void);
+bool FlashWriterFlush(void);
+void FlashWriterGetStats(FLASH_WRITER_STATS* out);
+void FlashWriterPrintStatus(void);
+
+#endif //__FLASH_WRITER_H
@@ -7,10 +7,45 @@
 #include "lwip/sys.h"
 #include "lwip/api.h"
 
+// FTP client pulling firmware images into their flash region (fw_upload.h).
+// 'ff' logs in to the firmware server, lists it (NLST) and downloads the
+// newest SUNFLOWER* and DANDELION* files; 'fc' and 'fg' do the same steps by
+// hand, e.g. against tools/ftp-standin.py.
+//
+// Downloads are binary, passive mode RETRs. The region is erased before the
+// RETR is sent, then data connection netbufs go to the flash writer a page at
+// a time, straight from the pbufs: only the tail of a netbuf that doesn't
+// fill a page is copied aside until the next one. Programming a page (~1 ms)
+// outruns the link, so the pull runs at link speed. The image CRCs are
+// computed on each page as it is queued and checked against the image header
+// once the file is in, along with a zlib.crc32 of the whole file for
+// comparing with the server's copy.
+//
+// A data connection that drops, stalls for FTP_DATA_TIMEOUT_MS or ends short
+// of the size the server gave (SIZE) is resumed with REST from the last whole
+// page, over a new control connection, up to FTP_MAX_RESUMES times.
+#define FTP_NAME_LEN            64
+#define FTP_REPLY_TIMEOUT_MS    10000
+#define FTP_DATA_TIMEOUT_MS     10000
+#define FTP_MAX_RESUMES         5
+#define FTP_RESUME_DELAY_MS     1000    // Times the resume count
+
+typedef struct FTP_STATS_T {
+    uint32_t downloads;         // Images pulled and validated
+    uint32_t failures;
+    uint32_t resumes;           // Data connections resumed with REST
+    uint32_t last_bytes;        // Size of the last file pulled
+    uint32_t last_ms;           // Time it took, erase and validation included
+    uint32_t last_crc;          // Its zlib.crc32
+} FTP_STATS;
+
 bool FTP_Init(void);
 bool FTP_DownloadFirmware(void);
 bool FTP_Connect(ip_addr_t *addr, uint16_t port);
+void FTP_Disconnect(void);
 bool FTP_GetFwVersions(char* sunflower, char* dandelion, uint8_t max_len);
-void FTP_Get(void);
+bool FTP_Get(const char* name, uint8_t device);
+void FTP_GetStats(FTP_STATS* out);
+void FTP_PrintStatus(void);
 
 #endif //__FTP_H
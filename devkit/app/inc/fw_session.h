@@ -0,0 +1,41 @@
+#ifndef __FW_SESSION_H
+#define __FW_SESSION_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+#include "fw_update.h"
+#include "fw_upload.h"
+
+// Firmware upload sessions are journaled in flash sector 4 (64k) so a client
+// that loses its connection can reconnect, ask which chunks already made it
+// to flash and send only the rest. Records are appended until the sector is
+// full. Each one carries a bitmap where bit n is cleared (programmed to 0,
+// no erase needed) once chunk n has been written and read back.
+#define FW_SESSION_SECTOR_START     0x08010000
+#define FW_SESSION_SECTOR_SIZE      (64 * 1024)
+#define FW_SESSION_MAGIC            0x46575353  // "FWSS"
+#define FW_SESSION_MAX_CHUNKS       (SUNFLOWER_IMAGE_SIZE / TCP_FW_PAYLOAD_BYTES)
+#define FW_SESSION_BITMAP_WORDS     (FW_SESSION_MAX_CHUNKS / 32)
+
+typedef struct FW_SESSION_KEY_T {
+    uint32_t device;
+    uint32_t region_start;
+    uint32_t image_size;
+    uint32_t image_crc;         // zlib.crc32 of the whole file, computed by the client
+} FW_SESSION_KEY;
+
+typedef struct FW_SESSION_RECORD_T {
+    uint32_t        magic;
+    FW_SESSION_KEY  key;
+    uint32_t        crc32;                              // CRC of the fields above
+    uint32_t        closed;                             // Programmed to 0 when the upload is finished or abandoned
+    uint32_t        missing[FW_SESSION_BITMAP_WORDS];   // Bit n cleared once chunk n is in flash
+} FW_SESSION_RECORD;
+
+bool FwSessionResume(FW_SESSION_KEY* key, uint32_t* missing);
+bool FwSessionStart(FW_SESSION_KEY* key);
+void FwSessionMarkDone(uint16_t chunk);
+bool FwSessionSync(void);
+void FwSessionClose(void);
+
+#endif //__FW_SESSION_H
@@ -7,13 +7,51 @@
 #include "sunflower_app_header.h"
 
 // Sunflower image is kept in sectors 9-10 (256k max image size)
-#define SUNFLOWER_IMAGE_START 0x080C0000
+#define SUNFLOWER_IMAGE_START SUNFLOWER_BACKUP_APP_START
 #define SUNFLOWER_IMAGE_SIZE  (256 * 1024)
 
+// The main (sectors 5-6) and backup (sectors 9-10) regions are both bootable
+// slots: the bootloader launches the newest valid image in place. An image must
+// be linked for the slot it is stored in (devkit / devkit_slot_b targets), and
+// the app always updates the slot it isn't running from. A newly launched image
+// has SUNFLOWER_BOOT_ATTEMPTS resets to call Confirm_Sunflower_Image before the
+// bootloader rolls back to the other slot.
+#define SUNFLOWER_BOOT_ATTEMPTS         3
+#define SUNFLOWER_BOOT_STATE_MAGIC      0x424F4F54  // "BOOT"
+
 // Dandelion image is kept in sector 11
 #define DANDELION_IMAGE_START 0x080E0000
 #define DANDELION_IMAGE_SIZE  (128 * 1024)
 
+// Results of full sunflower image checks are cached in backup SRAM so that a
+// warm reset doesn't CRC both slots again. A record only matches an image with
+// the same header CRCs, size and version, and is dropped whenever its slot is
+// rewritten. Backup SRAM loses its contents on power-up without VBAT, so cold
+// boots always do the full check.
+#define SUNFLOWER_VERIFY_CACHE_MAGIC    0x56524659  // "VRFY"
+#define SUNFLOWER_VERIFY_CACHE_ADDR     BKPSRAM_BASE
+
+typedef struct SUNFLOWER_VERIFY_RECORD_T {
+    uint32_t magic;
+    uint32_t header_crc32;
+    uint32_t body_crc32;
+    uint32_t image_size;
+    uint32_t version;
+    uint32_t crc32;                     // CRC of the fields above
+} SUNFLOWER_VERIFY_RECORD;
+
+typedef struct SUNFLOWER_VERIFY_CACHE_T {
+    SUNFLOWER_VERIFY_RECORD backup;
+    SUNFLOWER_VERIFY_RECORD main;
+    uint32_t                boot_us;        // Time the bootloader spent before launching the app
+    uint32_t                full_checks;    // Full image CRCs run since the last reset
+    uint32_t                boot_magic;     // The fields below are valid
+    uint32_t                confirmed_crc;  // Header CRC of the last image that confirmed a good boot
+    uint32_t                trial_crc;      // Header CRC of the unconfirmed image being tried
+    uint32_t                trial_attempts;
+    uint32_t                rejected_crc;   // Image rolled back from, not launched again
+} SUNFLOWER_VERIFY_CACHE;
+
 
 bool        Write_Dandelion_Word(uint32_t address, uint32_t word);
 bool        Write_Sunflower_Word(uint32_t address, uint32_t word);
@@ -23,6 +61,11 @@ uint32_t    Get_Dandelion_Version(void);
 uint32_t    Get_Sunflower_Version(void);
 void        Erase_Dandelion_Image(void);
 void        Erase_Sunflower_Image(void);
+SUNFLOWER_VERIFY_CACHE* Get_Sunflower_Verify_Cache(void);
+void        Invalidate_Sunflower_Verify_Cache(bool main_region);
+bool        Is_Sunflower_Image_Linked(bool main_region);
+bool        Is_Running_From_Main_Slot(void);
+void        Confirm_Sunflower_Image(void);
 uint32_t crc32(uint32_t crc, uint8_t *buf, uint32_t len);
 
 #endif // __FW_UPDATE_H
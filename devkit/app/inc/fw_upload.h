@@ -0,0 +1,48 @@
+#ifndef __FW_UPLOAD_H
+#define __FW_UPLOAD_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+#include "lwip/api.h"
+
+// Firmware images are sent over the TCP interface in fixed size chunks
+#define TCP_FW_PAYLOAD_BYTES    256
+
+// PAYLOAD, type, addr[4], payload[256] : stop-and-wait, one TCP_ACK per frame
+#define FW_PAYLOAD_FRAME_BYTES  (TCP_FW_PAYLOAD_BYTES + 6)
+
+// CHUNK, type, seq[2], payload[256] : chunk seq is written at offset seq * 256.
+// The host keeps several chunks in flight and the gateway answers with
+// WINDOW_ACK, seq[2] carrying the next chunk it expects (cumulative ACK).
+#define FW_CHUNK_FRAME_BYTES    (TCP_FW_PAYLOAD_BYTES + 4)
+#define FW_WINDOW_ACK_BYTES     3
+
+// RESUME, type, size[4], crc[4] : start or continue an upload of a file with
+// that size and zlib.crc32, answered with SESSION and the missing chunks
+#define FW_RESUME_FRAME_BYTES   10
+
+#define FW_MAX_FRAME_BYTES      FW_PAYLOAD_FRAME_BYTES
+
+// Running CRCs of an image as it is handed to the flash writer, checked
+// against the ones in its header by FwImageValidate. Shared with the FTP
+// download (ftp.h).
+typedef struct FW_IMAGE_CRC_T {
+    const struct FW_IMAGE_LAYOUT_T* layout;
+    uint32_t                next;           // Image offset the CRCs have reached
+    uint32_t                region_size;
+    uint32_t                image_size;     // From the image header, 0 until received
+    uint32_t                header_crc;
+    uint32_t                body_crc;
+    uint32_t                expected_header_crc;
+    uint32_t                expected_body_crc;
+    bool                    in_order;       // Cleared if chunks were not written sequentially
+} FW_IMAGE_CRC;
+
+void FwUploadReset(void);
+bool FwUploadInput(struct netconn *conn, uint8_t* data, uint16_t len);
+bool FwImageRegion(uint8_t device, uint32_t *start, uint32_t *size);
+void FwImageCrcReset(FW_IMAGE_CRC *crc, uint8_t device, uint32_t region_size);
+void FwImageCrcUpdate(FW_IMAGE_CRC *crc, uint32_t offset, const uint8_t *data, uint32_t len);
+bool FwImageValidate(uint8_t device, const FW_IMAGE_CRC *crc);
+
+#endif //__FW_UPLOAD_H
@@ -0,0 +1,51 @@
+#ifndef __HTTP_API_H
+#define __HTTP_API_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+#include "radio_packets.h"
+
+// JSON API served by lwIP's httpd on port 80, next to its static pages:
+//
+//  /api/nodes      gateway MAC and the radio network table
+//  /api/readings   latest report of the HTTP_API_READINGS nodes heard from last
+//  /api/stats      radio, time beacon, report log, exporter, MQTT and lwIP memory counters
+//  /api/valves     open/closed state of every valve
+//
+// Responses are generated while they are sent, one read buffer at a time, so
+// a long node table never sits in RAM whole. HTTP/1.1 requests get a chunked
+// response and the connection stays open for the next request unless the
+// client sent "Connection: close"; HTTP/1.0 requests get the bare body and a
+// close. tools/http-load.py measures the request rate with concurrent clients.
+//
+// RAM per connection, on top of the tcp_pcb from the TCP_PCB pool:
+//
+//  struct http_state       ~40 bytes of lwIP heap, for the life of the connection
+//  read buffer             HTTP_API_CHUNK_SIZE bytes of lwIP heap, while a response is sent
+//  unacked data            about one read buffer of lwIP heap: httpd reads the next
+//                          chunk when the previous one is acknowledged
+//  HTTP_API_CONN           HTTP_API_LINE_SIZE + 16 bytes, static pool, while a response is sent
+//
+// A connection sending a response takes about 2 x HTTP_API_CHUNK_SIZE + 100
+// bytes of lwIP heap, an idle keep-alive one only its http_state; MEM_SIZE
+// accounts for HTTP_API_MAX_CONNS responses at a time. Requests beyond that
+// get a 503 and a close.
+#define HTTP_API_MAX_CONNS          3
+#define HTTP_API_CHUNK_SIZE         512         // Read buffer size asked from httpd
+#define HTTP_API_LINE_SIZE          192         // Longest JSON fragment generated at once
+#define HTTP_API_READINGS           32          // Nodes whose latest report is kept
+
+typedef struct HTTP_API_STATS_T {
+    uint32_t requests;          // API responses started
+    uint32_t busy;              // Requests turned away with a 503
+    uint32_t bytes;             // Response bytes generated, framing included
+    uint16_t connections;       // Responses in progress
+    uint16_t max_connections;
+} HTTP_API_STATS;
+
+void        HttpApiInit(void);
+void        HttpApiRecordReading(generic_message_t* report);
+void        HttpApiGetStats(HTTP_API_STATS* out);
+void        HttpApiPrintStatus(void);
+
+#endif //__HTTP_API_H
@@ -31,7 +31,7 @@
  * critical regions during buffer allocation, deallocation and memory
  * allocation and deallocation.
  */
-//#define SYS_LIGHTWEIGHT_PROT    0
+#define SYS_LIGHTWEIGHT_PROT    1
 
 #define ETHARP_TRUST_IP_MAC     0
 #define IP_REASSEMBLY           1
@@ -52,38 +52,68 @@
    byte alignment -> define MEM_ALIGNMENT to 2. */
 #define MEM_ALIGNMENT           4
 
+/* USE_LWIP_MEM_PROFILE: take the heap, pool and mailbox sizes from
+   lwipopts_mem.h, generated by tools/lwip-profile.py from recorded
+   high-water marks. Sizes it does not set keep the values below. */
+#ifdef USE_LWIP_MEM_PROFILE
+#include "lwipopts_mem.h"
+#endif
+
 /* MEM_SIZE: the size of the heap memory. If the application will send
-a lot of data that needs to be copied, this should be set high. */
-#define MEM_SIZE                (5*1024)
+a lot of data that needs to be copied, this should be set high.
+4k of it are for the HTTP API responses, see http_api.h, 1.5k for the
+SNMP agent's response (1472 bytes, one request at a time). */
+#ifndef MEM_SIZE
+#define MEM_SIZE                (10*1024 + 512)
+#endif
 
 /* MEMP_NUM_PBUF: the number of memp struct pbufs. If the application
    sends a lot of data out of ROM (or other static memory), this
    should be set high. */
+#ifndef MEMP_NUM_PBUF
 #define MEMP_NUM_PBUF           100
+#endif
 /* MEMP_NUM_UDP_PCB: the number of UDP protocol control blocks. One
-   per active UDP "connection". */
-#define MEMP_NUM_UDP_PCB        6
+   per active UDP "connection". One of them is the SNTP client's. */
+#ifndef MEMP_NUM_UDP_PCB
+#define MEMP_NUM_UDP_PCB        7
+#endif
 /* MEMP_NUM_TCP_PCB: the number of simulatenously active TCP
    connections. */
+#ifndef MEMP_NUM_TCP_PCB
 #define MEMP_NUM_TCP_PCB        10
+#endif
 /* MEMP_NUM_TCP_PCB_LISTEN: the number of listening TCP
    connections. */
+#ifndef MEMP_NUM_TCP_PCB_LISTEN
 #define MEMP_NUM_TCP_PCB_LISTEN 5
+#endif
 /* MEMP_NUM_TCP_SEG: the number of simultaneously queued TCP
    segments. */
+#ifndef MEMP_NUM_TCP_SEG
 #define MEMP_NUM_TCP_SEG        20
+#endif
 /* MEMP_NUM_SYS_TIMEOUT: the number of simulateously active
-   timeouts. */
-#define MEMP_NUM_SYS_TIMEOUT    10
+   timeouts. One of them is the SNTP client's poll or retry, four are PPP's
+   (the LCP and IPCP retransmissions, the LCP echo and authentication). */
+#ifndef MEMP_NUM_SYS_TIMEOUT
+#define MEMP_NUM_SYS_TIMEOUT    15
+#endif
 
 
 /* ---------- Pbuf options ---------- */
 /* PBUF_POOL_SIZE: the number of buffers in the pbuf pool. */
+#ifndef PBUF_POOL_SIZE
 #define PBUF_POOL_SIZE          20
+#endif
 
 /* PBUF_POOL_BUFSIZE: the size of each pbuf in the pbuf pool. */
 #define PBUF_POOL_BUFSIZE       500
 
+/* LWIP_SUPPORT_CUSTOM_PBUF: ethernetif passes received frames up the stack
+   in the DMA receive buffers, wrapped as custom pbufs. */
+#define LWIP_SUPPORT_CUSTOM_PBUF 1
+
 
 /* ---------- TCP options ---------- */
 #define LWIP_TCP                1
@@ -124,9 +154,29 @@ a lot of data that needs to be copied, this should be set high. */
 #define LWIP_UDP                1
 #define UDP_TTL                 255
 
+/* ---------- IGMP options ---------- */
+/* Multicast groups are joined through IGMP, which also programs the MAC's
+   multicast filter (ethernetif.c). Other multicast is dropped by the MAC. */
+#define LWIP_IGMP               1
+
 
 /* ---------- Statistics options ---------- */
-#define LWIP_STATS 0
+/* Only the memory counters are kept: heap and pool usage, high-water marks
+   and allocation failures, read back with the 'nm' console command and the
+   'n' TCP command (see net_stats.c). The per protocol counters are off. */
+#define LWIP_STATS              1
+#define LWIP_STATS_LARGE        0
+#define MEM_STATS               1
+#define MEMP_STATS              1
+#define SYS_STATS               1
+#define LINK_STATS              0
+#define ETHARP_STATS            0
+#define IP_STATS                0
+#define IPFRAG_STATS            0
+#define ICMP_STATS              0
+#define IGMP_STATS              0
+#define UDP_STATS               0
+#define TCP_STATS               0
 #define LWIP_PROVIDE_ERRNO 1
 
 
@@ -147,18 +197,18 @@ The STM32F4x7 allows computing and verifying the IP, UDP, TCP and ICMP checksums
 
 
 #ifdef CHECKSUM_BY_HARDWARE
-  /* CHECKSUM_GEN_IP==0: Generate checksums by hardware for outgoing IP packets.*/
-  #define CHECKSUM_GEN_IP                 0
-  /* CHECKSUM_GEN_UDP==0: Generate checksums by hardware for outgoing UDP packets.*/
-  #define CHECKSUM_GEN_UDP                0
-  /* CHECKSUM_GEN_TCP==0: Generate checksums by hardware for outgoing TCP packets.*/
-  #define CHECKSUM_GEN_TCP                0 
-  /* CHECKSUM_CHECK_IP==0: Check checksums by hardware for incoming IP packets.*/
-  #define CHECKSUM_CHECK_IP               0
-  /* CHECKSUM_CHECK_UDP==0: Check checksums by hardware for incoming UDP packets.*/
-  #define CHECKSUM_CHECK_UDP              0
-  /* CHECKSUM_CHECK_TCP==0: Check checksums by hardware for incoming TCP packets.*/
-  #define CHECKSUM_CHECK_TCP              0
+  /* The Ethernet MAC generates and checks the checksums of its own frames
+     (ethernetif.c turns the software ones off for it). The PPP link to the
+     cellular modem has no such offload: it keeps them, per netif. */
+  #define LWIP_CHECKSUM_CTRL_PER_NETIF    1
+  #define CHECKSUM_GEN_IP                 1
+  #define CHECKSUM_GEN_UDP                1
+  #define CHECKSUM_GEN_TCP                1
+  #define CHECKSUM_GEN_ICMP               1
+  #define CHECKSUM_CHECK_IP               1
+  #define CHECKSUM_CHECK_UDP              1
+  #define CHECKSUM_CHECK_TCP              1
+  #define CHECKSUM_CHECK_ICMP             1
 #else
   /* CHECKSUM_GEN_IP==1: Generate checksums in software for outgoing IP packets.*/
   #define CHECKSUM_GEN_IP                 1
@@ -172,6 +222,8 @@ The STM32F4x7 allows computing and verifying the IP, UDP, TCP and ICMP checksums
   #define CHECKSUM_CHECK_UDP              1
   /* CHECKSUM_CHECK_TCP==1: Check checksums in software for incoming TCP packets.*/
   #define CHECKSUM_CHECK_TCP              1
+  /* LWIP_CHECKSUM_ON_COPY==1: Calculate checksum when copying data from application buffers to pbufs.*/
+  #define LWIP_CHECKSUM_ON_COPY           1
 #endif
 
 
@@ -195,6 +247,75 @@ The STM32F4x7 allows computing and verifying the IP, UDP, TCP and ICMP checksums
  */
 #define LWIP_SOCKET                     0
 
+/*
+   ------------------------------------
+   ---------- httpd options ----------
+   ------------------------------------
+*/
+/* The JSON API (http_api.c) streams its responses from custom files and
+   keeps HTTP/1.1 connections open between requests */
+#define LWIP_HTTPD_CUSTOM_FILES         1
+#define LWIP_HTTPD_DYNAMIC_FILE_READ    1
+#define LWIP_HTTPD_CUSTOM_FILES_READ    1
+#define LWIP_HTTPD_SUPPORT_11_KEEPALIVE 1
+
+/*
+   ------------------------------------
+   ---------- SNMP options ------------
+   ------------------------------------
+*/
+/* SNMP agent serving the gateway's private MIB (snmp_agent.c). It runs in
+   its own thread through the netconn API, so walking the node table never
+   holds the tcpip thread. lwIP's own MIB-2 is left out: it needs MIB2_STATS
+   counters on every packet path. */
+#define LWIP_SNMP                       1
+#define SNMP_USE_NETCONN                1
+#define SNMP_USE_RAW                    0
+#define SNMP_LWIP_MIB2                  0
+#define SNMP_STACK_SIZE                 600
+#define SNMP_THREAD_PRIO                osPriorityBelowNormal
+#define SNMP_LWIP_GETBULK_MAX_REPETITIONS 16
+
+/*
+   ------------------------------------
+   ---------- SNTP options ------------
+   ------------------------------------
+*/
+/* SNTP client disciplining the RTC (time_sync.c). The server is a DNS name
+   set by TimeSyncInit, or an address from the 't' console command. With
+   SNTP_CHECK_RESPONSE 2 the request carries the RTC time, which sntp.c uses
+   to take the round trip out of the offset. */
+#define SNTP_SERVER_DNS                 1
+#define SNTP_CHECK_RESPONSE             2
+#define SNTP_UPDATE_DELAY               (15 * 60 * 1000)
+#define SNTP_RETRY_TIMEOUT_MAX          (5 * 60 * 1000)
+#define SNTP_SET_SYSTEM_TIME_US(sec, us) TimeSyncSntpSet((sec), (us))
+#define SNTP_GET_SYSTEM_TIME(sec, us)   do { uint32_t s_, u_; TimeSyncSntpGet(&s_, &u_); (sec) = s_; (us) = u_; } while(0)
+
+void TimeSyncSntpSet(uint32_t sec, uint32_t us);
+void TimeSyncSntpGet(uint32_t* sec, uint32_t* us);
+
+/*
+   ------------------------------------
+   ---------- PPP options -------------
+   ------------------------------------
+*/
+/* PPP over serial to a cellular modem (cellular.c), for gateways without
+   Ethernet. VJ compresses the TCP/IP headers of established connections from
+   40 bytes to 3-7. PAP and CHAP (MD5, from the bundled polarssl code) cover
+   what carriers ask for; the DNS servers come from the peer. The PPP API
+   runs the calls from the cellular task under the core lock. */
+#define PPP_SUPPORT                     1
+#define PPPOS_SUPPORT                   1
+#define LWIP_PPP_API                    1
+#define VJ_SUPPORT                      1
+#define PAP_SUPPORT                     1
+#define CHAP_SUPPORT                    1
+#define MSCHAP_SUPPORT                  0
+#define PPP_IPV6_SUPPORT                0
+#define LCP_ECHOINTERVAL                30
+#define LCP_MAXECHOFAILS                4
+
 /*
    -----------------------------------
    ---------- DEBUG options ----------
@@ -211,13 +332,31 @@ The STM32F4x7 allows computing and verifying the IP, UDP, TCP and ICMP checksums
 */
 
 #define TCPIP_THREAD_STACKSIZE          1000
-#define TCPIP_MBOX_SIZE                 5
-#define DEFAULT_UDP_RECVMBOX_SIZE       2000
-#define DEFAULT_TCP_RECVMBOX_SIZE       2000
-#define DEFAULT_ACCEPTMBOX_SIZE         2000
+/* Mailbox lengths in messages. Each mailbox is a FreeRTOS queue allocated
+   from the FreeRTOS heap (4 bytes per message plus the queue header). */
+#ifndef TCPIP_MBOX_SIZE
+#define TCPIP_MBOX_SIZE                 6
+#endif
+#ifndef DEFAULT_UDP_RECVMBOX_SIZE
+#define DEFAULT_UDP_RECVMBOX_SIZE       6
+#endif
+#ifndef DEFAULT_TCP_RECVMBOX_SIZE
+#define DEFAULT_TCP_RECVMBOX_SIZE       6
+#endif
+#ifndef DEFAULT_ACCEPTMBOX_SIZE
+#define DEFAULT_ACCEPTMBOX_SIZE         6
+#endif
 #define DEFAULT_THREAD_STACKSIZE        500
 #define TCPIP_THREAD_PRIO               osPriorityHigh
 
+/* Threads using the netconn API run the stack themselves while holding a
+   (priority inheriting) core lock, instead of posting every call to the
+   tcpip thread and blocking until it has run. Received frames are processed
+   by the Ethernet input task under the same lock, without going through
+   the tcpip mailbox. */
+#define LWIP_TCPIP_CORE_LOCKING         1
+#define LWIP_TCPIP_CORE_LOCKING_INPUT   1
+
 
 
 #endif /* __LWIPOPTS_H__ */
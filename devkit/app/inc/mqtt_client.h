@@ -0,0 +1,60 @@
+#ifndef __MQTT_CLIENT_H
+#define __MQTT_CLIENT_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+
+// MQTT 3.1.1 client publishing the report log to a broker, so the backend can
+// ingest straight from it instead of polling the TCP terminal.
+//
+// Reports are published at QoS 1 from the oldest unacknowledged entry of the
+// report log. Consecutive reports of the same node go out as one PUBLISH of
+// up to MQTT_BATCH_MAX lines; at most MQTT_INFLIGHT_MAX publishes wait for
+// their PUBACK at a time, and the log is acknowledged (ReportLogAck) as the
+// PUBACKs come back in order. Nothing is held in RAM: after a reconnect the
+// client simply publishes again from the log, so the broker may see a batch
+// twice and subscribers dedupe on the log sequence number.
+//
+// Topics, <gw> being the gateway's radio MAC address in hex:
+//
+//  sunflower/<gw>/<node>/reports   one "seq,timestamp,m0,m1,m2,t0,t1,t2,humid,air_temp" line per report
+//  sunflower/<gw>/status           "online", retained; the will sets it to "offline"
+//  sunflower/<gw>/cmd/valve        subscribed: "open <valve>" or "close <valve>"
+//  sunflower/<gw>/cmd/polling      subscribed: sensor polling period in ms
+#define MQTT_TOPIC_PREFIX           "sunflower"
+
+#define MQTT_INFLIGHT_MAX           4           // QoS 1 publishes awaiting a PUBACK
+#define MQTT_BATCH_MAX              8           // Reports per publish
+#define MQTT_KEEPALIVE_S            60
+#define MQTT_ACK_TIMEOUT_MS         10000       // No CONNACK / PUBACK in time: reconnect
+#define MQTT_BACKOFF_MIN_MS         1000        // Reconnect delay, doubled after every failure
+#define MQTT_BACKOFF_MAX_MS         (5 * 60 * 1000)
+
+// Broker used at boot, change it with the 'q' console commands
+#define MQTT_DEFAULT_ENABLED        0
+#define MQTT_DEFAULT_BROKER         "192.168.1.1"
+#define MQTT_DEFAULT_PORT           1883
+
+typedef struct MQTT_STATS_T {
+    uint32_t connects;          // Sessions accepted by the broker
+    uint32_t failures;          // Connection attempts or sessions that failed
+    uint32_t publishes;
+    uint32_t reports;           // Reports acknowledged by the broker
+    uint32_t bytes;             // Bytes of PUBLISH packets sent
+    uint32_t puback_ms;         // Total and worst publish to PUBACK time
+    uint32_t max_puback_ms;
+    uint32_t age_s;             // Total and worst report timestamp to PUBACK time
+    uint32_t max_age_s;
+    uint32_t aged_reports;      // Reports counted in age_s (needs the clock set)
+    uint32_t connected_ms;      // Time spent connected, for the throughput
+    uint32_t commands;          // Valve and polling commands received
+} MQTT_STATS;
+
+void        MqttOSInit(void);
+void        MqttTask(void);
+bool        MqttSetBroker(const char* addr, uint16_t port);
+void        MqttEnable(bool enable);
+void        MqttGetStats(MQTT_STATS* out);
+void        MqttPrintStatus(void);
+
+#endif //__MQTT_CLIENT_H
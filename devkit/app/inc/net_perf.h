@@ -0,0 +1,34 @@
+#ifndef __NET_PERF_H
+#define __NET_PERF_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+
+// TCP throughput benchmark, lwIP's lwiperf speaking iperf2 on port 5001:
+//
+//  server  the gateway receives from 'iperf -c <gateway>' on a host, and sends
+//          back as well when the host asks for it with -r (after) or -d (at once)
+//  client  the gateway sends to 'iperf -s' on a host for NET_PERF_CLIENT_SECONDS
+//
+// One session runs at a time. The first connection of a session restarts
+// lwIP's high-water marks, as the 'nc' command does, so the result of each
+// direction carries the CPU load over its connection and the lwIP heap and
+// pool high-water marks the run reached. Each result is printed as lines:
+//
+//  iperf <rx|tx> <how it ended> bytes=.. ms=.. kbps=.. cpu=.. remote=..
+//  mem HEAP max=.. err=..
+//  memp <pool> num=.. max=.. err=..            one per pool
+//
+// tools/iperf-bench.py runs a session over the TCP command port ('i') and
+// the same iperf test against a host for comparison.
+#define NET_PERF_CLIENT_SECONDS     10
+#define NET_PERF_LINE_SIZE          96
+
+void        NetPerfInit(void);
+bool        NetPerfStartServer(void);
+bool        NetPerfStartClient(const char* addr, uint16_t port);
+void        NetPerfStop(void);
+bool        NetPerfLine(uint16_t index, char* line, uint16_t size);
+void        NetPerfPrintStatus(void);
+
+#endif //__NET_PERF_H
@@ -0,0 +1,31 @@
+#ifndef __NET_STATS_H
+#define __NET_STATS_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+
+// lwIP memory telemetry: usage, high-water mark and allocation failures of
+// the lwIP heap, every memp pool, the mailboxes and the FreeRTOS heap.
+// The counters are the ones lwIP keeps itself (MEM_STATS, MEMP_STATS,
+// SYS_STATS) plus the mailbox occupancy kept by the port, so reading them
+// costs nothing on the allocation paths beyond what lwIP already does.
+//
+// Each statistic is printed as one line, "<kind> <name> key=value ...":
+//
+//  limits LWIP seg=.. wnd=.. timeouts=.. reass=..   lower bounds lwIP's sanity checks put on the pools
+//  mem HEAP size=1 num=.. used=.. max=.. err=..     lwIP heap, in bytes
+//  memp <pool> size=.. num=.. used=.. max=.. err=.. one per pool, size is the element size
+//  mbox QUEUE num=.. used=.. max=.. fill=.. err=..  longest mailbox, mailboxes in use / max, deepest fill, full posts
+//  sem SYS used=.. max=.. err=..
+//  mutex SYS used=.. max=.. err=..
+//  heap RTOS num=.. used=.. max=..                  FreeRTOS heap, in bytes
+//
+// tools/lwip-profile.py turns recorded lines into a lwipopts_mem.h profile.
+#define NET_STATS_LINE_SIZE     96
+
+bool NetStatsLine(uint16_t index, char* line, uint16_t size);
+void NetStatsPrint(void);
+void NetStatsClear(void);
+const char* NetStatsPoolName(uint16_t pool);
+
+#endif //__NET_STATS_H
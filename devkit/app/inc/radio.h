@@ -2,6 +2,7 @@
 #define _RADIO_H
 
 #include "stm32f4xx.h"
+#include <stdbool.h>
 
 #define SPIn                             SPI1
 #define SPIn_CLK_ENABLE()                RCC_APB2PeriphClockCmd(RCC_APB2Periph_SPI1, ENABLE)
@@ -55,6 +56,11 @@
 
 #define MAX_NETWORK_MEMBERS              1024
 
+// Capture to dispatch latency histogram: bucket i counts latencies below
+// RADIO_LATENCY_BUCKET_US(i), the last one everything above
+#define RADIO_LATENCY_BUCKETS            12
+#define RADIO_LATENCY_BUCKET_US(i)       (256UL << (i))
+
 // Typedefs
 typedef enum RadioTaskState_t {
     CONNECTED,
@@ -90,18 +96,56 @@ typedef struct
     uint8_t   Radio_CustomPayload[RADIO_MAX_PACKET_LENGTH];
 } tRadioConfiguration;
 
+// 16 bytes per slot, MAX_NETWORK_MEMBERS slots
 typedef struct {
     uint32_t mac_address;
+    uint32_t lastHeard;         // Tick count of the last packet from the node, 0 before the first
+    uint32_t rxPackets;         // Packets received from the node
+    uint8_t  latchRssi;         // Raw LATCH_RSSI of the last packet, see RADIO_RSSI_DBM
 } NetworkMember_t;
 
+#define RADIO_RSSI_DBM(latch)            ((int16_t)((latch) / 2) - 140)
+
+// A frame read from the RX FIFO, with the microsecond counter at its sync
+// word: the arrival time of everything in it
+typedef struct RadioFrame_t {
+    uint8_t  data[RADIO_MAX_PACKET_LENGTH];
+    uint32_t capture;
+} RadioFrame;
+
+typedef struct RadioLatency_t {
+    uint32_t count;
+    uint32_t maxUs;
+    uint64_t sumUs;
+    uint32_t buckets[RADIO_LATENCY_BUCKETS];
+} RadioLatency;
+
+typedef struct RadioStats_t {
+    uint32_t rxPackets;         // Packets read from the RX FIFO
+    uint32_t crcErrors;         // Garbled packets dropped by the radio
+    uint32_t sensorReports;
+    uint32_t announces;         // Nodes asking to join
+    uint32_t txPackets;
+    uint32_t reinits;           // Radio reset and configured again after a failed configuration
+    uint32_t noSync;            // Frames without a sync word interrupt, stamped at their RX interrupt
+    RadioLatency dispatch;      // Sync word to sensor report handed on
+} RadioStats;
+
 // OS Task related functions
 void RadioTaskHwInit(void);
 void RadioTaskOSInit(void);
 void RadioTask(void);
-void RadioTaskHandleIRQ(void);
+void RadioTaskHandleIRQ(uint32_t capture);
 uint32_t RadioGetMACAddress(void);
 void RadioPrintConnectedDevices(void);
 uint32_t RadioGetDeviceMAC(uint16_t position);
+int32_t  RadioNextDevice(uint16_t position);
+bool     RadioGetDevice(uint16_t position, NetworkMember_t* out);
+uint16_t RadioDeviceCount(void);
+void RadioGetStats(RadioStats* out);
+void RadioPrintStats(void);
+uint32_t RadioLatencyPercentile(const RadioLatency* latency, uint8_t percent);
+uint64_t RadioCaptureToMs(uint32_t capture);
 
 // Public Radio API
 void SendToDevice(uint8_t* data, uint8_t size, uint32_t mac);
@@ -0,0 +1,62 @@
+#ifndef __REPORT_LOG_H
+#define __REPORT_LOG_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+#include "radio_packets.h"
+
+// The report log is an append-only journal of sensor reports kept in flash
+// sectors 1-3 (3 x 16k). Each sector starts with a header holding the sequence
+// number of its first record and a small table of acknowledgement words, so
+// mounting the log only reads the sector headers plus a binary search for the
+// write pointer. Records are fixed size: sequence number N lives at slot
+// (N - first_seq) of the sector that contains it.
+#define REPORT_LOG_NUM_SECTORS          3
+#define REPORT_LOG_SECTOR_SIZE          (16 * 1024)
+#define REPORT_LOG_SECTOR_MAGIC         0x52504C47  // "RPLG"
+#define REPORT_LOG_ACK_SLOTS            60
+#define REPORT_LOG_HEADER_SIZE          sizeof(REPORT_LOG_SECTOR_HEADER)
+#define REPORT_LOG_RECORDS_PER_SECTOR   ((REPORT_LOG_SECTOR_SIZE - REPORT_LOG_HEADER_SIZE) / sizeof(REPORT_LOG_RECORD))
+
+// Max number of reports handed out per 'r' request on the TCP interface
+#define REPORT_LOG_MAX_BATCH            32
+
+// Reports waiting for the writer task, ReportLogAppend() drops any beyond that
+#define REPORT_LOG_QUEUE_SIZE           32
+
+typedef struct REPORT_LOG_SECTOR_HEADER_T {
+    uint32_t magic;
+    uint32_t first_seq;
+    uint32_t erase_count;
+    uint32_t crc32;                             // CRC of the three words above
+    uint32_t ack_seq[REPORT_LOG_ACK_SLOTS];     // Written once each, last written slot is the current ack
+} REPORT_LOG_SECTOR_HEADER;
+
+typedef struct REPORT_LOG_RECORD_T {
+    uint32_t          seq;                      // Programmed first: a used slot never reads as 0xFFFFFFFF
+    uint32_t          crc32;                    // CRC of seq + report
+    generic_message_t report;
+} REPORT_LOG_RECORD;
+
+typedef struct REPORT_LOG_STATS_T {
+    uint32_t appended;
+    uint32_t dropped;           // Could not be queued for the writer task
+    uint32_t overwritten;       // Unacknowledged reports lost to sector rotation
+    uint32_t write_errors;
+    uint32_t crc_errors;        // Torn or corrupted records found while reading
+    uint32_t erases;
+    uint32_t unsaved_acks;      // Acks held in RAM because the head ack table was full
+} REPORT_LOG_STATS;
+
+void        ReportLogOSInit(void);
+void        ReportLogTask(void);
+bool        ReportLogAppend(generic_message_t* report);
+bool        ReportLogRead(uint32_t seq, generic_message_t* report);
+void        ReportLogAck(uint32_t seq);
+uint32_t    ReportLogFirstUnacked(void);
+uint32_t    ReportLogNextSeq(void);
+uint16_t    ReportLogQueueDepth(void);
+void        ReportLogGetStats(REPORT_LOG_STATS* out);
+void        ReportLogPrintStatus(void);
+
+#endif //__REPORT_LOG_H
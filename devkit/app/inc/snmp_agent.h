@@ -0,0 +1,88 @@
+#ifndef __SNMP_AGENT_H
+#define __SNMP_AGENT_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+
+// SNMP agent (lwIP's, SNMPv1/v2c on port 161) serving the gateway's private
+// MIB under 1.3.6.1.4.1.<SNMP_AGENT_ENTERPRISE_ID>.1:
+//
+//  .1 radio
+//     .1 gwRadioNodes              Gauge32     nodes in the network table
+//     .2 gwRadioRxPackets          Counter32
+//     .3 gwRadioCrcErrors          Counter32
+//     .4 gwRadioTxPackets          Counter32
+//     .5 gwRadioReinits            Counter32   radio configured again after a failure
+//     .6 gwNodeTable.1 gwNodeEntry, indexed by network table slot + 1
+//        .1 gwNodeIndex            Integer32
+//        .2 gwNodeMac              OCTET STRING (4), most significant byte first
+//        .3 gwNodeLastSeen         TimeTicks   uptime when the node was last heard, 0 if never
+//        .4 gwNodeRssi             Integer32   dBm of the last packet
+//        .5 gwNodeRxPackets        Counter32
+//  .2 reports
+//     .1 gwReportQueueDepth        Gauge32     reports waiting for the report log writer
+//     .2 gwReportQueueSize         Gauge32
+//     .3 gwReportLogDropped        Counter32   reports the report log could not queue
+//     .4 gwReportLogOverwritten    Counter32   unacknowledged reports lost to sector rotation
+//     .5 gwTelemetryDropped        Counter32
+//  .3 memory
+//     .1 gwRtosHeapFree            Gauge32     FreeRTOS heap, bytes
+//     .2 gwRtosHeapMinFree         Gauge32     low-water mark since boot
+//     .3 gwLwipHeapUsed            Gauge32     lwIP heap, bytes
+//     .4 gwLwipHeapMax             Gauge32     high-water mark since boot
+//     .5 gwLwipHeapErrors          Counter32   failed allocations
+//     .6 gwPoolTable.1 gwPoolEntry, indexed by lwIP memp pool + 1
+//        .1 gwPoolIndex            Integer32
+//        .2 gwPoolName             OCTET STRING
+//        .3 gwPoolSize             Gauge32     elements
+//        .4 gwPoolUsed             Gauge32
+//        .5 gwPoolMax              Gauge32     high-water mark since boot
+//        .6 gwPoolErrors           Counter32
+//  .4 system
+//     .1 gwUptime                  TimeTicks
+//     .2 gwCpuLoad                 Gauge32     percent busy over the last second
+//     .3 gwCpuLoadAvg              Gauge32     percent busy, one minute average
+//     .4 gwContextSwitches         Counter32
+//
+// Enterprise specific SNMPv1 traps, enterprise 1.3.6.1.4.1.<SNMP_AGENT_ENTERPRISE_ID>.2:
+//
+//  1 queue overflow    a report was dropped; gwReportQueueDepth, gwReportLogDropped
+//  2 radio re-init     the radio is being configured again; gwRadioReinits
+//
+// The agent runs in its own thread (SNMP_USE_NETCONN). A walk of the node
+// table costs one bitmap scan of at most MAX_NETWORK_MEMBERS / 32 words per
+// GETNEXT, never a scan of the table itself. Traps raised while the same trap
+// was sent less than SNMP_AGENT_TRAP_HOLDOFF_MS ago are coalesced into one.
+//
+// The CPU load counts the DWT cycles the idle task runs for, see
+// traceTASK_SWITCHED_IN/OUT in FreeRTOSConfig.h. Interrupts taken while idle
+// count as idle.
+
+// RFC 5612 documentation enterprise number, replace with our own IANA assigned one
+#define SNMP_AGENT_ENTERPRISE_ID    32473
+
+#define SNMP_AGENT_SAMPLE_MS        1000        // CPU load sample period, and how often pending traps are sent
+#define SNMP_AGENT_LOAD_AVG_SAMPLES 60          // Samples in the one minute average
+#define SNMP_AGENT_TRAP_HOLDOFF_MS  10000       // Shortest time between two traps of one kind
+
+typedef enum SNMP_AGENT_TRAP_T {
+    SNMP_AGENT_TRAP_QUEUE_OVERFLOW = 1,
+    SNMP_AGENT_TRAP_RADIO_REINIT   = 2,
+    SNMP_AGENT_NUM_TRAPS
+} SNMP_AGENT_TRAP;
+
+typedef struct SNMP_AGENT_STATS_T {
+    uint32_t traps_raised;
+    uint32_t traps_sent;        // Trap PDUs sent, one for any number raised within the holdoff
+    uint32_t trap_errors;       // Traps lwIP could not send
+} SNMP_AGENT_STATS;
+
+void        SnmpAgentInit(void);
+void        SnmpAgentRaiseTrap(SNMP_AGENT_TRAP trap);
+bool        SnmpAgentSetTrapSink(const char* addr);
+void        SnmpAgentEnableTraps(bool enable);
+void        SnmpAgentCpuCycles(uint64_t* total, uint64_t* idle);
+void        SnmpAgentGetStats(SNMP_AGENT_STATS* out);
+void        SnmpAgentPrintStatus(void);
+
+#endif //__SNMP_AGENT_H
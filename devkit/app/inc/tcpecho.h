@@ -10,7 +10,11 @@ enum BINARY_COMMANDS {
     EXIT_MODE   = 0x4,
     TCP_ACK     = 0x5,
     TCP_NACK    = 0x6,
-    END         = 0x7
+    END         = 0x7,
+    CHUNK       = 0x8,
+    WINDOW_ACK  = 0x9,
+    RESUME      = 0xA,
+    SESSION     = 0xB
 };
 
 enum DEVICE_TYPE {
@@ -18,10 +22,8 @@ enum DEVICE_TYPE {
     SUNFLOWER_DEVICE = 0x2
 };
 
-void tcpecho_os_init(void);
 void tcpecho_thread(void *arg);
-void unix_time_thread(void);
 void EnqueueSensorTCP(generic_message_t* data);
-uint32_t GetUnixTime(void);
+void GetReportSendStats(uint32_t* reports, uint32_t* switches);
 
 #endif //__TCPECHO_H
@@ -0,0 +1,74 @@
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+#include "radio_packets.h"
+
+// The telemetry exporter pushes sensor reports to a collector as UDP
+// datagrams, next to the report log the TCP terminal serves on 'r'. It keeps
+// no per-client state: the collector can be a single host or a multicast
+// group any number of listeners join.
+//
+// Reports are packed into one datagram until it is full or the oldest one in
+// it has waited TELEMETRY_FLUSH_MS. Over a metered link (cellular.h) they wait
+// up to TELEMETRY_METERED_FLUSH_MS instead: full datagrams, each one a single
+// write to the modem and a single radio wakeup on its side. Every datagram carries a sequence number
+// so a collector can count the lost ones; UDP gives no delivery guarantee,
+// the report log remains the reliable path. tools/telemetry-receiver.py is
+// a reference collector that measures loss and latency.
+//
+// Datagram layout, header fields in network byte order:
+//
+//  TELEMETRY_HEADER
+//  count x { uint32_t age_ms; generic_message_t report; }
+//
+// age_ms is the time between the report reaching the gateway and the datagram
+// being sent (network byte order), the report is as received over the radio.
+#define TELEMETRY_MAGIC             0x5346544D  // "SFTM"
+#define TELEMETRY_VERSION           1
+
+#define TELEMETRY_MTU               1500        // Ethernet, no IP fragmentation
+#define TELEMETRY_MAX_PAYLOAD       (TELEMETRY_MTU - 20 - 8)
+#define TELEMETRY_RECORD_SIZE       (sizeof(uint32_t) + sizeof(generic_message_t))
+#define TELEMETRY_MAX_RECORDS       ((TELEMETRY_MAX_PAYLOAD - sizeof(TELEMETRY_HEADER)) / TELEMETRY_RECORD_SIZE)
+
+#define TELEMETRY_FLUSH_MS          1000        // Longest a report waits for the datagram to fill
+#define TELEMETRY_METERED_FLUSH_MS  (60 * 1000) // The same over a metered link
+
+// Collector used at boot, change it with the 'e' console commands
+#define TELEMETRY_DEFAULT_ENABLED   0
+#define TELEMETRY_DEFAULT_ADDR      "239.255.83.70"
+#define TELEMETRY_DEFAULT_PORT      4270
+
+typedef struct TELEMETRY_HEADER_T {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  count;             // Reports in this datagram
+    uint16_t record_size;       // Bytes per report record
+    uint32_t seq;               // Datagram sequence number, restarts from 0 at boot
+    uint32_t uptime_ms;         // Gateway tick count when sent
+    uint32_t unix_time;         // Gateway clock when sent
+    uint32_t dropped;           // Reports the exporter dropped since boot
+} TELEMETRY_HEADER;
+
+typedef struct TELEMETRY_STATS_T {
+    uint32_t reports;           // Reports sent
+    uint32_t datagrams;
+    uint32_t bytes;             // UDP payload bytes
+    uint32_t size_flushes;      // Datagrams sent because they were full
+    uint32_t deadline_flushes;  // Datagrams sent because TELEMETRY_FLUSH_MS expired
+    uint32_t dropped;           // Reports that could not be queued for the exporter
+    uint32_t send_errors;       // Datagrams lwIP refused (no route, out of memory)
+} TELEMETRY_STATS;
+
+void        TelemetryOSInit(void);
+void        TelemetryTask(void);
+bool        TelemetryExport(generic_message_t* report);
+bool        TelemetrySetCollector(const char* addr, uint16_t port);
+void        TelemetryEnable(bool enable);
+void        TelemetrySetMetered(bool metered);
+void        TelemetryGetStats(TELEMETRY_STATS* out);
+void        TelemetryPrintStatus(void);
+
+#endif //__TELEMETRY_H
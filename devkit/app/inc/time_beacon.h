@@ -0,0 +1,90 @@
+#ifndef __TIME_BEACON_H
+#define __TIME_BEACON_H
+
+#include "stm32f4xx.h"
+#include <stdbool.h>
+
+// Time beacons: every TIME_BEACON_PERIOD_MS the gateway broadcasts its wall
+// clock (time_sync.h) and the sampling schedule, so the dandelions share one
+// time base and sample, and open their receivers, together.
+//
+// A beacon carries the gateway time at the end of its own sync word, the
+// instant a receiver's sync detect interrupt marks it by. The radio task
+// stamps the frame just before handing it to the radio and adds the TX
+// latency: the FIFO write, TX warm-up, then preamble and sync word on the air
+// (10 bytes at 10 kbps, 8 ms). The latency starts from those configured
+// lengths and follows the one measured on every beacon: its PACKET_SENT
+// capture, less the air time of the frame after the sync word, less its
+// stamp capture.
+//
+// Nodes following the beacons:
+//
+//  - set their clock to <timeS>.<timeMs> at the beacon's sync word
+//  - sample at epochS + n * samplePeriodMs, and stamp each report with the
+//    sampling instant it was taken at, in whole seconds
+//  - listen for windowMs either side of the next beacon, beaconPeriodMs on
+//
+// Drift: a report's arrival time less its sampling instant is the node's
+// clock error plus a constant sample-to-air delay. Two reports sent after the
+// same beacon at least TIME_BEACON_MIN_DRIFT_MS apart give the node's rate
+// against the gateway clock. Needs a sampling period of 2 s or longer, for the
+// report timestamps to tell the sampling instants apart.
+//
+// Clocks are tracked for the nodes in network table slots 0 to
+// TIME_BEACON_NODES - 1, by slot. Slots are handed out lowest first, so these
+// are the first nodes to join; the rest report no offset or drift.
+//
+// The beacon command is the gateway's own until radio_packets.h (shared with
+// the dandelion firmware) carries it: its value is clear of the commands
+// defined there. tools/beacon-sim.py runs this file's drift estimate, built
+// for the host, against simulated nodes with skewed clocks.
+#define TIME_BEACON_CMD             0xF0
+#define TIME_BEACON_PERIOD_MS       (10 * 60 * 1000)
+#define TIME_BEACON_SAMPLE_MS       (60 * 1000)     // Default sampling period
+#define TIME_BEACON_WINDOW_MS       50
+#define TIME_BEACON_MIN_DRIFT_MS    (5 * 60 * 1000)
+#define TIME_BEACON_NODES           64              // 16 bytes each
+
+// Beacon payload, in generic_message_t.payload
+typedef struct TIME_BEACON_T {
+    uint32_t timeS;             // Gateway Unix time at the end of this frame's sync word
+    uint16_t timeMs;
+    uint16_t sequence;          // Never 0
+    uint32_t epochS;            // Sampling instants: epochS + n * samplePeriodMs
+    uint32_t samplePeriodMs;
+    uint32_t beaconPeriodMs;    // Next beacon due this long after this one
+    uint16_t windowMs;          // Listen this long either side of it
+    uint16_t reserved;
+} TIME_BEACON;
+
+// Clock state of the node in a network table slot
+typedef struct TIME_BEACON_NODE_T {
+    int16_t  offsetS;           // Report timestamp minus arrival time at the last report, saturated
+    int16_t  driftPpm;          // Node clock rate against the gateway's, positive runs fast; 0 until measured
+    uint16_t refBeacon;         // Beacon the reference report followed, 0 for none
+    uint32_t refArrivalMs;      // Arrival time of the reference report, low 32 bits
+    int32_t  refLateMs;         // Its arrival time minus its sampling instant
+} TIME_BEACON_NODE;
+
+typedef struct TIME_BEACON_STATS_T {
+    uint32_t sent;              // Beacons stamped and handed to the radio
+    uint32_t skipped;           // Beacons not sent, the gateway clock was not set
+    uint32_t unmeasured;        // Sent beacons without a plausible PACKET_SENT capture
+    uint16_t sequence;          // Last beacon sent
+    uint32_t latencyUs;         // TX latency added to the next stamp
+    int32_t  lastErrorUs;       // Latency added minus latency measured, last beacon: positive, it ran ahead
+    uint32_t maxErrorUs;        // Largest error either way
+} TIME_BEACON_STATS;
+
+void        TimeBeaconInit(void);
+void        TimeBeaconSendNow(void);
+bool        TimeBeaconSetSampling(uint32_t periodMs, uint32_t epoch);
+void        TimeBeaconStamp(uint8_t* frame, uint8_t length, uint32_t capture);
+void        TimeBeaconSent(uint32_t capture);
+void        TimeBeaconRecordReport(uint16_t slot, uint32_t timestamp, uint64_t arrivalMs);
+void        TimeBeaconResetNode(uint16_t slot);
+bool        TimeBeaconGetNode(uint16_t slot, TIME_BEACON_NODE* out);
+void        TimeBeaconGetStats(TIME_BEACON_STATS* out);
+void        TimeBeaconPrintStatus(void);
+
+#endif // __TIME_BEACON_H
@@ -3,18 +3,49 @@
 
 #include "stm32f4xx.h"
 #include <stdbool.h>
-#include "lwip/opt.h"
-#include "lwip/sys.h"
-#include "lwip/api.h"
 
-void TimeSyncHwInit(void);
+// Wall clock: the RTC, disciplined by lwIP's SNTP client.
+//
+// The board has no LSE crystal, so the RTC runs from the LSI. TimeSyncHwInit
+// measures the LSI against the system clock with TIM5 and sets the RTC
+// prescalers for a ~1 ms subsecond register. Every SNTP response (every
+// 15 minutes, SNTP_UPDATE_DELAY) then:
+//
+//  - sets the calendar if the RTC is off by a second or more, otherwise
+//    shifts it by the offset (RTC_SynchroShiftConfig)
+//  - once two responses are TIME_SYNC_MIN_TRIM_S apart, corrects the
+//    frequency with the RTC's smooth calibration (steps of 2^-20, ~0.95 ppm)
+//    by half the drift measured between them. A drift beyond the calibration
+//    range moves the synchronous prescaler instead (~1000 ppm a step).
+//
+// The RTC keeps running over a reset, as long as the board stays powered,
+// and stays valid: a backup register marks it as set.
+//
+// Until the clock has been set, by SNTP or by 'ts' on the TCP command port,
+// the timestamps below are 0.
+#define TIME_SYNC_SERVER        "pool.ntp.org"
+#define TIME_SYNC_MIN_TRIM_S    600
 
-void TimeSyncInit(void);
+typedef struct TIME_SYNC_STATS_T {
+    uint32_t syncs;             // SNTP responses applied
+    uint32_t steps;             // Of them, the ones that set the calendar
+    uint32_t lastSync;          // Unix time of the last response
+    int32_t  lastOffsetUs;      // Server time minus RTC time at the last response
+    int32_t  trim;              // Smooth calibration in 2^-20 steps, positive runs faster
+    uint16_t prescaler;         // Synchronous prescaler (PREDIV_S)
+    uint32_t lsiHz;             // LSI frequency measured at boot
+} TIME_SYNC_STATS;
 
-void TimeSyncTask(void);
-
-bool TimeSync(void);
-
-uint32_t TimeSyncGet(void);
+void        TimeSyncHwInit(void);
+void        TimeSyncInit(void);
+bool        TimeSyncValid(void);
+uint64_t    TimeSyncNowMs(void);
+uint64_t    TimeSyncTickToMs(uint32_t tick);
+uint32_t    GetUnixTime(void);
+void        TimeSyncSetUnixTime(uint32_t unixTime);
+void        TimeSyncRequest(void);
+bool        TimeSyncSetServer(const char* addr);
+void        TimeSyncGetStats(TIME_SYNC_STATS* out);
+void        TimeSyncPrintStatus(void);
 
 #endif // __TIME_SYNC_H
@@ -2,6 +2,7 @@
 #define _VALVE_H
 
 #include "stm32f4xx.h"
+#include <stdbool.h>
 
 
 #define VALVE_0_PIN     GPIO_Pin_2
@@ -20,8 +21,11 @@
 #define VALVE_3_PORT    GPIOB
 #define VALVE_3_CLK     RCC_AHB1Periph_GPIOB
 
+#define NUM_VALVES      4
+
 void InitValveHw(void);
 void OpenValve(uint8_t valve);
 void CloseValve(uint8_t valve);
+bool IsValveOpen(uint8_t valve);
 
 #endif //_VALVE_H
\ No newline at end of file
@@ -0,0 +1,632 @@
+#include "cellular.h"
+#include "telemetry.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "debug.h"
+#include "xprintf.h"
+#include "lwip/tcpip.h"
+#include "lwip/pppapi.h"
+#include "netif/ppp/pppos.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CELLULAR_LINE_SIZE          64          // Longest modem reply kept, the rest is cut
+#define CELLULAR_TX_WAIT_MS         200         // For room in the TX ring, before dropping the rest of a frame
+#define CELLULAR_GUARD_MS           1100        // Silence around the "+++" escape to command mode
+#define CELLULAR_AT_TRIES           3
+
+static const char* const stateNames[] = {
+    "disabled", "dialing", "negotiating", "up", "waiting"
+};
+
+// Final replies that end a command without the one expected
+static const char* const failReplies[] = {
+    "ERROR", "+CME ERROR", "NO CARRIER", "BUSY", "NO DIALTONE", "NO ANSWER"
+};
+
+extern struct netif xnetif;
+
+static osSemaphoreId            wakeSem;            // Data arrived, or the link settings changed
+static osSemaphoreId            txSem;              // A TX DMA transfer finished
+
+static ppp_pcb*                 ppp;
+static struct netif             pppNetif;
+static volatile CELLULAR_STATE  state = CELLULAR_DISABLED;
+static volatile bool            linkDone;           // PPP is back in the dead phase
+static volatile bool            linkWasUp;
+
+static volatile bool            enabled = CELLULAR_DEFAULT_ENABLED;
+static volatile bool            dial = CELLULAR_DEFAULT_DIAL;
+static volatile bool            metered = CELLULAR_DEFAULT_METERED;
+static char                     apn[CELLULAR_APN_LEN] = CELLULAR_DEFAULT_APN;
+static CELLULAR_STATS           stats;
+
+// Written by the RX DMA stream, read from rxTail up to where it is
+static uint8_t                  rxBuf[CELLULAR_RX_BUF_SIZE];
+static uint16_t                 rxTail;
+
+// Filled at txHead, drained from txTail; txCount includes the txLen bytes
+// of the transfer in progress
+static uint8_t                  txBuf[CELLULAR_TX_BUF_SIZE];
+static uint16_t                 txHead;
+static volatile uint16_t        txTail;
+static volatile uint16_t        txCount;
+static volatile uint16_t        txLen;
+
+static char                     line[CELLULAR_LINE_SIZE];
+
+// Local function prototypes
+static uint16_t     RxSpan(uint8_t** data, uint16_t max);
+static void         RxDiscard(void);
+static uint32_t     Write(const uint8_t* data, uint32_t len);
+static void         TxStart(void);
+static bool         ReadLine(uint32_t timeoutMs);
+static bool         Command(const char* cmd, const char* expect, uint32_t timeoutMs);
+static bool         Dial(void);
+static void         Wait(uint32_t ms);
+static void         RunLink(void);
+static u32_t        Output(ppp_pcb* pcb, u8_t* data, u32_t len, void* ctx);
+static void         LinkStatus(ppp_pcb* pcb, int err, void* ctx);
+
+// Global function implementations
+
+void CellularHwInit(void)
+{
+    GPIO_InitTypeDef  gpio;
+    USART_InitTypeDef config;
+    DMA_InitTypeDef   dma;
+    NVIC_InitTypeDef  nvic;
+
+    MODEM_USART_CLK_ENABLE();
+    MODEM_GPIO_CLK_ENABLE();
+    MODEM_DMA_CLK_ENABLE();
+
+    GPIO_PinAFConfig(MODEM_GPIO_PORT, MODEM_TX_PIN_SOURCE, MODEM_AF);
+    GPIO_PinAFConfig(MODEM_GPIO_PORT, MODEM_RX_PIN_SOURCE, MODEM_AF);
+
+    gpio.GPIO_Pin   = MODEM_TX_PIN | MODEM_RX_PIN;
+    gpio.GPIO_Mode  = GPIO_Mode_AF;
+    gpio.GPIO_OType = GPIO_OType_PP;
+    gpio.GPIO_PuPd  = GPIO_PuPd_UP;
+    gpio.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_Init(MODEM_GPIO_PORT, &gpio);
+
+    // No RTS/CTS on these pins: the TX ring absorbs what the modem is slow to
+    // take, and RX is drained well before the DMA buffer wraps
+    config.USART_BaudRate               = CELLULAR_BAUD_RATE;
+    config.USART_HardwareFlowControl    = USART_HardwareFlowControl_None;
+    config.USART_Mode                   = USART_Mode_Rx | USART_Mode_Tx;
+    config.USART_Parity                 = USART_Parity_No;
+    config.USART_StopBits               = USART_StopBits_1;
+    config.USART_WordLength             = USART_WordLength_8b;
+    USART_Init(MODEM_USART, &config);
+
+    // RX: circular, for as long as the gateway runs
+    DMA_DeInit(MODEM_RX_DMA_STREAM);
+    DMA_StructInit(&dma);
+    dma.DMA_Channel             = MODEM_DMA_CHANNEL;
+    dma.DMA_PeripheralBaseAddr  = (uint32_t)&MODEM_USART->DR;
+    dma.DMA_Memory0BaseAddr     = (uint32_t)rxBuf;
+    dma.DMA_DIR                 = DMA_DIR_PeripheralToMemory;
+    dma.DMA_BufferSize          = CELLULAR_RX_BUF_SIZE;
+    dma.DMA_PeripheralInc       = DMA_PeripheralInc_Disable;
+    dma.DMA_MemoryInc           = DMA_MemoryInc_Enable;
+    dma.DMA_PeripheralDataSize  = DMA_PeripheralDataSize_Byte;
+    dma.DMA_MemoryDataSize      = DMA_MemoryDataSize_Byte;
+    dma.DMA_Mode                = DMA_Mode_Circular;
+    dma.DMA_Priority            = DMA_Priority_High;
+    DMA_Init(MODEM_RX_DMA_STREAM, &dma);
+    DMA_ITConfig(MODEM_RX_DMA_STREAM, DMA_IT_HT | DMA_IT_TC, ENABLE);
+
+    // TX: one transfer per TxStart(), which sets the address and length
+    DMA_DeInit(MODEM_TX_DMA_STREAM);
+    dma.DMA_Memory0BaseAddr     = (uint32_t)txBuf;
+    dma.DMA_DIR                 = DMA_DIR_MemoryToPeripheral;
+    dma.DMA_BufferSize          = 1;
+    dma.DMA_Mode                = DMA_Mode_Normal;
+    dma.DMA_Priority            = DMA_Priority_Medium;
+    DMA_Init(MODEM_TX_DMA_STREAM, &dma);
+    DMA_ITConfig(MODEM_TX_DMA_STREAM, DMA_IT_TC | DMA_IT_TE, ENABLE);
+
+    USART_DMACmd(MODEM_USART, USART_DMAReq_Rx | USART_DMAReq_Tx, ENABLE);
+    USART_ITConfig(MODEM_USART, USART_IT_IDLE, ENABLE);
+    USART_ITConfig(MODEM_USART, USART_IT_ERR, ENABLE);
+
+    nvic.NVIC_IRQChannelPreemptionPriority = configLIBRARY_LOWEST_INTERRUPT_PRIORITY;
+    nvic.NVIC_IRQChannelSubPriority        = 0;
+    nvic.NVIC_IRQChannelCmd                = ENABLE;
+    nvic.NVIC_IRQChannel                   = MODEM_USART_IRQn;
+    NVIC_Init(&nvic);
+    nvic.NVIC_IRQChannel                   = MODEM_RX_DMA_IRQn;
+    NVIC_Init(&nvic);
+    nvic.NVIC_IRQChannel                   = MODEM_TX_DMA_IRQn;
+    NVIC_Init(&nvic);
+
+    DMA_Cmd(MODEM_RX_DMA_STREAM, ENABLE);
+    USART_Cmd(MODEM_USART, ENABLE);
+}
+
+void CellularOSInit(void)
+{
+    osSemaphoreDef(CellularWake);
+    osSemaphoreDef(CellularTx);
+
+    wakeSem = osSemaphoreCreate(osSemaphore(CellularWake), 1);
+    txSem = osSemaphoreCreate(osSemaphore(CellularTx), 1);
+    assert_param(wakeSem != NULL && txSem != NULL);
+
+    // Binary semaphores are created available
+    osSemaphoreWait(wakeSem, 0);
+    osSemaphoreWait(txSem, 0);
+}
+
+void CellularTask(void)
+{
+    uint32_t retryMs = CELLULAR_RETRY_MS;
+
+    ppp = pppapi_pppos_create(&pppNetif, Output, LinkStatus, NULL);
+    assert_param(ppp != NULL);
+
+    // Whatever the network asks for: most APNs take any or no credentials
+    pppapi_set_auth(ppp, PPPAUTHTYPE_ANY, "", "");
+    ppp->settings.usepeerdns = 1;
+
+    while(1)
+    {
+        while(!enabled)
+        {
+            state = CELLULAR_DISABLED;
+            osSemaphoreWait(wakeSem, osWaitForever);
+        }
+
+        if(dial)
+        {
+            state = CELLULAR_DIALING;
+
+            if(!Dial())
+            {
+                if(enabled)
+                {
+                    WARN("Modem did not connect, next try in %d s\n", retryMs / 1000);
+                    stats.failures++;
+                }
+
+                Wait(retryMs);
+                retryMs = retryMs * 2 < CELLULAR_MAX_RETRY_MS ? retryMs * 2 : CELLULAR_MAX_RETRY_MS;
+                continue;
+            }
+        }
+
+        RunLink();
+
+        // A link that was up gets the short delay again, one that never came up backs off
+        if(linkWasUp)
+        {
+            retryMs = CELLULAR_RETRY_MS;
+        }
+
+        Wait(retryMs);
+
+        if(!linkWasUp)
+        {
+            retryMs = retryMs * 2 < CELLULAR_MAX_RETRY_MS ? retryMs * 2 : CELLULAR_MAX_RETRY_MS;
+        }
+    }
+}
+
+// Bring the link up, or take it down and leave the modem alone
+void CellularEnable(bool enable)
+{
+    enabled = enable;
+    osSemaphoreRelease(wakeSem);
+}
+
+// Dial with AT commands before starting PPP, or start PPP right away
+void CellularSetDial(bool on)
+{
+    dial = on;
+}
+
+// Takes effect on telemetry now, and on the LCP echo interval at the next connection
+void CellularSetMetered(bool on)
+{
+    metered = on;
+
+    if(state == CELLULAR_UP)
+    {
+        TelemetrySetMetered(on);
+    }
+}
+
+// Used from the next dial on
+bool CellularSetApn(const char* name)
+{
+    if(name == NULL || name[0] == '\0' || strlen(name) >= CELLULAR_APN_LEN || strchr(name, '"') != NULL)
+    {
+        return false;
+    }
+
+    taskENTER_CRITICAL();
+    strcpy(apn, name);
+    taskEXIT_CRITICAL();
+
+    return true;
+}
+
+bool CellularIsUp(void)
+{
+    return state == CELLULAR_UP;
+}
+
+void CellularGetStats(CELLULAR_STATS* out)
+{
+    memcpy(out, &stats, sizeof(CELLULAR_STATS));
+}
+
+void CellularPrintStatus(void)
+{
+    xprintf("Cellular: %s, APN \"%s\", %s, %s\n", stateNames[state], apn, dial ? "dialing" : "no dialing",
+            metered ? "metered" : "unmetered");
+
+    if(state == CELLULAR_UP)
+    {
+        xprintf("Address %s", ipaddr_ntoa(&pppNetif.ip_addr));
+        xprintf(", peer %s, VJ compression %s, up %d s\n", ipaddr_ntoa(&pppNetif.gw), ppp->vj_enabled ? "on" : "off",
+                (xTaskGetTickCount() - stats.up_ms) / 1000);
+    }
+
+    xprintf("Links: %d up, %d failed\n", stats.connects, stats.failures);
+    xprintf("RX: %d bytes, %d dropped, %d overruns. TX: %d bytes in %d DMA transfers, ring full %d times, %d dropped\n",
+            stats.rx_bytes, stats.rx_dropped, stats.rx_overruns, stats.tx_bytes, stats.tx_dmas, stats.tx_full,
+            stats.tx_dropped);
+}
+
+// Idle line and receive errors. Reading SR then DR clears both; DR holds
+// nothing the RX DMA has not already taken.
+void CellularUsartIRQ(void)
+{
+    uint16_t sr = MODEM_USART->SR;
+
+    if(sr & (USART_FLAG_ORE | USART_FLAG_FE | USART_FLAG_NE))
+    {
+        stats.rx_overruns++;
+    }
+
+    if(sr & (USART_FLAG_IDLE | USART_FLAG_ORE | USART_FLAG_FE | USART_FLAG_NE))
+    {
+        (void)MODEM_USART->DR;
+        osSemaphoreRelease(wakeSem);
+    }
+}
+
+// The RX buffer is half or all the way full
+void CellularRxDmaIRQ(void)
+{
+    DMA_ClearFlag(MODEM_RX_DMA_STREAM, MODEM_RX_DMA_FLAGS);
+    osSemaphoreRelease(wakeSem);
+}
+
+// A transfer finished (or failed, its bytes are gone either way): start the next one
+void CellularTxDmaIRQ(void)
+{
+    DMA_ClearFlag(MODEM_TX_DMA_STREAM, MODEM_TX_DMA_FLAGS);
+
+    txTail = (txTail + txLen) % CELLULAR_TX_BUF_SIZE;
+    txCount -= txLen;
+    txLen = 0;
+
+    TxStart();
+    osSemaphoreRelease(txSem);
+}
+
+// Local function implementations
+
+// Take up to <max> received bytes, as many as are contiguous in the buffer
+uint16_t RxSpan(uint8_t** data, uint16_t max)
+{
+    uint16_t head = (CELLULAR_RX_BUF_SIZE - DMA_GetCurrDataCounter(MODEM_RX_DMA_STREAM)) % CELLULAR_RX_BUF_SIZE;
+    uint16_t len = head >= rxTail ? head - rxTail : CELLULAR_RX_BUF_SIZE - rxTail;
+
+    if(len > max)
+    {
+        len = max;
+    }
+
+    *data = &rxBuf[rxTail];
+    rxTail = (rxTail + len) % CELLULAR_RX_BUF_SIZE;
+
+    return len;
+}
+
+void RxDiscard(void)
+{
+    uint8_t* data;
+
+    while(RxSpan(&data, CELLULAR_RX_BUF_SIZE))
+    {
+    }
+}
+
+// Queue bytes for the modem, waiting for room when the ring is full. Returns
+// how many were queued.
+uint32_t Write(const uint8_t* data, uint32_t len)
+{
+    uint32_t written = 0;
+    uint32_t n;
+
+    while(written < len)
+    {
+        taskENTER_CRITICAL();
+
+        n = len - written;
+        if(n > CELLULAR_TX_BUF_SIZE - txCount)
+        {
+            n = CELLULAR_TX_BUF_SIZE - txCount;
+        }
+        if(n > CELLULAR_TX_BUF_SIZE - txHead)
+        {
+            n = CELLULAR_TX_BUF_SIZE - txHead;
+        }
+
+        if(n)
+        {
+            memcpy(&txBuf[txHead], data + written, n);
+            txHead = (txHead + n) % CELLULAR_TX_BUF_SIZE;
+            txCount += n;
+            written += n;
+            TxStart();
+        }
+
+        taskEXIT_CRITICAL();
+
+        if(n == 0)
+        {
+            stats.tx_full++;
+
+            if(osSemaphoreWait(txSem, CELLULAR_TX_WAIT_MS) != osOK)
+            {
+                stats.tx_dropped += len - written;
+                break;
+            }
+        }
+    }
+
+    stats.tx_bytes += written;
+
+    return written;
+}
+
+// Send everything queued up to the end of the ring, unless a transfer is
+// already going. Called with the TX DMA interrupt masked or from it.
+void TxStart(void)
+{
+    if(txLen || txCount == 0)
+    {
+        return;
+    }
+
+    txLen = txCount < CELLULAR_TX_BUF_SIZE - txTail ? txCount : CELLULAR_TX_BUF_SIZE - txTail;
+
+    DMA_MemoryTargetConfig(MODEM_TX_DMA_STREAM, (uint32_t)&txBuf[txTail], DMA_Memory_0);
+    DMA_SetCurrDataCounter(MODEM_TX_DMA_STREAM, txLen);
+    DMA_ClearFlag(MODEM_TX_DMA_STREAM, MODEM_TX_DMA_FLAGS);
+    DMA_Cmd(MODEM_TX_DMA_STREAM, ENABLE);
+
+    stats.tx_dmas++;
+}
+
+// Read the next non-empty line from the modem into line[]
+bool ReadLine(uint32_t timeoutMs)
+{
+    uint32_t start = xTaskGetTickCount();
+    uint32_t waited;
+    uint16_t len = 0;
+    uint8_t* c;
+
+    while(1)
+    {
+        while(RxSpan(&c, 1))
+        {
+            if(*c == '\r' || *c == '\n')
+            {
+                if(len)
+                {
+                    line[len] = '\0';
+                    return true;
+                }
+            }
+            else if(len < CELLULAR_LINE_SIZE - 1)
+            {
+                line[len++] = *c;
+            }
+        }
+
+        waited = xTaskGetTickCount() - start;
+
+        if(waited >= timeoutMs || !enabled)
+        {
+            return false;
+        }
+
+        osSemaphoreWait(wakeSem, timeoutMs - waited);
+    }
+}
+
+// Send "<cmd>\r" and wait for a reply line starting with <expect>
+bool Command(const char* cmd, const char* expect, uint32_t timeoutMs)
+{
+    uint32_t start = xTaskGetTickCount();
+    uint32_t waited;
+
+    DEBUG("Modem < %s\n", cmd);
+
+    Write((const uint8_t*)cmd, strlen(cmd));
+    Write((const uint8_t*)"\r", 1);
+
+    while(1)
+    {
+        waited = xTaskGetTickCount() - start;
+
+        if(waited >= timeoutMs || !ReadLine(timeoutMs - waited))
+        {
+            return false;
+        }
+
+        DEBUG("Modem > %s\n", line);
+
+        if(strncmp(line, expect, strlen(expect)) == 0)
+        {
+            return true;
+        }
+
+        for(uint8_t i = 0; i < sizeof(failReplies) / sizeof(failReplies[0]); i++)
+        {
+            if(strncmp(line, failReplies[i], strlen(failReplies[i])) == 0)
+            {
+                return false;
+            }
+        }
+    }
+}
+
+bool Dial(void)
+{
+    char     name[CELLULAR_APN_LEN];
+    char     cmd[CELLULAR_APN_LEN + 24];
+    uint8_t  tries;
+
+    RxDiscard();
+
+    for(tries = 0; tries < CELLULAR_AT_TRIES; tries++)
+    {
+        if(Command("AT", "OK", CELLULAR_AT_TIMEOUT_MS))
+        {
+            break;
+        }
+    }
+
+    // Still in data mode from the last link: escape to command mode and hang up
+    if(tries == CELLULAR_AT_TRIES)
+    {
+        osDelay(CELLULAR_GUARD_MS);
+        Write((const uint8_t*)"+++", 3);
+        osDelay(CELLULAR_GUARD_MS);
+        Command("ATH", "OK", CELLULAR_AT_TIMEOUT_MS);
+
+        if(!Command("AT", "OK", CELLULAR_AT_TIMEOUT_MS))
+        {
+            return false;
+        }
+    }
+
+    taskENTER_CRITICAL();
+    strcpy(name, apn);
+    taskEXIT_CRITICAL();
+
+    snprintf(cmd, sizeof(cmd), "AT+CGDCONT=1,\"IP\",\"%s\"", name);
+
+    return Command("ATE0", "OK", CELLULAR_AT_TIMEOUT_MS) &&
+           Command(cmd, "OK", CELLULAR_AT_TIMEOUT_MS) &&
+           Command("ATD*99#", "CONNECT", CELLULAR_CONNECT_TIMEOUT_MS);
+}
+
+// Sleep for <ms>, or until the link is disabled
+void Wait(uint32_t ms)
+{
+    uint32_t start = xTaskGetTickCount();
+    uint32_t waited;
+
+    state = CELLULAR_WAITING;
+
+    while(enabled && (waited = xTaskGetTickCount() - start) < ms)
+    {
+        osSemaphoreWait(wakeSem, ms - waited);
+    }
+}
+
+// Run PPP over the serial line until it goes back to the dead phase
+void RunLink(void)
+{
+    bool     closing = false;
+    uint8_t* data;
+    uint16_t len;
+
+    ppp->settings.lcp_echo_interval = metered ? CELLULAR_METERED_ECHO_S : LCP_ECHOINTERVAL;
+    linkDone = false;
+    linkWasUp = false;
+    state = CELLULAR_NEGOTIATING;
+
+    if(pppapi_connect(ppp, 0) != ERR_OK)
+    {
+        stats.failures++;
+        return;
+    }
+
+    while(!linkDone)
+    {
+        if(!enabled && !closing)
+        {
+            pppapi_close(ppp, 0);
+            closing = true;
+        }
+
+        // pppos_input_tcpip() copies into a pool pbuf chain for the tcpip thread
+        while((len = RxSpan(&data, CELLULAR_RX_BUF_SIZE)) > 0)
+        {
+            if(pppos_input_tcpip(ppp, data, len) == ERR_OK)
+            {
+                stats.rx_bytes += len;
+            }
+            else
+            {
+                stats.rx_dropped += len;
+            }
+        }
+
+        osSemaphoreWait(wakeSem, osWaitForever);
+    }
+}
+
+// Called by PPPoS in the tcpip thread, a frame at a time
+u32_t Output(ppp_pcb* pcb, u8_t* data, u32_t len, void* ctx)
+{
+    return Write(data, len);
+}
+
+// Called in the tcpip thread: with PPPERR_NONE when IPCP is up, then once
+// with the reason when the link is over and PPP is dead
+void LinkStatus(ppp_pcb* pcb, int err, void* ctx)
+{
+    if(err == PPPERR_NONE)
+    {
+        state = CELLULAR_UP;
+        linkWasUp = true;
+        stats.connects++;
+        stats.up_ms = xTaskGetTickCount();
+
+        netif_set_default(&pppNetif);
+        TelemetrySetMetered(metered);
+
+        INFO("Cellular link up, address %s", ipaddr_ntoa(&pppNetif.ip_addr));
+        xprintf(", VJ compression %s\n", pcb->vj_enabled ? "on" : "off");
+        return;
+    }
+
+    if(state == CELLULAR_UP)
+    {
+        netif_set_default(&xnetif);
+        TelemetrySetMetered(false);
+
+        INFO("Cellular link down after %d s, error %d\n", (xTaskGetTickCount() - stats.up_ms) / 1000, err);
+    }
+
+    if(err != PPPERR_USER)
+    {
+        stats.failures++;
+    }
+
+    state = CELLULAR_NEGOTIATING;
+    linkDone = true;
+    osSemaphoreRelease(wakeSem);
+}
@@ -1,20 +1,118 @@
 #include "crc.h"
 
+#define CRC32_POLY  0xedb88320
+
+#if CRC32_METHOD == CRC32_NIBBLE
+
+static const uint32_t crcNibbleTable[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+#elif CRC32_METHOD >= CRC32_BYTE
+
+#if CRC32_METHOD == CRC32_SLICE_BY_8
+#define CRC32_SLICES 8
+#elif CRC32_METHOD == CRC32_SLICE_BY_4
+#define CRC32_SLICES 4
+#else
+#define CRC32_SLICES 1
+#endif
+
+// Built on first use: crcTable[0] is the classic byte table, crcTable[k][n] is
+// the CRC of byte n followed by k zero bytes
+static uint32_t crcTable[CRC32_SLICES][256];
+static uint8_t  crcTableReady;
+
+static void crc32_build_table(void)
+{
+    for(uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+
+        for(uint8_t k = 0; k < 8; k++)
+        {
+            c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        crcTable[0][n] = c;
+    }
+
+    for(uint32_t n = 0; n < 256; n++)
+    {
+        for(uint8_t k = 1; k < CRC32_SLICES; k++)
+        {
+            crcTable[k][n] = (crcTable[k - 1][n] >> 8) ^ crcTable[0][crcTable[k - 1][n] & 0xFF];
+        }
+    }
+
+    crcTableReady = 1;
+}
+
+#endif
+
 // Compute and return the CRC32
 // This CRC32 should match the zlib.crc32 python routine
 uint32_t crc32(uint32_t crc, uint8_t *buf, uint32_t len)
 {
     crc = ~crc;
+
+#if CRC32_METHOD == CRC32_BITWISE
+    while (len--) {
+        crc ^= *buf++;
+        crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+    }
+
+#elif CRC32_METHOD == CRC32_NIBBLE
     while (len--) {
         crc ^= *buf++;
-        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
-        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
-        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
-        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
-        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
-        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
-        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
-        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        crc = (crc >> 4) ^ crcNibbleTable[crc & 0x0F];
+        crc = (crc >> 4) ^ crcNibbleTable[crc & 0x0F];
+    }
+
+#else
+    if(!crcTableReady)
+    {
+        crc32_build_table();
+    }
+
+#if CRC32_SLICES > 1
+    // Byte at a time up to a word boundary, then whole words (little endian)
+    while (len && ((uint32_t)buf & 3)) {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *buf++) & 0xFF];
+        len--;
+    }
+
+#if CRC32_SLICES == 8
+    while (len >= 8) {
+        uint32_t one = *(uint32_t*)buf ^ crc;
+        uint32_t two = *(uint32_t*)(buf + 4);
+
+        crc = crcTable[7][one & 0xFF] ^ crcTable[6][(one >> 8) & 0xFF] ^ crcTable[5][(one >> 16) & 0xFF] ^ crcTable[4][one >> 24] ^
+              crcTable[3][two & 0xFF] ^ crcTable[2][(two >> 8) & 0xFF] ^ crcTable[1][(two >> 16) & 0xFF] ^ crcTable[0][two >> 24];
+        buf += 8;
+        len -= 8;
+    }
+#endif
+
+    while (len >= 4) {
+        crc ^= *(uint32_t*)buf;
+        crc = crcTable[3][crc & 0xFF] ^ crcTable[2][(crc >> 8) & 0xFF] ^ crcTable[1][(crc >> 16) & 0xFF] ^ crcTable[0][crc >> 24];
+        buf += 4;
+        len -= 4;
     }
+#endif
+
+    while (len--) {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *buf++) & 0xFF];
+    }
+#endif
+
     return ~crc;
-}
\ No newline at end of file
+}
@@ -0,0 +1,416 @@
+#include "flash_writer.h"
+#include "stm32f4xx_flash.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "debug.h"
+#include "xprintf.h"
+#include <string.h>
+
+#define FLASH_WRITER_IDLE_TIMEOUT   10
+#define FLASH_WRITER_PUT_TIMEOUT    5000
+#define FLASH_NUM_SECTORS           12
+
+#if FLASH_WRITER_VOLTAGE_RANGE == 1
+typedef uint8_t flash_unit_t;
+#define FLASH_WRITER_PSIZE          FLASH_PSIZE_BYTE
+#elif FLASH_WRITER_VOLTAGE_RANGE == 2
+typedef uint16_t flash_unit_t;
+#define FLASH_WRITER_PSIZE          FLASH_PSIZE_HALF_WORD
+#elif FLASH_WRITER_VOLTAGE_RANGE == 3
+typedef uint32_t flash_unit_t;
+#define FLASH_WRITER_PSIZE          FLASH_PSIZE_WORD
+#elif FLASH_WRITER_VOLTAGE_RANGE == 4
+typedef uint64_t flash_unit_t;
+#define FLASH_WRITER_PSIZE          FLASH_PSIZE_DOUBLE_WORD
+#else
+#error "FLASH_WRITER_VOLTAGE_RANGE must be 1-4"
+#endif
+
+#define FLASH_WRITER_ERASE_RANGE    ((uint8_t)(FLASH_WRITER_VOLTAGE_RANGE - 1))
+
+STATIC_ASSERT(FLASH_WRITER_PAGE_SIZE % sizeof(uint64_t) == 0);
+
+typedef struct FLASH_WRITER_PAGE_T {
+    uint32_t address;
+    uint16_t len;
+    uint32_t data[FLASH_WRITER_PAGE_SIZE / 4];
+} FLASH_WRITER_PAGE;
+
+static FLASH_WRITER_PAGE    pages[FLASH_WRITER_NUM_PAGES];
+
+static osMessageQId         freeQ;          // Page buffers available to producers
+static osMessageQId         workQ;          // Filled pages waiting to be programmed (NULL = wake up)
+static osMutexId            writerMutex;
+static volatile uint8_t     pending;        // Pages handed to the task and not yet programmed
+static volatile bool        failed;         // Latched until the next FlashWriterBegin
+static uint32_t             regionStart;
+static uint32_t             regionEnd;
+static uint16_t             eraseMask;      // Sectors of the region that still need erasing
+static FLASH_WRITER_STATS   stats;
+
+// Local function declarations
+static int8_t   SectorIndex(uint32_t address);
+static bool     EraseSector(uint8_t index);
+static bool     EraseUpTo(uint32_t address);
+static bool     ProgramPage(FLASH_WRITER_PAGE* page);
+static bool     QueuePage(uint32_t address, const uint8_t* data, uint16_t len);
+static void     Service(void);
+
+void FlashWriterOSInit(void)
+{
+    osMessageQDef(FlashWriterFreeQueue, FLASH_WRITER_NUM_PAGES, FLASH_WRITER_PAGE*);
+    osMessageQDef(FlashWriterWorkQueue, FLASH_WRITER_NUM_PAGES + 1, FLASH_WRITER_PAGE*);
+    osMutexDef(FlashWriterMutex);
+
+    freeQ = osMessageCreate(osMessageQ(FlashWriterFreeQueue), NULL);
+    workQ = osMessageCreate(osMessageQ(FlashWriterWorkQueue), NULL);
+    writerMutex = osMutexCreate(osMutex(FlashWriterMutex));
+
+    assert_param(freeQ != NULL);
+    assert_param(workQ != NULL);
+    assert_param(writerMutex != NULL);
+
+    for(uint8_t i = 0; i < FLASH_WRITER_NUM_PAGES; i++)
+    {
+        osMessagePut(freeQ, (uint32_t)&pages[i], 0);
+    }
+}
+
+void FlashWriterTask(void)
+{
+    while(1)
+    {
+        Service();
+    }
+}
+
+// Start writing a new image into [start, start + size). If 'erase' is set the
+// sectors covering the region are erased by the writer task, ahead of the data.
+bool FlashWriterBegin(uint32_t start, uint32_t size, bool erase)
+{
+    int8_t first = SectorIndex(start);
+    int8_t last  = SectorIndex(start + size - 1);
+
+    if(size == 0 || first < 0 || last < 0)
+    {
+        return false;
+    }
+
+    FlashWriterFlush();
+
+    osMutexWait(writerMutex, osWaitForever);
+
+    regionStart = start;
+    regionEnd   = start + size;
+    failed      = false;
+    eraseMask   = 0;
+
+    for(int8_t i = first; i <= last && erase; i++)
+    {
+        eraseMask |= (1 << i);
+    }
+
+    osMutexRelease(writerMutex);
+
+    // Wake the task so it starts erasing straight away
+    osMessagePut(workQ, (uint32_t)NULL, 0);
+
+    return true;
+}
+
+// Queue up to one page of data for programming at 'address'. Blocks while all
+// page buffers are in use. Returns false if the data is outside the region,
+// no buffer became free in time, or an earlier page failed to program.
+bool FlashWriterWrite(uint32_t address, const uint8_t* data, uint16_t len)
+{
+    if(address < regionStart || (address + len) > regionEnd)
+    {
+        return false;
+    }
+
+    return QueuePage(address, data, len);
+}
+
+// Queue a write outside the image region, e.g. bookkeeping that must only
+// reach flash after the image data queued before it. The caller is
+// responsible for the target being erased (or only clearing bits).
+bool FlashWriterWriteRecord(uint32_t address, const uint8_t* data, uint16_t len)
+{
+    return QueuePage(address, data, len);
+}
+
+// Erase the sector containing 'address' once everything queued is written
+bool FlashWriterErase(uint32_t address)
+{
+    int8_t index = SectorIndex(address);
+    bool   ok;
+
+    if(index < 0 || !FlashWriterFlush())
+    {
+        return false;
+    }
+
+    osMutexWait(writerMutex, osWaitForever);
+    ok = EraseSector(index);
+    osMutexRelease(writerMutex);
+
+    return ok;
+}
+
+// Wait for the erase of the current region to finish
+bool FlashWriterWaitErased(void)
+{
+    while(eraseMask && !failed)
+    {
+        osDelay(10);
+    }
+
+    return !failed;
+}
+
+static bool QueuePage(uint32_t address, const uint8_t* data, uint16_t len)
+{
+    osEvent             msgQueueEvent;
+    FLASH_WRITER_PAGE*  page;
+
+    if(failed || len == 0 || len > FLASH_WRITER_PAGE_SIZE || (address % sizeof(flash_unit_t)) != 0)
+    {
+        return false;
+    }
+
+    msgQueueEvent = osMessageGet(freeQ, 0);
+
+    if(msgQueueEvent.status != osEventMessage)
+    {
+        stats.stalls++;
+        msgQueueEvent = osMessageGet(freeQ, FLASH_WRITER_PUT_TIMEOUT);
+
+        if(msgQueueEvent.status != osEventMessage)
+        {
+            return false;
+        }
+    }
+
+    page = (FLASH_WRITER_PAGE*)(msgQueueEvent.value.p);
+    page->address = address;
+
+    // Pad to a whole programming unit with the erased value
+    memcpy(page->data, data, len);
+    memset((uint8_t*)page->data + len, 0xFF, FLASH_WRITER_PAGE_SIZE - len);
+    page->len = (len + sizeof(flash_unit_t) - 1) & ~(sizeof(flash_unit_t) - 1);
+
+    taskENTER_CRITICAL();
+    pending++;
+    taskEXIT_CRITICAL();
+
+    osMessagePut(workQ, (uint32_t)page, osWaitForever);
+
+    return true;
+}
+
+// Wait until every queued page has been programmed.
+// Returns false if anything failed since FlashWriterBegin.
+bool FlashWriterFlush(void)
+{
+    while(pending > 0)
+    {
+        osDelay(1);
+    }
+
+    return !failed;
+}
+
+void FlashWriterGetStats(FLASH_WRITER_STATS* out)
+{
+    memcpy(out, &stats, sizeof(FLASH_WRITER_STATS));
+}
+
+void FlashWriterPrintStatus(void)
+{
+    xprintf("Flash writer: x%d programming, %d/%d pages busy%s\n", sizeof(flash_unit_t) * 8, pending, FLASH_WRITER_NUM_PAGES, failed ? ", FAILED" : "");
+    xprintf("Programmed %d bytes in %d pages, %d ms", stats.bytes_programmed, stats.pages, stats.program_ms);
+
+    if(stats.program_ms > 0)
+    {
+        xprintf(" (%d KB/s)", (stats.bytes_programmed / 1024) * 1000 / stats.program_ms);
+    }
+
+    xprintf("\nErased %d sectors in %d ms, producer stalls: %d, write errors: %d\n", stats.erases, stats.erase_ms, stats.stalls, stats.write_errors);
+}
+
+// Local function implementations
+
+// One pass of the writer task: program the next queued page, or when there is
+// none, erase the next sector ahead of the write pointer
+void Service(void)
+{
+    osEvent             msgQueueEvent;
+    FLASH_WRITER_PAGE*  page;
+
+    msgQueueEvent = osMessageGet(workQ, eraseMask ? FLASH_WRITER_IDLE_TIMEOUT : osWaitForever);
+
+    osMutexWait(writerMutex, osWaitForever);
+
+    if(msgQueueEvent.status == osEventMessage && msgQueueEvent.value.p != NULL)
+    {
+        page = (FLASH_WRITER_PAGE*)(msgQueueEvent.value.p);
+
+        // The page may start a sector that the idle erase hasn't reached yet.
+        // Read the page back so a bad write is caught at the offending chunk
+        // rather than by a CRC over the whole image at the end.
+        if(!failed && (!EraseUpTo(page->address + page->len - 1) || !ProgramPage(page) ||
+                       memcmp((const void*)page->address, page->data, page->len) != 0))
+        {
+            ERR("Flash write failed at 0x%08x\n", page->address);
+            stats.write_errors++;
+            failed = true;
+        }
+
+        taskENTER_CRITICAL();
+        pending--;
+        taskEXIT_CRITICAL();
+
+        osMessagePut(freeQ, (uint32_t)page, 0);
+    }
+    else if(eraseMask)
+    {
+        // Nothing queued: erase the next sector ahead of the write pointer.
+        // The CPU stalls on instruction fetches while the sector is erased,
+        // but the ETH DMA keeps filling the receive descriptors meanwhile.
+        for(uint8_t i = 0; i < FLASH_NUM_SECTORS; i++)
+        {
+            if(eraseMask & (1 << i))
+            {
+                if(!EraseSector(i))
+                {
+                    failed = true;
+                }
+                break;
+            }
+        }
+    }
+
+    osMutexRelease(writerMutex);
+}
+
+// STM32F407 1MB: sectors 0-3 are 16k, sector 4 is 64k, sectors 5-11 are 128k
+int8_t SectorIndex(uint32_t address)
+{
+    uint32_t offset = address - FLASH_BASE;
+
+    if(address < FLASH_BASE || offset >= 0x100000)
+    {
+        return -1;
+    }
+    if(offset < 0x10000)
+    {
+        return offset / 0x4000;
+    }
+    if(offset < 0x20000)
+    {
+        return 4;
+    }
+
+    return 4 + (offset / 0x20000);
+}
+
+// The report log may be using the flash too: only re-lock it if we unlocked it.
+bool EraseSector(uint8_t index)
+{
+    bool     ok;
+    bool     was_locked;
+    uint32_t start = xTaskGetTickCount();
+
+    vTaskSuspendAll();
+
+    was_locked = (FLASH->CR & FLASH_CR_LOCK) != 0;
+    if(was_locked)
+    {
+        FLASH_Unlock();
+    }
+
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+    ok = FLASH_EraseSector(index << 3, FLASH_WRITER_ERASE_RANGE) == FLASH_COMPLETE;
+
+    if(was_locked)
+    {
+        FLASH_Lock();
+    }
+
+    xTaskResumeAll();
+
+    eraseMask &= ~(1 << index);
+    stats.erases++;
+    stats.erase_ms += xTaskGetTickCount() - start;
+
+    return ok;
+}
+
+// Make sure every region sector up to and including 'address' is erased
+bool EraseUpTo(uint32_t address)
+{
+    int8_t last = SectorIndex(address);
+
+    for(int8_t i = 0; i <= last; i++)
+    {
+        if((eraseMask & (1 << i)) && !EraseSector(i))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Program a page at the configured parallelism. PSIZE and PG are set once for
+// the whole page instead of once per word as FLASH_ProgramWord does.
+bool ProgramPage(FLASH_WRITER_PAGE* page)
+{
+    const flash_unit_t*     src   = (const flash_unit_t*)page->data;
+    volatile flash_unit_t*  dst   = (volatile flash_unit_t*)page->address;
+    uint16_t                units = page->len / sizeof(flash_unit_t);
+    uint32_t                start = xTaskGetTickCount();
+    bool                    ok;
+    bool                    was_locked;
+
+    vTaskSuspendAll();
+
+    was_locked = (FLASH->CR & FLASH_CR_LOCK) != 0;
+    if(was_locked)
+    {
+        FLASH_Unlock();
+    }
+
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+    ok = FLASH_WaitForLastOperation() == FLASH_COMPLETE;
+
+    FLASH->CR &= ~(FLASH_CR_PSIZE_0 | FLASH_CR_PSIZE_1);
+    FLASH->CR |= FLASH_WRITER_PSIZE;
+    FLASH->CR |= FLASH_CR_PG;
+
+    for(uint16_t i = 0; i < units && ok; i++)
+    {
+        // Erased flash already reads as all ones: skip padding and blank areas
+        if(src[i] != (flash_unit_t)~0)
+        {
+            dst[i] = src[i];
+            ok = FLASH_WaitForLastOperation() == FLASH_COMPLETE;
+        }
+    }
+
+    FLASH->CR &= ~FLASH_CR_PG;
+
+    if(was_locked)
+    {
+        FLASH_Lock();
+    }
+
+    xTaskResumeAll();
+
+    stats.pages++;
+    stats.bytes_programmed += page->len;
+    stats.program_ms += xTaskGetTickCount() - start;
+
+    return ok;
+}
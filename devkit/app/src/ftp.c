@@ -1,8 +1,16 @@
 #include "ftp.h"
+#include "fw_update.h"
+#include "fw_upload.h"
+#include "fw_session.h"
+#include "flash_writer.h"
+#include "tcpecho.h"
+#include "crc.h"
 #include "debug.h"
 #include <stdio.h>
 #include <string.h>
 #include "xprintf.h"
+#include "FreeRTOS.h"
+#include "task.h"
 #include "lwip/sockets.h"
 
 #define FTP_SERVER  "waterloo.autom8ed.com"
@@ -10,28 +18,68 @@
 #define FTP_PASS    "s4mar1tan"
 #define FTP_PORT    1337
 
-#define TMP_STR_LEN 64
+#define TMP_STR_LEN (FTP_NAME_LEN + 16)
+
+typedef enum FTP_RESULT_T {
+    FTP_DONE,
+    FTP_BROKEN,                 // The connection went: resume
+    FTP_FAILED                  // The server refused, or the flash write failed: give up
+} FTP_RESULT;
+
+// Download in progress. Static, the console task has a small stack.
+typedef struct FTP_TRANSFER_T {
+    uint32_t        start;      // Flash region the file goes to
+    uint32_t        size;
+    uint32_t        file_size;  // From SIZE, 0 if the server did not say
+    uint32_t        done;       // File bytes queued for flash, a whole number of pages
+    uint16_t        partial;    // Bytes in page[] after them
+    uint8_t         page[FLASH_WRITER_PAGE_SIZE];
+    FW_IMAGE_CRC    image_crc;
+    uint32_t        file_crc;
+} FTP_TRANSFER;
 
 struct netconn *g_conn          = NULL;
 struct netconn *g_data          = NULL;
 bool            g_connected     = false;
 
-static bool FTP_SendCommand(char* command, size_t msg_size);
-static bool FTP_PASV(void);
+static ip_addr_t        g_addr;
+static uint16_t         g_port;
+
+// Control connection data received and not read yet
+static struct netbuf*   ctrl_buf;
+static uint16_t         ctrl_pos;
+
+static char             reply[TMP_STR_LEN];     // Last line of the last reply
+static char             command[TMP_STR_LEN];
+static char             sunflower_name[FTP_NAME_LEN];
+static char             dandelion_name[FTP_NAME_LEN];
+static FTP_TRANSFER     transfer;
+static FTP_STATS        stats;
+
+static bool         FTP_ReadLine(char* line, uint16_t size);
+static int16_t      FTP_ReadReply(void);
+static int16_t      FTP_SendCommand(const char* verb, const char* arg);
+static bool         FTP_PASV(void);
+static void         FTP_CloseData(void);
+static void         FTP_ListName(char* name, char* sunflower, char* dandelion, uint8_t max_len);
+static int8_t       FTP_CompareNames(const char* a, const char* b);
+static FTP_RESULT   FTP_Retrieve(const char* name);
+static bool         FTP_Consume(const uint8_t* data, uint16_t len);
+static bool         FTP_WritePage(const uint8_t* data, uint16_t len);
 
 bool FTP_Init(void)
-{    
-    if(!g_conn) 
+{
+    if(!g_conn)
     {
         g_conn = netconn_new(NETCONN_TCP);
     }
-    
-    if (g_conn == NULL) 
+
+    if (g_conn == NULL)
     {
         WARN("Netconn initialization failed\n");
         return false;
     }
-    
+
     return true;
 }
 
@@ -39,315 +87,705 @@ bool FTP_DownloadFirmware(void)
 {
     ip_addr_t addr;
     err_t err;
-    
+    bool ok = true;
+
     err = netconn_gethostbyname(FTP_SERVER, &addr);
-    
+
     if(err != ERR_OK)
     {
         ERR("DNS could not resolve hostname: %s\n", lwip_strerr(err));
         return false;
     }
-    
-    if(!FTP_Init())
-        return false;
-    
+
     if(!FTP_Connect(&addr, FTP_PORT))
         return false;
-    
-    if(!FTP_GetFwVersions(NULL, NULL, 0))
+
+    if(!FTP_GetFwVersions(sunflower_name, dandelion_name, FTP_NAME_LEN))
+    {
+        FTP_Disconnect();
         return false;
-    
-    return true;
+    }
+
+    if(dandelion_name[0] != '\0')
+    {
+        ok &= FTP_Get(dandelion_name, DANDELION_DEVICE);
+    }
+
+    if(sunflower_name[0] != '\0')
+    {
+        ok &= FTP_Get(sunflower_name, SUNFLOWER_DEVICE);
+    }
+
+    FTP_Disconnect();
+
+    return ok;
 }
 
+// Connect and log in, binary mode. Drops the connection already open, if any.
 bool FTP_Connect(ip_addr_t *addr, uint16_t port)
 {
-    err_t err;   
-    char tmp[TMP_STR_LEN];
-    void* data;
-    uint16_t len;
-    struct netbuf *buf;
-    int8_t size;
-    
-    if(g_conn == NULL)
+    err_t err;
+    int16_t code;
+
+    FTP_Disconnect();
+
+    if(!FTP_Init())
     {
-        WARN("Cannot connect to FTP: netconn not initialized\n");
         return false;
     }
-    
+
     err = netconn_connect(g_conn, addr, port);
-    
-    if(err != ERR_OK) 
+
+    if(err != ERR_OK)
     {
         ERR("(FTP) Netconn could not connect to host %s\n", lwip_strerr(err));
-        netconn_close(g_conn);
+        FTP_Disconnect();
         return false;
     }
-    
+
+    netconn_set_recvtimeout(g_conn, FTP_REPLY_TIMEOUT_MS);
     g_connected = true;
+    ip_addr_copy(g_addr, *addr);
+    g_port = port;
+
+    if(FTP_ReadReply() != 220)
+    {
+        ERR("FTP server did not greet us: %s\n", reply);
+        FTP_Disconnect();
+        return false;
+    }
+
+    code = FTP_SendCommand("USER", FTP_USER);
+
+    if(code == 331)
+    {
+        code = FTP_SendCommand("PASS", FTP_PASS);
+    }
 
-    size = snprintf(tmp, TMP_STR_LEN, "USER %s\n", FTP_USER);
-    assert_param(size > 0 && size < TMP_STR_LEN);
-    netconn_write(g_conn, tmp, size, NETCONN_COPY);
-    
-    size = snprintf(tmp, TMP_STR_LEN, "PASS %s\n", FTP_PASS);
-    assert_param(size > 0 && size < TMP_STR_LEN);
-    netconn_write(g_conn, tmp, size, NETCONN_COPY);
-    
-    while((err = netconn_recv(g_conn, &buf)) == ERR_OK)
-    {
-        bool logged_in = false;
-        
-        do 
+    if(code != 230 || FTP_SendCommand("TYPE", "I") != 200)
+    {
+        ERR("Could not log in to FTP: %s\n", reply);
+        FTP_Disconnect();
+        return false;
+    }
+
+    return true;
+}
+
+void FTP_Disconnect(void)
+{
+    FTP_CloseData();
+
+    if(g_conn != NULL)
+    {
+        if(g_connected)
         {
-            netbuf_data(buf, &data, &len);
-            DEBUG("%s\n", (char*)data);
-            if(len >= 3)
+            netconn_write(g_conn, "QUIT\r\n", 6, NETCONN_COPY);
+        }
+
+        netconn_close(g_conn);
+        netconn_delete(g_conn);
+        g_conn = NULL;
+    }
+
+    if(ctrl_buf != NULL)
+    {
+        netbuf_delete(ctrl_buf);
+        ctrl_buf = NULL;
+    }
+
+    g_connected = false;
+}
+
+// Read one line of the control connection into <line>, without its CRLF.
+// Lines are split across netbufs and netbufs hold several lines, so what is
+// left of a netbuf is kept for the next call.
+bool FTP_ReadLine(char* line, uint16_t size)
+{
+    void* data;
+    uint16_t len;
+    uint16_t used = 0;
+
+    while(1)
+    {
+        if(ctrl_buf == NULL)
+        {
+            if(netconn_recv(g_conn, &ctrl_buf) != ERR_OK)
             {
-                if(strncmp((char*)data, "230", 3) == 0)
-                {
-                    logged_in = true;
-                }
-                else if(((char*)data)[0] == '4' || ((char*)data)[0] == '5')
-                {
-                    ERR("Could not connect to FTP, aborting");
-                    return false;
-                }
+                ctrl_buf = NULL;
+                return false;
             }
-        } while (netbuf_next(buf) >= 0);
-        netbuf_delete(buf);
-        
-        if(logged_in)
+            ctrl_pos = 0;
+        }
+
+        netbuf_data(ctrl_buf, &data, &len);
+
+        while(ctrl_pos < len)
         {
-            break;
+            char c = ((char*)data)[ctrl_pos++];
+
+            if(c == '\n')
+            {
+                line[used] = '\0';
+                return true;
+            }
+
+            // Long lines are cut short, the reply code is all that matters
+            if(c != '\r' && used < size - 1)
+            {
+                line[used++] = c;
+            }
+        }
+
+        ctrl_pos = 0;
+
+        if(netbuf_next(ctrl_buf) < 0)
+        {
+            netbuf_delete(ctrl_buf);
+            ctrl_buf = NULL;
         }
     }
-    
-    return true;
 }
 
-bool FTP_SendCommand(char* command, size_t msg_size)
+// Read a reply, all lines of it, leaving its last line in reply[]. Returns
+// its code, -1 if the control connection failed.
+int16_t FTP_ReadReply(void)
 {
-    void* data;
-    uint16_t len;
-    struct netbuf *buf;
-    
+    int16_t code;
+
+    if(!FTP_ReadLine(reply, sizeof(reply)) || strlen(reply) < 3)
+    {
+        FTP_Disconnect();
+        return -1;
+    }
+
+    code = (reply[0] - '0') * 100 + (reply[1] - '0') * 10 + (reply[2] - '0');
+
+    // Multi-line: "123-" up to a line starting with "123 "
+    if(reply[3] == '-')
+    {
+        char first[4];
+
+        memcpy(first, reply, 3);
+        first[3] = ' ';
+
+        do
+        {
+            if(!FTP_ReadLine(reply, sizeof(reply)))
+            {
+                FTP_Disconnect();
+                return -1;
+            }
+        } while(strncmp(reply, first, 4) != 0);
+    }
+
+    DEBUG("%s\n", reply);
+
+    return code;
+}
+
+// Send "<verb> <arg>" and return the code of the reply, -1 if the control
+// connection failed
+int16_t FTP_SendCommand(const char* verb, const char* arg)
+{
+    int size;
+
     // Cannot send command if not connected
     if(g_connected == false)
     {
-        return false;
+        return -1;
     }
-    
-    if(netconn_write(g_conn, command, msg_size, NETCONN_COPY) != ERR_OK)
+
+    size = snprintf(command, TMP_STR_LEN, arg ? "%s %s\r\n" : "%s\r\n", verb, arg);
+
+    if(size <= 0 || size >= TMP_STR_LEN)
+    {
+        ERR("FTP command too long\n");
+        return -1;
+    }
+
+    if(netconn_write(g_conn, command, size, NETCONN_COPY) != ERR_OK)
     {
         ERR("Could not write command over g_conn socket\n");
+        FTP_Disconnect();
+        return -1;
+    }
+
+    return FTP_ReadReply();
+}
+
+// Send a PASV command and open the g_data netconn.
+// Returns true if the g_data netconn was opened, else returns false for any error
+bool FTP_PASV(void)
+{
+    long            ip_temp_a;
+    long            ip_temp_b;
+    long            ip_temp_c;
+    long            ip_temp_d;
+    long            port_a;
+    long            port_b;
+    char*           first_num;
+    ip_addr_t       addr;
+
+    if(FTP_SendCommand("PASV", NULL) != 227)
+    {
+        DEBUG("Error sending passv command\n");
         return false;
     }
-    
-    while(netconn_recv(g_conn, &buf) == ERR_OK)
+
+    // 227 Entering Passive Mode (h1,h2,h3,h4,p1,p2): the parentheses are optional
+    first_num = &reply[3];
+
+    for(char* c = first_num; *c != '\0'; c++)
     {
-        bool done = false;
-        do 
+        if(*c < '0' || *c > '9')
         {
-            netbuf_data(buf, &data, &len);
-            
-            DEBUG("%s\n", (char*)data);
-            
-            if(((char*)data)[0] == '2' || ((char*)data)[0] == '3')
-            {
-                done = true;
-            }
-            else if(((char*)data)[0] == '4' || ((char*)data)[0] == '5')
-            {
-                DEBUG("Error connecting to FTP, aborting\n");
-                return false;
-            }
-        } while (netbuf_next(buf) >= 0);
-        netbuf_delete(buf);
-        
-        if(done)
-        {
-            break;
+            *c = ' ';
         }
     }
-    
+
+    if(!xatoi(&first_num, &ip_temp_a) || !xatoi(&first_num, &ip_temp_b) || !xatoi(&first_num, &ip_temp_c) ||
+       !xatoi(&first_num, &ip_temp_d) || !xatoi(&first_num, &port_a) || !xatoi(&first_num, &port_b))
+    {
+        ERR("Could not parse PASV reply\n");
+        return false;
+    }
+
+    IP4_ADDR(&addr, ip_temp_a, ip_temp_b, ip_temp_c, ip_temp_d);
+
+    g_data = netconn_new(NETCONN_TCP);
+
+    if(g_data == NULL)
+    {
+        ERR("Could not allocate g_data TCP socket for PASV command\n");
+        return false;
+    }
+
+    if(netconn_connect(g_data, &addr, (port_a*256) + port_b) != ERR_OK)
+    {
+        netconn_delete(g_data);
+        g_data = NULL;
+        ERR("Could not connect to data port from PASV command\n");
+        return false;
+    }
+
+    netconn_set_recvtimeout(g_data, FTP_DATA_TIMEOUT_MS);
+
     return true;
 }
 
-// Send a PASV command and open the g_data netconn.
-// Returns true if the g_data netconn was opened, else returns false for any error
-bool FTP_PASV(void)
-{  
-    char tmp[TMP_STR_LEN];
-    int8_t size; 
+void FTP_CloseData(void)
+{
+    if(g_data != NULL)
+    {
+        netconn_close(g_data);
+        netconn_delete(g_data);
+        g_data = NULL;
+    }
+}
+
+// List the server (NLST) and pick the newest SUNFLOWER* and DANDELION* file
+// names, empty if there are none. With NULL names the listing is only printed.
+bool FTP_GetFwVersions(char* sunflower, char* dandelion, uint8_t max_len)
+{
     void* data;
     uint16_t len;
     struct netbuf *buf;
-    
-    // Cannot send command if not connected
-    if(g_connected == false)
+    char name[FTP_NAME_LEN];
+    uint8_t used = 0;
+    int16_t code;
+    err_t err;
+
+    if(sunflower != NULL && dandelion != NULL)
     {
+        sunflower[0] = '\0';
+        dandelion[0] = '\0';
+    }
+
+    // Open a PASV data socket
+    if(!FTP_PASV())
+    {
+        ERR("Could not LIST files: cannot open PASV data socket\n");
         return false;
     }
-    
-    size = snprintf(tmp, TMP_STR_LEN, "PASV\n");
-    assert_param(size > 0 && size < TMP_STR_LEN);
-    if(netconn_write(g_conn, tmp, size, NETCONN_COPY) != ERR_OK)
+
+    code = FTP_SendCommand("NLST", NULL);
+
+    if(code != 150 && code != 125)
     {
-        ERR("Could not write PASV command over g_conn socket\n");
+        ERR("Could not write LIST command over g_conn socket\n");
+        FTP_CloseData();
         return false;
     }
-    
-    while(netconn_recv(g_conn, &buf) == ERR_OK)
+
+    // One name per line, lines split across netbufs
+    while((err = netconn_recv(g_data, &buf)) == ERR_OK)
     {
-        bool done = false;
-        do 
+        do
         {
             netbuf_data(buf, &data, &len);
-            
-            DEBUG("%s\n", (char*)data);
-            
-            if(strncmp((char*)data, "227", 3) == 0)
+
+            for(uint16_t i = 0; i < len; i++)
             {
-                uint8_t         start_pos = 0;
-                long            ip_temp_a;
-                long            ip_temp_b;
-                long            ip_temp_c;
-                long            ip_temp_d;
-                long            port_a;
-                long            port_b;
-                char*           first_num;
-                ip_addr_t       addr;
-                
-                for(uint8_t i = 0; i < len; i++)
-                {
-                    if(((char*)data)[i] == '(')
-                    {
-                        start_pos = i;
-                        ((char*)data)[i] = ' ';
-                    }
-                    else if(((char*)data)[i] == ')' || ((char*)data)[i] == ',')
-                    {
-                        ((char*)data)[i] = ' ';
-                    }
-                }
-                
-                first_num = &((char*)data)[start_pos];
-                                
-                xatoi(&first_num, &ip_temp_a);
-                xatoi(&first_num, &ip_temp_b);
-                xatoi(&first_num, &ip_temp_c);
-                xatoi(&first_num, &ip_temp_d);
-                xatoi(&first_num, &port_a);
-                xatoi(&first_num, &port_b);
-                
-                IP4_ADDR(&addr, ip_temp_a, ip_temp_b, ip_temp_c, ip_temp_d);
-                
-                g_data = netconn_new(NETCONN_TCP);
-                
-                if(g_data == NULL)
+                char c = ((char*)data)[i];
+
+                if(c == '\n')
                 {
-                    ERR("Could not allocate g_data TCP socket for PASV command\n");
-                    return false;
+                    name[used] = '\0';
+                    FTP_ListName(name, sunflower, dandelion, max_len);
+                    used = 0;
                 }
-                
-                if(netconn_connect(g_data, &addr, (port_a*256) + port_b) != ERR_OK)
+                else if(c != '\r' && used < FTP_NAME_LEN - 1)
                 {
-                    netconn_delete(g_data);
-                    ERR("Could not connect to data port from PASV command\n");
-                    return false;
+                    name[used++] = c;
                 }
-                
-                done = true;
-            }
-            else if(((char*)data)[0] == '4' || ((char*)data)[0] == '5')
-            {
-                DEBUG("Error sending passv command\n");
-                return false;
             }
         } while (netbuf_next(buf) >= 0);
         netbuf_delete(buf);
-        
-        if(done)
+    }
+
+    FTP_CloseData();
+
+    // The last name may not end in a newline
+    if(used > 0)
+    {
+        name[used] = '\0';
+        FTP_ListName(name, sunflower, dandelion, max_len);
+    }
+
+    code = FTP_ReadReply();
+
+    if(err != ERR_CLSD || (code != 226 && code != 250))
+    {
+        ERR("Listing failed: %s\n", reply);
+        return false;
+    }
+
+    return true;
+}
+
+// Download <name> into the <device> image region and validate it there
+bool FTP_Get(const char* name, uint8_t device)
+{
+    uint32_t    began = xTaskGetTickCount();
+    uint8_t     resumes = 0;
+    FTP_RESULT  result;
+    bool        valid;
+    char*       size_str;
+    long        file_size;
+
+    if(!g_connected || !FwImageRegion(device, &transfer.start, &transfer.size))
+    {
+        return false;
+    }
+
+    // The size tells a short transfer from a complete one
+    transfer.file_size = 0;
+
+    if(FTP_SendCommand("SIZE", name) == 213)
+    {
+        size_str = &reply[3];
+
+        if(xatoi(&size_str, &file_size) && file_size > 0)
         {
-            break;
+            transfer.file_size = file_size;
         }
     }
-    
-    return true;
+
+    if(transfer.file_size > transfer.size)
+    {
+        ERR("%s is %u bytes, the region only holds %u\n", name, transfer.file_size, transfer.size);
+        stats.failures++;
+        return false;
+    }
+
+    INFO("Downloading %s (%u bytes) to 0x%08x\n", name, transfer.file_size, transfer.start);
+
+    if(device == SUNFLOWER_DEVICE)
+    {
+        Invalidate_Sunflower_Verify_Cache(!Is_Running_From_Main_Slot());
+    }
+
+    // The region is about to be erased, a journaled upload into it is gone.
+    // Erase it all before the RETR: the data then never waits on a sector erase.
+    FwSessionClose();
+
+    if(!FlashWriterBegin(transfer.start, transfer.size, true) || !FlashWriterWaitErased())
+    {
+        stats.failures++;
+        return false;
+    }
+
+    transfer.done = 0;
+    transfer.file_crc = 0;
+    FwImageCrcReset(&transfer.image_crc, device, transfer.size);
+
+    while((result = FTP_Retrieve(name)) == FTP_BROKEN && resumes < FTP_MAX_RESUMES)
+    {
+        resumes++;
+        stats.resumes++;
+        WARN("FTP data connection lost at %u bytes, resuming\n", transfer.done);
+
+        osDelay(FTP_RESUME_DELAY_MS * resumes);
+
+        if(!g_connected)
+        {
+            FTP_Connect(&g_addr, g_port);
+        }
+    }
+
+    valid = (result == FTP_DONE) && FwImageValidate(device, &transfer.image_crc);
+
+    stats.last_bytes = transfer.done;
+    stats.last_ms = xTaskGetTickCount() - began;
+    stats.last_crc = transfer.file_crc;
+
+    if(valid)
+    {
+        stats.downloads++;
+        INFO("%s: %u bytes in %u ms, crc32 0x%08x\n", name, transfer.done, stats.last_ms, transfer.file_crc);
+    }
+    else
+    {
+        stats.failures++;
+        ERR("Download of %s failed\n", name);
+    }
+
+    return valid;
 }
 
-bool FTP_GetFwVersions(char* sunflower, char* dandelion, uint8_t max_len)
+void FTP_GetStats(FTP_STATS* out)
+{
+    memcpy(out, &stats, sizeof(FTP_STATS));
+}
+
+void FTP_PrintStatus(void)
+{
+    xprintf("FTP: %s, %u downloads, %u failures, %u resumes\n", g_connected ? "connected" : "not connected",
+            stats.downloads, stats.failures, stats.resumes);
+
+    if(stats.last_ms > 0)
+    {
+        xprintf("Last file: %u bytes in %u ms (%u KB/s), crc32 0x%08x\n", stats.last_bytes, stats.last_ms,
+                (stats.last_bytes / 1024) * 1000 / stats.last_ms, stats.last_crc);
+    }
+}
+
+// Add <name> to the listing: print it, and keep it if it is the newest image of its kind
+void FTP_ListName(char* name, char* sunflower, char* dandelion, uint8_t max_len)
+{
+    char* newest = NULL;
+
+    if(name[0] == '\0')
+    {
+        return;
+    }
+
+    INFO("%s\n", name);
+
+    if(sunflower == NULL || dandelion == NULL || strlen(name) >= max_len)
+    {
+        return;
+    }
+
+    if(strncmp(name, "SUNFLOWER", 9) == 0)
+    {
+        newest = sunflower;
+    }
+    else if(strncmp(name, "DANDELION", 9) == 0)
+    {
+        newest = dandelion;
+    }
+
+    if(newest != NULL && (newest[0] == '\0' || FTP_CompareNames(name, newest) > 0))
+    {
+        strcpy(newest, name);
+    }
+}
+
+// Compare file names with the numbers in them compared by value, so
+// SUNFLOWER_1.10.bin sorts after SUNFLOWER_1.9.bin
+int8_t FTP_CompareNames(const char* a, const char* b)
+{
+    while(*a != '\0' && *b != '\0')
+    {
+        if(*a >= '0' && *a <= '9' && *b >= '0' && *b <= '9')
+        {
+            uint32_t x = 0;
+            uint32_t y = 0;
+
+            while(*a >= '0' && *a <= '9')
+            {
+                x = x * 10 + (*a++ - '0');
+            }
+
+            while(*b >= '0' && *b <= '9')
+            {
+                y = y * 10 + (*b++ - '0');
+            }
+
+            if(x != y)
+            {
+                return x > y ? 1 : -1;
+            }
+        }
+        else if(*a != *b)
+        {
+            return *a > *b ? 1 : -1;
+        }
+        else
+        {
+            a++;
+            b++;
+        }
+    }
+
+    return (*a != '\0') - (*b != '\0');
+}
+
+// RETR <name> from transfer.done on, into flash
+FTP_RESULT FTP_Retrieve(const char* name)
 {
-    char tmp[TMP_STR_LEN];
-    int8_t size;     
     void* data;
     uint16_t len;
     struct netbuf *buf;
-    char* data_ptr;
-    char* end_of_data;
-    
-    // Cannot send command if not connected
-    if(g_connected == false)
+    char offset[12];
+    int16_t code;
+    err_t err;
+
+    if(!g_connected || !FTP_PASV())
     {
-        return false;
+        return g_connected ? FTP_FAILED : FTP_BROKEN;
     }
-    
-    // Open a PASV data socket
-    if(!FTP_PASV())
+
+    // A partial page is read again: only whole pages were queued
+    transfer.partial = 0;
+
+    if(transfer.done > 0)
     {
-        ERR("Could not LIST files: cannot open PASV data socket");
-        return false;
+        snprintf(offset, sizeof(offset), "%u", (unsigned int)transfer.done);
+
+        if(FTP_SendCommand("REST", offset) != 350)
+        {
+            ERR("FTP server cannot resume: %s\n", reply);
+            FTP_CloseData();
+            return g_connected ? FTP_FAILED : FTP_BROKEN;
+        }
     }
-    
-    size = snprintf(tmp, TMP_STR_LEN, "NLST\n");
-    assert_param(size > 0 && size < TMP_STR_LEN);
-    if(!FTP_SendCommand(tmp, size))
+
+    code = FTP_SendCommand("RETR", name);
+
+    if(code != 150 && code != 125)
     {
-        ERR("Could not write LIST command over g_conn socket\n");
-        return false;
+        ERR("RETR %s: %s\n", name, reply);
+        FTP_CloseData();
+        return g_connected ? FTP_FAILED : FTP_BROKEN;
     }
-    
-    while(netconn_recv(g_data, &buf) == ERR_OK)
+
+    while((err = netconn_recv(g_data, &buf)) == ERR_OK)
     {
         do
         {
             netbuf_data(buf, &data, &len);
-            
-            data_ptr = (char*)data;
-            end_of_data = data_ptr;
-            
-            while(data_ptr)
+
+            if(!FTP_Consume((uint8_t*)data, len))
             {
-                // If this file is the dandelion firmware image
-                if(strncmp(data_ptr, "DANDELION", 9) == 0)
-                {
-                    // Advance to the \n character
-                    while(*end_of_data != '\n')
-                    {
-                        end_of_data++;
-                    }
-                }
-                
-                // If this file is the sunflower firmware image
-                if(strncmp(data_ptr, "SUNFLOWER", 9) == 0)
-                {
-                    
-                }
+                netbuf_delete(buf);
+                FTP_Disconnect();
+                return FTP_FAILED;
             }
-            
-            INFO("%s\n", (char*)data);
         } while (netbuf_next(buf) >= 0);
         netbuf_delete(buf);
     }
-    
-    netconn_delete(g_data);
-    g_data = NULL;
-    
+
+    FTP_CloseData();
+
+    // ERR_CLSD: the server closed the data connection, at the end of the file
+    // or not. Anything else: start over on a new control connection, this one
+    // is still waiting on the transfer.
+    if(err != ERR_CLSD)
+    {
+        FTP_Disconnect();
+        return FTP_BROKEN;
+    }
+
+    code = FTP_ReadReply();
+
+    if((code != 226 && code != 250) ||
+       (transfer.file_size != 0 && transfer.done + transfer.partial != transfer.file_size))
+    {
+        return FTP_BROKEN;
+    }
+
+    // The last page of the file
+    if(transfer.partial > 0 && !FTP_WritePage(transfer.page, transfer.partial))
+    {
+        return FTP_FAILED;
+    }
+
+    return FTP_DONE;
+}
+
+// Hand received file data to the flash writer a page at a time. Whole pages
+// go straight from the netbuf, the rest waits in transfer.page.
+bool FTP_Consume(const uint8_t* data, uint16_t len)
+{
+    uint16_t copy;
+
+    while(len > 0)
+    {
+        if(transfer.partial == 0 && len >= FLASH_WRITER_PAGE_SIZE)
+        {
+            if(!FTP_WritePage(data, FLASH_WRITER_PAGE_SIZE))
+            {
+                return false;
+            }
+
+            data += FLASH_WRITER_PAGE_SIZE;
+            len  -= FLASH_WRITER_PAGE_SIZE;
+            continue;
+        }
+
+        copy = FLASH_WRITER_PAGE_SIZE - transfer.partial;
+        copy = copy < len ? copy : len;
+
+        memcpy(&transfer.page[transfer.partial], data, copy);
+        transfer.partial += copy;
+        data += copy;
+        len  -= copy;
+
+        if(transfer.partial == FLASH_WRITER_PAGE_SIZE)
+        {
+            transfer.partial = 0;
+
+            if(!FTP_WritePage(transfer.page, FLASH_WRITER_PAGE_SIZE))
+            {
+                return false;
+            }
+        }
+    }
+
     return true;
 }
 
-void FTP_Get(void)
+// Queue <len> bytes at transfer.done and run the CRCs over them
+bool FTP_WritePage(const uint8_t* data, uint16_t len)
 {
-    
+    if(transfer.done + len > transfer.size)
+    {
+        ERR("File does not fit the image region\n");
+        return false;
+    }
+
+    if(!FlashWriterWrite(transfer.start + transfer.done, data, len))
+    {
+        ERR("Flash write failed at 0x%08x\n", transfer.start + transfer.done);
+        return false;
+    }
+
+    FwImageCrcUpdate(&transfer.image_crc, transfer.done, data, len);
+    transfer.file_crc = crc32(transfer.file_crc, (uint8_t*)data, len);
+    transfer.done += len;
+
+    return true;
 }
@@ -0,0 +1,148 @@
+#include "fw_session.h"
+#include "flash_writer.h"
+#include "crc.h"
+#include "debug.h"
+#include <string.h>
+#include <stddef.h>
+
+#define FW_SESSION_MAX_RECORDS  (FW_SESSION_SECTOR_SIZE / sizeof(FW_SESSION_RECORD))
+#define FLASH_ERASED_WORD       0xFFFFFFFF
+
+STATIC_ASSERT(FW_SESSION_BITMAP_WORDS <= 32);
+STATIC_ASSERT(sizeof(FW_SESSION_RECORD) % 4 == 0);
+
+static FW_SESSION_RECORD* const records = (FW_SESSION_RECORD*)FW_SESSION_SECTOR_START;
+static FW_SESSION_RECORD*       current;                            // Open session, NULL if none
+static uint32_t                 missing[FW_SESSION_BITMAP_WORDS];   // RAM copy of current->missing
+static uint32_t                 dirty;                              // Bitmap words not yet queued for flash
+
+// Local function declarations
+static int32_t  LastRecord(void);
+static bool     RecordValid(FW_SESSION_RECORD* record);
+
+// Look for an unfinished session for the same image. On success 'out' gets
+// the bitmap of chunks still missing and the session becomes the current one.
+bool FwSessionResume(FW_SESSION_KEY* key, uint32_t* out)
+{
+    int32_t last = LastRecord();
+
+    current = NULL;
+
+    if(last < 0 || !RecordValid(&records[last]) || records[last].closed != FLASH_ERASED_WORD ||
+       memcmp(&records[last].key, key, sizeof(FW_SESSION_KEY)) != 0)
+    {
+        return false;
+    }
+
+    current = &records[last];
+    dirty = 0;
+    memcpy(missing, current->missing, sizeof(missing));
+    memcpy(out, missing, sizeof(missing));
+
+    return true;
+}
+
+// Append a record for a new session. The image region must already be erased.
+bool FwSessionStart(FW_SESSION_KEY* key)
+{
+    FW_SESSION_RECORD   header;
+    int32_t             next;
+
+    FwSessionClose();
+
+    next = LastRecord() + 1;
+
+    if(next >= FW_SESSION_MAX_RECORDS)
+    {
+        if(!FlashWriterErase(FW_SESSION_SECTOR_START))
+        {
+            return false;
+        }
+        next = 0;
+    }
+
+    header.magic = FW_SESSION_MAGIC;
+    header.key   = *key;
+    header.crc32 = crc32(0x00000000, (uint8_t*)&header, offsetof(FW_SESSION_RECORD, crc32));
+
+    if(!FlashWriterWriteRecord((uint32_t)&records[next], (uint8_t*)&header, offsetof(FW_SESSION_RECORD, closed)) ||
+       !FlashWriterFlush())
+    {
+        ERR("Failed to start upload session\n");
+        return false;
+    }
+
+    current = &records[next];
+    dirty = 0;
+    memset(missing, 0xFF, sizeof(missing));
+
+    return true;
+}
+
+void FwSessionMarkDone(uint16_t chunk)
+{
+    if(current != NULL && chunk < FW_SESSION_MAX_CHUNKS)
+    {
+        missing[chunk / 32] &= ~(1UL << (chunk % 32));
+        dirty |= 1UL << (chunk / 32);
+    }
+}
+
+// Queue the bitmap words that changed behind the image data already queued,
+// so a chunk is never marked done before it has been programmed and verified
+bool FwSessionSync(void)
+{
+    bool ok = true;
+
+    for(uint8_t i = 0; i < FW_SESSION_BITMAP_WORDS && current != NULL && dirty; i++)
+    {
+        if(dirty & (1UL << i))
+        {
+            // A word that could not be queued stays dirty for the next sync
+            if(FlashWriterWriteRecord((uint32_t)&current->missing[i], (uint8_t*)&missing[i], sizeof(uint32_t)))
+            {
+                dirty &= ~(1UL << i);
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+// The upload finished (or was restarted from scratch): it can't be resumed anymore
+void FwSessionClose(void)
+{
+    uint32_t closed = 0;
+
+    if(current != NULL)
+    {
+        FwSessionSync();
+        FlashWriterWriteRecord((uint32_t)&current->closed, (uint8_t*)&closed, sizeof(uint32_t));
+        FlashWriterFlush();
+        current = NULL;
+    }
+}
+
+// Local function implementations
+
+// Index of the last record written to the sector, -1 if it is empty
+int32_t LastRecord(void)
+{
+    int32_t i = 0;
+
+    while(i < FW_SESSION_MAX_RECORDS && records[i].magic != FLASH_ERASED_WORD)
+    {
+        i++;
+    }
+
+    return i - 1;
+}
+
+bool RecordValid(FW_SESSION_RECORD* record)
+{
+    return record->magic == FW_SESSION_MAGIC && record->crc32 == crc32(0x00000000, (uint8_t*)record, offsetof(FW_SESSION_RECORD, crc32));
+}
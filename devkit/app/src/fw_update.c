@@ -2,6 +2,8 @@
 #include "app_header.h"
 #include "sunflower_app_header.h"
 #include "crc.h"
+#include <string.h>
+#include <stddef.h>
 
 bool Write_Dandelion_Word(uint32_t address, uint32_t word)
 {
@@ -38,13 +40,35 @@ bool Is_Dandelion_Image_Valid(void)
 bool Is_Sunflower_Image_Valid(bool main_region)
 {
     SUNFLOWER_APP_HEADER* sunflower = main_region ? ((SUNFLOWER_APP_HEADER*)SUNFLOWER_MAIN_APP_START) : ((SUNFLOWER_APP_HEADER*)SUNFLOWER_BACKUP_APP_START);
+    SUNFLOWER_VERIFY_RECORD* record = main_region ? &Get_Sunflower_Verify_Cache()->main : &Get_Sunflower_Verify_Cache()->backup;
     
     if(sunflower->image_size < SUNFLOWER_IMAGE_SIZE && sunflower->image_size != 0 && sunflower->image_size != 0xFFFFFFFF) {
-        uint32_t crc32a = crc32(0x00000000, (uint8_t*)(SUNFLOWER_IMAGE_START), 98 * sizeof(uint32_t));
-        uint32_t crc32b = crc32(0x00000000, (uint8_t*)(SUNFLOWER_IMAGE_START + 400), sunflower->image_size - 400);
+        SUNFLOWER_VERIFY_RECORD current;
         
-        return (crc32a == sunflower->header_crc32) && (crc32b == sunflower->body_crc32);
+        current.magic = SUNFLOWER_VERIFY_CACHE_MAGIC;
+        current.header_crc32 = sunflower->header_crc32;
+        current.body_crc32 = sunflower->body_crc32;
+        current.image_size = sunflower->image_size;
+        current.version = sunflower->version;
+        current.crc32 = crc32(0x00000000, (uint8_t*)&current, offsetof(SUNFLOWER_VERIFY_RECORD, crc32));
+        
+        // This exact image already passed a full check since the last power-up
+        if(memcmp(record, &current, sizeof(SUNFLOWER_VERIFY_RECORD)) == 0) {
+            return true;
+        }
+        
+        Get_Sunflower_Verify_Cache()->full_checks++;
+        
+        uint32_t crc32a = crc32(0x00000000, (uint8_t*)sunflower, 98 * sizeof(uint32_t));
+        uint32_t crc32b = crc32(0x00000000, (uint8_t*)sunflower + 400, sunflower->image_size - 400);
+        
+        if((crc32a == sunflower->header_crc32) && (crc32b == sunflower->body_crc32)) {
+            memcpy(record, &current, sizeof(SUNFLOWER_VERIFY_RECORD));
+            return true;
+        }
     }
+    
+    memset(record, 0, sizeof(SUNFLOWER_VERIFY_RECORD));
     return false;
 }
 
@@ -71,3 +95,54 @@ void Erase_Sunflower_Image(void)
     FLASH_EraseSector(FLASH_Sector_9, VoltageRange_3);
     FLASH_EraseSector(FLASH_Sector_10, VoltageRange_3);
 }
+
+// The cache lives in backup SRAM: enable its clock and backup domain write access
+SUNFLOWER_VERIFY_CACHE* Get_Sunflower_Verify_Cache(void)
+{
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR |= PWR_CR_DBP;
+    RCC->AHB1ENR |= RCC_AHB1ENR_BKPSRAMEN;
+    
+    return (SUNFLOWER_VERIFY_CACHE*)SUNFLOWER_VERIFY_CACHE_ADDR;
+}
+
+// Must be called before a slot is erased or rewritten
+void Invalidate_Sunflower_Verify_Cache(bool main_region)
+{
+    SUNFLOWER_VERIFY_CACHE* cache = Get_Sunflower_Verify_Cache();
+    
+    memset(main_region ? &cache->main : &cache->backup, 0, sizeof(SUNFLOWER_VERIFY_RECORD));
+}
+
+// The reset vector must point into the slot, otherwise the image was linked
+// for the other one and can't run from here
+bool Is_Sunflower_Image_Linked(bool main_region)
+{
+    uint32_t slot = main_region ? SUNFLOWER_MAIN_APP_START : SUNFLOWER_BACKUP_APP_START;
+    uint32_t reset_vector = *((uint32_t*)(slot + 4));
+    
+    return reset_vector >= slot && reset_vector < (slot + SUNFLOWER_IMAGE_SIZE);
+}
+
+// The bootloader points VTOR at the slot it launched
+bool Is_Running_From_Main_Slot(void)
+{
+    return SCB->VTOR == SUNFLOWER_MAIN_APP_START;
+}
+
+// Called by the app once it is up: the running image stops being on trial
+void Confirm_Sunflower_Image(void)
+{
+    SUNFLOWER_VERIFY_CACHE* cache = Get_Sunflower_Verify_Cache();
+    SUNFLOWER_APP_HEADER* running = (SUNFLOWER_APP_HEADER*)SCB->VTOR;
+    
+    if(cache->boot_magic != SUNFLOWER_BOOT_STATE_MAGIC)
+    {
+        cache->boot_magic = SUNFLOWER_BOOT_STATE_MAGIC;
+        cache->rejected_crc = 0;
+    }
+    
+    cache->confirmed_crc = running->header_crc32;
+    cache->trial_crc = 0;
+    cache->trial_attempts = 0;
+}
@@ -0,0 +1,515 @@
+#include "fw_upload.h"
+#include "fw_update.h"
+#include "flash_writer.h"
+#include "fw_session.h"
+#include "tcpecho.h"
+#include "crc.h"
+#include "debug.h"
+#include <string.h>
+#include <stddef.h>
+
+// Binary firmware upload protocol spoken on the TCP interface while in
+// firmware update mode. TCP is a byte stream: segments may carry several
+// frames or split one frame in two, so frames are reassembled here before
+// they are acted on.
+
+// Where the signing script (tools/sign-app.py) puts the CRCs and image size.
+// The header CRC covers [0, header_end), the body CRC [body_start, image_size).
+typedef struct FW_IMAGE_LAYOUT_T {
+    uint32_t header_end;            // 0: the image has no header CRC
+    uint32_t body_start;
+    uint32_t header_crc_offset;
+    uint32_t body_crc_offset;
+    uint32_t size_offset;
+} FW_IMAGE_LAYOUT;
+
+static const FW_IMAGE_LAYOUT sunflowerLayout = {
+    offsetof(SUNFLOWER_APP_HEADER, header_crc32),
+    offsetof(SUNFLOWER_APP_HEADER, crc32_start_mark),
+    offsetof(SUNFLOWER_APP_HEADER, header_crc32),
+    offsetof(SUNFLOWER_APP_HEADER, body_crc32),
+    offsetof(SUNFLOWER_APP_HEADER, image_size),
+};
+
+static const FW_IMAGE_LAYOUT dandelionLayout = {
+    0,
+    4,
+    0,
+    0,
+    16,
+};
+
+static uint8_t      frame[FW_MAX_FRAME_BYTES];
+static uint16_t     frame_len;
+static uint16_t     next_chunk;
+static uint8_t      upload_device;
+static FW_IMAGE_CRC image_crc;
+static uint32_t     chunk_missing[FW_SESSION_BITMAP_WORDS];  // Bit n set until chunk n is queued
+
+static uint16_t FrameLength(uint8_t cmd);
+static bool     ProcessFrame(struct netconn *conn, bool *window_ack);
+static bool     ResumeSession(uint8_t device, uint32_t image_size, uint32_t image_crc32);
+static bool     ChunkMissing(uint16_t seq);
+static bool     WriteChunk(uint8_t device, uint32_t addr, uint8_t *payload);
+static bool     ImageCrcComplete(const FW_IMAGE_CRC *crc);
+static void     SendByte(struct netconn *conn, uint8_t cmd);
+static void     SendWindowAck(struct netconn *conn);
+static void     SendSession(struct netconn *conn, uint32_t image_size);
+
+// Called when the connection enters firmware update mode
+void FwUploadReset(void)
+{
+    frame_len  = 0;
+    next_chunk = 0;
+    memset(chunk_missing, 0xFF, sizeof(chunk_missing));
+}
+
+// Feed received stream bytes into the frame parser. Complete frames are
+// processed in order; all CHUNK frames found in one call are answered with a
+// single cumulative WINDOW_ACK.
+// Returns false once the host has asked to leave firmware update mode.
+bool FwUploadInput(struct netconn *conn, uint8_t* data, uint16_t len)
+{
+    bool fw_update_mode = true;
+    bool window_ack     = false;
+
+    while(len > 0 && fw_update_mode)
+    {
+        uint8_t  cmd    = (frame_len == 0) ? data[0] : frame[0];
+        uint16_t length = FrameLength(cmd);
+
+        if(length == 0)
+        {
+            ERR("Unexpected TCP command 0x%02x\n", cmd);
+            SendByte(conn, TCP_NACK);
+            data++;
+            len--;
+            continue;
+        }
+
+        uint16_t copy = ((length - frame_len) < len) ? (length - frame_len) : len;
+
+        memcpy(&frame[frame_len], data, copy);
+        frame_len += copy;
+        data      += copy;
+        len       -= copy;
+
+        if(frame_len == length)
+        {
+            fw_update_mode = ProcessFrame(conn, &window_ack);
+            frame_len = 0;
+        }
+    }
+
+    if(window_ack)
+    {
+        // Journal the chunks of this batch behind their data before acking them;
+        // chunks the journal doesn't know about can't be acknowledged
+        if(FwSessionSync())
+        {
+            SendWindowAck(conn);
+        }
+        else
+        {
+            ERR("Failed to journal chunks below %u\n", next_chunk);
+            SendByte(conn, TCP_NACK);
+        }
+    }
+
+    return fw_update_mode;
+}
+
+static uint16_t FrameLength(uint8_t cmd)
+{
+    switch(cmd)
+    {
+        case PAYLOAD:   return FW_PAYLOAD_FRAME_BYTES;
+        case CHUNK:     return FW_CHUNK_FRAME_BYTES;
+        case START:     return 2;
+        case RESUME:    return FW_RESUME_FRAME_BYTES;
+        case VALIDATE:  return 2;
+        case EXIT_MODE: return 1;
+        case END:       return 1;
+        default:        return 0;
+    }
+}
+
+static bool ProcessFrame(struct netconn *conn, bool *window_ack)
+{
+    switch(frame[0])
+    {
+        // PAYLOAD, type, addr[4], payload[256]
+        case PAYLOAD:
+            {
+                uint32_t addr = (frame[5] << 24) | (frame[4] << 16) | (frame[3] << 8) | frame[2];
+
+                SendByte(conn, WriteChunk(frame[1], addr, &frame[6]) ? TCP_ACK : TCP_NACK);
+            }
+            break;
+
+        // CHUNK, type, seq[2], payload[256]
+        case CHUNK:
+            {
+                uint16_t seq = (frame[3] << 8) | frame[2];
+
+                if(seq >= FW_SESSION_MAX_CHUNKS)
+                {
+                    SendByte(conn, TCP_NACK);
+                    break;
+                }
+
+                // A chunk that is already in flash is a retransmission or was
+                // written before the connection dropped: only acknowledge it
+                if(ChunkMissing(seq))
+                {
+                    if(!WriteChunk(frame[1], (uint32_t)seq * TCP_FW_PAYLOAD_BYTES, &frame[4]))
+                    {
+                        SendByte(conn, TCP_NACK);
+                        break;
+                    }
+                    chunk_missing[seq / 32] &= ~(1UL << (seq % 32));
+                    FwSessionMarkDone(seq);
+                }
+
+                // Cumulative: everything below the first missing chunk is written
+                while(next_chunk < FW_SESSION_MAX_CHUNKS && !ChunkMissing(next_chunk))
+                {
+                    next_chunk++;
+                }
+                *window_ack = true;
+            }
+            break;
+
+        // START, type
+        // The image region is erased by the flash writer task ahead of the data,
+        // so the host can start streaming chunks straight away
+        case START:
+            {
+                uint32_t start, size;
+
+                if(frame[1] == SUNFLOWER_DEVICE)
+                {
+                    Invalidate_Sunflower_Verify_Cache(!Is_Running_From_Main_Slot());
+                }
+
+                // The region is about to be erased, a journaled upload into it is gone
+                FwSessionClose();
+
+                if(FwImageRegion(frame[1], &start, &size) && FlashWriterBegin(start, size, true))
+                {
+                    upload_device = frame[1];
+                    next_chunk = 0;
+                    memset(chunk_missing, 0xFF, sizeof(chunk_missing));
+                    FwImageCrcReset(&image_crc, upload_device, size);
+                    SendByte(conn, TCP_ACK);
+                }
+                else
+                {
+                    SendByte(conn, TCP_NACK);
+                }
+            }
+            break;
+
+        // RESUME, type, size[4], crc[4]
+        // Like START, but if the journal holds an unfinished upload of the same
+        // file into the same region, keep what is already in flash. Answered
+        // with SESSION and the bitmap of the chunks the host still has to send.
+        case RESUME:
+            {
+                uint32_t image_size  = (frame[5] << 24) | (frame[4] << 16) | (frame[3] << 8) | frame[2];
+                uint32_t image_crc32 = (frame[9] << 24) | (frame[8] << 16) | (frame[7] << 8) | frame[6];
+
+                if(ResumeSession(frame[1], image_size, image_crc32))
+                {
+                    SendSession(conn, image_size);
+                }
+                else
+                {
+                    SendByte(conn, TCP_NACK);
+                }
+            }
+            break;
+
+        // VALIDATE, type
+        // The running CRCs only cover an image uploaded in this session
+        case VALIDATE:
+            {
+                bool valid = FwImageValidate(frame[1], frame[1] == upload_device ? &image_crc : NULL);
+
+                // Nothing left to resume once the image is known to be good
+                if(valid)
+                {
+                    FwSessionClose();
+                }
+
+                SendByte(conn, valid ? TCP_ACK : TCP_NACK);
+            }
+            break;
+
+        // EXIT BINARY MODE
+        case EXIT_MODE:
+            SendByte(conn, TCP_ACK);
+            return false;
+
+        // END OF IMAGE
+        case END:
+            SendByte(conn, FlashWriterFlush() ? TCP_ACK : TCP_NACK);
+            break;
+    }
+
+    return true;
+}
+
+bool FwImageRegion(uint8_t device, uint32_t *start, uint32_t *size)
+{
+    switch(device)
+    {
+        // DANDELION TYPE
+        case DANDELION_DEVICE:
+            *start = DANDELION_IMAGE_START;
+            *size  = DANDELION_IMAGE_SIZE;
+            return true;
+
+        // SUNFLOWER TYPE: always the slot we are not running from
+        case SUNFLOWER_DEVICE:
+            *start = Is_Running_From_Main_Slot() ? SUNFLOWER_BACKUP_APP_START : SUNFLOWER_MAIN_APP_START;
+            *size  = SUNFLOWER_IMAGE_SIZE;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool ResumeSession(uint8_t device, uint32_t image_size, uint32_t image_crc32)
+{
+    FW_SESSION_KEY  key;
+    uint32_t        start, size;
+
+    if(!FwImageRegion(device, &start, &size) || image_size == 0 || image_size > size)
+    {
+        return false;
+    }
+
+    if(device == SUNFLOWER_DEVICE)
+    {
+        Invalidate_Sunflower_Verify_Cache(!Is_Running_From_Main_Slot());
+    }
+
+    key.device       = device;
+    key.region_start = start;
+    key.image_size   = image_size;
+    key.image_crc    = image_crc32;
+
+    if(FwSessionResume(&key, chunk_missing))
+    {
+        INFO("Resuming upload of %d bytes at 0x%08x\n", image_size, start);
+
+        if(!FlashWriterBegin(start, size, false))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        // The journal record must not claim chunks of an image that is still
+        // in the region, so it is only written once the erase is done
+        memset(chunk_missing, 0xFF, sizeof(chunk_missing));
+
+        if(!FlashWriterBegin(start, size, true) || !FlashWriterWaitErased() || !FwSessionStart(&key))
+        {
+            return false;
+        }
+    }
+
+    // The running CRCs only work for a sequential upload, anything
+    // else falls back to a full check of the image at VALIDATE
+    upload_device = device;
+    next_chunk = 0;
+    FwImageCrcReset(&image_crc, device, size);
+
+    return true;
+}
+
+static bool ChunkMissing(uint16_t seq)
+{
+    return (chunk_missing[seq / 32] & (1UL << (seq % 32))) != 0;
+}
+
+// Hand a chunk to the flash writer task. Returns as soon as the data is
+// queued; programming errors are reported by FlashWriterFlush at END.
+static bool WriteChunk(uint8_t device, uint32_t addr, uint8_t *payload)
+{
+    uint32_t start, size;
+
+    if(!FwImageRegion(device, &start, &size) || addr >= size)
+    {
+        return false;
+    }
+
+    if(!FlashWriterWrite(start + addr, payload, TCP_FW_PAYLOAD_BYTES))
+    {
+        return false;
+    }
+
+    if(device == upload_device)
+    {
+        FwImageCrcUpdate(&image_crc, addr, payload, TCP_FW_PAYLOAD_BYTES);
+    }
+
+    return true;
+}
+
+void FwImageCrcReset(FW_IMAGE_CRC *crc, uint8_t device, uint32_t region_size)
+{
+    memset(crc, 0, sizeof(FW_IMAGE_CRC));
+
+    crc->layout      = (device == SUNFLOWER_DEVICE) ? &sunflowerLayout : &dandelionLayout;
+    crc->region_size = region_size;
+    crc->in_order    = true;
+}
+
+// Copy a little endian header word out of the chunk if it lies inside it
+static void CaptureWord(uint32_t field, uint32_t offset, const uint8_t *data, uint32_t len, uint32_t *out)
+{
+    if(field >= offset && (field + 4) <= (offset + len))
+    {
+        data += field - offset;
+        *out = (data[3] << 24) | (data[2] << 16) | (data[1] << 8) | data[0];
+    }
+}
+
+// Extend a running CRC with the part of the chunk that lies inside [start, end)
+static void CrcSpan(uint32_t start, uint32_t end, uint32_t offset, const uint8_t *data, uint32_t len, uint32_t *crc)
+{
+    uint32_t lo = (start > offset) ? start : offset;
+    uint32_t hi = (end < (offset + len)) ? end : (offset + len);
+
+    if(lo < hi)
+    {
+        *crc = crc32(*crc, (uint8_t*)data + (lo - offset), hi - lo);
+    }
+}
+
+// Extend the running CRCs with the image bytes at <offset>. Header words are
+// picked up whole, so <data> must not split one: chunks and flash pages never do.
+void FwImageCrcUpdate(FW_IMAGE_CRC *crc, uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    const FW_IMAGE_LAYOUT* layout = crc->layout;
+
+    if(!crc->in_order || offset != crc->next)
+    {
+        crc->in_order = false;
+        return;
+    }
+
+    // The header fields always arrive before (or with) the first body byte
+    CaptureWord(layout->size_offset, offset, data, len, &crc->image_size);
+    CaptureWord(layout->body_crc_offset, offset, data, len, &crc->expected_body_crc);
+
+    if(layout->header_end)
+    {
+        CaptureWord(layout->header_crc_offset, offset, data, len, &crc->expected_header_crc);
+        CrcSpan(0, layout->header_end, offset, data, len, &crc->header_crc);
+    }
+
+    if(offset + len > layout->body_start)
+    {
+        if(crc->image_size <= layout->body_start || crc->image_size > crc->region_size)
+        {
+            crc->in_order = false;
+            return;
+        }
+
+        CrcSpan(layout->body_start, crc->image_size, offset, data, len, &crc->body_crc);
+    }
+
+    crc->next += len;
+}
+
+// Check the image just written to the <device> region. Compares the CRCs
+// accumulated in <crc> while it was written with the ones in the image
+// header: every page was read back by the flash writer, so this doesn't need
+// to re-read the image. Falls back to a full check without <crc>, or if the
+// image was not written sequentially.
+bool FwImageValidate(uint8_t device, const FW_IMAGE_CRC *crc)
+{
+    bool valid = FlashWriterFlush();
+
+    if(valid && crc != NULL && ImageCrcComplete(crc))
+    {
+        INFO("Header CRC 0x%08x/0x%08x, body CRC 0x%08x/0x%08x\n", crc->header_crc, crc->expected_header_crc,
+                                                                     crc->body_crc, crc->expected_body_crc);
+
+        valid = (crc->header_crc == crc->expected_header_crc) && (crc->body_crc == crc->expected_body_crc);
+    }
+    else if(valid)
+    {
+        switch(device)
+        {
+            // DANDELION TYPE
+            case DANDELION_DEVICE:
+                valid = Is_Dandelion_Image_Valid();
+                break;
+
+            // SUNFLOWER TYPE
+            case SUNFLOWER_DEVICE:
+                valid = Is_Sunflower_Image_Valid(!Is_Running_From_Main_Slot());
+                break;
+
+            default:
+                valid = false;
+                break;
+        }
+    }
+
+    // The bootloader runs sunflower images in place: reject one
+    // linked for the slot we are running from
+    if(valid && device == SUNFLOWER_DEVICE && !Is_Sunflower_Image_Linked(!Is_Running_From_Main_Slot()))
+    {
+        ERR("Image is not linked for slot 0x%08x\n", Is_Running_From_Main_Slot() ? SUNFLOWER_BACKUP_APP_START : SUNFLOWER_MAIN_APP_START);
+        valid = false;
+    }
+
+    return valid;
+}
+
+static bool ImageCrcComplete(const FW_IMAGE_CRC *crc)
+{
+    return crc->in_order && crc->image_size != 0 && crc->next >= crc->image_size;
+}
+
+static void SendByte(struct netconn *conn, uint8_t cmd)
+{
+    netconn_write(conn, &cmd, 1, NETCONN_COPY);
+}
+
+static void SendWindowAck(struct netconn *conn)
+{
+    uint8_t buffer[FW_WINDOW_ACK_BYTES];
+
+    buffer[0] = WINDOW_ACK;
+    buffer[1] = next_chunk & 0xFF;
+    buffer[2] = (next_chunk >> 8) & 0xFF;
+
+    netconn_write(conn, buffer, FW_WINDOW_ACK_BYTES, NETCONN_COPY);
+}
+
+// SESSION, chunks[2], bitmap[(chunks + 7) / 8] : bit n set if chunk n is missing
+static void SendSession(struct netconn *conn, uint32_t image_size)
+{
+    uint8_t     buffer[3 + FW_SESSION_BITMAP_WORDS * 4];
+    uint16_t    chunks = (image_size + TCP_FW_PAYLOAD_BYTES - 1) / TCP_FW_PAYLOAD_BYTES;
+    uint16_t    bytes  = (chunks + 7) / 8;
+
+    buffer[0] = SESSION;
+    buffer[1] = chunks & 0xFF;
+    buffer[2] = (chunks >> 8) & 0xFF;
+
+    for(uint16_t i = 0; i < bytes; i++)
+    {
+        buffer[3 + i] = (chunk_missing[i / 4] >> ((i % 4) * 8)) & 0xFF;
+    }
+
+    netconn_write(conn, buffer, 3 + bytes, NETCONN_COPY);
+}
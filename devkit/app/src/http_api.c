@@ -0,0 +1,565 @@
+#include "http_api.h"
+#include "radio.h"
+#include "valve.h"
+#include "report_log.h"
+#include "telemetry.h"
+#include "mqtt_client.h"
+#include "net_stats.h"
+#include "tcpecho.h"
+#include "time_sync.h"
+#include "time_beacon.h"
+#include "sensor_conversions.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "debug.h"
+#include "xprintf.h"
+#include "lwip/apps/httpd.h"
+#include "lwip/apps/fs.h"
+#include "lwip/stats.h"
+#include "lwip/memp.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !LWIP_HTTPD_CUSTOM_FILES_READ || !LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+#error "http_api needs LWIP_HTTPD_CUSTOM_FILES_READ and LWIP_HTTPD_SUPPORT_11_KEEPALIVE in lwipopts.h"
+#endif
+
+// Chunk framing: "xxxx\r\n" before the data, "\r\n" after it
+#define HTTP_API_CHUNK_HEAD         6
+#define HTTP_API_CHUNK_FRAMING      (HTTP_API_CHUNK_HEAD + 2)
+
+STATIC_ASSERT(HTTP_API_CHUNK_SIZE > HTTP_API_CHUNK_FRAMING && HTTP_API_CHUNK_SIZE <= 0xFFFF);
+
+typedef enum HTTP_API_STATE_T {
+    HTTP_API_HEADERS,
+    HTTP_API_BODY,
+    HTTP_API_TRAILER,
+    HTTP_API_DONE
+} HTTP_API_STATE;
+
+typedef struct HTTP_API_CONN_T HTTP_API_CONN;
+
+// Writes the next fragment of a response body into conn->out. Returns false
+// once the body is complete.
+typedef bool (*HTTP_API_GENERATOR)(HTTP_API_CONN* conn);
+
+typedef struct HTTP_API_ENDPOINT_T {
+    const char*        path;
+    HTTP_API_GENERATOR next;
+} HTTP_API_ENDPOINT;
+
+struct HTTP_API_CONN_T {
+    bool               used;
+    bool               chunked;
+    HTTP_API_STATE     state;
+    HTTP_API_GENERATOR next;
+    uint16_t           step;            // Generator position, 0 for the opening fragment
+    uint16_t           items;           // Array elements written, to place the commas
+    uint16_t           pos;             // Next byte of out to send
+    uint16_t           len;
+    char               out[HTTP_API_LINE_SIZE];
+};
+
+typedef struct HTTP_API_READING_T {
+    uint32_t          tick;             // Arrival time
+    generic_message_t report;           // src is 0 for an unused slot
+} HTTP_API_READING;
+
+// Sent when every HTTP_API_CONN is in use
+static const char httpBusy[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                               "Content-Type: application/json\r\n"
+                               "Content-Length: 17\r\n"
+                               "Connection: close\r\n"
+                               "\r\n"
+                               "{\"error\":\"busy\"}\n";
+
+static HTTP_API_CONN    conns[HTTP_API_MAX_CONNS];
+static HTTP_API_READING readings[HTTP_API_READINGS];
+static HTTP_API_STATS   stats;
+
+// Local function prototypes
+static bool             Put(HTTP_API_CONN* conn, const char* fmt, ...);
+static int              Take(HTTP_API_CONN* conn, char* dst, int size);
+static int              ReadChunk(HTTP_API_CONN* conn, char* dst, int size);
+static bool             NodesNext(HTTP_API_CONN* conn);
+static bool             ReadingsNext(HTTP_API_CONN* conn);
+static bool             StatsNext(HTTP_API_CONN* conn);
+static bool             ValvesNext(HTTP_API_CONN* conn);
+
+static const HTTP_API_ENDPOINT endpoints[] = {
+    { "/api/nodes",     NodesNext },
+    { "/api/readings",  ReadingsNext },
+    { "/api/stats",     StatsNext },
+    { "/api/valves",    ValvesNext },
+};
+
+// Global function implementations
+
+// Call before the scheduler starts, httpd uses the raw API
+void HttpApiInit(void)
+{
+    httpd_init();
+}
+
+// Keep <report> as the latest reading of its node, replacing the node heard
+// from longest ago when the table is full. Caller keeps ownership of the input pointer.
+void HttpApiRecordReading(generic_message_t* report)
+{
+    uint32_t now = xTaskGetTickCount();
+    uint16_t slot = 0;
+
+    taskENTER_CRITICAL();
+
+    for(uint16_t i = 0; i < HTTP_API_READINGS; i++)
+    {
+        if(readings[i].report.src == report->src)
+        {
+            slot = i;
+            break;
+        }
+
+        if(readings[slot].report.src != 0 &&
+           (readings[i].report.src == 0 || now - readings[i].tick > now - readings[slot].tick))
+        {
+            slot = i;
+        }
+    }
+
+    readings[slot].tick = now;
+    memcpy(&readings[slot].report, report, sizeof(generic_message_t));
+
+    taskEXIT_CRITICAL();
+}
+
+void HttpApiGetStats(HTTP_API_STATS* out)
+{
+    memcpy(out, &stats, sizeof(HTTP_API_STATS));
+}
+
+void HttpApiPrintStatus(void)
+{
+    xprintf("HTTP API: %d of %d responses in progress (max %d), %d bytes per read, %d bytes of lwIP heap\n", stats.connections,
+            HTTP_API_MAX_CONNS, stats.max_connections, HTTP_API_CHUNK_SIZE, MEM_SIZE);
+    xprintf("Served: %d requests, %d bytes. Busy: %d\n", stats.requests, stats.bytes, stats.busy);
+}
+
+// httpd file system hooks, called from the tcpip thread
+
+int fs_open_custom(struct fs_file* file, const char* name)
+{
+    const HTTP_API_ENDPOINT* endpoint = NULL;
+    HTTP_API_CONN*           conn = NULL;
+    size_t                   len;
+    bool                     http11 = (file->flags & FS_FILE_FLAGS_HTTP_1_1) != 0;
+
+    for(uint8_t i = 0; i < sizeof(endpoints) / sizeof(endpoints[0]); i++)
+    {
+        len = strlen(endpoints[i].path);
+
+        if(!strncmp(name, endpoints[i].path, len) && (name[len] == '\0' || name[len] == '?'))
+        {
+            endpoint = &endpoints[i];
+            break;
+        }
+    }
+
+    if(endpoint == NULL)
+    {
+        return 0;
+    }
+
+    for(uint8_t i = 0; i < HTTP_API_MAX_CONNS; i++)
+    {
+        if(!conns[i].used)
+        {
+            conn = &conns[i];
+            break;
+        }
+    }
+
+    file->http_header_included = 1;
+
+    if(conn == NULL)
+    {
+        stats.busy++;
+        file->data = httpBusy;
+        file->len = sizeof(httpBusy) - 1;
+        file->index = file->len;
+        file->pextension = NULL;
+        file->flags &= ~FS_FILE_FLAGS_PERSISTENT;
+        return 1;
+    }
+
+    // Without chunked encoding only the close delimits the body
+    if(!http11)
+    {
+        file->flags &= ~FS_FILE_FLAGS_PERSISTENT;
+    }
+
+    memset(conn, 0, sizeof(HTTP_API_CONN));
+    conn->used = true;
+    conn->chunked = http11;
+    conn->state = HTTP_API_HEADERS;
+    conn->next = endpoint->next;
+
+    Put(conn, "HTTP/1.%d 200 OK\r\n"
+              "Server: sunflower\r\n"
+              "Content-Type: application/json\r\n"
+              "Cache-Control: no-cache\r\n"
+              "%s%s\r\n",
+              http11 ? 1 : 0,
+              http11 ? "Transfer-Encoding: chunked\r\n" : "",
+              (file->flags & FS_FILE_FLAGS_PERSISTENT) ? "" : "Connection: close\r\n");
+
+    file->data = NULL;
+    file->len = 0;
+    file->index = 0;
+    file->pextension = conn;
+
+    stats.requests++;
+    stats.connections++;
+    if(stats.connections > stats.max_connections)
+    {
+        stats.max_connections = stats.connections;
+    }
+
+    return 1;
+}
+
+void fs_close_custom(struct fs_file* file)
+{
+    HTTP_API_CONN* conn = (HTTP_API_CONN*)file->pextension;
+
+    if(conn != NULL)
+    {
+        conn->used = false;
+        file->pextension = NULL;
+        stats.connections--;
+    }
+}
+
+// Fill <buffer> with as much of the response as fits: the headers, one chunk
+// of body, and the trailer once the generator is done
+int fs_read_custom(struct fs_file* file, char* buffer, int count)
+{
+    HTTP_API_CONN* conn = (HTTP_API_CONN*)file->pextension;
+    int            n = 0;
+    int            read;
+
+    if(conn == NULL)
+    {
+        read = file->len - file->index;
+        if(read <= 0)
+        {
+            return FS_READ_EOF;
+        }
+
+        read = read < count ? read : count;
+        memcpy(buffer, file->data + file->index, read);
+        file->index += read;
+        return read;
+    }
+
+    while(n < count && conn->state != HTTP_API_DONE)
+    {
+        if(conn->state == HTTP_API_BODY)
+        {
+            read = ReadChunk(conn, buffer + n, count - n);
+
+            // No room left for another chunk
+            if(read == 0 && conn->state == HTTP_API_BODY)
+            {
+                break;
+            }
+        }
+        else
+        {
+            read = Take(conn, buffer + n, count - n);
+
+            if(conn->pos == conn->len)
+            {
+                conn->state = conn->state == HTTP_API_HEADERS ? HTTP_API_BODY : HTTP_API_DONE;
+            }
+        }
+
+        n += read;
+    }
+
+    stats.bytes += n;
+
+    return n > 0 ? n : FS_READ_EOF;
+}
+
+// The response length is not known in advance: ask httpd for a read buffer
+// of HTTP_API_CHUNK_SIZE until the trailer is out
+int fs_bytes_left_custom(struct fs_file* file)
+{
+    HTTP_API_CONN* conn = (HTTP_API_CONN*)file->pextension;
+
+    if(conn == NULL)
+    {
+        return file->len - file->index;
+    }
+
+    return conn->state == HTTP_API_DONE ? 0 : HTTP_API_CHUNK_SIZE;
+}
+
+// Local function implementations
+
+bool Put(HTTP_API_CONN* conn, const char* fmt, ...)
+{
+    va_list args;
+    int     len;
+
+    va_start(args, fmt);
+    len = vsnprintf(conn->out, sizeof(conn->out), fmt, args);
+    va_end(args);
+
+    conn->pos = 0;
+    conn->len = len < 0 ? 0 : (len < (int)sizeof(conn->out) ? len : (int)sizeof(conn->out) - 1);
+
+    return true;
+}
+
+int Take(HTTP_API_CONN* conn, char* dst, int size)
+{
+    int n = conn->len - conn->pos;
+
+    n = n < size ? n : size;
+    memcpy(dst, conn->out + conn->pos, n);
+    conn->pos += n;
+
+    return n;
+}
+
+// Write one chunk of body into <dst>, ending the body when the generator runs
+// dry. Returns the bytes written, 0 when <size> is too small for a chunk.
+int ReadChunk(HTTP_API_CONN* conn, char* dst, int size)
+{
+    char* body = conn->chunked ? dst + HTTP_API_CHUNK_HEAD : dst;
+    int   room = conn->chunked ? size - HTTP_API_CHUNK_FRAMING : size;
+    int   used = 0;
+    char  head[HTTP_API_CHUNK_HEAD + 1];
+
+    while(used < room)
+    {
+        if(conn->pos == conn->len && !conn->next(conn))
+        {
+            conn->state = HTTP_API_TRAILER;
+            Put(conn, conn->chunked ? "0\r\n\r\n" : "");
+            break;
+        }
+
+        used += Take(conn, body + used, room - used);
+    }
+
+    if(used == 0)
+    {
+        return 0;
+    }
+
+    if(!conn->chunked)
+    {
+        return used;
+    }
+
+    // Fixed width size, leading zeros are allowed
+    snprintf(head, sizeof(head), "%04x\r\n", used);
+    memcpy(dst, head, HTTP_API_CHUNK_HEAD);
+    memcpy(body + used, "\r\n", 2);
+
+    return used + HTTP_API_CHUNK_FRAMING;
+}
+
+// {"gateway":"..","nodes":[{"slot":0,"mac":"..","clock_offset_s":..,"drift_ppm":..},..]}
+bool NodesNext(HTTP_API_CONN* conn)
+{
+    NetworkMember_t  node;
+    TIME_BEACON_NODE clock;
+
+    if(conn->step == 0)
+    {
+        conn->step++;
+        return Put(conn, "{\"gateway\":\"%08x\",\"nodes\":[", RadioGetMACAddress());
+    }
+
+    while(conn->step <= MAX_NETWORK_MEMBERS)
+    {
+        conn->step++;
+
+        if(RadioGetDevice(conn->step - 2, &node))
+        {
+            // Zero past the slots whose clocks are tracked (TIME_BEACON_NODES)
+            TimeBeaconGetNode(conn->step - 2, &clock);
+
+            return Put(conn, "%s{\"slot\":%d,\"mac\":\"%08x\",\"clock_offset_s\":%d,\"drift_ppm\":%d}",
+                       conn->items++ ? "," : "", conn->step - 2, node.mac_address, clock.offsetS,
+                       clock.driftPpm);
+        }
+    }
+
+    if(conn->step == MAX_NETWORK_MEMBERS + 1)
+    {
+        conn->step++;
+        return Put(conn, "]}");
+    }
+
+    return false;
+}
+
+// {"unix_time":..,"readings":[{"node":"..","age_ms":..,"timestamp":..,"moisture":[..],"temp":[..],..},..]}
+bool ReadingsNext(HTTP_API_CONN* conn)
+{
+    HTTP_API_READING reading;
+
+    if(conn->step == 0)
+    {
+        conn->step++;
+        return Put(conn, "{\"unix_time\":%u,\"readings\":[", GetUnixTime());
+    }
+
+    while(conn->step <= HTTP_API_READINGS)
+    {
+        taskENTER_CRITICAL();
+        memcpy(&reading, &readings[conn->step - 1], sizeof(HTTP_API_READING));
+        taskEXIT_CRITICAL();
+
+        conn->step++;
+
+        if(reading.report.src != 0)
+        {
+            return Put(conn, "%s{\"node\":\"%08x\",\"age_ms\":%u,\"timestamp\":%u,\"moisture\":[%.2f,%.2f,%.2f],"
+                             "\"temp\":[%.2f,%.2f,%.2f],\"humid\":%.2f,\"air_temp\":%.2f,\"chip_temp\":%d}",
+                       conn->items++ ? "," : "", reading.report.src, xTaskGetTickCount() - reading.tick,
+                       reading.report.payload.sensor_message.timestamp,
+                       Moisture_To_Float(reading.report.payload.sensor_message.moisture0),
+                       Moisture_To_Float(reading.report.payload.sensor_message.moisture1),
+                       Moisture_To_Float(reading.report.payload.sensor_message.moisture2),
+                       TMP102_To_Float(reading.report.payload.sensor_message.temp0),
+                       TMP102_To_Float(reading.report.payload.sensor_message.temp1),
+                       TMP102_To_Float(reading.report.payload.sensor_message.temp2),
+                       HTU21D_Humid_To_Float(reading.report.payload.sensor_message.humid),
+                       HTU21D_Temp_To_Float(reading.report.payload.sensor_message.air_temp),
+                       reading.report.payload.sensor_message.chip_temp);
+        }
+    }
+
+    if(conn->step == HTTP_API_READINGS + 1)
+    {
+        conn->step++;
+        return Put(conn, "]}");
+    }
+
+    return false;
+}
+
+// One object per subsystem, then one per lwIP memory pool
+bool StatsNext(HTTP_API_CONN* conn)
+{
+    uint16_t step = conn->step++;
+    uint16_t pool;
+
+    switch(step)
+    {
+        case 0:
+            return Put(conn, "{\"uptime_ms\":%u,\"unix_time\":%u,", xTaskGetTickCount(), GetUnixTime());
+
+        case 1:
+        {
+            RadioStats radio;
+            RadioGetStats(&radio);
+            return Put(conn, "\"radio\":{\"mac\":\"%08x\",\"rx_packets\":%u,\"crc_errors\":%u,\"sensor_reports\":%u,"
+                             "\"announces\":%u,\"tx_packets\":%u,\"no_sync\":%u,",
+                       RadioGetMACAddress(), radio.rxPackets, radio.crcErrors, radio.sensorReports, radio.announces,
+                       radio.txPackets, radio.noSync);
+        }
+
+        case 2:
+        {
+            RadioStats radio;
+            RadioGetStats(&radio);
+            return Put(conn, "\"dispatch_us\":{\"count\":%u,\"mean\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u}},",
+                       radio.dispatch.count, radio.dispatch.count ? (uint32_t)(radio.dispatch.sumUs / radio.dispatch.count) : 0,
+                       RadioLatencyPercentile(&radio.dispatch, 50), RadioLatencyPercentile(&radio.dispatch, 99),
+                       radio.dispatch.maxUs);
+        }
+
+        case 3:
+        {
+            TIME_BEACON_STATS beacon;
+            TimeBeaconGetStats(&beacon);
+            return Put(conn, "\"time_beacon\":{\"sent\":%u,\"sequence\":%u,\"skipped\":%u,\"unmeasured\":%u,"
+                             "\"latency_us\":%u,\"last_error_us\":%d,\"max_error_us\":%u},",
+                       beacon.sent, beacon.sequence, beacon.skipped, beacon.unmeasured, beacon.latencyUs,
+                       beacon.lastErrorUs, beacon.maxErrorUs);
+        }
+
+        case 4:
+        {
+            REPORT_LOG_STATS log;
+            ReportLogGetStats(&log);
+            return Put(conn, "\"report_log\":{\"next_seq\":%u,\"first_unacked\":%u,\"appended\":%u,\"dropped\":%u,"
+                             "\"overwritten\":%u,\"write_errors\":%u,\"crc_errors\":%u},",
+                       ReportLogNextSeq(), ReportLogFirstUnacked(), log.appended, log.dropped, log.overwritten,
+                       log.write_errors, log.crc_errors);
+        }
+
+        case 5:
+        {
+            TELEMETRY_STATS telemetry;
+            TelemetryGetStats(&telemetry);
+            return Put(conn, "\"telemetry\":{\"reports\":%u,\"datagrams\":%u,\"dropped\":%u,\"send_errors\":%u},",
+                       telemetry.reports, telemetry.datagrams, telemetry.dropped, telemetry.send_errors);
+        }
+
+        case 6:
+        {
+            MQTT_STATS mqtt;
+            MqttGetStats(&mqtt);
+            return Put(conn, "\"mqtt\":{\"connects\":%u,\"failures\":%u,\"publishes\":%u,\"reports\":%u,\"commands\":%u},",
+                       mqtt.connects, mqtt.failures, mqtt.publishes, mqtt.reports, mqtt.commands);
+        }
+
+        case 7:
+            return Put(conn, "\"http\":{\"requests\":%u,\"busy\":%u,\"bytes\":%u,\"connections\":%d,\"max_connections\":%d},",
+                       stats.requests, stats.busy, stats.bytes, stats.connections, stats.max_connections);
+
+        case 8:
+            return Put(conn, "\"lwip\":{\"heap\":{\"size\":%d,\"used\":%d,\"max\":%d,\"err\":%d},\"pools\":{",
+                       lwip_stats.mem.avail, lwip_stats.mem.used, lwip_stats.mem.max, lwip_stats.mem.err);
+
+        default:
+            pool = step - 9;
+
+            if(pool < MEMP_MAX)
+            {
+                return Put(conn, "%s\"%s\":{\"size\":%d,\"num\":%d,\"used\":%d,\"max\":%d,\"err\":%d}", pool ? "," : "",
+                           NetStatsPoolName(pool), memp_pools[pool]->size, lwip_stats.memp[pool].avail,
+                           lwip_stats.memp[pool].used, lwip_stats.memp[pool].max, lwip_stats.memp[pool].err);
+            }
+
+            if(pool == MEMP_MAX)
+            {
+                return Put(conn, "}},\"rtos_heap\":{\"size\":%d,\"used\":%d,\"max\":%d}}", (int)configTOTAL_HEAP_SIZE,
+                           (int)(configTOTAL_HEAP_SIZE - xPortGetFreeHeapSize()),
+                           (int)(configTOTAL_HEAP_SIZE - xPortGetMinimumEverFreeHeapSize()));
+            }
+
+            return false;
+    }
+}
+
+// {"valves":[{"valve":0,"open":false},..]}
+bool ValvesNext(HTTP_API_CONN* conn)
+{
+    uint16_t valve = conn->step++;
+
+    if(valve < NUM_VALVES)
+    {
+        return Put(conn, "%s{\"valve\":%d,\"open\":%s}%s", valve ? "," : "{\"valves\":[", valve,
+                   IsValveOpen(valve) ? "true" : "false", valve == NUM_VALVES - 1 ? "]}" : "");
+    }
+
+    return false;
+}
@@ -50,10 +50,19 @@
 #include "console.h"
 #include "radio.h"
 #include "time_sync.h"
+#include "time_beacon.h"
 #include "led.h"
 #include "debug.h"
 #include "tcpecho.h"
 #include "valve.h"
+#include "report_log.h"
+#include "flash_writer.h"
+#include "telemetry.h"
+#include "mqtt_client.h"
+#include "http_api.h"
+#include "snmp_agent.h"
+#include "net_perf.h"
+#include "cellular.h"
 #include "sunflower_app_header.h"
 
 /*--------------- LCD Messages ---------------*/
@@ -65,15 +74,55 @@
 /*--------------- Tasks Priority -------------*/
 #define DHCP_TASK_PRIO      osPriorityNormal      
 #define LED_TASK_PRIO       osPriorityLow
-#define TIME_SYNC_TASK_PRIO osPriorityLow
 #define CONSOLE_TASK_PRIO   osPriorityNormal
 #define RADIO_TASK_PRIO     osPriorityHigh
+#define REPORT_LOG_TASK_PRIO osPriorityNormal
+#define FLASH_WRITER_TASK_PRIO osPriorityNormal
+#define TELEMETRY_TASK_PRIO osPriorityNormal
+#define MQTT_TASK_PRIO      osPriorityNormal
+#define CELLULAR_TASK_PRIO  osPriorityAboveNormal
 
 extern struct netif xnetif;
+
+/* Incremented by the scheduler on every context switch (traceTASK_SWITCHED_IN) */
+volatile uint32_t ulTaskSwitchCount;
+
+/* Cycles spent in the idle task, and the cycle count it was last switched in at (traceTASK_SWITCHED_OUT) */
+volatile uint32_t ulIdleCycles;
+volatile uint32_t ulIdleSwitchedIn;
+
+/* The FreeRTOS heap (configAPPLICATION_ALLOCATED_HEAP), in the 64 KB CCM
+   RAM. Nothing allocated from it is handed to a DMA stream, which cannot
+   reach CCM: the Ethernet, radio and modem buffers are static, and the
+   Ethernet driver copies any frame not in its own or lwIP's buffers.
+
+   Budget, in bytes with heap_4's 8 byte block headers, worst case:
+     task stacks, 7196 words (tcpip 1000, Eth_if 1000, Mqtt 768,
+       snmp_netconn 600, tcpecho 500, Radio, Telemetry, Cellular and
+       timer 512 each, LED, Console, ReportLog, FlashWriter and idle
+       256 each)                                                   28896
+     14 TCBs, 96 each                                               1344
+     24 queues, semaphores and mutexes, 96 each                     2304
+     their storage (report log and telemetry 32 deep, timers 10)     696
+     2 software timers                                               112
+     ~10 netconns: receive mbox and semaphore, 2 accept mboxes      2496
+     full report log, telemetry and radio queues of report copies   6208
+                                                                   -----
+                                                                   42056
+   which leaves 15 KB of the 56 KB for what is not counted here. */
+STATIC_ASSERT(configTOTAL_HEAP_SIZE <= 64 * 1024);
+
+#if defined(__CC_ARM)
+uint8_t ucHeap[configTOTAL_HEAP_SIZE] __attribute__((at(CCMDATARAM_BASE), zero_init));
+#else
+uint8_t ucHeap[configTOTAL_HEAP_SIZE] __attribute__((section(".ccmram")));
+#endif
  
 extern void tcpecho_init(void);
 extern void udpecho_init(void);
 
+static void StartThread(const osThreadDef_t* thread, void* argument);
+
 int main(void)
 {
     // Needed for FreeRTOS (only use pre-emption priority values)
@@ -99,46 +148,87 @@ int main(void)
     
     RadioTaskHwInit();
     RadioTaskOSInit();
-    tcpecho_os_init();
+    ReportLogOSInit();
+    FlashWriterOSInit();
+    TelemetryOSInit();
+    MqttOSInit();
+    
+    /* The modem IRQs release the cellular semaphores, so create them first */
+    CellularOSInit();
+    CellularHwInit();
     
-    //TimeSyncHwInit();
-    //TimeSyncInit();
+    /* Start the RTC, or pick up where it was before a reset */
+    TimeSyncHwInit();
     
     /* Initilaize the LwIP stack */
     LwIP_Init();
 
+    /* SNTP keeps the RTC on time */
+    TimeSyncInit();
+    
+    /* The nodes take their time from the gateway's beacons */
+    TimeBeaconInit();
+
     /* Initialize tcp echo server */
     tcpecho_init();
+    
+    /* Start the HTTP server and its JSON API */
+    HttpApiInit();
+    
+    /* Start the SNMP agent and its private MIB */
+    SnmpAgentInit();
+    
+    /* iperf sessions are started from the console and the TCP command port */
+    NetPerfInit();
 
 #ifdef USE_DHCP
     /* Start DHCPClient */
     osThreadDef(DHCP_Thread, LwIP_DHCP_task, DHCP_TASK_PRIO, 1, configMINIMAL_STACK_SIZE * 2);
-    osThreadCreate(osThread(DHCP_Thread), NULL);
+    StartThread(osThread(DHCP_Thread), NULL);
 #endif
 
     /* Start toogleLed4 task : Toggle LED4  every 250ms */
     osThreadDef(LED_Thread, (os_pthread)ToggleLed4Task, LED_TASK_PRIO, 1, configMINIMAL_STACK_SIZE);
-    osThreadCreate(osThread(LED_Thread), NULL);
+    StartThread(osThread(LED_Thread), NULL);
     
     osThreadDef(Console_Thead, (os_pthread)ConsoleTask, CONSOLE_TASK_PRIO, 1, configMINIMAL_STACK_SIZE);
-    osThreadCreate(osThread(Console_Thead), NULL);
+    StartThread(osThread(Console_Thead), NULL);
     
     osThreadDef(Radio_Thead, (os_pthread)RadioTask, RADIO_TASK_PRIO, 1, configMINIMAL_STACK_SIZE * 2);
-    osThreadCreate(osThread(Radio_Thead), NULL);
+    StartThread(osThread(Radio_Thead), NULL);
+    
+    osThreadDef(Report_Log_Thread, (os_pthread)ReportLogTask, REPORT_LOG_TASK_PRIO, 1, configMINIMAL_STACK_SIZE);
+    StartThread(osThread(Report_Log_Thread), NULL);
+    
+    osThreadDef(Flash_Writer_Thread, (os_pthread)FlashWriterTask, FLASH_WRITER_TASK_PRIO, 1, configMINIMAL_STACK_SIZE);
+    StartThread(osThread(Flash_Writer_Thread), NULL);
     
-    //osThreadDef(Time_Sync_Thread, (os_pthread)TimeSyncTask, TIME_SYNC_TASK_PRIO, 1, configMINIMAL_STACK_SIZE);
-    //osThreadCreate(osThread(Time_Sync_Thread), NULL);
+    osThreadDef(Telemetry_Thread, (os_pthread)TelemetryTask, TELEMETRY_TASK_PRIO, 1, configMINIMAL_STACK_SIZE * 2);
+    StartThread(osThread(Telemetry_Thread), NULL);
     
-    osThreadDef(Unix_Time_Thread, (os_pthread)unix_time_thread, LED_TASK_PRIO, 1, configMINIMAL_STACK_SIZE);
-    osThreadCreate(osThread(Unix_Time_Thread), NULL);
+    osThreadDef(Mqtt_Thread, (os_pthread)MqttTask, MQTT_TASK_PRIO, 1, configMINIMAL_STACK_SIZE * 3);
+    StartThread(osThread(Mqtt_Thread), NULL);
+    
+    osThreadDef(Cellular_Thread, (os_pthread)CellularTask, CELLULAR_TASK_PRIO, 1, configMINIMAL_STACK_SIZE * 2);
+    StartThread(osThread(Cellular_Thread), NULL);
 
     /* Start scheduler */
     vTaskStartScheduler();
 
-    /* We should never get here as control is now taken by the scheduler */
+    /* We should never get here as control is now taken by the scheduler.
+       If we do, there was no heap left for the idle and timer tasks. */
+    ERR("NO HEAP FOR THE IDLE AND TIMER TASKS! HALTING SYSTEM\r\n");
     for( ;; );
 }
 
+/* A task missing for want of heap would otherwise go unnoticed */
+static void StartThread(const osThreadDef_t* thread, void* argument)
+{
+    osThreadId id = osThreadCreate(thread, argument);
+
+    assert_param(id != NULL);
+}
+
 void vApplicationStackOverflowHook(void)
 {
     //TODO: fix 
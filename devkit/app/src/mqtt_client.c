@@ -0,0 +1,848 @@
+#include "mqtt_client.h"
+#include "report_log.h"
+#include "tcpecho.h"
+#include "time_sync.h"
+#include "radio.h"
+#include "radio_packets.h"
+#include "sensor_conversions.h"
+#include "valve.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "debug.h"
+#include "xprintf.h"
+#include "lwip/api.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MQTT_POLL_MS                100         // Receive timeout between window refills
+#define MQTT_TX_SIZE                1024
+#define MQTT_RX_SIZE                256         // Larger incoming packets are dropped
+#define MQTT_HEADER_MAX             5           // Type byte and up to 4 remaining length bytes
+#define MQTT_TOPIC_SIZE             48
+#define MQTT_LINE_SIZE              128
+#define MQTT_ARG_SIZE               16
+
+// Fixed header byte of each control packet
+#define MQTT_CONNECT                0x10
+#define MQTT_CONNACK                0x20
+#define MQTT_PUBLISH                0x30
+#define MQTT_PUBACK                 0x40
+#define MQTT_SUBSCRIBE              0x82
+#define MQTT_SUBACK                 0x90
+#define MQTT_PINGREQ                0xC0
+#define MQTT_PINGRESP               0xD0
+#define MQTT_DISCONNECT             0xE0
+
+#define MQTT_PUBLISH_RETAIN         0x01
+#define MQTT_PUBLISH_QOS1           0x02
+
+#define MQTT_CONNECT_CLEAN          0x02
+#define MQTT_CONNECT_WILL           0x04
+#define MQTT_CONNECT_WILL_QOS1      0x08
+#define MQTT_CONNECT_WILL_RETAIN    0x20
+
+#define MQTT_SUBACK_FAILURE         0x80
+
+// A publish always has room for at least one report, lines run about 70 bytes
+STATIC_ASSERT(MQTT_HEADER_MAX + 2 + MQTT_LINE_SIZE + 2 + MQTT_LINE_SIZE <= MQTT_TX_SIZE);
+
+// A publish waiting for its PUBACK, in the order they were sent
+typedef struct MQTT_INFLIGHT_T {
+    uint16_t packet_id;
+    bool     acked;
+    uint8_t  reports;
+    uint32_t last_seq;          // Acknowledges the log up to here
+    uint32_t sent_tick;
+    uint32_t oldest_time;       // Timestamp of the first report
+} MQTT_INFLIGHT;
+
+static bool             enabled = MQTT_DEFAULT_ENABLED;
+static ip_addr_t        brokerAddr;
+static uint16_t         brokerPort = MQTT_DEFAULT_PORT;
+static MQTT_STATS       stats;
+
+// Session state, only used by the MQTT task
+static struct netconn*  conn;
+static bool             connected;
+static uint32_t         connectedTick;
+static char             gatewayId[9];
+static uint16_t         lastPacketId;
+static uint32_t         pubSeq;             // Next log entry to publish
+static MQTT_INFLIGHT    inflight[MQTT_INFLIGHT_MAX];
+static uint8_t          inflightHead;
+static uint8_t          inflightCount;
+static uint32_t         lastTxTick;
+static uint32_t         lastRxTick;
+static uint8_t          txBuf[MQTT_TX_SIZE];
+static uint8_t          rxBuf[MQTT_RX_SIZE];
+static uint16_t         rxLen;
+static uint32_t         rxSkip;             // Bytes still to drop of a packet too large for rxBuf
+
+// Local function prototypes
+static bool             Session(void);
+static bool             Receive(void);
+static bool             Service(void);
+static bool             Input(const uint8_t* data, uint16_t len);
+static int8_t           DecodeLength(const uint8_t* p, uint16_t avail, uint32_t* len);
+static bool             HandlePacket(uint8_t type, const uint8_t* p, uint32_t len);
+static void             HandlePuback(uint16_t id);
+static void             HandleCommand(const uint8_t* topic, uint16_t topic_len, const uint8_t* payload, uint32_t len);
+static uint8_t*         PutString(uint8_t* p, const char* s);
+static uint16_t         NextPacketId(void);
+static bool             SendPacket(uint8_t type, uint8_t* end);
+static bool             SendConnect(void);
+static bool             SendSubscribe(void);
+static bool             SendStatus(const char* status);
+static bool             SendPuback(uint16_t id);
+static bool             PublishBatch(void);
+static uint16_t         FormatReport(char* line, uint16_t size, uint32_t seq, generic_message_t* report);
+
+// Global function implementations
+void MqttOSInit(void)
+{
+    ipaddr_aton(MQTT_DEFAULT_BROKER, &brokerAddr);
+}
+
+void MqttTask(void)
+{
+    uint32_t backoff = MQTT_BACKOFF_MIN_MS;
+    uint32_t delay;
+    bool     accepted;
+
+    while(1)
+    {
+        if(!enabled)
+        {
+            osDelay(1000);
+            continue;
+        }
+
+        accepted = Session();
+
+        if(!enabled)
+        {
+            continue;
+        }
+
+        if(accepted)
+        {
+            backoff = MQTT_BACKOFF_MIN_MS;
+        }
+
+        // Spread the retries so gateways behind one broker don't reconnect in lockstep
+        delay = backoff + xTaskGetTickCount() % (backoff / 4 + 1);
+        INFO("MQTT: reconnecting in %d ms\n", delay);
+        osDelay(delay);
+
+        if(!accepted)
+        {
+            backoff = backoff * 2 > MQTT_BACKOFF_MAX_MS ? MQTT_BACKOFF_MAX_MS : backoff * 2;
+        }
+    }
+}
+
+// Use the broker at <addr> (dotted quad) port <port> from the next connection on
+bool MqttSetBroker(const char* addr, uint16_t port)
+{
+    ip_addr_t parsed;
+
+    if(!ipaddr_aton(addr, &parsed) || port == 0)
+    {
+        return false;
+    }
+
+    taskENTER_CRITICAL();
+    ip_addr_copy(brokerAddr, parsed);
+    brokerPort = port;
+    taskEXIT_CRITICAL();
+
+    return true;
+}
+
+// Disabling ends the session with a DISCONNECT, so the broker does not publish the will
+void MqttEnable(bool enable)
+{
+    enabled = enable;
+}
+
+void MqttGetStats(MQTT_STATS* out)
+{
+    memcpy(out, &stats, sizeof(MQTT_STATS));
+}
+
+void MqttPrintStatus(void)
+{
+    uint32_t connected_ms = stats.connected_ms + (connected ? xTaskGetTickCount() - connectedTick : 0);
+
+    xprintf("MQTT: %s, broker %s:%d, %s\n", enabled ? "enabled" : "disabled", ipaddr_ntoa(&brokerAddr), brokerPort,
+            connected ? "connected" : "not connected");
+    xprintf("Sessions: %d, failures: %d, next seq %d, %d publishes in flight\n", stats.connects, stats.failures, pubSeq, inflightCount);
+    xprintf("Sent: %d reports acked in %d publishes (%d bytes), %d reports/min connected\n", stats.reports, stats.publishes, stats.bytes,
+            connected_ms >= 1000 ? stats.reports * 60 / (connected_ms / 1000) : 0);
+    xprintf("PUBACK: %d ms avg, %d ms max. Report age at PUBACK: %d s avg, %d s max\n",
+            stats.publishes ? stats.puback_ms / stats.publishes : 0, stats.max_puback_ms,
+            stats.aged_reports ? stats.age_s / stats.aged_reports : 0, stats.max_age_s);
+    xprintf("Commands received: %d\n", stats.commands);
+}
+
+// Local function implementations
+
+// One connection to the broker, until it fails or the client is disabled.
+// Returns true if the broker accepted the session.
+bool Session(void)
+{
+    ip_addr_t addr;
+    uint16_t  port;
+    bool      ok;
+    bool      accepted;
+
+    taskENTER_CRITICAL();
+    ip_addr_copy(addr, brokerAddr);
+    port = brokerPort;
+    taskEXIT_CRITICAL();
+
+    snprintf(gatewayId, sizeof(gatewayId), "%08x", RadioGetMACAddress());
+
+    conn = netconn_new(NETCONN_TCP);
+
+    if(conn == NULL)
+    {
+        stats.failures++;
+        return false;
+    }
+
+    connected = false;
+    inflightHead = 0;
+    inflightCount = 0;
+    rxLen = 0;
+    rxSkip = 0;
+    lastRxTick = lastTxTick = xTaskGetTickCount();
+
+    ok = netconn_connect(conn, &addr, port) == ERR_OK;
+
+    if(ok)
+    {
+        netconn_set_recvtimeout(conn, MQTT_POLL_MS);
+        ok = SendConnect();
+    }
+
+    while(ok && enabled)
+    {
+        ok = Receive() && Service();
+    }
+
+    accepted = connected;
+
+    if(ok)
+    {
+        SendPacket(MQTT_DISCONNECT, txBuf + MQTT_HEADER_MAX);
+    }
+    else
+    {
+        WARN("MQTT: connection to %s:%d %s\n", ipaddr_ntoa(&addr), port, connected ? "lost" : "failed");
+        stats.failures++;
+    }
+
+    if(connected)
+    {
+        stats.connected_ms += xTaskGetTickCount() - connectedTick;
+        connected = false;
+    }
+
+    netconn_close(conn);
+    netconn_delete(conn);
+    conn = NULL;
+
+    return accepted;
+}
+
+// Wait up to MQTT_POLL_MS for data from the broker and handle it
+bool Receive(void)
+{
+    struct netbuf* buf;
+    void*          data;
+    u16_t          len;
+    err_t          err;
+    bool           ok = true;
+
+    err = netconn_recv(conn, &buf);
+
+    if(err == ERR_TIMEOUT)
+    {
+        return true;
+    }
+
+    if(err != ERR_OK)
+    {
+        return false;
+    }
+
+    do
+    {
+        netbuf_data(buf, &data, &len);
+        ok = Input((const uint8_t*)data, len);
+    } while(ok && netbuf_next(buf) >= 0);
+
+    netbuf_delete(buf);
+
+    return ok;
+}
+
+// Timeouts, keepalive and refilling the publish window
+bool Service(void)
+{
+    uint32_t now = xTaskGetTickCount();
+
+    if(!connected)
+    {
+        return now - lastRxTick < MQTT_ACK_TIMEOUT_MS;
+    }
+
+    if(inflightCount && now - inflight[inflightHead].sent_tick >= MQTT_ACK_TIMEOUT_MS)
+    {
+        WARN("MQTT: no PUBACK for packet %d\n", inflight[inflightHead].packet_id);
+        return false;
+    }
+
+    if(now - lastRxTick >= MQTT_KEEPALIVE_S * 1500)
+    {
+        return false;
+    }
+
+    // Read ahead of the acknowledged position, never past the window
+    if(pubSeq < ReportLogFirstUnacked())
+    {
+        pubSeq = ReportLogFirstUnacked();
+    }
+
+    while(inflightCount < MQTT_INFLIGHT_MAX && pubSeq < ReportLogNextSeq())
+    {
+        if(!PublishBatch())
+        {
+            return false;
+        }
+    }
+
+    if(now - lastTxTick >= MQTT_KEEPALIVE_S * 500)
+    {
+        return SendPacket(MQTT_PINGREQ, txBuf + MQTT_HEADER_MAX);
+    }
+
+    return true;
+}
+
+// Reassemble control packets from the TCP stream
+bool Input(const uint8_t* data, uint16_t len)
+{
+    uint16_t n;
+    uint32_t remaining;
+    uint32_t total;
+    int8_t   header;
+
+    lastRxTick = xTaskGetTickCount();
+
+    while(len)
+    {
+        if(rxSkip)
+        {
+            n = rxSkip < len ? rxSkip : len;
+            rxSkip -= n;
+            data += n;
+            len -= n;
+            continue;
+        }
+
+        n = MQTT_RX_SIZE - rxLen < len ? MQTT_RX_SIZE - rxLen : len;
+        memcpy(&rxBuf[rxLen], data, n);
+        rxLen += n;
+        data += n;
+        len -= n;
+
+        while(rxLen >= 2)
+        {
+            header = DecodeLength(rxBuf, rxLen, &remaining);
+
+            if(header < 0)
+            {
+                return false;
+            }
+            else if(header == 0)
+            {
+                break;
+            }
+
+            total = header + remaining;
+
+            if(total > MQTT_RX_SIZE)
+            {
+                WARN("MQTT: dropped a %d byte packet\n", total);
+                rxSkip = total - rxLen;
+                rxLen = 0;
+                break;
+            }
+
+            if(total > rxLen)
+            {
+                break;
+            }
+
+            if(!HandlePacket(rxBuf[0], &rxBuf[header], remaining))
+            {
+                return false;
+            }
+
+            rxLen -= total;
+            memmove(rxBuf, &rxBuf[total], rxLen);
+        }
+    }
+
+    return true;
+}
+
+// Fixed header length, 0 if more bytes are needed, -1 if malformed
+int8_t DecodeLength(const uint8_t* p, uint16_t avail, uint32_t* len)
+{
+    uint32_t multiplier = 1;
+    uint8_t  i = 1;
+    uint8_t  b;
+
+    *len = 0;
+
+    do
+    {
+        if(i > 4)
+        {
+            return -1;
+        }
+
+        if(i >= avail)
+        {
+            return 0;
+        }
+
+        b = p[i++];
+        *len += (b & 0x7F) * multiplier;
+        multiplier *= 128;
+    } while(b & 0x80);
+
+    return i;
+}
+
+bool HandlePacket(uint8_t type, const uint8_t* p, uint32_t len)
+{
+    uint16_t topic_len;
+    uint16_t id = 0;
+    uint32_t offset;
+    uint8_t  qos;
+
+    switch(type & 0xF0)
+    {
+        case MQTT_CONNACK:
+            if(len < 2 || p[1] != 0)
+            {
+                WARN("MQTT: broker refused the connection (%d)\n", len < 2 ? -1 : p[1]);
+                return false;
+            }
+
+            connected = true;
+            connectedTick = xTaskGetTickCount();
+            stats.connects++;
+            pubSeq = ReportLogFirstUnacked();
+            INFO("MQTT: connected as sunflower-%s\n", gatewayId);
+
+            return SendSubscribe() && SendStatus("online");
+
+        case MQTT_PUBACK:
+            if(len >= 2)
+            {
+                HandlePuback((p[0] << 8) | p[1]);
+            }
+            break;
+
+        case MQTT_SUBACK:
+            if(len >= 3 && p[2] == MQTT_SUBACK_FAILURE)
+            {
+                WARN("MQTT: command subscription refused\n");
+            }
+            break;
+
+        case MQTT_PUBLISH:
+            qos = (type >> 1) & 0x03;
+
+            if(len < 2)
+            {
+                return false;
+            }
+
+            topic_len = (p[0] << 8) | p[1];
+            offset = 2 + topic_len;
+
+            if(qos)
+            {
+                if(offset + 2 > len)
+                {
+                    return false;
+                }
+                id = (p[offset] << 8) | p[offset + 1];
+                offset += 2;
+            }
+
+            if(offset > len)
+            {
+                return false;
+            }
+
+            HandleCommand(&p[2], topic_len, &p[offset], len - offset);
+
+            // Subscribed at QoS 1, the broker never sends QoS 2
+            if(qos == 1)
+            {
+                return SendPuback(id);
+            }
+            break;
+
+        default:
+            // PINGRESP: receiving it already refreshed lastRxTick
+            break;
+    }
+
+    return true;
+}
+
+void HandlePuback(uint16_t id)
+{
+    MQTT_INFLIGHT* slot;
+    uint32_t       now = xTaskGetTickCount();
+    uint32_t       unix_time = GetUnixTime();
+    uint32_t       ms;
+
+    for(uint8_t i = 0; i < inflightCount; i++)
+    {
+        slot = &inflight[(inflightHead + i) % MQTT_INFLIGHT_MAX];
+
+        if(slot->packet_id == id && !slot->acked)
+        {
+            slot->acked = true;
+
+            ms = now - slot->sent_tick;
+            stats.puback_ms += ms;
+            stats.max_puback_ms = ms > stats.max_puback_ms ? ms : stats.max_puback_ms;
+
+            // Only meaningful once the clock has been set
+            if(slot->oldest_time && unix_time >= slot->oldest_time && unix_time - slot->oldest_time < 24 * 60 * 60)
+            {
+                stats.age_s += (unix_time - slot->oldest_time) * slot->reports;
+                stats.aged_reports += slot->reports;
+                stats.max_age_s = unix_time - slot->oldest_time > stats.max_age_s ? unix_time - slot->oldest_time : stats.max_age_s;
+            }
+            break;
+        }
+    }
+
+    // The log is acknowledged in order, a PUBACK overtaking an older one waits for it
+    while(inflightCount && inflight[inflightHead].acked)
+    {
+        slot = &inflight[inflightHead];
+
+        ReportLogAck(slot->last_seq);
+        stats.reports += slot->reports;
+
+        inflightHead = (inflightHead + 1) % MQTT_INFLIGHT_MAX;
+        inflightCount--;
+    }
+}
+
+void HandleCommand(const uint8_t* topic, uint16_t topic_len, const uint8_t* payload, uint32_t len)
+{
+    char   prefix[MQTT_TOPIC_SIZE];
+    char   arg[MQTT_ARG_SIZE];
+    size_t prefix_len;
+    long   value;
+
+    prefix_len = snprintf(prefix, sizeof(prefix), MQTT_TOPIC_PREFIX "/%s/cmd/", gatewayId);
+
+    if(topic_len <= prefix_len || memcmp(topic, prefix, prefix_len) != 0)
+    {
+        return;
+    }
+
+    topic += prefix_len;
+    topic_len -= prefix_len;
+
+    len = len < sizeof(arg) - 1 ? len : sizeof(arg) - 1;
+    memcpy(arg, payload, len);
+    arg[len] = '\0';
+
+    if(topic_len == 5 && memcmp(topic, "valve", 5) == 0)
+    {
+        if(strncmp(arg, "open ", 5) == 0)
+        {
+            OpenValve(atoi(&arg[5]));
+        }
+        else if(strncmp(arg, "close ", 6) == 0)
+        {
+            CloseValve(atoi(&arg[6]));
+        }
+        else
+        {
+            WARN("MQTT: bad valve command '%s'\n", arg);
+            return;
+        }
+    }
+    else if(topic_len == 7 && memcmp(topic, "polling", 7) == 0)
+    {
+        generic_message_t* generic_msg;
+
+        value = atol(arg);
+
+        if(value < 500 || value > (24 * 60 * 60 * 1000))
+        {
+            WARN("MQTT: polling rate %d out of range\n", value);
+            return;
+        }
+
+        generic_msg = pvPortMalloc(sizeof(generic_message_t));
+
+        if(generic_msg == NULL)
+        {
+            return;
+        }
+
+        memset(generic_msg, 0, sizeof(generic_message_t));
+        generic_msg->cmd = SENSOR_CMD;
+        generic_msg->payload.sensor_cmd.sensor_polling_period = value;
+        generic_msg->payload.sensor_cmd.valid_fields = 0x1;
+        SendToBroadcast((uint8_t*)generic_msg, sizeof(generic_message_t));
+    }
+    else
+    {
+        return;
+    }
+
+    stats.commands++;
+}
+
+// MQTT UTF-8 string: 16-bit big endian length, then the bytes
+uint8_t* PutString(uint8_t* p, const char* s)
+{
+    uint16_t len = strlen(s);
+
+    *p++ = len >> 8;
+    *p++ = len & 0xFF;
+    memcpy(p, s, len);
+
+    return p + len;
+}
+
+uint16_t NextPacketId(void)
+{
+    // Packet identifiers must be non-zero
+    if(++lastPacketId == 0)
+    {
+        lastPacketId = 1;
+    }
+
+    return lastPacketId;
+}
+
+// Send the packet whose variable header and payload were built from
+// txBuf + MQTT_HEADER_MAX up to <end>: the fixed header goes right in front
+bool SendPacket(uint8_t type, uint8_t* end)
+{
+    uint8_t* body = txBuf + MQTT_HEADER_MAX;
+    uint32_t remaining = end - body;
+    uint8_t  encoded[4];
+    uint8_t  n = 0;
+    uint8_t* start;
+
+    do
+    {
+        encoded[n] = remaining % 128;
+        remaining /= 128;
+        if(remaining)
+        {
+            encoded[n] |= 0x80;
+        }
+        n++;
+    } while(remaining);
+
+    start = body - 1 - n;
+    start[0] = type;
+    memcpy(&start[1], encoded, n);
+
+    if(netconn_write(conn, start, end - start, NETCONN_COPY) != ERR_OK)
+    {
+        return false;
+    }
+
+    lastTxTick = xTaskGetTickCount();
+
+    if((type & 0xF0) == MQTT_PUBLISH)
+    {
+        stats.bytes += end - start;
+    }
+
+    return true;
+}
+
+bool SendConnect(void)
+{
+    uint8_t* p = txBuf + MQTT_HEADER_MAX;
+    char     str[MQTT_TOPIC_SIZE];
+
+    // Protocol name and level 4 (3.1.1)
+    p = PutString(p, "MQTT");
+    *p++ = 4;
+
+    // Clean session: after a reconnect the report log is published again from
+    // the last acknowledged report, no broker side state is needed
+    *p++ = MQTT_CONNECT_CLEAN | MQTT_CONNECT_WILL | MQTT_CONNECT_WILL_QOS1 | MQTT_CONNECT_WILL_RETAIN;
+    *p++ = MQTT_KEEPALIVE_S >> 8;
+    *p++ = MQTT_KEEPALIVE_S & 0xFF;
+
+    snprintf(str, sizeof(str), "sunflower-%s", gatewayId);
+    p = PutString(p, str);
+
+    snprintf(str, sizeof(str), MQTT_TOPIC_PREFIX "/%s/status", gatewayId);
+    p = PutString(p, str);
+    p = PutString(p, "offline");
+
+    return SendPacket(MQTT_CONNECT, p);
+}
+
+bool SendSubscribe(void)
+{
+    uint8_t* p = txBuf + MQTT_HEADER_MAX;
+    uint16_t id = NextPacketId();
+    char     filter[MQTT_TOPIC_SIZE];
+
+    *p++ = id >> 8;
+    *p++ = id & 0xFF;
+
+    snprintf(filter, sizeof(filter), MQTT_TOPIC_PREFIX "/%s/cmd/+", gatewayId);
+    p = PutString(p, filter);
+    *p++ = 1;
+
+    return SendPacket(MQTT_SUBSCRIBE, p);
+}
+
+// Retained QoS 0 status, replaced by the will if the gateway drops off
+bool SendStatus(const char* status)
+{
+    uint8_t* p = txBuf + MQTT_HEADER_MAX;
+    char     topic[MQTT_TOPIC_SIZE];
+    uint16_t len = strlen(status);
+
+    snprintf(topic, sizeof(topic), MQTT_TOPIC_PREFIX "/%s/status", gatewayId);
+    p = PutString(p, topic);
+    memcpy(p, status, len);
+
+    return SendPacket(MQTT_PUBLISH | MQTT_PUBLISH_RETAIN, p + len);
+}
+
+bool SendPuback(uint16_t id)
+{
+    uint8_t* p = txBuf + MQTT_HEADER_MAX;
+
+    *p++ = id >> 8;
+    *p++ = id & 0xFF;
+
+    return SendPacket(MQTT_PUBACK, p);
+}
+
+// Publish the reports from pubSeq on that belong to the same node, up to
+// MQTT_BATCH_MAX of them. Entries that cannot be read any more are skipped.
+bool PublishBatch(void)
+{
+    generic_message_t report;
+    MQTT_INFLIGHT*    slot;
+    uint8_t*          p = txBuf + MQTT_HEADER_MAX;
+    uint8_t*          end = txBuf + MQTT_TX_SIZE;
+    char              line[MQTT_LINE_SIZE];
+    uint16_t          len;
+    uint16_t          id;
+    uint32_t          node;
+    uint32_t          seq = pubSeq;
+    uint8_t           count = 0;
+
+    while(seq < ReportLogNextSeq() && !ReportLogRead(seq, &report))
+    {
+        seq++;
+    }
+
+    if(seq >= ReportLogNextSeq())
+    {
+        pubSeq = seq;
+        return true;
+    }
+
+    node = report.src;
+    id = NextPacketId();
+
+    snprintf(line, sizeof(line), MQTT_TOPIC_PREFIX "/%s/%08x/reports", gatewayId, node);
+    p = PutString(p, line);
+    *p++ = id >> 8;
+    *p++ = id & 0xFF;
+
+    slot = &inflight[(inflightHead + inflightCount) % MQTT_INFLIGHT_MAX];
+    slot->packet_id = id;
+    slot->acked = false;
+    slot->oldest_time = report.payload.sensor_message.timestamp;
+
+    do
+    {
+        len = FormatReport(line, sizeof(line), seq, &report);
+
+        if(p + len > end)
+        {
+            break;
+        }
+
+        memcpy(p, line, len);
+        p += len;
+        count++;
+        seq++;
+
+        if(count == MQTT_BATCH_MAX)
+        {
+            break;
+        }
+
+        while(seq < ReportLogNextSeq() && !ReportLogRead(seq, &report))
+        {
+            seq++;
+        }
+    } while(seq < ReportLogNextSeq() && report.src == node);
+
+    if(!SendPacket(MQTT_PUBLISH | MQTT_PUBLISH_QOS1, p))
+    {
+        return false;
+    }
+
+    slot->reports = count;
+    slot->last_seq = seq - 1;
+    slot->sent_tick = xTaskGetTickCount();
+    inflightCount++;
+
+    pubSeq = seq;
+    stats.publishes++;
+
+    return true;
+}
+
+uint16_t FormatReport(char* line, uint16_t size, uint32_t seq, generic_message_t* report)
+{
+    int len = snprintf(line, size, "%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", seq, report->payload.sensor_message.timestamp,
+                       Moisture_To_Float(report->payload.sensor_message.moisture0),
+                       Moisture_To_Float(report->payload.sensor_message.moisture1),
+                       Moisture_To_Float(report->payload.sensor_message.moisture2),
+                       TMP102_To_Float(report->payload.sensor_message.temp0),
+                       TMP102_To_Float(report->payload.sensor_message.temp1),
+                       TMP102_To_Float(report->payload.sensor_message.temp2),
+                       HTU21D_Humid_To_Float(report->payload.sensor_message.humid),
+                       HTU21D_Temp_To_Float(report->payload.sensor_message.air_temp));
+
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,345 @@
+#include "net_perf.h"
+#include "net_stats.h"
+#include "snmp_agent.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "debug.h"
+#include "xprintf.h"
+#include "lwip/tcpip.h"
+#include "lwip/stats.h"
+#include "lwip/memp.h"
+#include "lwip/ip_addr.h"
+#include "lwip/apps/lwiperf.h"
+#include <stdio.h>
+#include <string.h>
+
+#define DIR_RX              0
+#define DIR_TX              1
+#define NUM_DIRS            2
+
+// Lines of one result: the summary, the heap and every pool
+#define RESULT_LINES        (2 + MEMP_MAX)
+
+typedef enum NET_PERF_MODE_T {
+    NET_PERF_IDLE,
+    NET_PERF_SERVER,
+    NET_PERF_CLIENT
+} NET_PERF_MODE;
+
+// A start or stop request handed to the tcpip thread
+typedef struct NET_PERF_REQUEST_T {
+    NET_PERF_MODE mode;             // NET_PERF_IDLE to stop
+    ip_addr_t     addr;
+    uint16_t      port;
+    bool          ok;
+} NET_PERF_REQUEST;
+
+typedef struct NET_PERF_RESULT_T {
+    uint8_t   type;                 // enum lwiperf_report_type, LWIPERF_TCP_STARTED while running
+    ip_addr_t remote;
+    uint32_t  bytes;
+    uint32_t  ms;
+    uint8_t   cpu;                  // Percent busy over the connection
+    uint16_t  heapMax;
+    uint16_t  heapErr;
+    uint16_t  poolMax[MEMP_MAX];
+    uint16_t  poolErr[MEMP_MAX];
+} NET_PERF_RESULT;
+
+static const char* const typeNames[] = {
+    "running", "done", "done", "aborted", "data-error", "tx-error", "reset"
+};
+
+static osSemaphoreId    doneSem;
+static osMutexId        requestLock;
+
+// Owned by the tcpip thread
+static NET_PERF_MODE    mode = NET_PERF_IDLE;
+static void*            session;
+static ip_addr_t        clientAddr;
+static uint16_t         clientPort;
+static uint8_t          active;                 // Bit <dir> set while a connection runs
+static uint64_t         startCycles[NUM_DIRS];
+static uint64_t         startIdleCycles[NUM_DIRS];
+static NET_PERF_RESULT  results[NUM_DIRS];
+static bool             haveResult[NUM_DIRS];
+
+// Local function prototypes
+static bool     Request(NET_PERF_REQUEST* request);
+static void     HandleRequest(void* ctx);
+static void     Report(void* arg, enum lwiperf_report_type report_type, const ip_addr_t* local_addr, u16_t local_port,
+                       const ip_addr_t* remote_addr, u16_t remote_port, u32_t bytes_transferred, u32_t ms_duration,
+                       u32_t bandwidth_kbitpsec);
+static void     Started(uint8_t dir, const ip_addr_t* remote_addr);
+static void     Finished(uint8_t dir, enum lwiperf_report_type report_type, u32_t bytes, u32_t ms);
+
+// Global function implementations
+
+void NetPerfInit(void)
+{
+    osSemaphoreDef(NetPerfDone);
+    osMutexDef(NetPerfRequest);
+
+    doneSem = osSemaphoreCreate(osSemaphore(NetPerfDone), 1);
+    requestLock = osMutexCreate(osMutex(NetPerfRequest));
+    assert_param(doneSem != NULL && requestLock != NULL);
+
+    // Binary semaphores are created available
+    osSemaphoreWait(doneSem, 0);
+}
+
+// Listen for iperf clients on port 5001 until NetPerfStop()
+bool NetPerfStartServer(void)
+{
+    NET_PERF_REQUEST request;
+
+    request.mode = NET_PERF_SERVER;
+
+    return Request(&request);
+}
+
+// Send to the iperf server at <addr>:<port> for NET_PERF_CLIENT_SECONDS
+bool NetPerfStartClient(const char* addr, uint16_t port)
+{
+    NET_PERF_REQUEST request;
+
+    if(!ipaddr_aton(addr, &request.addr))
+    {
+        return false;
+    }
+
+    request.mode = NET_PERF_CLIENT;
+    request.port = port;
+
+    return Request(&request);
+}
+
+// Abort the session and its connections. Connections cut short leave no result.
+void NetPerfStop(void)
+{
+    NET_PERF_REQUEST request;
+
+    request.mode = NET_PERF_IDLE;
+    Request(&request);
+}
+
+// Format result line <index> into <line>: the rx result, then the tx result,
+// RESULT_LINES each. Returns false past the last line.
+bool NetPerfLine(uint16_t index, char* line, uint16_t size)
+{
+    NET_PERF_RESULT* result;
+    uint8_t          dir;
+    uint16_t         pool;
+
+    for(dir = 0; dir < NUM_DIRS; dir++)
+    {
+        if(!haveResult[dir])
+        {
+            continue;
+        }
+
+        if(index < RESULT_LINES)
+        {
+            break;
+        }
+
+        index -= RESULT_LINES;
+    }
+
+    if(dir == NUM_DIRS)
+    {
+        return false;
+    }
+
+    result = &results[dir];
+
+    if(index == 0)
+    {
+        snprintf(line, size, "iperf %s %s bytes=%u ms=%u kbps=%u cpu=%u remote=%s", dir == DIR_RX ? "rx" : "tx",
+                 typeNames[result->type], result->bytes, result->ms,
+                 result->ms > 0 ? (uint32_t)(((uint64_t)result->bytes * 8) / result->ms) : 0, result->cpu,
+                 ipaddr_ntoa(&result->remote));
+    }
+    else if(index == 1)
+    {
+        snprintf(line, size, "mem HEAP max=%u err=%u", result->heapMax, result->heapErr);
+    }
+    else
+    {
+        pool = index - 2;
+        snprintf(line, size, "memp %s num=%u max=%u err=%u", NetStatsPoolName(pool), lwip_stats.memp[pool].avail,
+                 result->poolMax[pool], result->poolErr[pool]);
+    }
+
+    return true;
+}
+
+void NetPerfPrintStatus(void)
+{
+    char line[NET_PERF_LINE_SIZE];
+
+    switch(mode)
+    {
+        case NET_PERF_SERVER:
+            xprintf("iperf server listening on port %d\n", LWIPERF_TCP_PORT_DEFAULT);
+            break;
+
+        case NET_PERF_CLIENT:
+            xprintf("iperf client sending to %s:%d\n", ipaddr_ntoa(&clientAddr), clientPort);
+            break;
+
+        default:
+            xprintf("iperf idle\n");
+            break;
+    }
+
+    for(uint16_t i = 0; NetPerfLine(i, line, sizeof(line)); i++)
+    {
+        xprintf("%s\n", line);
+    }
+}
+
+// Local function implementations
+
+// Run <request> in the tcpip thread and wait for it: lwiperf uses the raw API
+bool Request(NET_PERF_REQUEST* request)
+{
+    request->ok = false;
+
+    osMutexWait(requestLock, osWaitForever);
+
+    if(tcpip_callback(HandleRequest, request) == ERR_OK)
+    {
+        osSemaphoreWait(doneSem, osWaitForever);
+    }
+
+    osMutexRelease(requestLock);
+
+    return request->ok;
+}
+
+// tcpip thread
+void HandleRequest(void* ctx)
+{
+    NET_PERF_REQUEST* request = (NET_PERF_REQUEST*)ctx;
+
+    if(request->mode == NET_PERF_IDLE)
+    {
+        if(session != NULL)
+        {
+            lwiperf_abort(session);
+        }
+
+        session = NULL;
+        mode = NET_PERF_IDLE;
+        active = 0;
+        request->ok = true;
+    }
+    else if(mode == NET_PERF_IDLE)
+    {
+        if(request->mode == NET_PERF_SERVER)
+        {
+            session = lwiperf_start_tcp_server_default(Report, NULL);
+        }
+        else
+        {
+            ip_addr_copy(clientAddr, request->addr);
+            clientPort = request->port;
+            session = lwiperf_start_tcp_client(&clientAddr, clientPort, NET_PERF_CLIENT_SECONDS, Report, NULL);
+        }
+
+        if(session != NULL)
+        {
+            mode = request->mode;
+            request->ok = true;
+        }
+    }
+
+    osSemaphoreRelease(doneSem);
+}
+
+// tcpip thread. A connection on port 5001 is one the gateway receives on;
+// its own client connections, and the ones a server sends back on, use an
+// ephemeral local port.
+void Report(void* arg, enum lwiperf_report_type report_type, const ip_addr_t* local_addr, u16_t local_port,
+            const ip_addr_t* remote_addr, u16_t remote_port, u32_t bytes_transferred, u32_t ms_duration,
+            u32_t bandwidth_kbitpsec)
+{
+    uint8_t dir = local_port == LWIPERF_TCP_PORT_DEFAULT ? DIR_RX : DIR_TX;
+
+    (void)arg;
+    (void)local_addr;
+    (void)remote_port;
+    (void)bandwidth_kbitpsec;
+
+    if(report_type == LWIPERF_TCP_STARTED)
+    {
+        Started(dir, remote_addr);
+        return;
+    }
+
+    // A reset connection reports no addresses: it is the one still running
+    if(local_addr == NULL)
+    {
+        dir = (active & (1 << DIR_RX)) ? DIR_RX : DIR_TX;
+    }
+
+    Finished(dir, report_type, bytes_transferred, ms_duration);
+
+    // lwiperf frees a client session when it ends
+    if(mode == NET_PERF_CLIENT && dir == DIR_TX)
+    {
+        session = NULL;
+        mode = NET_PERF_IDLE;
+    }
+}
+
+void Started(uint8_t dir, const ip_addr_t* remote_addr)
+{
+    NET_PERF_RESULT* result = &results[dir];
+
+    // The first connection of a run measures the high-water marks from here
+    if(active == 0)
+    {
+        NetStatsClear();
+    }
+
+    active |= 1 << dir;
+    SnmpAgentCpuCycles(&startCycles[dir], &startIdleCycles[dir]);
+
+    memset(result, 0, sizeof(NET_PERF_RESULT));
+    result->type = LWIPERF_TCP_STARTED;
+    ip_addr_copy(result->remote, *remote_addr);
+    haveResult[dir] = true;
+}
+
+void Finished(uint8_t dir, enum lwiperf_report_type report_type, u32_t bytes, u32_t ms)
+{
+    NET_PERF_RESULT* result = &results[dir];
+    uint64_t         cycles;
+    uint64_t         idleCycles;
+
+    if(!(active & (1 << dir)))
+    {
+        return;
+    }
+
+    active &= ~(1 << dir);
+    SnmpAgentCpuCycles(&cycles, &idleCycles);
+    cycles -= startCycles[dir];
+    idleCycles -= startIdleCycles[dir];
+
+    result->type = report_type <= LWIPERF_TCP_ABORTED_REMOTE ? report_type : LWIPERF_TCP_ABORTED_LOCAL;
+    result->bytes = bytes;
+    result->ms = ms;
+    result->cpu = cycles > 0 ? 100 - (uint8_t)((idleCycles * 100) / cycles) : 0;
+
+    result->heapMax = lwip_stats.mem.max;
+    result->heapErr = lwip_stats.mem.err;
+
+    for(uint16_t i = 0; i < MEMP_MAX; i++)
+    {
+        result->poolMax[i] = lwip_stats.memp[i].max;
+        result->poolErr[i] = lwip_stats.memp[i].err;
+    }
+}
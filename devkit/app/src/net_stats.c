@@ -0,0 +1,136 @@
+#include "net_stats.h"
+#include "lwip/opt.h"
+#include "lwip/stats.h"
+#include "lwip/memp.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "FreeRTOS.h"
+#include "xprintf.h"
+#include <stdio.h>
+
+#if !MEM_STATS || !MEMP_STATS || !SYS_STATS
+#error "net_stats needs MEM_STATS, MEMP_STATS and SYS_STATS in lwipopts.h"
+#endif
+
+// The same lower bounds lwIP's init.c sanity checks enforce, reported so the
+// profile tool never sizes a pool below them
+#define NET_STATS_WND_PBUF_PAYLOAD  (PBUF_POOL_BUFSIZE - (PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN + PBUF_IP_HLEN + PBUF_TRANSPORT_HLEN))
+#define NET_STATS_WND_PBUFS         ((TCP_WND + NET_STATS_WND_PBUF_PAYLOAD - 1) / NET_STATS_WND_PBUF_PAYLOAD)
+#define NET_STATS_TIMEOUTS          (LWIP_TCP + IP_REASSEMBLY + LWIP_ARP + (2 * LWIP_DHCP) + LWIP_AUTOIP + LWIP_IGMP + LWIP_DNS + PPP_SUPPORT)
+
+#if IP_REASSEMBLY
+#define NET_STATS_REASS_PBUFS       IP_REASS_MAX_PBUFS
+#else
+#define NET_STATS_REASS_PBUFS       0
+#endif
+
+// Line index of each group of statistics
+#define NET_STATS_LIMITS    0
+#define NET_STATS_MEM       1
+#define NET_STATS_MEMP      2
+#define NET_STATS_MBOX      (NET_STATS_MEMP + MEMP_MAX)
+#define NET_STATS_SEM       (NET_STATS_MBOX + 1)
+#define NET_STATS_MUTEX     (NET_STATS_MBOX + 2)
+#define NET_STATS_HEAP      (NET_STATS_MBOX + 3)
+
+const char* NetStatsPoolName(uint16_t pool)
+{
+#ifdef LWIP_DEBUG
+    return memp_pools[pool]->desc;
+#else
+    static char name[8];
+
+    snprintf(name, sizeof(name), "POOL%d", pool);
+    return name;
+#endif
+}
+
+// Format statistics line <index> into <line>. Returns false past the last line.
+bool NetStatsLine(uint16_t index, char* line, uint16_t size)
+{
+    if(index == NET_STATS_LIMITS)
+    {
+        snprintf(line, size, "limits LWIP seg=%d wnd=%d timeouts=%d reass=%d", TCP_SND_QUEUELEN, NET_STATS_WND_PBUFS,
+                 NET_STATS_TIMEOUTS, NET_STATS_REASS_PBUFS);
+    }
+    else if(index == NET_STATS_MEM)
+    {
+        struct stats_mem* mem = &lwip_stats.mem;
+
+        snprintf(line, size, "mem HEAP size=1 num=%d used=%d max=%d err=%d", mem->avail, mem->used, mem->max, mem->err);
+    }
+    else if(index < NET_STATS_MBOX)
+    {
+        uint16_t          pool = index - NET_STATS_MEMP;
+        struct stats_mem* mem  = &lwip_stats.memp[pool];
+
+        snprintf(line, size, "memp %s size=%d num=%d used=%d max=%d err=%d", NetStatsPoolName(pool), memp_pools[pool]->size,
+                 mem->avail, mem->used, mem->max, mem->err);
+    }
+    else if(index == NET_STATS_MBOX)
+    {
+        struct stats_syselem* mbox = &lwip_stats.sys.mbox;
+        sys_mbox_stats_t      fill;
+
+        sys_arch_mbox_stats(&fill, 0);
+        snprintf(line, size, "mbox QUEUE num=%d used=%d max=%d fill=%d err=%lu", fill.nMaxLength, mbox->used, mbox->max,
+                 fill.nMaxFill, fill.nPostFull);
+    }
+    else if(index == NET_STATS_SEM || index == NET_STATS_MUTEX)
+    {
+        struct stats_syselem* elem = index == NET_STATS_SEM ? &lwip_stats.sys.sem : &lwip_stats.sys.mutex;
+
+        snprintf(line, size, "%s SYS used=%d max=%d err=%d", index == NET_STATS_SEM ? "sem" : "mutex", elem->used, elem->max, elem->err);
+    }
+    else if(index == NET_STATS_HEAP)
+    {
+        snprintf(line, size, "heap RTOS num=%d used=%d max=%d", (int)configTOTAL_HEAP_SIZE, (int)(configTOTAL_HEAP_SIZE - xPortGetFreeHeapSize()),
+                 (int)(configTOTAL_HEAP_SIZE - xPortGetMinimumEverFreeHeapSize()));
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void NetStatsPrint(void)
+{
+    char line[NET_STATS_LINE_SIZE];
+
+    for(uint16_t i = 0; NetStatsLine(i, line, sizeof(line)); i++)
+    {
+        xprintf("%s\n", line);
+    }
+}
+
+// Restart the high-water marks from the current usage and zero the failure
+// counts. The FreeRTOS heap minimum cannot be reset.
+void NetStatsClear(void)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+    sys_mbox_stats_t fill;
+
+    SYS_ARCH_PROTECT(lev);
+
+    lwip_stats.mem.max = lwip_stats.mem.used;
+    lwip_stats.mem.err = 0;
+
+    for(uint16_t i = 0; i < MEMP_MAX; i++)
+    {
+        lwip_stats.memp[i].max = lwip_stats.memp[i].used;
+        lwip_stats.memp[i].err = 0;
+    }
+
+    lwip_stats.sys.sem.max   = lwip_stats.sys.sem.used;
+    lwip_stats.sys.sem.err   = 0;
+    lwip_stats.sys.mutex.max = lwip_stats.sys.mutex.used;
+    lwip_stats.sys.mutex.err = 0;
+    lwip_stats.sys.mbox.max  = lwip_stats.sys.mbox.used;
+    lwip_stats.sys.mbox.err  = 0;
+
+    SYS_ARCH_UNPROTECT(lev);
+
+    sys_arch_mbox_stats(&fill, 1);
+}
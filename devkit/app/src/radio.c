@@ -11,10 +11,17 @@
 #include "core_cmInstr.h"
 #include "led.h"
 #include "tcpecho.h"
+#include "time_sync.h"
+#include "time_beacon.h"
 #include "fw_update.h"
 #include "app_header.h"
 #include "sunflower_app_header.h"
 #include "crc.h"
+#include "snmp_agent.h"
+#include <string.h>
+
+// TIM2 counts microseconds, free-running: a 32-bit capture wraps after ~71 minutes
+#define US_COUNTER              (TIM2->CNT)
 
 // Global variables
 osMessageQId radioTxMsgQ;
@@ -28,13 +35,28 @@ tRadioConfiguration*    pRadioConfiguration                 = &RadioConfiguratio
 uint8_t customRadioPacket[RADIO_MAX_PACKET_LENGTH];
 
 // Local variables
-static uint8_t          rxBuff[RADIO_MAX_PACKET_LENGTH];
+static RadioFrame       rxFrame;
+
+// Microsecond counter at each NIRQ edge, taken by the EXTI handler, one per
+// RADIO_IRQ_DETECTED message on radioWakeupMsgQ (which never holds more)
+static volatile uint32_t irqCaptures[RADIO_MSG_QUEUE_SIZE];
+static volatile uint8_t  irqCaptureHead;
+static uint8_t           irqCaptureTail;
+
+// Capture of the last sync word interrupt, until its frame is read
+static uint32_t         syncCapture;
+static bool             syncPending;
 
 static NetworkMember_t  networkTable[MAX_NETWORK_MEMBERS];
+static uint32_t         networkUsed[MAX_NETWORK_MEMBERS / 32];     // One bit per occupied networkTable slot
+static uint16_t         networkCount;
+
+STATIC_ASSERT(MAX_NETWORK_MEMBERS % 32 == 0);
 
 static RadioTaskState radioTaskState = CONNECTED;
 static NetworkInfo    network;
 static SensorData     sensorData;
+static RadioStats     stats;
 
 // Local function prototypes
 static uint8_t    SendRadioConfig(void);
@@ -44,6 +66,11 @@ static void       SignalRadioTXNeeded(void);
 static SensorData ParseSensorMessage(uint8_t* radioMessage);
 static void       AddDevice(uint32_t mac);
 static void       RemoveDevice(uint32_t mac);
+static int32_t    FindDevice(uint32_t mac);
+static int32_t    NextSlot(uint16_t position, bool used);
+static void       RecordPacket(uint32_t mac);
+static void       RecordReport(uint32_t mac, uint32_t timestamp, uint32_t capture);
+static void       RecordLatency(uint32_t us);
 
 // Global function implementations
 void RadioTaskOSInit(void)
@@ -81,6 +108,7 @@ void RadioTaskHwInit(void)
 {   
     GPIO_InitTypeDef    GPIO_InitStructure;
     EXTI_InitTypeDef    EXTI_InitStructure;
+    RCC_ClocksTypeDef   clocks;
     
     SPIn_SCK_GPIO_CLK_ENABLE();
     SPIn_MISO_GPIO_CLK_ENABLE();
@@ -132,6 +160,16 @@ void RadioTaskHwInit(void)
     EXTI_InitStructure.EXTI_LineCmd = ENABLE;
     EXTI_Init(&EXTI_InitStructure);
     
+    // Free-running microsecond counter for the NIRQ captures. APB1 timers run
+    // at twice PCLK1 when APB1 is divided.
+    RCC_GetClocksFreq(&clocks);
+    
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+    TIM2->PSC = ((RCC->CFGR & RCC_CFGR_PPRE1_2) ? clocks.PCLK1_Frequency * 2 : clocks.PCLK1_Frequency) / 1000000 - 1;
+    TIM2->ARR = 0xFFFFFFFF;
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CR1 = TIM_CR1_CEN;
+    
     // De-select all SPI devices
     GPIO_SetBits(SPIn_NSS_GPIO_PORT, SPIn_NSS_PIN);
 }
@@ -158,10 +196,18 @@ void RadioTask(void)
             if(Si446xCmd.PART_INFO.PART != 0x4463)
             {
                 ERR("Radio did not return correct part number!\n");
+                stats.reinits++;
+                SnmpAgentRaiseTrap(SNMP_AGENT_TRAP_RADIO_REINIT);
             }
             else
             {
                 radioConfigured = 1;
+                
+                // Interrupt on the sync word too: its capture is the frame's arrival
+                si446x_set_property(SI446X_PROP_GRP_ID_INT_CTL, 3, SI446X_PROP_GRP_INDEX_INT_CTL_ENABLE,
+                                    SI446X_PROP_INT_CTL_ENABLE_PH_INT_STATUS_EN_BIT | SI446X_PROP_INT_CTL_ENABLE_MODEM_INT_STATUS_EN_BIT,
+                                    PACKET_SENT | PACKET_RX | CRC_ERROR,
+                                    SI446X_PROP_INT_CTL_MODEM_ENABLE_SYNC_DETECT_EN_BIT);
             }
         }
         else
@@ -174,6 +220,8 @@ void RadioTask(void)
             // TODO: do something else if Radio config fails
             // assert_param(0);
             ERR("Radio configuration failed! Retrying in 2 seconds...\n");
+            stats.reinits++;
+            SnmpAgentRaiseTrap(SNMP_AGENT_TRAP_RADIO_REINIT);
             osDelay(2000);
         }
     }
@@ -197,7 +245,7 @@ void RadioTask(void)
         {
             if(msgQueueEvent.value.v == RADIO_IRQ_DETECTED)
             {
-                RadioTaskHandleIRQ();
+                RadioTaskHandleIRQ(irqCaptures[irqCaptureTail++ % RADIO_MSG_QUEUE_SIZE]);
             }
             else if(msgQueueEvent.value.v == RADIO_TX_NEEDED)
             {
@@ -211,8 +259,12 @@ void RadioTask(void)
                     ((generic_message_t*)(msg->pData))->dst = msg->dest;
                     ((generic_message_t*)(msg->pData))->src = RadioGetMACAddress();
                     
+                    // Last thing before the radio: beacons carry the time they go out at
+                    TimeBeaconStamp(msg->pData, msg->size, US_COUNTER);
+                    
                     // Transmit the packet to the radio hardware
                     Radio_StartTx_Variable_Packet(pRadioConfiguration->Radio_ChannelNumber, msg->pData, msg->size);
+                    stats.txPackets++;
                     
                     // Free the data
                     vPortFree(msg->pData);
@@ -283,12 +335,19 @@ uint8_t SendRadioConfig(void)
     return retVal;
 }
 
+// EXTI handler: first thing, take the microsecond counter for the frame the
+// interrupt is about
 void SignalRadioIRQ(void)
 {
+    irqCaptures[irqCaptureHead % RADIO_MSG_QUEUE_SIZE] = US_COUNTER;
+    
     // Wakeup the radio task by putting a message on it's "wakeup" queue.
     // TODO: Check that this actually succeeded, and don't block forever.
     //       Might need to return a status to indicate to calling function that we failed to send message
-    osMessagePut(radioWakeupMsgQ, RADIO_IRQ_DETECTED, osWaitForever);
+    if(osMessagePut(radioWakeupMsgQ, RADIO_IRQ_DETECTED, osWaitForever) == osOK)
+    {
+        irqCaptureHead++;
+    }
 }
 
 void SignalRadioTXNeeded(void)
@@ -332,7 +391,9 @@ void Radio_StartRX(uint8_t channel)
                   SI446X_CMD_START_RX_ARG_NEXT_STATE3_RXINVALID_STATE_ENUM_RX );
 }
 
-void RadioTaskHandleIRQ(void)
+// <capture> is the microsecond counter at the NIRQ edge: the time of the
+// earliest of the interrupts it reports
+void RadioTaskHandleIRQ(uint32_t capture)
 {
     uint8_t phInt = 0;
     uint8_t chipInt = 0;
@@ -348,11 +409,19 @@ void RadioTaskHandleIRQ(void)
     
     DEBUG("phInt: %x, chipInt: %x, modemInt: %x\n", phInt, chipInt, modemInt);
     
+    // SYNC_DETECT: a frame is coming in
+    if(modemInt & SI446X_CMD_GET_INT_STATUS_REP_MODEM_STATUS_SYNC_DETECT_BIT)
+    {
+        syncCapture = capture;
+        syncPending = true;
+    }
+    
     // PACKET_SENT
     if(phInt & PACKET_SENT)
     {
         // TODO: Packet was transmitted, move to the "wait for ACK" state
         DEBUG("Packet TX completed event\n");
+        TimeBeaconSent(capture);
     }
     
     // PACKET_RX
@@ -361,9 +430,15 @@ void RadioTaskHandleIRQ(void)
         BlinkLed3();
         DEBUG("Radio RX Event\n");
         
-        si446x_read_rx_fifo(RadioConfiguration.Radio_PacketLength, rxBuff);
+        si446x_read_rx_fifo(RadioConfiguration.Radio_PacketLength, rxFrame.data);
+        stats.rxPackets++;
+        
+        // Without its sync word interrupt, the RX one is the next best thing
+        rxFrame.capture = syncPending ? syncCapture : capture;
+        stats.noSync += syncPending ? 0 : 1;
+        syncPending = false;
         
-        generic_message_t* message = (generic_message_t*)rxBuff;
+        generic_message_t* message = (generic_message_t*)rxFrame.data;
         generic_message_t* generic_msg;
         
         if(message->dst == RadioGetMACAddress() || message->dst == 0xFFFFFFFF)
@@ -402,7 +477,13 @@ void RadioTaskHandleIRQ(void)
                         DEBUG("MOISTURE SENSOR READING OUT OF RANGE. CHECK SENSOR ENVIRONMENT\n");
                     }*/
                     
-                    message->payload.sensor_message.timestamp = GetUnixTime();
+                    // The node's own timestamp, before it is replaced with the arrival time
+                    RecordReport(message->src, message->payload.sensor_message.timestamp, rxFrame.capture);
+                    
+                    // Stamped with the sync word, not with however long the task took to get here
+                    message->payload.sensor_message.timestamp = (uint32_t)(RadioCaptureToMs(rxFrame.capture) / 1000);
+                    stats.sensorReports++;
+                    RecordLatency(US_COUNTER - rxFrame.capture);
                     
                     // Pass the message to the tcpecho task
                     EnqueueSensorTCP(message);
@@ -428,6 +509,7 @@ void RadioTaskHandleIRQ(void)
                 
                 case ANNOUNCE:
                     DEBUG("Announce received from 0x%08x\n", message->src);
+                    stats.announces++;
                     generic_msg = pvPortMalloc(sizeof(generic_message_t));
                 
                     // TODO: check we didn't run out of RAM (we should catch this in the 
@@ -451,12 +533,17 @@ void RadioTaskHandleIRQ(void)
                     break;
             }
         }
+        
+        // After the switch, so a node's ANNOUNCE already counts against its new slot
+        RecordPacket(message->src);
     }
     
     // CRC_ERROR
     if(phInt & CRC_ERROR)
     {
         DEBUG("Radio CRC error Event\n");
+        stats.crcErrors++;
+        syncPending = false;
         // TODO: Recevied a garbled packet. Reply with a NAK
     }
      
@@ -466,7 +553,6 @@ void RadioTaskHandleIRQ(void)
     //  CMD_ERROR
     //  FIFO_UNDERFLOW_OVERFLOW_ERROR
     //  FILTER_MATCH 
-    //  SYNC_DETECT
     //  PREAMBLE_DETECT
     //  RSSI
     //  RSSI_JUMP
@@ -484,30 +570,136 @@ uint32_t RadioGetMACAddress(void)
 
 void AddDevice(uint32_t mac)
 {
-    for(uint32_t i = 0; i < MAX_NETWORK_MEMBERS; i++)
+    int32_t slot = FindDevice(mac);
+    
+    // A node announcing again keeps its slot and counters
+    if(slot >= 0)
+    {
+        return;
+    }
+    
+    slot = NextSlot(0, false);
+    
+    if(slot < 0)
+    {
+        // TODO: if table insertion failed, throw an error or debug
+        return;
+    }
+    
+    // The SNMP agent reads slots from its own thread: fill the slot before marking it used
+    memset(&networkTable[slot], 0, sizeof(NetworkMember_t));
+    networkTable[slot].mac_address = mac;
+    TimeBeaconResetNode(slot);
+    networkUsed[slot / 32] |= 1UL << (slot % 32);
+    networkCount++;
+}
+
+void RemoveDevice(uint32_t mac)
+{
+    int32_t slot = FindDevice(mac);
+    
+    if(slot < 0)
     {
-        if(networkTable[i].mac_address == 0x00000000)
+        // TODO: if table insertion failed, throw an error or debug
+        return;
+    }
+    
+    networkUsed[slot / 32] &= ~(1UL << (slot % 32));
+    networkTable[slot].mac_address = 0x00000000;
+    networkCount--;
+}
+
+// Slot holding <mac>, or -1. Only occupied slots are compared.
+int32_t FindDevice(uint32_t mac)
+{
+    int32_t slot = NextSlot(0, true);
+    
+    while(slot >= 0)
+    {
+        if(networkTable[slot].mac_address == mac)
         {
-            networkTable[i].mac_address = mac;
-            return;
+            return slot;
         }
+        
+        slot = NextSlot(slot + 1, true);
     }
     
-    // TODO: if table insertion failed, throw an error or debug
+    return -1;
 }
 
-void RemoveDevice(uint32_t mac)
+// First slot at or after <position> that is occupied (used = true) or free (used = false), or -1.
+// Scans the bitmap a word at a time: at most MAX_NETWORK_MEMBERS / 32 words whatever the table holds.
+int32_t NextSlot(uint16_t position, bool used)
 {
-    for(uint32_t i = 0; i < MAX_NETWORK_MEMBERS; i++)
+    uint32_t word;
+    uint16_t index = position / 32;
+    
+    if(position >= MAX_NETWORK_MEMBERS)
+    {
+        return -1;
+    }
+    
+    word = (used ? networkUsed[index] : ~networkUsed[index]) & (0xFFFFFFFFUL << (position % 32));
+    
+    while(word == 0)
     {
-        if(networkTable[i].mac_address == mac)
+        if(++index >= MAX_NETWORK_MEMBERS / 32)
         {
-            networkTable[i].mac_address = 0x00000000;
-            return;
+            return -1;
         }
+        
+        word = used ? networkUsed[index] : ~networkUsed[index];
+    }
+    
+    // Count trailing zeros: lowest set bit
+    return index * 32 + __CLZ(__RBIT(word));
+}
+
+// Per node counters for a packet received from <mac>, if it is in the network table
+void RecordPacket(uint32_t mac)
+{
+    int32_t slot = FindDevice(mac);
+    
+    if(slot < 0)
+    {
+        return;
+    }
+    
+    // LATCH_RSSI was latched when the preamble was detected (MODEM_RSSI_CONTROL)
+    si446x_get_modem_status(0xFF);
+    
+    networkTable[slot].lastHeard = xTaskGetTickCount();
+    networkTable[slot].rxPackets++;
+    networkTable[slot].latchRssi = Si446xCmd.GET_MODEM_STATUS.LATCH_RSSI;
+}
+
+// Clock offset and drift of <mac> from the timestamp of a report that arrived at <capture>
+void RecordReport(uint32_t mac, uint32_t timestamp, uint32_t capture)
+{
+    int32_t slot = FindDevice(mac);
+    
+    if(slot < 0)
+    {
+        return;
+    }
+    
+    TimeBeaconRecordReport(slot, timestamp, RadioCaptureToMs(capture));
+}
+
+void RecordLatency(uint32_t us)
+{
+    RadioLatency* latency = &stats.dispatch;
+    uint8_t       bucket = 0;
+    
+    while(bucket < RADIO_LATENCY_BUCKETS - 1 && us >= RADIO_LATENCY_BUCKET_US(bucket))
+    {
+        bucket++;
     }
     
-    // TODO: if table insertion failed, throw an error or debug
+    latency->buckets[bucket]++;
+    latency->count++;
+    latency->sumUs += us;
+    latency->maxUs = us > latency->maxUs ? us : latency->maxUs;
 }
 
 void RadioPrintConnectedDevices(void)
@@ -531,6 +723,110 @@ uint32_t RadioGetDeviceMAC(uint16_t position)
     return 0x00000000;
 }
 
+// First occupied network table slot at or after <position>, or -1 past the last one
+int32_t RadioNextDevice(uint16_t position)
+{
+    return NextSlot(position, true);
+}
+
+// Consistent copy of network table slot <position>. Returns false if the slot is free.
+bool RadioGetDevice(uint16_t position, NetworkMember_t* out)
+{
+    if(position >= MAX_NETWORK_MEMBERS)
+    {
+        return false;
+    }
+    
+    taskENTER_CRITICAL();
+    memcpy(out, &networkTable[position], sizeof(NetworkMember_t));
+    taskEXIT_CRITICAL();
+    
+    return out->mac_address != 0x00000000;
+}
+
+uint16_t RadioDeviceCount(void)
+{
+    return networkCount;
+}
+
+void RadioGetStats(RadioStats* out)
+{
+    memcpy(out, &stats, sizeof(RadioStats));
+}
+
+void RadioPrintStats(void)
+{
+    RadioStats    s;
+    RadioLatency* latency = &s.dispatch;
+    
+    RadioGetStats(&s);
+    
+    xprintf("RX packets: %u, CRC errors: %u, without sync capture: %u\n", s.rxPackets, s.crcErrors, s.noSync);
+    xprintf("Sensor reports: %u, announces: %u, TX packets: %u, reinits: %u\n", s.sensorReports, s.announces,
+            s.txPackets, s.reinits);
+    
+    if(latency->count == 0)
+    {
+        return;
+    }
+    
+    xprintf("Sync word to dispatch: mean %u us, p50 < %u us, p99 < %u us, max %u us\n",
+            (uint32_t)(latency->sumUs / latency->count), RadioLatencyPercentile(latency, 50),
+            RadioLatencyPercentile(latency, 99), latency->maxUs);
+    
+    for(uint8_t i = 0; i < RADIO_LATENCY_BUCKETS; i++)
+    {
+        if(latency->buckets[i] == 0)
+        {
+            continue;
+        }
+        
+        if(i < RADIO_LATENCY_BUCKETS - 1)
+        {
+            xprintf("  < %6u us: %u\n", RADIO_LATENCY_BUCKET_US(i), latency->buckets[i]);
+        }
+        else
+        {
+            xprintf("  >= %5u us: %u\n", RADIO_LATENCY_BUCKET_US(i - 1), latency->buckets[i]);
+        }
+    }
+}
+
+// Upper bound of the bucket holding the <percent>th percentile; the maximum
+// for the last bucket, 0 without samples
+uint32_t RadioLatencyPercentile(const RadioLatency* latency, uint8_t percent)
+{
+    uint32_t rank = (uint32_t)(((uint64_t)latency->count * percent + 99) / 100);
+    uint32_t seen = 0;
+    
+    if(latency->count == 0)
+    {
+        return 0;
+    }
+    
+    for(uint8_t i = 0; i < RADIO_LATENCY_BUCKETS - 1; i++)
+    {
+        seen += latency->buckets[i];
+        
+        if(seen >= rank)
+        {
+            return RADIO_LATENCY_BUCKET_US(i);
+        }
+    }
+    
+    return latency->maxUs;
+}
+
+// Wall time in ms of microsecond counter capture <capture> (less than ~71
+// minutes old), 0 until the clock is set
+uint64_t RadioCaptureToMs(uint32_t capture)
+{
+    uint32_t agoMs = (US_COUNTER - capture) / 1000;
+    uint64_t now = TimeSyncNowMs();
+    
+    return now > agoMs ? now - agoMs : 0;
+}
+
 void TransmitFwUpdate(void)
 {
     // Abort update if image fails verification
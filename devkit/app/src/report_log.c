@@ -0,0 +1,556 @@
+#include "report_log.h"
+#include "stm32f4xx_flash.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "crc.h"
+#include "debug.h"
+#include "xprintf.h"
+#include <string.h>
+
+#define REPORT_LOG_IDLE_TIMEOUT     1000
+#define FLASH_ERASED_WORD           0xFFFFFFFF
+
+// The writer queue must absorb the reports that arrive while a sector is erased
+STATIC_ASSERT(REPORT_LOG_QUEUE_SIZE >= 16);
+STATIC_ASSERT(sizeof(REPORT_LOG_RECORD) % 4 == 0);
+STATIC_ASSERT(sizeof(REPORT_LOG_SECTOR_HEADER) % 4 == 0);
+
+typedef struct REPORT_LOG_SECTOR_T {
+    uint32_t address;
+    uint16_t flash_sector;
+} REPORT_LOG_SECTOR;
+
+static const REPORT_LOG_SECTOR logSectors[REPORT_LOG_NUM_SECTORS] = {
+    { 0x08004000, FLASH_Sector_1 },
+    { 0x08008000, FLASH_Sector_2 },
+    { 0x0800C000, FLASH_Sector_3 },
+};
+
+osMessageQId reportLogQ;
+
+static osMutexId        logMutex;
+static bool             sectorValid[REPORT_LOG_NUM_SECTORS];
+static bool             sectorErased[REPORT_LOG_NUM_SECTORS];
+static uint8_t          headSector;
+static uint32_t         headUsed;       // Record slots used in the head sector
+static uint32_t         headAckSlots;   // Ack slots used in the head sector
+static uint32_t         nextSeq;
+static uint32_t         ackSeq;         // Everything up to and including ackSeq has been acknowledged
+static REPORT_LOG_STATS stats;
+
+// Local function prototypes
+static void                       Mount(void);
+static REPORT_LOG_SECTOR_HEADER*  Header(uint8_t sector);
+static REPORT_LOG_RECORD*         Slot(uint8_t sector, uint32_t slot);
+static bool                       HeaderValid(uint8_t sector);
+static uint32_t                   CountUsedWords(volatile uint32_t* first, uint32_t stride, uint32_t count);
+static uint32_t                   SectorLastSeq(uint8_t sector);
+static int8_t                     OldestSector(void);
+static bool                       ProgramWords(uint32_t address, const uint32_t* words, uint32_t count);
+static bool                       EraseSector(uint8_t sector);
+static bool                       StartSector(uint8_t sector);
+static void                       Rotate(void);
+static void                       Reclaim(void);
+static uint32_t                   RecordCRC(uint32_t seq, generic_message_t* report);
+static void                       WriteRecord(generic_message_t* report);
+
+// Global function implementations
+void ReportLogOSInit(void)
+{
+    osMessageQDef(ReportLogQueue, REPORT_LOG_QUEUE_SIZE, generic_message_t*);
+    osMutexDef(ReportLogMutex);
+
+    reportLogQ = osMessageCreate(osMessageQ(ReportLogQueue), NULL);
+    logMutex = osMutexCreate(osMutex(ReportLogMutex));
+
+    assert_param(reportLogQ != NULL);
+    assert_param(logMutex != NULL);
+
+    Mount();
+}
+
+void ReportLogTask(void)
+{
+    osEvent             msgQueueEvent;
+    generic_message_t*  report;
+
+    while(1)
+    {
+        msgQueueEvent = osMessageGet(reportLogQ, REPORT_LOG_IDLE_TIMEOUT);
+
+        if(msgQueueEvent.status == osEventMessage)
+        {
+            report = (generic_message_t*)(msgQueueEvent.value.p);
+
+            osMutexWait(logMutex, osWaitForever);
+            WriteRecord(report);
+            osMutexRelease(logMutex);
+
+            vPortFree(report);
+        }
+        else
+        {
+            // Nothing to write: give back any sectors the clients have acknowledged
+            // so the next rotation doesn't have to stall on an erase
+            osMutexWait(logMutex, osWaitForever);
+            Reclaim();
+            osMutexRelease(logMutex);
+        }
+    }
+}
+
+// Queue a copy of a report for the writer task. Never blocks: the radio task calls this.
+// Caller keeps ownership of the input pointer.
+bool ReportLogAppend(generic_message_t* report)
+{
+    generic_message_t* copy = pvPortMalloc(sizeof(generic_message_t));
+
+    if(copy == NULL)
+    {
+        stats.dropped++;
+        return false;
+    }
+
+    memcpy(copy, report, sizeof(generic_message_t));
+
+    if(osMessagePut(reportLogQ, (uint32_t)copy, 0) != osOK)
+    {
+        vPortFree(copy);
+        stats.dropped++;
+        return false;
+    }
+
+    return true;
+}
+
+// Copy report 'seq' out of the log. Returns false if it was reclaimed, never written or is corrupt.
+bool ReportLogRead(uint32_t seq, generic_message_t* report)
+{
+    bool found = false;
+
+    osMutexWait(logMutex, osWaitForever);
+
+    for(uint8_t i = 0; i < REPORT_LOG_NUM_SECTORS && seq < nextSeq; i++)
+    {
+        if(!sectorValid[i])
+        {
+            continue;
+        }
+
+        uint32_t first = Header(i)->first_seq;
+
+        if(seq >= first && seq - first < REPORT_LOG_RECORDS_PER_SECTOR)
+        {
+            REPORT_LOG_RECORD* rec = Slot(i, seq - first);
+
+            if(rec->seq == seq && rec->crc32 == RecordCRC(seq, &rec->report))
+            {
+                memcpy(report, &rec->report, sizeof(generic_message_t));
+                found = true;
+            }
+            else
+            {
+                stats.crc_errors++;
+            }
+            break;
+        }
+    }
+
+    osMutexRelease(logMutex);
+
+    return found;
+}
+
+// Acknowledge every report up to and including 'seq'
+void ReportLogAck(uint32_t seq)
+{
+    osMutexWait(logMutex, osWaitForever);
+
+    if(seq >= nextSeq)
+    {
+        seq = nextSeq - 1;
+    }
+
+    if(seq > ackSeq)
+    {
+        ackSeq = seq;
+
+        if(sectorValid[headSector] && headAckSlots < REPORT_LOG_ACK_SLOTS)
+        {
+            uint32_t address = (uint32_t)&Header(headSector)->ack_seq[headAckSlots];
+
+            if(ProgramWords(address, &ackSeq, 1))
+            {
+                headAckSlots++;
+            }
+            else
+            {
+                stats.write_errors++;
+            }
+        }
+        else
+        {
+            // Kept in RAM until the next rotation writes it into the new header.
+            // A reboot before then replays these reports: clients dedupe by sequence number.
+            stats.unsaved_acks++;
+        }
+    }
+
+    osMutexRelease(logMutex);
+}
+
+uint32_t ReportLogFirstUnacked(void)
+{
+    uint32_t first;
+    int8_t   oldest;
+
+    osMutexWait(logMutex, osWaitForever);
+
+    first = ackSeq + 1;
+    oldest = OldestSector();
+
+    if(oldest >= 0 && first < Header(oldest)->first_seq)
+    {
+        first = Header(oldest)->first_seq;
+    }
+
+    osMutexRelease(logMutex);
+
+    return first;
+}
+
+uint32_t ReportLogNextSeq(void)
+{
+    return nextSeq;
+}
+
+// Reports queued for the writer task, at most REPORT_LOG_QUEUE_SIZE
+uint16_t ReportLogQueueDepth(void)
+{
+    return (uint16_t)uxQueueMessagesWaiting(reportLogQ);
+}
+
+void ReportLogGetStats(REPORT_LOG_STATS* out)
+{
+    memcpy(out, &stats, sizeof(REPORT_LOG_STATS));
+}
+
+void ReportLogPrintStatus(void)
+{
+    xprintf("Report log: next seq %d, acked %d, %d records/sector\n", nextSeq, ackSeq, REPORT_LOG_RECORDS_PER_SECTOR);
+
+    for(uint8_t i = 0; i < REPORT_LOG_NUM_SECTORS; i++)
+    {
+        if(sectorValid[i])
+        {
+            xprintf("[%d] first seq %d, erased %d times%s\n", i, Header(i)->first_seq, Header(i)->erase_count, i == headSector ? " (head)" : "");
+        }
+        else
+        {
+            xprintf("[%d] %s\n", i, sectorErased[i] ? "free" : "invalid");
+        }
+    }
+
+    xprintf("Appended: %d, dropped: %d, overwritten: %d\n", stats.appended, stats.dropped, stats.overwritten);
+    xprintf("Write errors: %d, CRC errors: %d, erases: %d, unsaved acks: %d\n", stats.write_errors, stats.crc_errors, stats.erases, stats.unsaved_acks);
+}
+
+// Local function implementations
+
+// Rebuild the RAM state from flash. Only the sector headers are read, plus two
+// binary searches in the head sector to find the write pointer and the last ack.
+void Mount(void)
+{
+    int8_t head = -1;
+
+    for(uint8_t i = 0; i < REPORT_LOG_NUM_SECTORS; i++)
+    {
+        sectorValid[i] = HeaderValid(i);
+        sectorErased[i] = false;
+
+        if(sectorValid[i] && (head < 0 || Header(i)->first_seq > Header(head)->first_seq))
+        {
+            head = i;
+        }
+    }
+
+    if(head < 0)
+    {
+        INFO("Report log is empty, formatting\n");
+
+        nextSeq = 1;
+        ackSeq = 0;
+        headSector = 0;
+        StartSector(0);
+        return;
+    }
+
+    headSector = head;
+    headUsed = CountUsedWords(&Slot(head, 0)->seq, sizeof(REPORT_LOG_RECORD) / 4, REPORT_LOG_RECORDS_PER_SECTOR);
+    headAckSlots = CountUsedWords(&Header(head)->ack_seq[0], 1, REPORT_LOG_ACK_SLOTS);
+    nextSeq = Header(head)->first_seq + headUsed;
+    ackSeq = headAckSlots > 0 ? Header(head)->ack_seq[headAckSlots - 1] : 0;
+
+    if(ackSeq >= nextSeq)
+    {
+        ackSeq = nextSeq - 1;
+    }
+
+    INFO("Report log mounted: next seq %d, acked %d\n", nextSeq, ackSeq);
+}
+
+REPORT_LOG_SECTOR_HEADER* Header(uint8_t sector)
+{
+    return (REPORT_LOG_SECTOR_HEADER*)logSectors[sector].address;
+}
+
+REPORT_LOG_RECORD* Slot(uint8_t sector, uint32_t slot)
+{
+    return (REPORT_LOG_RECORD*)(logSectors[sector].address + REPORT_LOG_HEADER_SIZE + slot * sizeof(REPORT_LOG_RECORD));
+}
+
+bool HeaderValid(uint8_t sector)
+{
+    REPORT_LOG_SECTOR_HEADER* hdr = Header(sector);
+
+    return hdr->magic == REPORT_LOG_SECTOR_MAGIC && hdr->crc32 == crc32(0x00000000, (uint8_t*)hdr, 3 * sizeof(uint32_t));
+}
+
+// Words are written in order, so the used ones form a prefix: binary search for its length
+uint32_t CountUsedWords(volatile uint32_t* first, uint32_t stride, uint32_t count)
+{
+    uint32_t lo = 0;
+    uint32_t hi = count;
+
+    while(lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if(first[mid * stride] != FLASH_ERASED_WORD)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Sequence number of the last record that can be held in a valid sector
+uint32_t SectorLastSeq(uint8_t sector)
+{
+    uint32_t first = Header(sector)->first_seq;
+    uint32_t last  = nextSeq - 1;
+
+    for(uint8_t i = 0; i < REPORT_LOG_NUM_SECTORS; i++)
+    {
+        if(sectorValid[i] && Header(i)->first_seq > first && Header(i)->first_seq - 1 < last)
+        {
+            last = Header(i)->first_seq - 1;
+        }
+    }
+
+    return last;
+}
+
+int8_t OldestSector(void)
+{
+    int8_t oldest = -1;
+
+    for(uint8_t i = 0; i < REPORT_LOG_NUM_SECTORS; i++)
+    {
+        if(sectorValid[i] && (oldest < 0 || Header(i)->first_seq < Header(oldest)->first_seq))
+        {
+            oldest = i;
+        }
+    }
+
+    return oldest;
+}
+
+// The firmware update path may have the flash unlocked: only re-lock it if we unlocked it.
+// The scheduler is suspended so no other task can change the lock state underneath us.
+bool ProgramWords(uint32_t address, const uint32_t* words, uint32_t count)
+{
+    bool ok = true;
+    bool was_locked;
+
+    vTaskSuspendAll();
+
+    was_locked = (FLASH->CR & FLASH_CR_LOCK) != 0;
+    if(was_locked)
+    {
+        FLASH_Unlock();
+    }
+
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+
+    for(uint32_t i = 0; i < count && ok; i++)
+    {
+        ok = FLASH_ProgramWord(address + (i * 4), words[i]) == FLASH_COMPLETE;
+    }
+
+    if(was_locked)
+    {
+        FLASH_Lock();
+    }
+
+    xTaskResumeAll();
+
+    return ok;
+}
+
+bool EraseSector(uint8_t sector)
+{
+    bool ok;
+    bool was_locked;
+
+    vTaskSuspendAll();
+
+    was_locked = (FLASH->CR & FLASH_CR_LOCK) != 0;
+    if(was_locked)
+    {
+        FLASH_Unlock();
+    }
+
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+    ok = FLASH_EraseSector(logSectors[sector].flash_sector, VoltageRange_3) == FLASH_COMPLETE;
+
+    if(was_locked)
+    {
+        FLASH_Lock();
+    }
+
+    xTaskResumeAll();
+
+    stats.erases++;
+    sectorValid[sector] = false;
+    sectorErased[sector] = ok;
+
+    return ok;
+}
+
+// Erase (if needed) and stamp a sector as the new head, starting at nextSeq
+bool StartSector(uint8_t sector)
+{
+    uint32_t erase_count = sectorValid[sector] ? Header(sector)->erase_count + 1 : 1;
+    uint32_t hdr[4];
+
+    if(!sectorErased[sector] && !EraseSector(sector))
+    {
+        stats.write_errors++;
+        return false;
+    }
+
+    hdr[0] = REPORT_LOG_SECTOR_MAGIC;
+    hdr[1] = nextSeq;
+    hdr[2] = erase_count;
+    hdr[3] = crc32(0x00000000, (uint8_t*)hdr, 3 * sizeof(uint32_t));
+
+    // The ack table goes first: a header is only valid once its CRC word lands,
+    // so a reset part way through leaves a sector that is simply ignored at mount
+    if(!ProgramWords((uint32_t)&Header(sector)->ack_seq[0], &ackSeq, 1) ||
+       !ProgramWords(logSectors[sector].address, hdr, 4))
+    {
+        stats.write_errors++;
+        return false;
+    }
+
+    sectorValid[sector] = true;
+    sectorErased[sector] = false;
+    headSector = sector;
+    headUsed = 0;
+    headAckSlots = 1;
+
+    return true;
+}
+
+// The head sector is full: move on to the next one, which holds the oldest records
+void Rotate(void)
+{
+    uint8_t next = (headSector + 1) % REPORT_LOG_NUM_SECTORS;
+
+    if(sectorValid[next])
+    {
+        uint32_t last = SectorLastSeq(next);
+
+        if(last > ackSeq)
+        {
+            WARN("Report log full: dropping %d unacknowledged reports\n", last - ackSeq);
+            stats.overwritten += last - ackSeq;
+            ackSeq = last;
+        }
+    }
+
+    StartSector(next);
+}
+
+// Erase the oldest sectors once every record in them has been acknowledged
+void Reclaim(void)
+{
+    int8_t oldest = OldestSector();
+
+    while(oldest >= 0 && oldest != headSector && SectorLastSeq(oldest) <= ackSeq)
+    {
+        EraseSector(oldest);
+        oldest = OldestSector();
+    }
+
+    // Pre-erase the sector the next rotation will use if it is still dirty
+    // from a previous run (invalid header, so it holds nothing we can read)
+    uint8_t next = (headSector + 1) % REPORT_LOG_NUM_SECTORS;
+    if(!sectorValid[next] && !sectorErased[next])
+    {
+        EraseSector(next);
+    }
+}
+
+uint32_t RecordCRC(uint32_t seq, generic_message_t* report)
+{
+    uint32_t crc = crc32(0x00000000, (uint8_t*)&seq, sizeof(uint32_t));
+
+    return crc32(crc, (uint8_t*)report, sizeof(generic_message_t));
+}
+
+void WriteRecord(generic_message_t* report)
+{
+    REPORT_LOG_RECORD  rec;
+    REPORT_LOG_RECORD* slot;
+
+    if(!sectorValid[headSector] || headUsed >= REPORT_LOG_RECORDS_PER_SECTOR)
+    {
+        Rotate();
+
+        // The next sector could not be started: the head is still the full one
+        if(!sectorValid[headSector] || headUsed >= REPORT_LOG_RECORDS_PER_SECTOR)
+        {
+            stats.dropped++;
+            return;
+        }
+    }
+
+    slot = Slot(headSector, headUsed);
+
+    rec.seq = nextSeq;
+    memcpy(&rec.report, report, sizeof(generic_message_t));
+    rec.crc32 = RecordCRC(rec.seq, &rec.report);
+
+    // Sequence numbers map 1:1 onto slots, so a slot that fails to program is
+    // consumed anyway and shows up as a CRC error when it is read back
+    headUsed++;
+    nextSeq++;
+
+    if(ProgramWords((uint32_t)slot, (uint32_t*)&rec, sizeof(REPORT_LOG_RECORD) / 4))
+    {
+        stats.appended++;
+    }
+    else
+    {
+        stats.write_errors++;
+    }
+}
@@ -0,0 +1,584 @@
+#include "snmp_agent.h"
+#include "radio.h"
+#include "report_log.h"
+#include "telemetry.h"
+#include "net_stats.h"
+#include "dwt.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "debug.h"
+#include "xprintf.h"
+#include "lwip/apps/snmp.h"
+#include "lwip/apps/snmp_core.h"
+#include "lwip/apps/snmp_scalar.h"
+#include "lwip/apps/snmp_table.h"
+#include "lwip/stats.h"
+#include "lwip/memp.h"
+#include "lwip/ip_addr.h"
+#include <string.h>
+
+#if !LWIP_SNMP || !SNMP_USE_NETCONN
+#error "snmp_agent needs LWIP_SNMP and SNMP_USE_NETCONN in lwipopts.h"
+#endif
+
+// TimeTicks are hundredths of a second
+#define TIMETICKS(tick)             ((tick) / (configTICK_RATE_HZ / 100))
+
+#define GATEWAY_OID                 1, 3, 6, 1, 4, 1, SNMP_AGENT_ENTERPRISE_ID, 1
+#define GATEWAY_OID_LEN             8
+
+#define TRAP_MAX_VARBINDS           2
+
+// Local variables
+static const u32_t                  gatewayOid[] = { GATEWAY_OID };
+static const struct snmp_obj_id     deviceOid = { GATEWAY_OID_LEN, { GATEWAY_OID } };
+static const struct snmp_obj_id     trapOid = { GATEWAY_OID_LEN, { 1, 3, 6, 1, 4, 1, SNMP_AGENT_ENTERPRISE_ID, 2 } };
+
+static osTimerId            sampleTimer;
+static uint32_t             lastCycles;
+static uint32_t             lastIdleCycles;
+static uint64_t             totalCycles;        // Since SnmpAgentInit(), up to the last sample
+static uint64_t             totalIdleCycles;
+static uint8_t              cpuLoad;            // Percent, last sample period
+static int32_t              cpuLoadAvg;         // Percent x 256, exponential average
+
+static bool                 trapsEnabled;
+static ip_addr_t            trapSink;
+static volatile uint8_t     pendingTraps;       // Bit <trap> set while the trap waits to be sent
+static uint8_t              sentTraps;          // Bit <trap> set once the trap has been sent
+static uint32_t             lastTrapTick[SNMP_AGENT_NUM_TRAPS];
+static struct snmp_varbind  trapVarbinds[TRAP_MAX_VARBINDS];
+static u32_t                trapValues[TRAP_MAX_VARBINDS];
+static SNMP_AGENT_STATS     stats;
+
+// Cell values handed to lwIP by pointer, read back before the next cell is looked up
+static uint8_t              nodeMac[4];
+
+// Local function prototypes
+static void         Sample(void const* argument);
+static void         CyclesSinceSample(uint32_t* elapsed, uint32_t* idle);
+static void         SendPendingTraps(void);
+static bool         SendTrap(SNMP_AGENT_TRAP trap);
+static void         SetTrapVarbind(uint8_t index, u32_t group, u32_t object, u8_t type, u32_t value);
+static u16_t        RadioValue(struct snmp_node_instance* instance, void* value);
+static snmp_err_t   NodeCell(u32_t column, uint16_t slot, NetworkMember_t* node, union snmp_variant_value* value, u32_t* value_len);
+static snmp_err_t   NodeTableGetCell(const u32_t* column, const u32_t* row_oid, u8_t row_oid_len, union snmp_variant_value* value, u32_t* value_len);
+static snmp_err_t   NodeTableGetNext(const u32_t* column, struct snmp_obj_id* row_oid, union snmp_variant_value* value, u32_t* value_len);
+static u16_t        ReportsValue(const struct snmp_scalar_array_node_def* node, void* value);
+static u16_t        MemoryValue(struct snmp_node_instance* instance, void* value);
+static snmp_err_t   PoolCell(u32_t column, uint16_t pool, union snmp_variant_value* value, u32_t* value_len);
+static snmp_err_t   PoolTableGetCell(const u32_t* column, const u32_t* row_oid, u8_t row_oid_len, union snmp_variant_value* value, u32_t* value_len);
+static snmp_err_t   PoolTableGetNext(const u32_t* column, struct snmp_obj_id* row_oid, union snmp_variant_value* value, u32_t* value_len);
+static u16_t        SystemValue(const struct snmp_scalar_array_node_def* node, void* value);
+
+// MIB tree, see snmp_agent.h
+static const struct snmp_scalar_node radioNodes = SNMP_SCALAR_CREATE_NODE_READONLY(1, SNMP_ASN1_TYPE_GAUGE, RadioValue);
+static const struct snmp_scalar_node radioRxPackets = SNMP_SCALAR_CREATE_NODE_READONLY(2, SNMP_ASN1_TYPE_COUNTER, RadioValue);
+static const struct snmp_scalar_node radioCrcErrors = SNMP_SCALAR_CREATE_NODE_READONLY(3, SNMP_ASN1_TYPE_COUNTER, RadioValue);
+static const struct snmp_scalar_node radioTxPackets = SNMP_SCALAR_CREATE_NODE_READONLY(4, SNMP_ASN1_TYPE_COUNTER, RadioValue);
+static const struct snmp_scalar_node radioReinits = SNMP_SCALAR_CREATE_NODE_READONLY(5, SNMP_ASN1_TYPE_COUNTER, RadioValue);
+
+static const struct snmp_table_simple_col_def nodeTableColumns[] = {
+    { 1, SNMP_ASN1_TYPE_INTEGER,      SNMP_VARIANT_VALUE_TYPE_S32 },        // gwNodeIndex
+    { 2, SNMP_ASN1_TYPE_OCTET_STRING, SNMP_VARIANT_VALUE_TYPE_CONST_PTR },  // gwNodeMac
+    { 3, SNMP_ASN1_TYPE_TIMETICKS,    SNMP_VARIANT_VALUE_TYPE_U32 },        // gwNodeLastSeen
+    { 4, SNMP_ASN1_TYPE_INTEGER,      SNMP_VARIANT_VALUE_TYPE_S32 },        // gwNodeRssi
+    { 5, SNMP_ASN1_TYPE_COUNTER,      SNMP_VARIANT_VALUE_TYPE_U32 }         // gwNodeRxPackets
+};
+
+static const struct snmp_table_simple_node nodeTable = SNMP_TABLE_CREATE_SIMPLE(6, nodeTableColumns, NodeTableGetCell, NodeTableGetNext);
+
+static const struct snmp_node* const radioGroup[] = {
+    &radioNodes.node.node,
+    &radioRxPackets.node.node,
+    &radioCrcErrors.node.node,
+    &radioTxPackets.node.node,
+    &radioReinits.node.node,
+    &nodeTable.node.node
+};
+
+static const struct snmp_tree_node radioRoot = SNMP_CREATE_TREE_NODE(1, radioGroup);
+
+static const struct snmp_scalar_array_node_def reportsScalars[] = {
+    { 1, SNMP_ASN1_TYPE_GAUGE,   SNMP_NODE_INSTANCE_READ_ONLY },   // gwReportQueueDepth
+    { 2, SNMP_ASN1_TYPE_GAUGE,   SNMP_NODE_INSTANCE_READ_ONLY },   // gwReportQueueSize
+    { 3, SNMP_ASN1_TYPE_COUNTER, SNMP_NODE_INSTANCE_READ_ONLY },   // gwReportLogDropped
+    { 4, SNMP_ASN1_TYPE_COUNTER, SNMP_NODE_INSTANCE_READ_ONLY },   // gwReportLogOverwritten
+    { 5, SNMP_ASN1_TYPE_COUNTER, SNMP_NODE_INSTANCE_READ_ONLY }    // gwTelemetryDropped
+};
+
+static const struct snmp_scalar_array_node reportsRoot = SNMP_SCALAR_CREATE_ARRAY_NODE(2, reportsScalars, ReportsValue, NULL, NULL);
+
+static const struct snmp_scalar_node rtosHeapFree = SNMP_SCALAR_CREATE_NODE_READONLY(1, SNMP_ASN1_TYPE_GAUGE, MemoryValue);
+static const struct snmp_scalar_node rtosHeapMinFree = SNMP_SCALAR_CREATE_NODE_READONLY(2, SNMP_ASN1_TYPE_GAUGE, MemoryValue);
+static const struct snmp_scalar_node lwipHeapUsed = SNMP_SCALAR_CREATE_NODE_READONLY(3, SNMP_ASN1_TYPE_GAUGE, MemoryValue);
+static const struct snmp_scalar_node lwipHeapMax = SNMP_SCALAR_CREATE_NODE_READONLY(4, SNMP_ASN1_TYPE_GAUGE, MemoryValue);
+static const struct snmp_scalar_node lwipHeapErrors = SNMP_SCALAR_CREATE_NODE_READONLY(5, SNMP_ASN1_TYPE_COUNTER, MemoryValue);
+
+static const struct snmp_table_simple_col_def poolTableColumns[] = {
+    { 1, SNMP_ASN1_TYPE_INTEGER,      SNMP_VARIANT_VALUE_TYPE_S32 },        // gwPoolIndex
+    { 2, SNMP_ASN1_TYPE_OCTET_STRING, SNMP_VARIANT_VALUE_TYPE_CONST_PTR },  // gwPoolName
+    { 3, SNMP_ASN1_TYPE_GAUGE,        SNMP_VARIANT_VALUE_TYPE_U32 },        // gwPoolSize
+    { 4, SNMP_ASN1_TYPE_GAUGE,        SNMP_VARIANT_VALUE_TYPE_U32 },        // gwPoolUsed
+    { 5, SNMP_ASN1_TYPE_GAUGE,        SNMP_VARIANT_VALUE_TYPE_U32 },        // gwPoolMax
+    { 6, SNMP_ASN1_TYPE_COUNTER,      SNMP_VARIANT_VALUE_TYPE_U32 }         // gwPoolErrors
+};
+
+static const struct snmp_table_simple_node poolTable = SNMP_TABLE_CREATE_SIMPLE(6, poolTableColumns, PoolTableGetCell, PoolTableGetNext);
+
+static const struct snmp_node* const memoryGroup[] = {
+    &rtosHeapFree.node.node,
+    &rtosHeapMinFree.node.node,
+    &lwipHeapUsed.node.node,
+    &lwipHeapMax.node.node,
+    &lwipHeapErrors.node.node,
+    &poolTable.node.node
+};
+
+static const struct snmp_tree_node memoryRoot = SNMP_CREATE_TREE_NODE(3, memoryGroup);
+
+static const struct snmp_scalar_array_node_def systemScalars[] = {
+    { 1, SNMP_ASN1_TYPE_TIMETICKS, SNMP_NODE_INSTANCE_READ_ONLY }, // gwUptime
+    { 2, SNMP_ASN1_TYPE_GAUGE,     SNMP_NODE_INSTANCE_READ_ONLY }, // gwCpuLoad
+    { 3, SNMP_ASN1_TYPE_GAUGE,     SNMP_NODE_INSTANCE_READ_ONLY }, // gwCpuLoadAvg
+    { 4, SNMP_ASN1_TYPE_COUNTER,   SNMP_NODE_INSTANCE_READ_ONLY }  // gwContextSwitches
+};
+
+static const struct snmp_scalar_array_node systemRoot = SNMP_SCALAR_CREATE_ARRAY_NODE(4, systemScalars, SystemValue, NULL, NULL);
+
+static const struct snmp_node* const gatewayGroups[] = {
+    &radioRoot.node,
+    &reportsRoot.node.node,
+    &memoryRoot.node,
+    &systemRoot.node.node
+};
+
+static const struct snmp_tree_node gatewayRoot = SNMP_CREATE_TREE_NODE(1, gatewayGroups);
+static const struct snmp_mib       gatewayMib = SNMP_MIB_CREATE(gatewayOid, &gatewayRoot.node);
+static const struct snmp_mib*      mibs[] = { &gatewayMib };
+
+// Global function implementations
+
+// Call after LwIP_Init() and before the scheduler starts
+void SnmpAgentInit(void)
+{
+    osTimerDef(SnmpAgentTimer, Sample);
+
+    // Start the cycle counter the idle time accounting reads
+    DWT_CYCCNT_START();
+    lastCycles = DWT->CYCCNT;
+    lastIdleCycles = ulIdleCycles;
+
+    snmp_set_device_enterprise_oid(&deviceOid);
+    snmp_set_mibs(mibs, LWIP_ARRAYSIZE(mibs));
+    snmp_init();
+
+    sampleTimer = osTimerCreate(osTimer(SnmpAgentTimer), osTimerPeriodic, NULL);
+    assert_param(sampleTimer != NULL);
+    osTimerStart(sampleTimer, SNMP_AGENT_SAMPLE_MS);
+}
+
+// Ask for <trap> to be sent. Safe from any task; the trap goes out from the
+// timer task within SNMP_AGENT_SAMPLE_MS, or at the end of its holdoff.
+void SnmpAgentRaiseTrap(SNMP_AGENT_TRAP trap)
+{
+    taskENTER_CRITICAL();
+    pendingTraps |= 1 << trap;
+    stats.traps_raised++;
+    taskEXIT_CRITICAL();
+}
+
+// Send traps to <addr> on port 162 from now on
+bool SnmpAgentSetTrapSink(const char* addr)
+{
+    ip_addr_t parsed;
+
+    if(!ipaddr_aton(addr, &parsed))
+    {
+        return false;
+    }
+
+    ip_addr_copy(trapSink, parsed);
+    snmp_trap_dst_ip_set(0, &trapSink);
+    SnmpAgentEnableTraps(true);
+
+    return true;
+}
+
+// Traps raised while disabled are discarded. Stays disabled until a trap sink is set.
+void SnmpAgentEnableTraps(bool enable)
+{
+    trapsEnabled = enable && !ip_addr_isany(&trapSink);
+    snmp_trap_dst_enable(0, trapsEnabled);
+}
+
+// CPU cycles since SnmpAgentInit() and how many of them the idle task ran for.
+// The difference of two readings gives the load over any period, not just whole samples.
+void SnmpAgentCpuCycles(uint64_t* total, uint64_t* idle)
+{
+    uint32_t elapsed;
+    uint32_t idleSince;
+
+    taskENTER_CRITICAL();
+    CyclesSinceSample(&elapsed, &idleSince);
+    *total = totalCycles + elapsed;
+    *idle = totalIdleCycles + idleSince;
+    taskEXIT_CRITICAL();
+}
+
+void SnmpAgentGetStats(SNMP_AGENT_STATS* out)
+{
+    memcpy(out, &stats, sizeof(SNMP_AGENT_STATS));
+}
+
+void SnmpAgentPrintStatus(void)
+{
+    xprintf("SNMP agent: port 161, community \"%s\", enterprise %d, traps %s to %s\n", snmp_get_community(),
+            SNMP_AGENT_ENTERPRISE_ID, trapsEnabled ? "enabled" : "disabled", ipaddr_ntoa(&trapSink));
+    xprintf("Traps: %d raised, %d sent, %d errors\n", stats.traps_raised, stats.traps_sent, stats.trap_errors);
+    xprintf("CPU load: %d%% last second, %d%% one minute average, %d context switches\n", cpuLoad, cpuLoadAvg >> 8,
+            ulTaskSwitchCount);
+}
+
+// Local function implementations
+
+// Timer task, every SNMP_AGENT_SAMPLE_MS
+void Sample(void const* argument)
+{
+    uint32_t elapsed;
+    uint32_t idle;
+
+    (void)argument;
+
+    // The cycle counter wraps every 25 s at 168 MHz: fold it into the 64 bit totals every sample
+    taskENTER_CRITICAL();
+    CyclesSinceSample(&elapsed, &idle);
+    lastCycles += elapsed;
+    lastIdleCycles = ulIdleCycles;
+    totalCycles += elapsed;
+    totalIdleCycles += idle;
+    taskEXIT_CRITICAL();
+
+    if(elapsed > 0)
+    {
+        cpuLoad = 100 - (uint8_t)(((uint64_t)idle * 100) / elapsed);
+        cpuLoadAvg += (((int32_t)cpuLoad << 8) - cpuLoadAvg) / SNMP_AGENT_LOAD_AVG_SAMPLES;
+    }
+
+    SendPendingTraps();
+}
+
+// Cycles since the last sample and the idle task's share of them. Call in a critical section.
+void CyclesSinceSample(uint32_t* elapsed, uint32_t* idle)
+{
+    *elapsed = DWT->CYCCNT - lastCycles;
+    *idle = ulIdleCycles - lastIdleCycles;
+
+    // The idle period the previous sample cut in two is counted whole in this one
+    if(*idle > *elapsed)
+    {
+        *idle = *elapsed;
+    }
+}
+
+void SendPendingTraps(void)
+{
+    uint32_t now = xTaskGetTickCount();
+    uint8_t  bit;
+
+    for(uint8_t trap = 1; trap < SNMP_AGENT_NUM_TRAPS; trap++)
+    {
+        bit = 1 << trap;
+
+        if((pendingTraps & bit) == 0)
+        {
+            continue;
+        }
+
+        // Stays pending: everything raised during the holdoff goes out as one trap
+        if(trapsEnabled && (sentTraps & bit) && now - lastTrapTick[trap] < SNMP_AGENT_TRAP_HOLDOFF_MS)
+        {
+            continue;
+        }
+
+        taskENTER_CRITICAL();
+        pendingTraps &= ~bit;
+        taskEXIT_CRITICAL();
+
+        if(!trapsEnabled)
+        {
+            continue;
+        }
+
+        if(SendTrap((SNMP_AGENT_TRAP)trap))
+        {
+            stats.traps_sent++;
+        }
+        else
+        {
+            stats.trap_errors++;
+        }
+
+        sentTraps |= bit;
+        lastTrapTick[trap] = now;
+    }
+}
+
+bool SendTrap(SNMP_AGENT_TRAP trap)
+{
+    REPORT_LOG_STATS logStats;
+    RadioStats       radio;
+    uint8_t          count = 0;
+
+    switch(trap)
+    {
+        case SNMP_AGENT_TRAP_QUEUE_OVERFLOW:
+            ReportLogGetStats(&logStats);
+            SetTrapVarbind(count++, 2, 1, SNMP_ASN1_TYPE_GAUGE, ReportLogQueueDepth());
+            SetTrapVarbind(count++, 2, 3, SNMP_ASN1_TYPE_COUNTER, logStats.dropped);
+            break;
+
+        case SNMP_AGENT_TRAP_RADIO_REINIT:
+            RadioGetStats(&radio);
+            SetTrapVarbind(count++, 1, 5, SNMP_ASN1_TYPE_COUNTER, radio.reinits);
+            break;
+
+        default:
+            return false;
+    }
+
+    return snmp_send_trap(&trapOid, SNMP_GENTRAP_ENTERPRISE_SPECIFIC, trap, trapVarbinds, count) == ERR_OK;
+}
+
+// Varbind <index> of the next trap: scalar <group>.<object>.0 of the gateway MIB
+void SetTrapVarbind(uint8_t index, u32_t group, u32_t object, u8_t type, u32_t value)
+{
+    const u32_t          suffix[] = { group, object, 0 };
+    struct snmp_varbind* varbind = &trapVarbinds[index];
+
+    snmp_oid_assign(&varbind->oid, gatewayOid, LWIP_ARRAYSIZE(gatewayOid));
+    snmp_oid_append(&varbind->oid, suffix, LWIP_ARRAYSIZE(suffix));
+    trapValues[index] = value;
+    varbind->type = type;
+    varbind->value = &trapValues[index];
+    varbind->value_len = sizeof(u32_t);
+}
+
+// The MIB callbacks below run in the SNMP agent thread
+
+u16_t RadioValue(struct snmp_node_instance* instance, void* value)
+{
+    u32_t*     out = (u32_t*)value;
+    RadioStats radio;
+
+    RadioGetStats(&radio);
+
+    switch(instance->node->oid)
+    {
+        case 1: *out = RadioDeviceCount();  break;
+        case 2: *out = radio.rxPackets;     break;
+        case 3: *out = radio.crcErrors;     break;
+        case 4: *out = radio.txPackets;     break;
+        case 5: *out = radio.reinits;       break;
+        default:
+            return 0;
+    }
+
+    return sizeof(u32_t);
+}
+
+snmp_err_t NodeCell(u32_t column, uint16_t slot, NetworkMember_t* node, union snmp_variant_value* value, u32_t* value_len)
+{
+    switch(column)
+    {
+        case 1:
+            value->s32 = slot + 1;
+            break;
+
+        case 2:
+            nodeMac[0] = (uint8_t)(node->mac_address >> 24);
+            nodeMac[1] = (uint8_t)(node->mac_address >> 16);
+            nodeMac[2] = (uint8_t)(node->mac_address >> 8);
+            nodeMac[3] = (uint8_t)(node->mac_address);
+            value->const_ptr = nodeMac;
+            *value_len = sizeof(nodeMac);
+            break;
+
+        case 3:
+            value->u32 = node->rxPackets > 0 ? TIMETICKS(node->lastHeard) : 0;
+            break;
+
+        case 4:
+            value->s32 = node->rxPackets > 0 ? RADIO_RSSI_DBM(node->latchRssi) : 0;
+            break;
+
+        case 5:
+            value->u32 = node->rxPackets;
+            break;
+
+        default:
+            return SNMP_ERR_NOSUCHINSTANCE;
+    }
+
+    return SNMP_ERR_NOERROR;
+}
+
+// GET: row N is network table slot N - 1
+snmp_err_t NodeTableGetCell(const u32_t* column, const u32_t* row_oid, u8_t row_oid_len, union snmp_variant_value* value, u32_t* value_len)
+{
+    NetworkMember_t node;
+
+    if(row_oid_len != 1 || row_oid[0] < 1 || row_oid[0] > MAX_NETWORK_MEMBERS)
+    {
+        return SNMP_ERR_NOSUCHINSTANCE;
+    }
+
+    if(!RadioGetDevice(row_oid[0] - 1, &node))
+    {
+        return SNMP_ERR_NOSUCHINSTANCE;
+    }
+
+    return NodeCell(*column, row_oid[0] - 1, &node, value, value_len);
+}
+
+// GETNEXT: the first occupied slot after <row_oid>, found in the network
+// table's occupancy bitmap instead of by walking the table
+snmp_err_t NodeTableGetNext(const u32_t* column, struct snmp_obj_id* row_oid, union snmp_variant_value* value, u32_t* value_len)
+{
+    NetworkMember_t node;
+    int32_t         slot = 0;
+    u32_t           row;
+
+    if(row_oid->len > 0)
+    {
+        // Any instance below row N sorts after it: the next row is N + 1, slot N
+        if(row_oid->id[0] >= MAX_NETWORK_MEMBERS)
+        {
+            return SNMP_ERR_NOSUCHINSTANCE;
+        }
+
+        slot = row_oid->id[0];
+    }
+
+    // A slot freed between the bitmap scan and the copy is skipped
+    for(slot = RadioNextDevice(slot); slot >= 0; slot = RadioNextDevice(slot + 1))
+    {
+        if(RadioGetDevice(slot, &node))
+        {
+            row = slot + 1;
+            snmp_oid_assign(row_oid, &row, 1);
+            return NodeCell(*column, slot, &node, value, value_len);
+        }
+    }
+
+    return SNMP_ERR_NOSUCHINSTANCE;
+}
+
+u16_t ReportsValue(const struct snmp_scalar_array_node_def* node, void* value)
+{
+    u32_t*           out = (u32_t*)value;
+    REPORT_LOG_STATS logStats;
+    TELEMETRY_STATS  telemetry;
+
+    ReportLogGetStats(&logStats);
+    TelemetryGetStats(&telemetry);
+
+    switch(node->oid)
+    {
+        case 1: *out = ReportLogQueueDepth();   break;
+        case 2: *out = REPORT_LOG_QUEUE_SIZE;   break;
+        case 3: *out = logStats.dropped;        break;
+        case 4: *out = logStats.overwritten;    break;
+        case 5: *out = telemetry.dropped;       break;
+        default:
+            return 0;
+    }
+
+    return sizeof(u32_t);
+}
+
+u16_t MemoryValue(struct snmp_node_instance* instance, void* value)
+{
+    u32_t* out = (u32_t*)value;
+
+    switch(instance->node->oid)
+    {
+        case 1: *out = xPortGetFreeHeapSize();              break;
+        case 2: *out = xPortGetMinimumEverFreeHeapSize();   break;
+        case 3: *out = lwip_stats.mem.used;                 break;
+        case 4: *out = lwip_stats.mem.max;                  break;
+        case 5: *out = lwip_stats.mem.err;                  break;
+        default:
+            return 0;
+    }
+
+    return sizeof(u32_t);
+}
+
+snmp_err_t PoolCell(u32_t column, uint16_t pool, union snmp_variant_value* value, u32_t* value_len)
+{
+    struct stats_mem* mem = &lwip_stats.memp[pool];
+
+    switch(column)
+    {
+        case 1:
+            value->s32 = pool + 1;
+            break;
+
+        case 2:
+            value->const_ptr = NetStatsPoolName(pool);
+            *value_len = strlen(NetStatsPoolName(pool));
+            break;
+
+        case 3: value->u32 = mem->avail;    break;
+        case 4: value->u32 = mem->used;     break;
+        case 5: value->u32 = mem->max;      break;
+        case 6: value->u32 = mem->err;      break;
+        default:
+            return SNMP_ERR_NOSUCHINSTANCE;
+    }
+
+    return SNMP_ERR_NOERROR;
+}
+
+// Row N is memp pool N - 1
+snmp_err_t PoolTableGetCell(const u32_t* column, const u32_t* row_oid, u8_t row_oid_len, union snmp_variant_value* value, u32_t* value_len)
+{
+    if(row_oid_len != 1 || row_oid[0] < 1 || row_oid[0] > MEMP_MAX)
+    {
+        return SNMP_ERR_NOSUCHINSTANCE;
+    }
+
+    return PoolCell(*column, row_oid[0] - 1, value, value_len);
+}
+
+snmp_err_t PoolTableGetNext(const u32_t* column, struct snmp_obj_id* row_oid, union snmp_variant_value* value, u32_t* value_len)
+{
+    u32_t row = row_oid->len > 0 ? row_oid->id[0] + 1 : 1;
+
+    if(row > MEMP_MAX)
+    {
+        return SNMP_ERR_NOSUCHINSTANCE;
+    }
+
+    snmp_oid_assign(row_oid, &row, 1);
+    return PoolCell(*column, row - 1, value, value_len);
+}
+
+u16_t SystemValue(const struct snmp_scalar_array_node_def* node, void* value)
+{
+    u32_t* out = (u32_t*)value;
+
+    switch(node->oid)
+    {
+        case 1: *out = TIMETICKS(xTaskGetTickCount());  break;
+        case 2: *out = cpuLoad;                         break;
+        case 3: *out = cpuLoadAvg >> 8;                 break;
+        case 4: *out = ulTaskSwitchCount;               break;
+        default:
+            return 0;
+    }
+
+    return sizeof(u32_t);
+}
@@ -117,9 +117,12 @@ static void ETH_MACDMA_Config(void)
   ETH_InitStructure.ETH_RetryTransmission = ETH_RetryTransmission_Disable;
   ETH_InitStructure.ETH_AutomaticPadCRCStrip = ETH_AutomaticPadCRCStrip_Disable;
   ETH_InitStructure.ETH_ReceiveAll = ETH_ReceiveAll_Disable;
+  /* Address filtering: unicast to our MAC, broadcast (ARP, DHCP) and the
+     multicast groups lwIP joins, which ethernetif.c programs into the perfect
+     address registers and the hash table. The MAC drops everything else. */
   ETH_InitStructure.ETH_BroadcastFramesReception = ETH_BroadcastFramesReception_Enable;
   ETH_InitStructure.ETH_PromiscuousMode = ETH_PromiscuousMode_Disable;
-  ETH_InitStructure.ETH_MulticastFramesFilter = ETH_MulticastFramesFilter_Perfect;
+  ETH_InitStructure.ETH_MulticastFramesFilter = ETH_MulticastFramesFilter_PerfectHashTable;
   ETH_InitStructure.ETH_UnicastFramesFilter = ETH_UnicastFramesFilter_Perfect;
 #ifdef CHECKSUM_BY_HARDWARE
   ETH_InitStructure.ETH_ChecksumOffload = ETH_ChecksumOffload_Enable;
@@ -146,8 +149,8 @@ static void ETH_MACDMA_Config(void)
   /* Configure Ethernet */
   EthInitStatus = ETH_Init(&ETH_InitStructure, LAN8720_PHY_ADDRESS);
 
-  /* Enable the Ethernet Rx Interrupt */
-  ETH_DMAITConfig(ETH_DMA_IT_NIS | ETH_DMA_IT_R, ENABLE);
+  /* Enable the Ethernet Rx and Tx complete Interrupts */
+  ETH_DMAITConfig(ETH_DMA_IT_NIS | ETH_DMA_IT_R | ETH_DMA_IT_T, ENABLE);
 }
 
 
@@ -51,6 +51,7 @@
 #include "uart.h"
 #include "radio.h"
 #include "led.h"
+#include "cellular.h"
 
 /* Scheduler includes */
 #include "FreeRTOS.h"
@@ -59,9 +60,10 @@
 
 /* lwip includes */
 #include "lwip/sys.h"
+#include "ethernetif.h"
 
 
-extern xSemaphoreHandle s_xSemaphore;
+extern xSemaphoreHandle s_xTxDoneSemaphore;
 
 extern void xPortSysTickHandler(void); 
 
@@ -156,12 +158,17 @@ void ETH_IRQHandler(void)
 {
   portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 
-  /* Frame received */
+  /* Frame(s) received: mask the Rx interrupt and wake up the LwIP input task */
   if ( ETH_GetDMAFlagStatus(ETH_DMA_FLAG_R) == SET) {
-    /* Give the semaphore to wakeup LwIP task */
-    xSemaphoreGiveFromISR( s_xSemaphore, &xHigherPriorityTaskWoken );   
+    ethernetif_rx_irq( &xHigherPriorityTaskWoken );
   }
 	
+  /* Frame sent: wake up low_level_output if it waits for descriptors */
+  if ( ETH_GetDMAFlagStatus(ETH_DMA_FLAG_T) == SET) {
+    xSemaphoreGiveFromISR( s_xTxDoneSemaphore, &xHigherPriorityTaskWoken );
+    ETH_DMAClearITPendingBit(ETH_DMA_IT_T);
+  }
+
   /* Clear the interrupt flags. */
   /* Clear the Eth DMA Rx IT pending bits */
   ETH_DMAClearITPendingBit(ETH_DMA_IT_R);
@@ -197,6 +204,21 @@ void USARTn_Handler(void)
     }
 }
 
+void MODEM_USART_Handler(void)
+{
+    CellularUsartIRQ();
+}
+
+void MODEM_RX_DMA_Handler(void)
+{
+    CellularRxDmaIRQ();
+}
+
+void MODEM_TX_DMA_Handler(void)
+{
+    CellularTxDmaIRQ();
+}
+
 /******************************************************************************/
 /*                 STM32F4xx Peripherals Interrupt Handlers                   */
 /*  Add here the Interrupt Handler for the used peripheral(s) (PPP), for the  */
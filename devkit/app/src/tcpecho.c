@@ -37,13 +37,22 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
-#include "fw_update.h"
+#include <string.h>
 #include "tcpecho.h"
 #include "stm32f4xx.h"
 #include "radio_packets.h"
 #include "FreeRTOS.h"
 #include "sensor_conversions.h"
 #include "valve.h"
+#include "report_log.h"
+#include "fw_upload.h"
+#include "fw_update.h"
+#include "net_stats.h"
+#include "telemetry.h"
+#include "http_api.h"
+#include "snmp_agent.h"
+#include "net_perf.h"
+#include "time_sync.h"
 
 #if LWIP_NETCONN
 
@@ -52,25 +61,14 @@
 
 #define TCPECHO_THREAD_PRIO  osPriorityAboveNormal
 
-#define TCP_FW_PAYLOAD_BYTES 256
-
-#define MAX_WAITING_LOGS 20
-
 const char* banner = "SUNFLOWER OS TCP/IP TERMINAL INTERFACE";
 
-osMessageQId sensorMsgQ;
-
 void net_printf(struct netconn *conn, const char *fmt, ...);
-void net_bin_nack(struct netconn *conn);
-void net_bin_ack(struct netconn *conn);
-
-uint32_t unix_time;
+void net_print_report(struct netconn *conn, generic_message_t *msg);
 
-void tcpecho_os_init(void)
-{
-    osMessageQDef(SensorLogQueue, MAX_WAITING_LOGS, generic_message_t*);
-    sensorMsgQ = osMessageCreate(osMessageQ(SensorLogQueue), NULL);
-}
+// Context switches spent sending reports, see GetReportSendStats
+static uint32_t reports_sent;
+static uint32_t report_switches;
 
 void tcpecho_thread(void *arg)
 {
@@ -89,6 +87,9 @@ void tcpecho_thread(void *arg)
         if (err == ERR_OK) {
             /* Tell connection to go into listening mode. */
             netconn_listen(conn);
+            
+            // The network stack and terminal came up: this image is good
+            Confirm_Sunflower_Image();
 
             while (1) {
                 /* Grab new connection. */
@@ -100,6 +101,7 @@ void tcpecho_thread(void *arg)
                     void   *data;
                     u16_t  len;
                     bool   fw_update_mode = false;
+                    uint32_t read_seq = 0;
                     
                     net_printf(newconn, "%s\r\n", banner);
 
@@ -118,13 +120,20 @@ void tcpecho_thread(void *arg)
                                             switch(((char*)data)[1])
                                             {
                                                 case 'f':
+                                                    FwUploadReset();
                                                     fw_update_mode = true;
                                                     continue;
+                                                
+                                                case 'u':
+                                                    // Sunflower images must be linked for this slot
+                                                    net_printf(newconn, "USLOT: 0x%08x\r\n", Is_Running_From_Main_Slot() ? SUNFLOWER_BACKUP_APP_START : SUNFLOWER_MAIN_APP_START);
+                                                    continue;
                                             }
                                             
                                             net_printf(newconn, "mf : enter firmware update mode. All ASCII output will cease.");
                                             net_printf(newconn, "Can be disabled by restarting TCP connection or sending the ");
                                             net_printf(newconn, "EXIT_FW_UPDATE_MODE command.\r\n");
+                                            net_printf(newconn, "mu : print the slot sunflower updates are written to\r\n");
                                             
                                             break;
                                             
@@ -132,7 +141,7 @@ void tcpecho_thread(void *arg)
                                             switch(((char*)data)[1]) 
                                             {
                                                 case 's':
-                                                    unix_time = atoi((const char*)&(((char*)data)[2]));
+                                                    TimeSyncSetUnixTime(strtoul((const char*)&(((char*)data)[2]), NULL, 10));
                                                     continue;
                                             }
                                             net_printf(newconn, "ts <UNIX time> : set the system time to <UNIX time>\r\n");
@@ -140,48 +149,39 @@ void tcpecho_thread(void *arg)
                                             break;
                                             
                                         case 'r':
+                                            switch(((char*)data)[1])
                                             {
-                                                generic_message_t* msg;
-                                                osEvent            msgQueueEvent;
+                                                case 'a':
+                                                    ReportLogAck(strtoul((const char*)&(((char*)data)[2]), NULL, 10));
+                                                    continue;
+                                            }
+                                            {
+                                                generic_message_t report;
+                                                uint32_t          sent = 0;
+                                                uint32_t          switches = ulTaskSwitchCount;
                                                 
-                                                // Get a sensor log
-                                                do
+                                                // Resume from this session's cursor, or from the oldest
+                                                // unacknowledged report if that is further along
+                                                if(read_seq < ReportLogFirstUnacked())
                                                 {
-                                                    msgQueueEvent = osMessageGet(sensorMsgQ, 0);
-                                                    
-                                                    if(msgQueueEvent.status == osEventMessage)
+                                                    read_seq = ReportLogFirstUnacked();
+                                                }
+                                                
+                                                while(read_seq < ReportLogNextSeq() && sent < REPORT_LOG_MAX_BATCH)
+                                                {
+                                                    if(ReportLogRead(read_seq, &report))
                                                     {
-                                                        msg = (generic_message_t*)(msgQueueEvent.value.p);
-                                                        // Print the message to the TCP console
-                                                        
-                                                        net_printf(newconn, "DREP:  ", msg->src);
-                                                        
-                                                        net_printf(newconn, "%08x,", msg->src); // Dandelion ID
-                                                        
-                                                        net_printf(newconn, "%d,", unix_time);  // Timestamp
-                                                        
-                                                        // TODO: improve moisture math
-                                                        float moisture0 = msg->payload.sensor_message.moisture0;
-                                                        float moisture1 = msg->payload.sensor_message.moisture1;
-                                                        float moisture2 = msg->payload.sensor_message.moisture2;
-                                                        
-                                                        net_printf(newconn, "%f,", Moisture_To_Float(moisture0));  // Moist 0
-                                                        net_printf(newconn, "%f,", Moisture_To_Float(moisture1));  // Moist 1
-                                                        net_printf(newconn, "%f,", Moisture_To_Float(moisture2));  // Moist 2
-                                                                                                                
-                                                        net_printf(newconn, "%f,", TMP102_To_Float(msg->payload.sensor_message.temp0));               // Soil Temp 1
-                                                        net_printf(newconn, "%f,", TMP102_To_Float(msg->payload.sensor_message.temp1));               // Soil Temp 2
-                                                        net_printf(newconn, "%f,", TMP102_To_Float(msg->payload.sensor_message.temp2));               // Soil Temp 3
-                                                        
-                                                        net_printf(newconn, "%f,", HTU21D_Humid_To_Float(msg->payload.sensor_message.humid));         // Air Humidity
-                                                        net_printf(newconn, "%d", HTU21D_Temp_To_Float(msg->payload.sensor_message.air_temp));        // Air temp                       // Air Temp
-                                                        
-                                                        net_printf(newconn, "\r\n");
-                                                        
-                                                        // Free the memory used by the message
-                                                        vPortFree(msg);
+                                                        net_print_report(newconn, &report);
+                                                        sent++;
                                                     }
-                                                } while(msgQueueEvent.status == osEventMessage);
+                                                    read_seq++;
+                                                }
+                                                
+                                                // Tell the client how far it has read so it can acknowledge with 'ra'
+                                                net_printf(newconn, "RSEQ: %d\r\n", read_seq - 1);
+                                                
+                                                reports_sent += sent;
+                                                report_switches += ulTaskSwitchCount - switches;
                                             }
                                             break;
                                         case 'v':
@@ -203,6 +203,72 @@ void tcpecho_thread(void *arg)
                                                 net_printf(newconn, "vc <valve> : close valve\r\n");
                                             }
                                             break;
+                                        case 'n':
+                                            if(((char*)data)[1] == 'c')
+                                            {
+                                                NetStatsClear();
+                                            }
+                                            else
+                                            {
+                                                char line[NET_STATS_LINE_SIZE];
+                                                
+                                                // One "NSTAT: " line per statistic, see net_stats.h
+                                                for(uint16_t i = 0; NetStatsLine(i, line, sizeof(line)); i++)
+                                                {
+                                                    netconn_write(newconn, "NSTAT: ", 7, NETCONN_COPY);
+                                                    netconn_write(newconn, line, strlen(line), NETCONN_COPY);
+                                                    netconn_write(newconn, "\r\n", 2, NETCONN_COPY);
+                                                }
+                                            }
+                                            break;
+                                        case 'i':
+                                            {
+                                                char     line[NET_PERF_LINE_SIZE];
+                                                char     args[24];
+                                                char*    port_str;
+                                                uint16_t args_len;
+                                                bool     ok = true;
+                                                
+                                                switch(((char*)data)[1])
+                                                {
+                                                    case 's':
+                                                        ok = NetPerfStartServer();
+                                                        break;
+                                                    
+                                                    case 'c':
+                                                        // "ic <ip> <port>"
+                                                        args_len = len > 3 ? len - 3 : 0;
+                                                        if(args_len > sizeof(args) - 1)
+                                                        {
+                                                            args_len = sizeof(args) - 1;
+                                                        }
+                                                        memcpy(args, &(((char*)data)[3]), args_len);
+                                                        args[args_len] = '\0';
+                                                        
+                                                        port_str = strchr(args, ' ');
+                                                        if(port_str == NULL)
+                                                        {
+                                                            ok = false;
+                                                            break;
+                                                        }
+                                                        *port_str++ = '\0';
+                                                        
+                                                        ok = NetPerfStartClient(args, strtoul(port_str, NULL, 10));
+                                                        break;
+                                                    
+                                                    case 'x':
+                                                        NetPerfStop();
+                                                        break;
+                                                }
+                                                
+                                                // Then the last results, see net_perf.h
+                                                net_printf(newconn, "IPERF: %s\r\n", ok ? "OK" : "ERROR");
+                                                for(uint16_t i = 0; NetPerfLine(i, line, sizeof(line)); i++)
+                                                {
+                                                    net_printf(newconn, "IPERF: %s\r\n", line);
+                                                }
+                                            }
+                                            break;
                                         case 'p':
                                             {
                                                 long  polling_rate = atoi((const char*)&(((char*)data)[2]));
@@ -230,120 +296,22 @@ void tcpecho_thread(void *arg)
                                             net_printf(newconn, "m : mode control\r\n");
                                             net_printf(newconn, "t : time control\r\n");
                                             net_printf(newconn, "r : report request\r\n");
+                                            net_printf(newconn, "ra <seq> : acknowledge reports up to <seq>\r\n");
                                             net_printf(newconn, "v : valve control\r\n");
                                             net_printf(newconn, "p : polling rate\r\n");
+                                            net_printf(newconn, "n : lwIP memory statistics\r\n");
+                                            net_printf(newconn, "nc : clear memory high-water marks\r\n");
+                                            net_printf(newconn, "is : start an iperf server on port 5001\r\n");
+                                            net_printf(newconn, "ic <ip> <port> : send to an iperf server\r\n");
+                                            net_printf(newconn, "ix : stop the iperf session\r\n");
+                                            net_printf(newconn, "i : iperf results\r\n");
                                             break;
                                     }
                                     net_printf(newconn, "\r\n\n");
                                 }
                                 else if(fw_update_mode)
-                                {                                    
-                                    switch(((char*)data)[0])
-                                    {
-                                        // PAYLOAD, type, addr[4], payload[64]
-                                        case PAYLOAD:
-                                            if(len == (TCP_FW_PAYLOAD_BYTES + 6))
-                                            {
-                                                uint32_t addr = (((uint8_t*)data)[5] << 24) | (((uint8_t*)data)[4] << 16) | (((uint8_t*)data)[3] << 8) | (((uint8_t*)data)[2]);
-                                                
-                                                switch(((uint8_t*)data)[1])
-                                                {
-                                                    // DANDELION TYPE
-                                                    case DANDELION_DEVICE:
-                                                        for(uint16_t i = 0; i < TCP_FW_PAYLOAD_BYTES; i += 4)
-                                                        {
-                                                            uint32_t word = (((uint8_t*)data)[9 + i] << 24) | (((uint8_t*)data)[8 + i] << 16) | (((uint8_t*)data)[7 + i] << 8) | (((uint8_t*)data)[6 + i]);
-                                                            Write_Dandelion_Word(addr + i, word);
-                                                        }
-                                                        net_bin_ack(newconn);
-                                                        break;
-                                                    
-                                                    // SUNFLOWER TYPE
-                                                    case SUNFLOWER_DEVICE:
-                                                        for(uint16_t i = 0; i < TCP_FW_PAYLOAD_BYTES; i += 4)
-                                                        {
-                                                            uint32_t word = (((uint8_t*)data)[9 + i] << 24) | (((uint8_t*)data)[8 + i] << 16) | (((uint8_t*)data)[7 + i] << 8) | (((uint8_t*)data)[6 + i]);
-                                                            Write_Sunflower_Word(addr + i, word);
-                                                        }
-                                                        net_bin_ack(newconn);
-                                                        break;
-                                                    
-                                                    default:
-                                                        net_bin_nack(newconn);
-                                                        break;
-                                                }
-                                            }
-                                            break;
-                                        
-                                        // START, type
-                                        case START:
-                                            if(len == 2)
-                                            {                                                
-                                                switch(((uint8_t*)data)[1])
-                                                {
-                                                    // DANDELION TYPE
-                                                    case DANDELION_DEVICE:
-                                                        FLASH_Unlock();
-                                                        Erase_Dandelion_Image();
-                                                        net_bin_ack(newconn);
-                                                        break;
-                                                    
-                                                    // SUNFLOWER TYPE
-                                                    case SUNFLOWER_DEVICE:
-                                                        FLASH_Unlock();
-                                                        Erase_Sunflower_Image();
-                                                        net_bin_ack(newconn);
-                                                        break;
-                                                    
-                                                    default:
-                                                        net_bin_nack(newconn);
-                                                        break;
-                                                }
-                                            }
-                                            break;
-                                                                                
-                                        // VALIDATE, type
-                                        case VALIDATE:
-                                            if(len == 2)
-                                            {                                                
-                                                switch(((uint8_t*)data)[1])
-                                                {
-                                                    // DANDELION TYPE
-                                                    case DANDELION_DEVICE:
-                                                        Erase_Dandelion_Image();
-                                                        net_bin_ack(newconn);
-                                                        break;
-                                                    
-                                                    // SUNFLOWER TYPE
-                                                    case SUNFLOWER_DEVICE:
-                                                        Erase_Sunflower_Image();
-                                                        net_bin_ack(newconn);
-                                                        break;
-                                                    
-                                                    default:
-                                                        net_bin_nack(newconn);
-                                                        break;
-                                                }
-                                            }
-                                            break;
-                                        
-                                        // EXIT BINARY MODE
-                                        case EXIT_MODE:
-                                            fw_update_mode = false;
-                                            net_bin_ack(newconn);
-                                            break;
-                                        
-                                        // EXIT BINARY MODE
-                                        case END:
-                                            FLASH_Lock();
-                                            net_bin_ack(newconn);
-                                            break;
-                                        
-                                        default:
-                                            ERR("Unexpected TCP command");
-                                            net_bin_nack(newconn);
-                                            break;
-                                    }
+                                {
+                                    fw_update_mode = FwUploadInput(newconn, (uint8_t*)data, len);
                                 }
                             }
                             
@@ -365,32 +333,26 @@ void tcpecho_thread(void *arg)
     }
 }
 
-void unix_time_thread(void)
-{
-    while(1)
-    {
-        unix_time++;
-        vTaskDelay(1000);
-    }
-}
-
-uint32_t GetUnixTime(void)
+// Reports sent on 'r' requests and the context switches it took (including
+// the ones to other tasks that ran meanwhile)
+void GetReportSendStats(uint32_t* reports, uint32_t* switches)
 {
-    return unix_time;
+    *reports  = reports_sent;
+    *switches = report_switches;
 }
 
-// Add a sensor log to the TCP transmit queue
+// Add a sensor log to the flash report log and hand it to the UDP exporter
 // The pointer passed into this function will NEVER be freed automatically: a copy of the data is made
 // Caller must free the input pointer after this function returns.
 void EnqueueSensorTCP(generic_message_t* data)
 {
-    generic_message_t* message = pvPortMalloc(sizeof(generic_message_t));
-    memcpy(message, data, sizeof(generic_message_t));
-    
-    if(osMessagePut(sensorMsgQ, (uint32_t)message, 0) != osOK)
+    if(!ReportLogAppend(data))
     {
-        vPortFree(message);
+        SnmpAgentRaiseTrap(SNMP_AGENT_TRAP_QUEUE_OVERFLOW);
     }
+    
+    TelemetryExport(data);
+    HttpApiRecordReading(data);
 }
 
 void net_printf(struct netconn *conn, const char *fmt, ...)
@@ -403,20 +365,31 @@ void net_printf(struct netconn *conn, const char *fmt, ...)
     netconn_write(conn, buffer, strlen(buffer), NETCONN_COPY);
 }
 
-void net_bin_ack(struct netconn *conn)
+void net_print_report(struct netconn *conn, generic_message_t *msg)
 {
-    uint8_t buffer[1];
-    buffer[0] = TCP_ACK;
+    net_printf(conn, "DREP:  ");
     
-    netconn_write(conn, buffer, 1, NETCONN_COPY);
-}
+    net_printf(conn, "%08x,", msg->src);                                  // Dandelion ID
     
-void net_bin_nack(struct netconn *conn)
-{
-    uint8_t buffer[1];
-    buffer[0] = TCP_NACK;
+    net_printf(conn, "%d,", msg->payload.sensor_message.timestamp);       // Timestamp
+    
+    // TODO: improve moisture math
+    float moisture0 = msg->payload.sensor_message.moisture0;
+    float moisture1 = msg->payload.sensor_message.moisture1;
+    float moisture2 = msg->payload.sensor_message.moisture2;
+    
+    net_printf(conn, "%f,", Moisture_To_Float(moisture0));  // Moist 0
+    net_printf(conn, "%f,", Moisture_To_Float(moisture1));  // Moist 1
+    net_printf(conn, "%f,", Moisture_To_Float(moisture2));  // Moist 2
+                                                            
+    net_printf(conn, "%f,", TMP102_To_Float(msg->payload.sensor_message.temp0));               // Soil Temp 1
+    net_printf(conn, "%f,", TMP102_To_Float(msg->payload.sensor_message.temp1));               // Soil Temp 2
+    net_printf(conn, "%f,", TMP102_To_Float(msg->payload.sensor_message.temp2));               // Soil Temp 3
+    
+    net_printf(conn, "%f,", HTU21D_Humid_To_Float(msg->payload.sensor_message.humid));         // Air Humidity
+    net_printf(conn, "%d", HTU21D_Temp_To_Float(msg->payload.sensor_message.air_temp));        // Air temp
     
-    netconn_write(conn, buffer, 1, NETCONN_COPY);
+    net_printf(conn, "\r\n");
 }
 
 void tcpecho_init(void)
@@ -0,0 +1,276 @@
+#include "telemetry.h"
+#include "tcpecho.h"
+#include "time_sync.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "debug.h"
+#include "xprintf.h"
+#include "lwip/api.h"
+#include "lwip/def.h"
+#include <string.h>
+
+#define TELEMETRY_QUEUE_SIZE        32
+
+STATIC_ASSERT(sizeof(TELEMETRY_HEADER) == 24);
+STATIC_ASSERT(TELEMETRY_MAX_RECORDS >= 1 && TELEMETRY_MAX_RECORDS <= 255);
+
+// A report waiting for the exporter, stamped when it reached the gateway
+typedef struct TELEMETRY_ITEM_T {
+    uint32_t          tick;
+    generic_message_t report;
+} TELEMETRY_ITEM;
+
+osMessageQId telemetryQ;
+
+static bool             enabled = TELEMETRY_DEFAULT_ENABLED;
+static uint32_t         flushMs = TELEMETRY_FLUSH_MS;
+static ip_addr_t        collectorAddr;
+static uint16_t         collectorPort = TELEMETRY_DEFAULT_PORT;
+static struct netconn*  conn;
+static uint32_t         datagramSeq;
+static TELEMETRY_STATS  stats;
+
+// Datagram being filled. Each record's age field holds the arrival tick
+// until the datagram is sent.
+static uint32_t         batch[TELEMETRY_MAX_PAYLOAD / sizeof(uint32_t)];
+static uint8_t          batchCount;
+static uint32_t         batchFirstTick;
+
+// Local function prototypes
+static uint8_t*         Record(uint8_t index);
+static void             Append(TELEMETRY_ITEM* item);
+static void             Flush(void);
+
+// Global function implementations
+void TelemetryOSInit(void)
+{
+    osMessageQDef(TelemetryQueue, TELEMETRY_QUEUE_SIZE, TELEMETRY_ITEM*);
+
+    telemetryQ = osMessageCreate(osMessageQ(TelemetryQueue), NULL);
+
+    assert_param(telemetryQ != NULL);
+
+    ipaddr_aton(TELEMETRY_DEFAULT_ADDR, &collectorAddr);
+}
+
+void TelemetryTask(void)
+{
+    osEvent         msgQueueEvent;
+    TELEMETRY_ITEM* item;
+    uint32_t        timeout;
+    uint32_t        waited;
+
+    conn = netconn_new(NETCONN_UDP);
+    assert_param(conn != NULL);
+
+    while(1)
+    {
+        // Sleep until the next report, or until the oldest one queued is due
+        timeout = osWaitForever;
+        if(batchCount)
+        {
+            waited = xTaskGetTickCount() - batchFirstTick;
+            timeout = waited < flushMs ? flushMs - waited : 0;
+        }
+
+        msgQueueEvent = osMessageGet(telemetryQ, timeout);
+
+        if(msgQueueEvent.status == osEventMessage)
+        {
+            item = (TELEMETRY_ITEM*)(msgQueueEvent.value.p);
+
+            Append(item);
+            vPortFree(item);
+
+            if(batchCount == TELEMETRY_MAX_RECORDS)
+            {
+                stats.size_flushes++;
+                Flush();
+                continue;
+            }
+        }
+
+        if(batchCount && xTaskGetTickCount() - batchFirstTick >= flushMs)
+        {
+            stats.deadline_flushes++;
+            Flush();
+        }
+    }
+}
+
+// Queue a copy of a report for the exporter. Never blocks: the radio task calls this.
+// Caller keeps ownership of the input pointer.
+bool TelemetryExport(generic_message_t* report)
+{
+    TELEMETRY_ITEM* item;
+
+    if(!enabled)
+    {
+        return false;
+    }
+
+    item = pvPortMalloc(sizeof(TELEMETRY_ITEM));
+
+    if(item == NULL)
+    {
+        stats.dropped++;
+        return false;
+    }
+
+    item->tick = xTaskGetTickCount();
+    memcpy(&item->report, report, sizeof(generic_message_t));
+
+    if(osMessagePut(telemetryQ, (uint32_t)item, 0) != osOK)
+    {
+        vPortFree(item);
+        stats.dropped++;
+        return false;
+    }
+
+    return true;
+}
+
+// Send to <addr> (dotted quad, unicast or multicast) port <port> from now on
+bool TelemetrySetCollector(const char* addr, uint16_t port)
+{
+    ip_addr_t parsed;
+
+    if(!ipaddr_aton(addr, &parsed) || port == 0)
+    {
+        return false;
+    }
+
+    taskENTER_CRITICAL();
+    ip_addr_copy(collectorAddr, parsed);
+    collectorPort = port;
+    taskEXIT_CRITICAL();
+
+    return true;
+}
+
+// Reports already queued when the exporter is disabled are discarded
+void TelemetryEnable(bool enable)
+{
+    enabled = enable;
+}
+
+// Hold reports for TELEMETRY_METERED_FLUSH_MS rather than TELEMETRY_FLUSH_MS.
+// The datagram being filled takes the new deadline at the next report.
+void TelemetrySetMetered(bool metered)
+{
+    flushMs = metered ? TELEMETRY_METERED_FLUSH_MS : TELEMETRY_FLUSH_MS;
+}
+
+void TelemetryGetStats(TELEMETRY_STATS* out)
+{
+    memcpy(out, &stats, sizeof(TELEMETRY_STATS));
+}
+
+void TelemetryPrintStatus(void)
+{
+    xprintf("Telemetry: %s, collector %s:%d, %d reports per datagram, flush after %d ms\n", enabled ? "enabled" : "disabled",
+            ipaddr_ntoa(&collectorAddr), collectorPort, TELEMETRY_MAX_RECORDS, flushMs);
+    xprintf("Sent: %d reports in %d datagrams (%d bytes), next seq %d\n", stats.reports, stats.datagrams, stats.bytes, datagramSeq);
+    xprintf("Flushes: %d full, %d deadline. Dropped: %d reports, send errors: %d\n", stats.size_flushes, stats.deadline_flushes,
+            stats.dropped, stats.send_errors);
+}
+
+// Local function implementations
+
+uint8_t* Record(uint8_t index)
+{
+    return (uint8_t*)batch + sizeof(TELEMETRY_HEADER) + index * TELEMETRY_RECORD_SIZE;
+}
+
+void Append(TELEMETRY_ITEM* item)
+{
+    uint8_t* record = Record(batchCount);
+
+    if(!enabled)
+    {
+        return;
+    }
+
+    if(batchCount == 0)
+    {
+        batchFirstTick = item->tick;
+    }
+
+    memcpy(record, &item->tick, sizeof(uint32_t));
+    memcpy(record + sizeof(uint32_t), &item->report, sizeof(generic_message_t));
+    batchCount++;
+}
+
+void Flush(void)
+{
+    TELEMETRY_HEADER* header = (TELEMETRY_HEADER*)batch;
+    uint16_t          len = sizeof(TELEMETRY_HEADER) + batchCount * TELEMETRY_RECORD_SIZE;
+    uint32_t          now = xTaskGetTickCount();
+    struct netbuf*    buf;
+    void*             payload;
+    ip_addr_t         addr;
+    uint16_t          port;
+    uint32_t          age;
+
+    if(!enabled)
+    {
+        batchCount = 0;
+        return;
+    }
+
+    for(uint8_t i = 0; i < batchCount; i++)
+    {
+        memcpy(&age, Record(i), sizeof(uint32_t));
+        age = lwip_htonl(now - age);
+        memcpy(Record(i), &age, sizeof(uint32_t));
+    }
+
+    header->magic       = lwip_htonl(TELEMETRY_MAGIC);
+    header->version     = TELEMETRY_VERSION;
+    header->count       = batchCount;
+    header->record_size = lwip_htons(TELEMETRY_RECORD_SIZE);
+    header->seq         = lwip_htonl(datagramSeq);
+    header->uptime_ms   = lwip_htonl(now);
+    header->unix_time   = lwip_htonl(GetUnixTime());
+    header->dropped     = lwip_htonl(stats.dropped);
+
+    taskENTER_CRITICAL();
+    ip_addr_copy(addr, collectorAddr);
+    port = collectorPort;
+    taskEXIT_CRITICAL();
+
+    // The sequence number advances even if lwIP refuses the datagram, so the
+    // collector sees the loss
+    datagramSeq++;
+
+    buf = netbuf_new();
+    payload = buf != NULL ? netbuf_alloc(buf, len) : NULL;
+
+    if(payload != NULL)
+    {
+        memcpy(payload, batch, len);
+
+        if(netconn_sendto(conn, buf, &addr, port) == ERR_OK)
+        {
+            stats.reports += batchCount;
+            stats.datagrams++;
+            stats.bytes += len;
+        }
+        else
+        {
+            stats.send_errors++;
+        }
+    }
+    else
+    {
+        stats.send_errors++;
+    }
+
+    if(buf != NULL)
+    {
+        netbuf_delete(buf);
+    }
+
+    batchCount = 0;
+}
@@ -0,0 +1,327 @@
+#include "time_beacon.h"
+#include "time_sync.h"
+#include "radio.h"
+#include "radio_packets.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "debug.h"
+#include "xprintf.h"
+#include <string.h>
+
+// Frame timing at the radio_config.h settings: 10 kbps 2GFSK, 8 byte
+// preamble, 2 byte sync word, CRC-16 after the payload
+#define BYTE_AIR_US             800
+#define PRE_SYNC_US             ((8 + 2) * BYTE_AIR_US)
+#define CRC_BYTES               2
+
+// Stamp to preamble before the first measurement: three commands and the
+// FIFO write over the SPI at ~330 kHz, then TX warm-up
+#define TX_SETUP_US             2000
+
+// Longest plausible stamp to preamble: past it the PACKET_SENT capture is
+// not the beacon's
+#define MAX_SETUP_US            10000
+
+#define MIN_PERIOD_MS           500
+#define MAX_PERIOD_MS           (24 * 60 * 60 * 1000)
+
+// Shortest sampling period the report timestamps (whole seconds) tell the
+// sampling instants apart at
+#define MIN_DRIFT_PERIOD_MS     2000
+
+STATIC_ASSERT(sizeof(TIME_BEACON) <= sizeof(((generic_message_t*)0)->payload));
+
+static osTimerId            beaconTimer;
+static uint32_t             samplePeriodMs = TIME_BEACON_SAMPLE_MS;
+static uint32_t             epochS;
+static TIME_BEACON_STATS    stats = { .latencyUs = TX_SETUP_US + PRE_SYNC_US };
+
+// By network table slot. Written by the radio task only.
+static TIME_BEACON_NODE     nodeClocks[TIME_BEACON_NODES];
+
+// Owned by the radio task: the beacon on the air, until its PACKET_SENT
+static bool                 inFlight;
+static uint32_t             txCapture;
+static uint32_t             postSyncUs;
+static uint32_t             addedUs;
+
+// Local function prototypes
+static void     Tick(void const* argument);
+static uint64_t SamplingInstant(uint64_t ms);
+static int16_t  Saturate16(int64_t value);
+
+// Global function implementations
+
+// Call after RadioTaskOSInit() and before the scheduler starts
+void TimeBeaconInit(void)
+{
+    osTimerDef(TimeBeaconTimer, Tick);
+
+    beaconTimer = osTimerCreate(osTimer(TimeBeaconTimer), osTimerPeriodic, NULL);
+    assert_param(beaconTimer != NULL);
+    osTimerStart(beaconTimer, TIME_BEACON_PERIOD_MS);
+}
+
+// Queue a beacon for broadcast. Skipped until the gateway clock is set: a
+// beacon would only pull the nodes off whatever time they have.
+void TimeBeaconSendNow(void)
+{
+    generic_message_t* msg;
+
+    if(!TimeSyncValid())
+    {
+        stats.skipped++;
+        return;
+    }
+
+    msg = pvPortMalloc(sizeof(generic_message_t));
+
+    if(msg == NULL)
+    {
+        stats.skipped++;
+        return;
+    }
+
+    // The radio task fills in the payload as it transmits the frame
+    memset(msg, 0, sizeof(generic_message_t));
+    msg->cmd = TIME_BEACON_CMD;
+    SendToBroadcast((uint8_t*)msg, sizeof(generic_message_t));
+}
+
+// Sample every <periodMs> from <epochS> on, from the next beacon on. False if
+// the period is out of the range SENSOR_CMD takes.
+bool TimeBeaconSetSampling(uint32_t periodMs, uint32_t epoch)
+{
+    if(periodMs < MIN_PERIOD_MS || periodMs > MAX_PERIOD_MS)
+    {
+        return false;
+    }
+
+    taskENTER_CRITICAL();
+    samplePeriodMs = periodMs;
+    epochS = epoch;
+    taskEXIT_CRITICAL();
+
+    return true;
+}
+
+// Called by the radio task with every frame it is about to transmit,
+// <length> bytes of it, and the microsecond counter: stamps beacons with the
+// time their sync word will go out at
+void TimeBeaconStamp(uint8_t* frame, uint8_t length, uint32_t capture)
+{
+    generic_message_t* msg = (generic_message_t*)frame;
+    TIME_BEACON        beacon;
+    uint64_t           now;
+
+    // A beacon still waiting for its PACKET_SENT was cut short by this frame
+    if(inFlight)
+    {
+        stats.unmeasured++;
+        inFlight = false;
+    }
+
+    if(msg->cmd != TIME_BEACON_CMD)
+    {
+        return;
+    }
+
+    now = TimeSyncNowMs() + (stats.latencyUs + 500) / 1000;
+    stats.sequence = stats.sequence == 0xFFFF ? 1 : stats.sequence + 1;
+
+    beacon.timeS = (uint32_t)(now / 1000);
+    beacon.timeMs = (uint16_t)(now % 1000);
+    beacon.sequence = stats.sequence;
+    beacon.epochS = epochS;
+    beacon.samplePeriodMs = samplePeriodMs;
+    beacon.beaconPeriodMs = TIME_BEACON_PERIOD_MS;
+    beacon.windowMs = TIME_BEACON_WINDOW_MS;
+    beacon.reserved = 0;
+    memcpy(&msg->payload, &beacon, sizeof(TIME_BEACON));
+
+    inFlight = true;
+    txCapture = capture;
+    postSyncUs = (length + CRC_BYTES) * BYTE_AIR_US;
+    addedUs = stats.latencyUs;
+    stats.sent++;
+}
+
+// Called by the radio task on PACKET_SENT with its capture: measures the
+// latency the last beacon had
+void TimeBeaconSent(uint32_t capture)
+{
+    uint32_t elapsedUs = capture - txCapture;
+    uint32_t measuredUs;
+    int32_t  errorUs;
+
+    if(!inFlight)
+    {
+        return;
+    }
+
+    inFlight = false;
+
+    if(elapsedUs < postSyncUs + PRE_SYNC_US || elapsedUs > postSyncUs + PRE_SYNC_US + MAX_SETUP_US)
+    {
+        stats.unmeasured++;
+        return;
+    }
+
+    measuredUs = elapsedUs - postSyncUs;
+    errorUs = (int32_t)addedUs - (int32_t)measuredUs;
+
+    stats.lastErrorUs = errorUs;
+    stats.maxErrorUs = (uint32_t)(errorUs < 0 ? -errorUs : errorUs) > stats.maxErrorUs ?
+                       (uint32_t)(errorUs < 0 ? -errorUs : errorUs) : stats.maxErrorUs;
+
+    // A quarter of the way to the measurement: one beacon held up by an
+    // interrupt does not throw the next one off
+    stats.latencyUs = (uint32_t)((int32_t)stats.latencyUs - errorUs / 4);
+}
+
+// Per node clock statistics from the report timestamp <timestamp> of the
+// node in network table slot <slot>, which arrived at gateway time
+// <arrivalMs>. Called by the radio task.
+void TimeBeaconRecordReport(uint16_t slot, uint32_t timestamp, uint64_t arrivalMs)
+{
+    TIME_BEACON_NODE* node;
+    uint64_t          instant;
+    int64_t           lateMs;
+    uint32_t          spanMs;
+
+    // Untracked, the node has no time yet, or the gateway has none to compare with
+    if(slot >= TIME_BEACON_NODES || timestamp == 0 || arrivalMs == 0)
+    {
+        return;
+    }
+
+    node = &nodeClocks[slot];
+
+    node->offsetS = Saturate16((int64_t)timestamp - (int64_t)(arrivalMs / 1000));
+
+    if(stats.sequence == 0 || samplePeriodMs < MIN_DRIFT_PERIOD_MS)
+    {
+        return;
+    }
+
+    // The sampling instant the report was taken at, in whole seconds
+    instant = SamplingInstant((uint64_t)timestamp * 1000 + 500);
+
+    if(instant == 0)
+    {
+        return;
+    }
+
+    lateMs = (int64_t)arrivalMs - (int64_t)instant;
+
+    if(lateMs < INT32_MIN || lateMs > INT32_MAX)
+    {
+        node->refBeacon = 0;
+        return;
+    }
+
+    // First report since the last beacon: the one the next are measured from
+    if(node->refBeacon != stats.sequence)
+    {
+        node->refBeacon = stats.sequence;
+        node->refArrivalMs = (uint32_t)arrivalMs;
+        node->refLateMs = (int32_t)lateMs;
+        return;
+    }
+
+    spanMs = (uint32_t)arrivalMs - node->refArrivalMs;
+
+    if(spanMs < TIME_BEACON_MIN_DRIFT_MS)
+    {
+        return;
+    }
+
+    // Reports arriving later and later: the node's clock runs slow
+    node->driftPpm = Saturate16(-((int64_t)lateMs - node->refLateMs) * 1000000 / spanMs);
+}
+
+// Forget the clock of network table slot <slot>, taken by a new node.
+// Called by the radio task.
+void TimeBeaconResetNode(uint16_t slot)
+{
+    if(slot < TIME_BEACON_NODES)
+    {
+        taskENTER_CRITICAL();
+        memset(&nodeClocks[slot], 0, sizeof(TIME_BEACON_NODE));
+        taskEXIT_CRITICAL();
+    }
+}
+
+// Consistent copy of the clock of network table slot <slot>. Returns false,
+// and a zeroed clock, if the slot is not tracked.
+bool TimeBeaconGetNode(uint16_t slot, TIME_BEACON_NODE* out)
+{
+    if(slot >= TIME_BEACON_NODES)
+    {
+        memset(out, 0, sizeof(TIME_BEACON_NODE));
+        return false;
+    }
+
+    taskENTER_CRITICAL();
+    memcpy(out, &nodeClocks[slot], sizeof(TIME_BEACON_NODE));
+    taskEXIT_CRITICAL();
+
+    return true;
+}
+
+void TimeBeaconGetStats(TIME_BEACON_STATS* out)
+{
+    memcpy(out, &stats, sizeof(TIME_BEACON_STATS));
+}
+
+void TimeBeaconPrintStatus(void)
+{
+    TIME_BEACON_STATS s;
+    TIME_BEACON_NODE  clock;
+    int32_t           slot = RadioNextDevice(0);
+
+    TimeBeaconGetStats(&s);
+
+    xprintf("Beacons every %u s: sent %u (last %u), skipped %u, unmeasured %u\n", TIME_BEACON_PERIOD_MS / 1000,
+            s.sent, s.sequence, s.skipped, s.unmeasured);
+    xprintf("TX latency %u us, last error %d us, max error %u us\n", s.latencyUs, s.lastErrorUs, s.maxErrorUs);
+    xprintf("Sampling every %u ms from %u\n", samplePeriodMs, epochS);
+
+    while(slot >= 0 && slot < TIME_BEACON_NODES)
+    {
+        if(TimeBeaconGetNode(slot, &clock) && clock.refBeacon != 0)
+        {
+            xprintf("[%d]    0x%08x  offset %d s, drift %d ppm\n", slot, RadioGetDeviceMAC(slot), clock.offsetS,
+                    clock.driftPpm);
+        }
+
+        slot = RadioNextDevice(slot + 1);
+    }
+}
+
+// Local function implementations
+
+// Timer task: a beacon every TIME_BEACON_PERIOD_MS
+void Tick(void const* argument)
+{
+    TimeBeaconSendNow();
+}
+
+// The sampling instant nearest <ms>, 0 before the epoch
+uint64_t SamplingInstant(uint64_t ms)
+{
+    uint64_t epochMs = (uint64_t)epochS * 1000;
+
+    if(ms < epochMs)
+    {
+        return 0;
+    }
+
+    return epochMs + (ms - epochMs + samplePeriodMs / 2) / samplePeriodMs * samplePeriodMs;
+}
+
+int16_t Saturate16(int64_t value)
+{
+    return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value;
+}
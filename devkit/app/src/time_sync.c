@@ -1,110 +1,534 @@
 #include "time_sync.h"
 #include "debug.h"
-#include <stdio.h>
-#include <string.h>
 #include "xprintf.h"
-#include "dns.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32f4xx_rcc.h"
 #include "stm32f4xx_rtc.h"
+#include "lwip/tcpip.h"
+#include "lwip/ip_addr.h"
+#include "lwip/apps/sntp.h"
+#include <string.h>
+
+// LSI / 32 clocks the synchronous prescaler at ~1 kHz
+#define PREDIV_A                31
+#define PREDIV_S_MIN            127
+#define PREDIV_S_MAX            0x7FFF
+
+// LSI edges per TIM5 capture, and captures per measurement (~8 ms)
+#define LSI_EDGES_PER_CAPTURE   8
+#define LSI_CAPTURES            32
+#define LSI_CAPTURE_TIMEOUT     0x100000
+#define LSI_NOMINAL_HZ          32000
+
+// Smooth calibration range in 2^-20 steps. Past TRIM_RESCALE the synchronous
+// prescaler moves instead, so the calibration stays clear of its ends.
+#define TRIM_MIN                (-511)
+#define TRIM_MAX                512
+#define TRIM_RESCALE            480
+#define TRIM_ONE                (1 << 20)
+
+// Backup register marking the calendar as set
+#define RTC_SET_REG             RTC_BKP_DR0
+#define RTC_SET_MAGIC           0x54534E31
+
+#define UNIX_2000               946684800UL
+#define DAYS_1970_2000          10957
+#define US_PER_S                1000000LL
+
+#define BCD2BIN(x)              ((((x) >> 4) & 0x0F) * 10 + ((x) & 0x0F))
+#define BIN2BCD(x)              ((((x) / 10) << 4) | ((x) % 10))
+
+static const uint16_t monthDays[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+static char             serverName[] = TIME_SYNC_SERVER;
+static ip_addr_t        serverAddr;
+static bool             useServerAddr;
+
+static volatile bool    valid;
+static TIME_SYNC_STATS  stats;
+
+// Owned by the tcpip thread: server time of the last correction, 0 to start
+// the frequency measurement over
+static int64_t          lastCorrectionUs;
 
-#define TIME_SERVER "time.nist.gov"
-#define TIME_PORT   37
-static struct netconn *g_conn          = NULL;
+// Local function prototypes
+static uint32_t MeasureLsi(void);
+static uint32_t Tim5Clock(void);
+static int64_t  ReadRtcUs(void);
+static bool     WriteCalendar(uint32_t unixTime, uint16_t prescaler);
+static void     WriteTrim(int32_t trim);
+static bool     UpdateTrim(int64_t offsetUs, int64_t intervalUs);
+static void     SetClock(int64_t serverUs, bool step);
+static void     Shift(int64_t offsetUs);
+static uint32_t DateToUnix(uint8_t year, uint8_t month, uint8_t day);
+static void     StartSntp(void* ctx);
+static void     RestartSntp(void* ctx);
+static void     SetUnixTime(void* ctx);
 
+// Global function implementations
+
+// Called before the scheduler starts: the LSI measurement busy-waits ~8 ms
 void TimeSyncHwInit(void)
 {
-    // Initialize the RTC here
-    RTC_InitTypeDef rtc;
-    rtc.RTC_HourFormat = RTC_HourFormat_24;
-    rtc.RTC_SynchPrediv = 128; // LSI clock is ~32.768 kHz, which is close to the default values
-    rtc.RTC_SynchPrediv = 256;
-    RTC_Init(&rtc);
+    // Backup domain write access for the RTC
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR |= PWR_CR_DBP;
+
+    RCC_LSICmd(ENABLE);
+    while(RCC_GetFlagStatus(RCC_FLAG_LSIRDY) == RESET);
+
+    stats.lsiHz = MeasureLsi();
+
+    // Set before a reset: it kept counting, with its prescaler and calibration
+    if(RTC_ReadBackupRegister(RTC_SET_REG) == RTC_SET_MAGIC && (RCC->BDCR & RCC_BDCR_RTCEN))
+    {
+        RTC_WaitForSynchro();
+
+        stats.prescaler = RTC->PRER & RTC_PRER_PREDIV_S;
+        stats.trim = ((RTC->CALR & RTC_CALR_CALP) ? TRIM_MAX : 0) - (int32_t)(RTC->CALR & RTC_CALR_CALM);
+        valid = true;
+
+        INFO("RTC kept its time over the reset: %u\n", GetUnixTime());
+        return;
+    }
+
+    // The clock source can only be chosen once per backup domain reset
+    if((RCC->BDCR & RCC_BDCR_RTCSEL) == 0)
+    {
+        RCC_RTCCLKConfig(RCC_RTCCLKSource_LSI);
+    }
+
+    RCC_RTCCLKCmd(ENABLE);
+
+    stats.prescaler = (stats.lsiHz + (PREDIV_A + 1) / 2) / (PREDIV_A + 1) - 1;
+    stats.prescaler = stats.prescaler < PREDIV_S_MIN ? PREDIV_S_MIN : stats.prescaler;
+    stats.trim = 0;
+
+    WriteCalendar(UNIX_2000, stats.prescaler);
+    WriteTrim(stats.trim);
 }
 
+// Start the SNTP client, once lwIP is up
 void TimeSyncInit(void)
 {
-    g_conn = netconn_new(NETCONN_TCP);
-    
-    if (g_conn == NULL) 
+    tcpip_callback(StartSntp, NULL);
+}
+
+bool TimeSyncValid(void)
+{
+    return valid;
+}
+
+// Milliseconds since 1970
+uint64_t TimeSyncNowMs(void)
+{
+    return valid ? (uint64_t)(ReadRtcUs() / 1000) : 0;
+}
+
+// Milliseconds since 1970 at FreeRTOS tick <tick> (a recent one: it can be
+// read in an interrupt handler, this can't)
+uint64_t TimeSyncTickToMs(uint32_t tick)
+{
+    uint64_t now = TimeSyncNowMs();
+    uint32_t ago = (xTaskGetTickCount() - tick) * portTICK_PERIOD_MS;
+
+    return now > ago ? now - ago : 0;
+}
+
+uint32_t GetUnixTime(void)
+{
+    return (uint32_t)(TimeSyncNowMs() / 1000);
+}
+
+// Set the clock by hand. SNTP takes over at its next response.
+void TimeSyncSetUnixTime(uint32_t unixTime)
+{
+    if(unixTime < UNIX_2000)
     {
-        WARN("Netconn initialization failed\n");
+        WARN("Unix time %u is before 2000: the RTC can't hold it\n", unixTime);
+        return;
     }
+
+    tcpip_callback(SetUnixTime, (void*)unixTime);
 }
 
-void TimeSyncTask(void)
+// Ask the server now instead of at the next poll
+void TimeSyncRequest(void)
 {
-    while(g_conn == NULL)
+    tcpip_callback(RestartSntp, NULL);
+}
+
+// Use the server at <addr> (a local stand-in, say), or TIME_SYNC_SERVER again for NULL
+bool TimeSyncSetServer(const char* addr)
+{
+    ip_addr_t parsed;
+
+    if(addr != NULL && !ipaddr_aton(addr, &parsed))
     {
-        // Delay for 5 seconds
-        vTaskDelay(5000);
-        TimeSyncInit();
+        return false;
     }
-    
-    // Sync the time from the time-server once every hour
-    while(1)
+
+    if(addr != NULL)
     {
-        TimeSync();
-        vTaskDelay(60 * 60 * 1000);
+        ip_addr_copy(serverAddr, parsed);
     }
+
+    useServerAddr = addr != NULL;
+    tcpip_callback(RestartSntp, NULL);
+
+    return true;
+}
+
+void TimeSyncGetStats(TIME_SYNC_STATS* out)
+{
+    memcpy(out, &stats, sizeof(TIME_SYNC_STATS));
 }
 
-// Connect to a time server and download the current TIME
-bool TimeSync(void)
+void TimeSyncPrintStatus(void)
 {
-    err_t err;
-    void* data;
-    uint16_t len;
-    struct netbuf *buf;
-    ip_addr_t addr;
-    uint32_t received_time;
-    
-    if(g_conn == NULL)
+    TIME_SYNC_STATS s;
+    uint64_t        now = TimeSyncNowMs();
+
+    TimeSyncGetStats(&s);
+
+    if(valid)
     {
-        ERR("Cannot connect to time server: netconn not initialized\n");
-        return false;
+        xprintf("Time: %u.%03u (unix)\n", (uint32_t)(now / 1000), (uint32_t)(now % 1000));
     }
-    
-    err = netconn_gethostbyname(TIME_SERVER, &addr);
-    
-    if(err != ERR_OK)
+    else
     {
-        ERR("DNS could not resolve hostname: %s\n", lwip_strerr(err));
-        return false;
+        xprintf("Time: not set\n");
     }
-    
-    err = netconn_connect(g_conn, &addr, TIME_PORT);
-    
-    if(err != ERR_OK) 
+
+    xprintf("SNTP server: %s\n", useServerAddr ? ipaddr_ntoa(&serverAddr) : serverName);
+    xprintf("Syncs: %u, steps: %u", s.syncs, s.steps);
+
+    if(s.syncs > 0)
     {
-        ERR("Netconn could not connect to host %s\n", lwip_strerr(err));
-        netconn_close(g_conn);
-        return false;
+        xprintf(", last offset %d us, %u s ago", s.lastOffsetUs, (uint32_t)(now / 1000) - s.lastSync);
+    }
+
+    xprintf("\nRTC: LSI %u Hz, prescaler %u, trim %d (%d ppm)\n", s.lsiHz, s.prescaler, s.trim,
+            (int32_t)(((int64_t)s.trim * US_PER_S) / TRIM_ONE));
+}
+
+// SNTP_SET_SYSTEM_TIME_US, tcpip thread: <sec>.<us> is the server time now,
+// with the round trip taken out
+void TimeSyncSntpSet(uint32_t sec, uint32_t us)
+{
+    int64_t serverUs = sec * US_PER_S + us;
+    int64_t offsetUs = serverUs - ReadRtcUs();
+    bool    step = !valid || offsetUs >= US_PER_S || offsetUs <= -US_PER_S;
+
+    stats.syncs++;
+    stats.lastSync = sec;
+    stats.lastOffsetUs = step ? (offsetUs > 0 ? INT32_MAX : INT32_MIN) : (int32_t)offsetUs;
+
+    DEBUG("SNTP: offset %d us\n", stats.lastOffsetUs);
+
+    // Drift since the last correction, once there is enough of it to measure.
+    // A response sooner than that ('ts') only corrects the time.
+    if(!step && lastCorrectionUs != 0 && serverUs - lastCorrectionUs >= TIME_SYNC_MIN_TRIM_S * US_PER_S)
+    {
+        step = UpdateTrim(offsetUs, serverUs - lastCorrectionUs);
+    }
+
+    SetClock(serverUs, step);
+    lastCorrectionUs = serverUs;
+}
+
+// SNTP_GET_SYSTEM_TIME, tcpip thread: the RTC time, set or not, so a request
+// and its response are timed by the same clock
+void TimeSyncSntpGet(uint32_t* sec, uint32_t* us)
+{
+    int64_t now = ReadRtcUs();
+
+    *sec = (uint32_t)(now / US_PER_S);
+    *us = (uint32_t)(now % US_PER_S);
+}
+
+// Local function implementations
+
+// Count timer clocks over LSI_CAPTURES * LSI_EDGES_PER_CAPTURE LSI periods:
+// TIM5 channel 4 can capture the LSI internally
+uint32_t MeasureLsi(void)
+{
+    uint32_t first = 0;
+    uint32_t last = 0;
+    uint32_t timeout = 0;
+    uint16_t i;
+
+    RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
+
+    TIM5->OR = TIM_OR_TI4_RMP_0;
+    TIM5->PSC = 0;
+    TIM5->ARR = 0xFFFFFFFF;
+    TIM5->CCMR2 = TIM_CCMR2_CC4S_0 | TIM_CCMR2_IC4PSC;
+    TIM5->CCER = TIM_CCER_CC4E;
+    TIM5->EGR = TIM_EGR_UG;
+    TIM5->SR = 0;
+    TIM5->CR1 = TIM_CR1_CEN;
+
+    for(i = 0; i <= LSI_CAPTURES; i++)
+    {
+        for(timeout = LSI_CAPTURE_TIMEOUT; !(TIM5->SR & TIM_SR_CC4IF) && timeout > 0; timeout--);
+
+        if(timeout == 0)
+        {
+            break;
+        }
+
+        // Reading the capture clears the flag
+        last = TIM5->CCR4;
+        first = i == 0 ? last : first;
+    }
+
+    TIM5->CR1 = 0;
+    TIM5->CCER = 0;
+    TIM5->OR = 0;
+    RCC->APB1ENR &= ~RCC_APB1ENR_TIM5EN;
+
+    if(timeout == 0 || last == first)
+    {
+        WARN("LSI measurement timed out, assuming %u Hz\n", LSI_NOMINAL_HZ);
+        return LSI_NOMINAL_HZ;
+    }
+
+    return (uint32_t)(((uint64_t)Tim5Clock() * LSI_EDGES_PER_CAPTURE * LSI_CAPTURES) / (last - first));
+}
+
+// APB1 timers run at twice PCLK1 when APB1 is divided
+uint32_t Tim5Clock(void)
+{
+    RCC_ClocksTypeDef clocks;
+
+    RCC_GetClocksFreq(&clocks);
+
+    return (RCC->CFGR & RCC_CFGR_PPRE1_2) ? clocks.PCLK1_Frequency * 2 : clocks.PCLK1_Frequency;
+}
+
+// Microseconds since 1970 on the RTC, at the resolution of the synchronous
+// prescaler. The subsecond count runs down from PREDIV_S, and can be above
+// it for a moment after a shift.
+int64_t ReadRtcUs(void)
+{
+    uint32_t ssr;
+    uint32_t tr;
+    uint32_t dr;
+    int32_t  prescaler = RTC->PRER & RTC_PRER_PREDIV_S;
+    uint32_t secs;
+
+    // Reading SSR freezes TR and DR until DR is read
+    taskENTER_CRITICAL();
+    ssr = RTC->SSR;
+    tr = RTC->TR;
+    dr = RTC->DR;
+    taskEXIT_CRITICAL();
+
+    secs = DateToUnix(BCD2BIN(dr >> 16), BCD2BIN((dr >> 8) & 0x1F), BCD2BIN(dr & 0x3F)) +
+           BCD2BIN((tr >> 16) & 0x3F) * 3600 + BCD2BIN((tr >> 8) & 0x7F) * 60 + BCD2BIN(tr & 0x7F);
+
+    return secs * US_PER_S + ((int64_t)(prescaler - (int32_t)ssr) * US_PER_S) / (prescaler + 1);
+}
+
+// Set the calendar to <unixTime>.000 and the synchronous prescaler, in one
+// pass through initialization mode
+bool WriteCalendar(uint32_t unixTime, uint16_t prescaler)
+{
+    uint32_t days = unixTime / 86400 - DAYS_1970_2000;
+    uint32_t secs = unixTime % 86400;
+    uint8_t  weekday = (unixTime / 86400 + 3) % 7 + 1;     // 1970-01-01 was a Thursday, Monday is 1
+    uint8_t  year = 0;
+    uint8_t  month;
+    bool     leap;
+    bool     ok = false;
+
+    while(days >= ((year % 4) == 0 ? 366 : 365))
+    {
+        days -= (year % 4) == 0 ? 366 : 365;
+        year++;
     }
-    
-    if(netconn_recv(g_conn, &buf) == ERR_OK)
+
+    leap = (year % 4) == 0;
+
+    for(month = 12; month > 1; month--)
     {
-        do 
+        if(days >= monthDays[month - 1] + (leap && month > 2 ? 1 : 0))
         {
-            netbuf_data(buf, &data, &len);
-            DEBUG("Data length: %d\n", len);
-            
-            if(len == 4)
-            {
-                received_time = ((((uint8_t*)data)[0]) << 24) | ((((uint8_t*)data)[1]) << 16) | ((((uint8_t*)data)[2]) << 8) | (((uint8_t*)data)[3]);
-                INFO("Time sync received! Current time is %u\n", received_time);
-                
-                // Update the RTC
-            }
-        } while (netbuf_next(buf) >= 0);
-        netbuf_delete(buf);
-    }
-    
-    //netconn_close(g_conn);
-    
+            break;
+        }
+    }
+
+    days -= monthDays[month - 1] + (leap && month > 2 ? 1 : 0);
+
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+
+    if(RTC_EnterInitMode() == SUCCESS)
+    {
+        // The synchronous prescaler has to be written first
+        RTC->PRER = prescaler;
+        RTC->PRER = prescaler | (PREDIV_A << 16);
+        RTC->CR &= ~RTC_CR_FMT;
+        RTC->TR = (BIN2BCD(secs / 3600) << 16) | (BIN2BCD((secs / 60) % 60) << 8) | BIN2BCD(secs % 60);
+        RTC->DR = (BIN2BCD(year) << 16) | (weekday << 13) | (BIN2BCD(month) << 8) | BIN2BCD(days + 1);
+        RTC_ExitInitMode();
+        ok = true;
+    }
+
+    RTC->WPR = 0xFF;
+
+    if(!ok || RTC_WaitForSynchro() == ERROR)
+    {
+        ERR("Could not set the RTC\n");
+        return false;
+    }
+
+    stats.prescaler = prescaler;
+
     return true;
 }
 
-// Return the current UNIX time
-uint32_t TimeSyncGet(void)
+// Smooth calibration over 32 s: <trim> 2^-20 steps faster (positive) or slower
+void WriteTrim(int32_t trim)
 {
-    return 0;
+    if(trim > 0)
+    {
+        RTC_SmoothCalibConfig(RTC_SmoothCalibPeriod_32sec, RTC_SmoothCalibPlusPulses_Set, TRIM_MAX - trim);
+    }
+    else
+    {
+        RTC_SmoothCalibConfig(RTC_SmoothCalibPeriod_32sec, RTC_SmoothCalibPlusPulses_Reset, -trim);
+    }
+
+    stats.trim = trim;
+}
+
+// The RTC fell <offsetUs> behind the server over <intervalUs>: speed it up by
+// half of that. Returns true if the prescaler moved, which takes setting the
+// calendar again.
+bool UpdateTrim(int64_t offsetUs, int64_t intervalUs)
+{
+    int32_t  drift = (int32_t)((offsetUs * TRIM_ONE) / intervalUs);
+    int32_t  trim = stats.trim + drift / 2;
+    uint16_t prescaler = stats.prescaler;
+
+    // One prescaler step is (1 / (PREDIV_S + 1)) of the rate
+    if(trim > TRIM_RESCALE && prescaler > PREDIV_S_MIN)
+    {
+        prescaler--;
+        trim -= TRIM_ONE / (prescaler + 1);
+    }
+    else if(trim < -TRIM_RESCALE && prescaler < PREDIV_S_MAX)
+    {
+        prescaler++;
+        trim += TRIM_ONE / (prescaler + 1);
+    }
+
+    trim = trim > TRIM_MAX ? TRIM_MAX : (trim < TRIM_MIN ? TRIM_MIN : trim);
+
+    INFO("RTC drift %d ppm, trim %d -> %d, prescaler %u\n", (int32_t)(((int64_t)drift * US_PER_S) / TRIM_ONE),
+         stats.trim, trim, prescaler);
+
+    WriteTrim(trim);
+
+    if(prescaler != stats.prescaler)
+    {
+        stats.prescaler = prescaler;
+        return true;
+    }
+
+    return false;
+}
+
+// tcpip thread. Setting the calendar starts the second over and takes a few
+// RTC clocks: what is left of the offset afterwards is shifted in.
+void SetClock(int64_t serverUs, bool step)
+{
+    uint32_t start = xTaskGetTickCount();
+
+    if(step)
+    {
+        if(!WriteCalendar((uint32_t)(serverUs / US_PER_S), stats.prescaler))
+        {
+            return;
+        }
+
+        stats.steps++;
+        RTC_WriteBackupRegister(RTC_SET_REG, RTC_SET_MAGIC);
+        valid = true;
+    }
+
+    Shift(serverUs + (int64_t)(xTaskGetTickCount() - start) * portTICK_PERIOD_MS * 1000 - ReadRtcUs());
+}
+
+// Move the RTC by <offsetUs> (less than a second either way): a shift can
+// only take time off, so going forward adds a second and takes the rest back
+void Shift(int64_t offsetUs)
+{
+    int32_t fraction = stats.prescaler + 1;
+    int32_t ticks = (int32_t)((offsetUs * fraction) / US_PER_S);
+
+    if(ticks > 0 && ticks < fraction)
+    {
+        RTC_SynchroShiftConfig(RTC_ShiftAdd1S_Set, fraction - ticks);
+    }
+    else if(ticks < 0 && ticks > -fraction)
+    {
+        RTC_SynchroShiftConfig(RTC_ShiftAdd1S_Reset, -ticks);
+    }
+}
+
+// Seconds since 1970 of a calendar date in 2000-2099 (the RTC's range)
+uint32_t DateToUnix(uint8_t year, uint8_t month, uint8_t day)
+{
+    uint32_t days = DAYS_1970_2000 + year * 365 + (year + 3) / 4;
+
+    month = month < 1 ? 1 : (month > 12 ? 12 : month);
+    days += monthDays[month - 1] + (day > 0 ? day - 1 : 0);
+    days += (year % 4) == 0 && month > 2 ? 1 : 0;
+
+    return days * 86400;
+}
+
+// tcpip thread
+void StartSntp(void* ctx)
+{
+    (void)ctx;
+
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, serverName);
+    sntp_init();
+}
+
+// tcpip thread. Starting the client over sends a request right away.
+void RestartSntp(void* ctx)
+{
+    (void)ctx;
+
+    sntp_stop();
+
+    if(useServerAddr)
+    {
+        sntp_setservername(0, NULL);
+        sntp_setserver(0, &serverAddr);
+    }
+    else
+    {
+        sntp_setservername(0, serverName);
+    }
+
+    sntp_init();
+}
+
+// tcpip thread
+void SetUnixTime(void* ctx)
+{
+    INFO("RTC set by hand\n");
+
+    SetClock((uint32_t)ctx * US_PER_S, true);
+
+    // The offset to the next response is not drift
+    lastCorrectionUs = 0;
 }
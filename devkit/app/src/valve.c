@@ -76,4 +76,25 @@ void OpenValve(uint8_t valve)
             GPIO_ResetBits(VALVE_3_PORT, VALVE_3_PIN);
             break;
     }
+}
+
+// Valves are driven active low: read back the output latch
+bool IsValveOpen(uint8_t valve)
+{
+    switch(valve)
+    {
+        case 0:
+            return GPIO_ReadOutputDataBit(VALVE_0_PORT, VALVE_0_PIN) == Bit_RESET;
+        
+        case 1:
+            return GPIO_ReadOutputDataBit(VALVE_1_PORT, VALVE_1_PIN) == Bit_RESET;
+        
+        case 2:
+            return GPIO_ReadOutputDataBit(VALVE_2_PORT, VALVE_2_PIN) == Bit_RESET;
+        
+        case 3:
+            return GPIO_ReadOutputDataBit(VALVE_3_PORT, VALVE_3_PIN) == Bit_RESET;
+    }
+    
+    return false;
 }
\ No newline at end of file
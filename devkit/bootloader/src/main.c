@@ -15,24 +15,91 @@ SUNFLOWER_APP_HEADER* backup_app = (SUNFLOWER_APP_HEADER*)SUNFLOWER_BACKUP_APP_S
 // LOCAL FUNCTION DECLARATIONS
 void createIVT(SUNFLOWER_APP_HEADER* app);
 void launchImage(SUNFLOWER_APP_HEADER* app);
-void CopyBackupToMain(void);
+bool isBootable(SUNFLOWER_APP_HEADER* app, bool main_region, SUNFLOWER_VERIFY_CACHE* cache);
+SUNFLOWER_APP_HEADER* selectSlot(SUNFLOWER_VERIFY_CACHE* cache);
 
 // GLOBAL FUNCTIONS
 int main(void)
 {   
-    // If the backup region is valid and the main app is not a debug app
-    if(Is_Sunflower_Image_Valid(false))
+    SUNFLOWER_VERIFY_CACHE* cache = Get_Sunflower_Verify_Cache();
+    
+    // Count cycles until the app is launched to measure the boot time
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    
+    cache->full_checks = 0;
+    
+    // Backup SRAM holds garbage after a cold power-up
+    if(cache->boot_magic != SUNFLOWER_BOOT_STATE_MAGIC)
     {
-        // Check if the version is greater than the main app region
-        // Or if the main app is invalid
-        if((backup_app->version > main_app->version) || !Is_Sunflower_Image_Valid(true))
+        cache->boot_magic = SUNFLOWER_BOOT_STATE_MAGIC;
+        cache->confirmed_crc = 0;
+        cache->trial_crc = 0;
+        cache->trial_attempts = 0;
+        cache->rejected_crc = 0;
+    }
+    
+    SUNFLOWER_APP_HEADER* app = selectSlot(cache);
+    
+    SystemCoreClockUpdate();
+    cache->boot_us = DWT->CYCCNT / (SystemCoreClock / 1000000);
+    
+    launchImage(app);
+    for(;;);
+}
+
+bool isBootable(SUNFLOWER_APP_HEADER* app, bool main_region, SUNFLOWER_VERIFY_CACHE* cache)
+{
+    return app->header_crc32 != cache->rejected_crc && Is_Sunflower_Image_Linked(main_region) && Is_Sunflower_Image_Valid(main_region);
+}
+
+// Pick the newest valid image. Both slots run in place, so nothing is copied.
+SUNFLOWER_APP_HEADER* selectSlot(SUNFLOWER_VERIFY_CACHE* cache)
+{
+    bool main_ok   = isBootable(main_app, true, cache);
+    bool backup_ok = isBootable(backup_app, false, cache);
+    SUNFLOWER_APP_HEADER* newest;
+    SUNFLOWER_APP_HEADER* other;
+    
+    if(main_ok && backup_ok)
+    {
+        newest = (backup_app->version > main_app->version) ? backup_app : main_app;
+        other  = (newest == backup_app) ? main_app : backup_app;
+    }
+    else if(main_ok || backup_ok)
+    {
+        newest = main_ok ? main_app : backup_app;
+        other  = 0;
+    }
+    else
+    {
+        // Nothing valid: try the main slot as before
+        return main_app;
+    }
+    
+    // An image that hasn't confirmed a good boot yet only gets a few tries
+    if(newest->header_crc32 != cache->confirmed_crc)
+    {
+        if(newest->header_crc32 != cache->trial_crc)
+        {
+            cache->trial_crc = newest->header_crc32;
+            cache->trial_attempts = 0;
+        }
+        
+        if(cache->trial_attempts >= SUNFLOWER_BOOT_ATTEMPTS && other)
         {
-            CopyBackupToMain();
+            // Roll back to the other slot
+            cache->rejected_crc = newest->header_crc32;
+            cache->trial_crc = 0;
+            cache->trial_attempts = 0;
+            return other;
         }
+        
+        cache->trial_attempts++;
     }
     
-    launchImage(main_app);
-    for(;;);
+    return newest;
 }
 
 void launchImage(SUNFLOWER_APP_HEADER* app)
@@ -48,21 +115,6 @@ void launchImage(SUNFLOWER_APP_HEADER* app)
     launch(stackPtr, progCtr);
 }
 
-void CopyBackupToMain(void)
-{
-    // Erase the main application
-    FLASH_Unlock();
-    FLASH_EraseSector(FLASH_Sector_5, VoltageRange_1);
-    FLASH_EraseSector(FLASH_Sector_6, VoltageRange_1);
-    
-    for(uint32_t i = 0; i < backup_app->image_size; i += 4)
-    {
-        FLASH_ProgramWord(i + SUNFLOWER_MAIN_APP_START, *((uint32_t*)(SUNFLOWER_BACKUP_APP_START + i)));
-    }
-    
-    FLASH_Lock();
-}
-
 #ifdef  USE_FULL_ASSERT
 
 /**
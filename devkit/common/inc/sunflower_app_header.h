@@ -7,7 +7,7 @@
 #define SUNFLOWER_SRAM_START			0x20000000
 #define SUNFLOWER_FLASH_START			0x08000000
 #define SUNFLOWER_MAIN_APP_START		0x08020000
-#define SUNFLOWER_BACKUP_APP_START		0x080C0000
+#define SUNFLOWER_BACKUP_APP_START		0x080A0000
 
 #define xstr(s) str(s)
 #define str(s) #s
@@ -635,6 +635,10 @@ extern "C" {
 	#define configUSE_MALLOC_FAILED_HOOK 0
 #endif
 
+#ifndef configAPPLICATION_ALLOCATED_HEAP
+	#define configAPPLICATION_ALLOCATED_HEAP 0
+#endif
+
 #ifndef portPRIVILEGE_BIT
 	#define portPRIVILEGE_BIT ( ( UBaseType_t ) 0x00 )
 #endif
@@ -51,6 +51,10 @@ void fs_close_custom(struct fs_file *file);
 u8_t fs_canread_custom(struct fs_file *file);
 u8_t fs_wait_read_custom(struct fs_file *file, fs_wait_cb callback_fn, void *callback_arg);
 #endif /* LWIP_HTTPD_FS_ASYNC_READ */
+#if LWIP_HTTPD_CUSTOM_FILES_READ
+int fs_read_custom(struct fs_file *file, char *buffer, int count);
+int fs_bytes_left_custom(struct fs_file *file);
+#endif /* LWIP_HTTPD_CUSTOM_FILES_READ */
 #endif /* LWIP_HTTPD_CUSTOM_FILES */
 
 /*-----------------------------------------------------------------------------------*/
@@ -118,6 +122,15 @@ fs_read(struct fs_file *file, char *buffer, int count)
 {
   int read;
 
+#if LWIP_HTTPD_CUSTOM_FILES_READ
+  if (file->is_custom_file) {
+#if LWIP_HTTPD_FS_ASYNC_READ
+    LWIP_UNUSED_ARG(callback_fn);
+    LWIP_UNUSED_ARG(callback_arg);
+#endif /* LWIP_HTTPD_FS_ASYNC_READ */
+    return fs_read_custom(file, buffer, count);
+  }
+#endif /* LWIP_HTTPD_CUSTOM_FILES_READ */
   if(file->index == file->len) {
     return FS_READ_EOF;
   }
@@ -171,5 +184,10 @@ fs_is_file_ready(struct fs_file *file, fs_wait_cb callback_fn, void *callback_ar
 int
 fs_bytes_left(struct fs_file *file)
 {
+#if LWIP_HTTPD_CUSTOM_FILES_READ
+  if (file->is_custom_file) {
+    return fs_bytes_left_custom(file);
+  }
+#endif /* LWIP_HTTPD_CUSTOM_FILES_READ */
   return file->len - file->index;
 }
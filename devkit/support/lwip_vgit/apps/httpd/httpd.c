@@ -96,6 +96,8 @@
 
 #define CRLF "\r\n"
 #define HTTP11_CONNECTIONKEEPALIVE "Connection: keep-alive"
+#define HTTP11_CONNECTIONCLOSE     "Connection: close"
+#define HTTP11_VERSION             "HTTP/1.1"
 
 #if LWIP_HTTPD_SSI
 #define LWIP_HTTPD_IS_SSI(hs) ((hs)->ssi)
@@ -1871,6 +1873,19 @@ http_parse_request(struct pbuf *inp, struct http_state *hs, struct tcp_pcb *pcb)
             hs->keepalive = 0;
           }
 #endif /* LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
+#if LWIP_HTTPD_CUSTOM_FILES
+          /* custom files choose their own framing: HTTP/1.1 connections are
+             persistent unless the client says otherwise */
+          hs->file_handle.flags = 0;
+          if (!is_09 && !strncmp(sp2 + 1, HTTP11_VERSION, sizeof(HTTP11_VERSION) - 1)) {
+            hs->file_handle.flags |= FS_FILE_FLAGS_HTTP_1_1;
+            if (!strnstr(data, HTTP11_CONNECTIONCLOSE, data_len)) {
+              hs->file_handle.flags |= FS_FILE_FLAGS_PERSISTENT;
+            }
+          } else if (!is_09 && strnstr(data, HTTP11_CONNECTIONKEEPALIVE, data_len)) {
+            hs->file_handle.flags |= FS_FILE_FLAGS_PERSISTENT;
+          }
+#endif /* LWIP_HTTPD_CUSTOM_FILES */
           /* null-terminate the METHOD (pbuf is freed anyway wen returning) */
           *sp1 = 0;
           uri[uri_len] = 0;
@@ -2063,6 +2078,12 @@ http_init_file(struct http_state *hs, struct fs_file *file, int is_09, const cha
     LWIP_ASSERT("File length must be positive!", (file->len >= 0));
     hs->left = file->len;
     hs->retries = 0;
+#if LWIP_HTTPD_CUSTOM_FILES && LWIP_HTTPD_SUPPORT_11_KEEPALIVE
+    if (file->is_custom_file) {
+      /* fs_open_custom() has decided how its response is delimited */
+      hs->keepalive = (file->flags & FS_FILE_FLAGS_PERSISTENT) ? 1 : 0;
+    }
+#endif /* LWIP_HTTPD_CUSTOM_FILES && LWIP_HTTPD_SUPPORT_11_KEEPALIVE */
 #if LWIP_HTTPD_TIMING
     hs->time_started = sys_now();
 #endif /* LWIP_HTTPD_TIMING */
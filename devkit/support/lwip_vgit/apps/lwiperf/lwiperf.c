@@ -162,11 +162,8 @@ static void lwiperf_tcp_err(void *arg, err_t err);
 static void
 lwiperf_list_add(lwiperf_state_base_t* item)
 {
-  if (lwiperf_all_connections == NULL) {
-    lwiperf_all_connections = item;
-  } else {
-    item = lwiperf_all_connections;
-  }
+  item->next = lwiperf_all_connections;
+  lwiperf_all_connections = item;
 }
 
 /** Remove an iperf session from the 'active' list */
@@ -180,7 +177,7 @@ lwiperf_list_remove(lwiperf_state_base_t* item)
       if (prev == NULL) {
         lwiperf_all_connections = iter->next;
       } else {
-        prev->next = item;
+        prev->next = iter->next;
       }
       /* @debug: ensure this item is listed only once */
       for (iter = iter->next; iter != NULL; iter = iter->next) {
@@ -204,21 +201,25 @@ lwip_tcp_conn_report(lwiperf_state_tcp_t* conn, enum lwiperf_report_type report_
     } else {
       bandwidth_kbitpsec = (conn->bytes_transferred / duration_ms) * 8U;
     }
-    conn->report_fn(conn->report_arg, report_type,
-      &conn->conn_pcb->local_ip, conn->conn_pcb->local_port,
-      &conn->conn_pcb->remote_ip, conn->conn_pcb->remote_port,
-      conn->bytes_transferred, duration_ms, bandwidth_kbitpsec);
+    if (conn->conn_pcb != NULL) {
+      conn->report_fn(conn->report_arg, report_type,
+        &conn->conn_pcb->local_ip, conn->conn_pcb->local_port,
+        &conn->conn_pcb->remote_ip, conn->conn_pcb->remote_port,
+        conn->bytes_transferred, duration_ms, bandwidth_kbitpsec);
+    } else {
+      /* the pcb is gone (error callback) */
+      conn->report_fn(conn->report_arg, report_type, NULL, 0, NULL, 0,
+        conn->bytes_transferred, duration_ms, bandwidth_kbitpsec);
+    }
   }
 }
 
-/** Close an iperf tcp session */
+/** Close the pcb of an iperf tcp session and free the session */
 static void
-lwiperf_tcp_close(lwiperf_state_tcp_t* conn, enum lwiperf_report_type report_type)
+lwiperf_tcp_free(lwiperf_state_tcp_t* conn)
 {
   err_t err;
 
-  lwip_tcp_conn_report(conn, report_type);
-  lwiperf_list_remove(&conn->base);
   if (conn->conn_pcb != NULL) {
     tcp_arg(conn->conn_pcb, NULL);
     tcp_poll(conn->conn_pcb, NULL, 0);
@@ -230,14 +231,23 @@ lwiperf_tcp_close(lwiperf_state_tcp_t* conn, enum lwiperf_report_type report_typ
       /* don't want to wait for free memory here... */
       tcp_abort(conn->conn_pcb);
     }
-  } else {
+  } else if (conn->server_pcb != NULL) {
     /* no conn pcb, this is the server pcb */
     err = tcp_close(conn->server_pcb);
-    LWIP_ASSERT("error", err != ERR_OK);
+    LWIP_ASSERT("error", err == ERR_OK);
   }
   LWIPERF_FREE(lwiperf_state_tcp_t, conn);
 }
 
+/** Close an iperf tcp session */
+static void
+lwiperf_tcp_close(lwiperf_state_tcp_t* conn, enum lwiperf_report_type report_type)
+{
+  lwip_tcp_conn_report(conn, report_type);
+  lwiperf_list_remove(&conn->base);
+  lwiperf_tcp_free(conn);
+}
+
 /** Try to send more data on an iperf tcp session */
 static err_t
 lwiperf_tcp_client_send_more(lwiperf_state_tcp_t* conn)
@@ -268,7 +278,7 @@ lwiperf_tcp_client_send_more(lwiperf_state_tcp_t* conn)
       /* this session is byte-limited */
       u32_t amount_bytes = htonl(conn->settings.amount);
       /* @todo: this can send up to 1*MSS more than requested... */
-      if (amount_bytes >= conn->bytes_transferred) {
+      if (conn->bytes_transferred >= amount_bytes) {
         /* all requested bytes transferred -> close the connection */
         lwiperf_tcp_close(conn, LWIPERF_TCP_DONE_CLIENT);
         return ERR_OK;
@@ -344,6 +354,7 @@ lwiperf_tcp_client_connected(void *arg, struct tcp_pcb *tpcb, err_t err)
   }
   conn->poll_count = 0;
   conn->time_started = sys_now();
+  lwip_tcp_conn_report(conn, LWIPERF_TCP_STARTED);
   return lwiperf_tcp_client_send_more(conn);
 }
 
@@ -506,6 +517,9 @@ lwiperf_tcp_err(void *arg, err_t err)
 {
   lwiperf_state_tcp_t* conn = (lwiperf_state_tcp_t*)arg;
   LWIP_UNUSED_ARG(err);
+  /* the pcb is already freed, don't close it again */
+  conn->conn_pcb = NULL;
+  conn->server_pcb = NULL;
   lwiperf_tcp_close(conn, LWIPERF_TCP_ABORTED_REMOTE);
 }
 
@@ -518,6 +532,7 @@ lwiperf_tcp_poll(void *arg, struct tcp_pcb *tpcb)
   LWIP_UNUSED_ARG(tpcb);
   if (++conn->poll_count >= LWIPERF_TCP_MAX_IDLE_SEC) {
     lwiperf_tcp_close(conn, LWIPERF_TCP_ABORTED_LOCAL);
+    return ERR_OK; /* conn is freed */
   }
 
   if (!conn->base.server) {
@@ -558,6 +573,7 @@ lwiperf_tcp_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
   tcp_err(conn->conn_pcb, lwiperf_tcp_err);
 
   lwiperf_list_add(&conn->base);
+  lwip_tcp_conn_report(conn, LWIPERF_TCP_STARTED);
   return ERR_OK;
 }
 
@@ -619,7 +635,62 @@ lwiperf_start_tcp_server(const ip_addr_t* local_addr, u16_t local_port,
   return s;
 }
 
-/** Abort an iperf session (handle returned by lwiperf_start_tcp_server*()) */
+/** Start a TCP iperf client to an iperf server at a specific IP address and
+ * port, sending for duration_sec seconds (iperf -c remote -t duration_sec).
+ * The report function is called with LWIPERF_TCP_DONE_CLIENT when the time is
+ * up or with one of the ABORTED codes; the handle is invalid after that.
+ *
+ * @returns a connection handle that can be used to abort the client
+ *          by calling @ref lwiperf_abort()
+ */
+void*
+lwiperf_start_tcp_client(const ip_addr_t* remote_addr, u16_t remote_port, u32_t duration_sec,
+  lwiperf_report_fn report_fn, void* report_arg)
+{
+  err_t err;
+  lwiperf_state_tcp_t* client_conn;
+  struct tcp_pcb* newpcb;
+
+  client_conn = (lwiperf_state_tcp_t*)LWIPERF_ALLOC(lwiperf_state_tcp_t);
+  if (client_conn == NULL) {
+    return NULL;
+  }
+  newpcb = tcp_new();
+  if (newpcb == NULL) {
+    LWIPERF_FREE(lwiperf_state_tcp_t, client_conn);
+    return NULL;
+  }
+
+  memset(client_conn, 0, sizeof(lwiperf_state_tcp_t));
+  client_conn->base.tcp = 1;
+  client_conn->base.server = 0;
+  client_conn->conn_pcb = newpcb;
+  client_conn->time_started = sys_now();
+  client_conn->report_fn = report_fn;
+  client_conn->report_arg = report_arg;
+  client_conn->next_num = 4; /* initial nr is '4' since the header has 24 byte */
+  /* iperf2 header: no answer test, time-limited (unit is 10ms) */
+  client_conn->settings.flags = 0;
+  client_conn->settings.num_threads = PP_HTONL(1);
+  client_conn->settings.remote_port = PP_HTONL(LWIPERF_TCP_PORT_DEFAULT);
+  client_conn->settings.amount = htonl((u32_t)-(s32_t)(duration_sec * 100U));
+
+  tcp_arg(newpcb, client_conn);
+  tcp_sent(newpcb, lwiperf_tcp_client_sent);
+  tcp_poll(newpcb, lwiperf_tcp_poll, 2U);
+  tcp_err(newpcb, lwiperf_tcp_err);
+
+  err = tcp_connect(newpcb, remote_addr, remote_port, lwiperf_tcp_client_connected);
+  if (err != ERR_OK) {
+    lwiperf_tcp_free(client_conn);
+    return NULL;
+  }
+  lwiperf_list_add(&client_conn->base);
+  return client_conn;
+}
+
+/** Abort an iperf session (handle returned by lwiperf_start_tcp_server*() or
+ * lwiperf_start_tcp_client()), without calling its report function */
 void
 lwiperf_abort(void* lwiperf_session)
 {
@@ -631,8 +702,10 @@ lwiperf_abort(void* lwiperf_session)
       i = i->next;
       if (last != NULL) {
         last->next = i;
+      } else {
+        lwiperf_all_connections = i;
       }
-      LWIPERF_FREE(lwiperf_state_tcp_t, dealloc); /* TODO: type? */
+      lwiperf_tcp_free((lwiperf_state_tcp_t*)dealloc);
     } else {
       last = i;
       i = i->next;
@@ -66,19 +66,6 @@ extern "C" {
 #define SNMP_VERSION_1  0
 #define SNMP_VERSION_2c 1
 
-struct snmp_varbind
-{
-  /* object identifier */
-  struct snmp_obj_id oid;
-
-  /* value ASN1 type */
-  u8_t type;
-  /* object value length */
-  u16_t value_len;
-  /* object value */
-  void *value;
-};
-
 struct snmp_varbind_enumerator
 {
   struct snmp_pbuf_stream pbuf_stream;
@@ -140,6 +127,8 @@ struct snmp_request
 extern const char *snmp_community;
 /** Agent community string for write access */
 extern const char *snmp_community_write;
+/** Handle (netconn or udp_pcb) the agent sends traps with, set when the agent starts */
+extern void *snmp_traps_handle;
 
 void snmp_receive(void *handle, struct pbuf *p, const ip_addr_t *source_ip, u16_t port);
 err_t snmp_sendto(void *handle, struct pbuf *p, const ip_addr_t *dst, u16_t port);
@@ -41,6 +41,8 @@
 #include "snmp_msg.h"
 #include "lwip/sys.h"
 
+#include <string.h>
+
 /** SNMP netconn API worker thread */
 static void
 snmp_netconn_thread(void *arg)
@@ -53,9 +55,8 @@ snmp_netconn_thread(void *arg)
   conn = netconn_new(NETCONN_UDP);
   LWIP_ERROR("snmp_netconn: invalid conn", (conn != NULL), return;);
   
-  /*trap_msg.handle = conn;*/
-  /*trap_msg.lip = &conn->pcb.udp->local_ip;*/
-  
+  snmp_traps_handle = conn;
+
   /* Bind to SNMP port with default IP address */
   netconn_bind(conn, IP_ADDR_ANY, SNMP_IN_PORT);  
 
@@ -73,8 +73,7 @@ snmp_init(void)
 
 #if LWIP_IPV4
   if (snmp_pcb_4 != NULL) {
-    /*trap_msg.handle = snmp_pcb;*/
-    /*trap_msg.lip = &snmp_pcb->local_ip;*/
+    snmp_traps_handle = snmp_pcb_4;
 
     udp_recv(snmp_pcb_4, snmp_recv, (void *)SNMP_IN_PORT);
     udp_bind(snmp_pcb_4, IP_ADDR_ANY, SNMP_IN_PORT);
@@ -38,10 +38,18 @@
 #include "lwip/apps/snmp.h"
 #include "lwip/apps/snmp_core.h"
 #include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+#include "lwip/sys.h"
+#include "snmp_msg.h"
+#include "snmp_asn1.h"
 
-#define snmp_community_trap snmp_community
-/** Agent community string for sending traps */
-extern const char *snmp_community_trap;
+#include <string.h>
+
+#define TRAP_BUILD_EXEC(code) \
+  if ((code) != ERR_OK) { \
+    LWIP_DEBUGF(SNMP_DEBUG, ("SNMP error during creation of trap frame!: " # code)); \
+    return ERR_ARG; \
+  }
 
 struct snmp_trap_dst
 {
@@ -54,9 +62,6 @@ static struct snmp_trap_dst trap_dst[SNMP_TRAP_DESTINATIONS];
 
 static u8_t snmp_auth_traps_enabled = 0;
 
-/** TRAP message structure */
-/*struct snmp_msg_trap trap_msg;*/
-
 /**
  * Sets enable switch for this trap destination.
  * @param dst_idx index in 0 .. SNMP_TRAP_DESTINATIONS-1
@@ -95,40 +100,285 @@ snmp_get_auth_traps_enabled(void)
   return snmp_auth_traps_enabled;
 }
 
+/**
+ * Counts the octets a varbind takes in a trap.
+ * @param varbind the varbind to count
+ * @param value_len returns the length of the encoded value
+ * @param vb_len returns the length of the VarBind sequence contents
+ * @return ERR_OK, ERR_VAL if the value type cannot be sent in a trap
+ */
+static err_t
+snmp_trap_varbind_cnt(const struct snmp_varbind *varbind, u16_t *value_len, u16_t *vb_len)
+{
+  u16_t oid_len;
+  u8_t  len_len;
+
+  switch (varbind->type) {
+    case SNMP_ASN1_TYPE_INTEGER:
+      snmp_asn1_enc_s32t_cnt(*((s32_t*)varbind->value), value_len);
+      break;
+    case SNMP_ASN1_TYPE_COUNTER:
+    case SNMP_ASN1_TYPE_GAUGE:
+    case SNMP_ASN1_TYPE_TIMETICKS:
+      snmp_asn1_enc_u32t_cnt(*((u32_t*)varbind->value), value_len);
+      break;
+    case SNMP_ASN1_TYPE_OCTET_STRING:
+    case SNMP_ASN1_TYPE_IPADDR:
+    case SNMP_ASN1_TYPE_OPAQUE:
+    case SNMP_ASN1_TYPE_NULL:
+      *value_len = varbind->value_len;
+      break;
+    case SNMP_ASN1_TYPE_OBJECT_ID:
+      snmp_asn1_enc_oid_cnt((u32_t*)varbind->value, varbind->value_len / sizeof(u32_t), value_len);
+      break;
+    default:
+      /* Counter64 does not exist in SNMPv1 */
+      return ERR_VAL;
+  }
+
+  snmp_asn1_enc_oid_cnt(varbind->oid.id, varbind->oid.len, &oid_len);
+  snmp_asn1_enc_length_cnt(oid_len, &len_len);
+  *vb_len = 1 + len_len + oid_len;
+  snmp_asn1_enc_length_cnt(*value_len, &len_len);
+  *vb_len += 1 + len_len + *value_len;
+
+  return ERR_OK;
+}
+
+static err_t
+snmp_trap_varbind_enc(struct snmp_pbuf_stream *pbuf_stream, const struct snmp_varbind *varbind)
+{
+  struct snmp_asn1_tlv tlv;
+  u16_t value_len;
+  u16_t vb_len;
+
+  TRAP_BUILD_EXEC( snmp_trap_varbind_cnt(varbind, &value_len, &vb_len) );
+
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_SEQUENCE, 0, vb_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(pbuf_stream, &tlv) );
+
+  snmp_asn1_enc_oid_cnt(varbind->oid.id, varbind->oid.len, &tlv.value_len);
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_OBJECT_ID, 0, tlv.value_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(pbuf_stream, &tlv) );
+  TRAP_BUILD_EXEC( snmp_asn1_enc_oid(pbuf_stream, varbind->oid.id, varbind->oid.len) );
+
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, varbind->type, 0, value_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(pbuf_stream, &tlv) );
+
+  switch (varbind->type) {
+    case SNMP_ASN1_TYPE_INTEGER:
+      TRAP_BUILD_EXEC( snmp_asn1_enc_s32t(pbuf_stream, value_len, *((s32_t*)varbind->value)) );
+      break;
+    case SNMP_ASN1_TYPE_COUNTER:
+    case SNMP_ASN1_TYPE_GAUGE:
+    case SNMP_ASN1_TYPE_TIMETICKS:
+      TRAP_BUILD_EXEC( snmp_asn1_enc_u32t(pbuf_stream, value_len, *((u32_t*)varbind->value)) );
+      break;
+    case SNMP_ASN1_TYPE_OBJECT_ID:
+      TRAP_BUILD_EXEC( snmp_asn1_enc_oid(pbuf_stream, (u32_t*)varbind->value, varbind->value_len / sizeof(u32_t)) );
+      break;
+    default:
+      if (value_len > 0) {
+        TRAP_BUILD_EXEC( snmp_asn1_enc_raw(pbuf_stream, (u8_t*)varbind->value, value_len) );
+      }
+      break;
+  }
+
+  return ERR_OK;
+}
+
+/**
+ * Encodes a complete SNMPv1 Trap message into p.
+ */
+static err_t
+snmp_trap_enc(struct pbuf *p, const struct snmp_obj_id *eoid, const ip4_addr_t *agent_addr, s32_t generic_trap,
+              s32_t specific_trap, u32_t timestamp, const struct snmp_varbind *varbinds, u16_t num_varbinds,
+              u16_t vbl_len, u16_t pdu_len, u16_t msg_len)
+{
+  struct snmp_pbuf_stream pbuf_stream;
+  struct snmp_asn1_tlv tlv;
+  const char *community = snmp_get_community_trap();
+  u16_t i;
+
+  TRAP_BUILD_EXEC( snmp_pbuf_stream_init(&pbuf_stream, p, 0, p->tot_len) );
+
+  /* 'Message' sequence */
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_SEQUENCE, 0, msg_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+
+  /* version */
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_INTEGER, 0, 1);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+  TRAP_BUILD_EXEC( snmp_asn1_enc_s32t(&pbuf_stream, 1, SNMP_VERSION_1) );
+
+  /* community */
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_OCTET_STRING, 0, (u16_t)strlen(community));
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+  TRAP_BUILD_EXEC( snmp_asn1_enc_raw(&pbuf_stream, (const u8_t*)community, tlv.value_len) );
+
+  /* 'Trap-PDU' sequence */
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, (SNMP_ASN1_CLASS_CONTEXT | SNMP_ASN1_CONTENTTYPE_CONSTRUCTED | SNMP_ASN1_CONTEXT_PDU_TRAP), 0, pdu_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+
+  /* enterprise */
+  snmp_asn1_enc_oid_cnt(eoid->id, eoid->len, &tlv.value_len);
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_OBJECT_ID, 0, tlv.value_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+  TRAP_BUILD_EXEC( snmp_asn1_enc_oid(&pbuf_stream, eoid->id, eoid->len) );
+
+  /* agent-addr */
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_IPADDR, 0, 4);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+  TRAP_BUILD_EXEC( snmp_asn1_enc_raw(&pbuf_stream, (const u8_t*)&agent_addr->addr, 4) );
+
+  /* generic-trap */
+  snmp_asn1_enc_s32t_cnt(generic_trap, &tlv.value_len);
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_INTEGER, 0, tlv.value_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+  TRAP_BUILD_EXEC( snmp_asn1_enc_s32t(&pbuf_stream, tlv.value_len, generic_trap) );
+
+  /* specific-trap */
+  snmp_asn1_enc_s32t_cnt(specific_trap, &tlv.value_len);
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_INTEGER, 0, tlv.value_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+  TRAP_BUILD_EXEC( snmp_asn1_enc_s32t(&pbuf_stream, tlv.value_len, specific_trap) );
+
+  /* time-stamp */
+  snmp_asn1_enc_u32t_cnt(timestamp, &tlv.value_len);
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_TIMETICKS, 0, tlv.value_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+  TRAP_BUILD_EXEC( snmp_asn1_enc_u32t(&pbuf_stream, tlv.value_len, timestamp) );
+
+  /* 'VarBindList' sequence */
+  SNMP_ASN1_SET_TLV_PARAMS(tlv, SNMP_ASN1_TYPE_SEQUENCE, 0, vbl_len);
+  TRAP_BUILD_EXEC( snmp_ans1_enc_tlv(&pbuf_stream, &tlv) );
+
+  for (i = 0; i < num_varbinds; i++) {
+    TRAP_BUILD_EXEC( snmp_trap_varbind_enc(&pbuf_stream, &varbinds[i]) );
+  }
+
+  return ERR_OK;
+}
 
 /**
  * Sends an generic or enterprise specific trap message.
  *
+ * @param eoid points to enterprise object identifier, NULL for the device enterprise oid
  * @param generic_trap is the trap code
- * @param eoid points to enterprise object identifier
  * @param specific_trap used for enterprise traps when generic_trap == 6
- * @return ERR_OK when success, ERR_MEM if we're out of memory
+ * @param varbinds variable bindings sent with the trap, may be NULL
+ * @param num_varbinds number of entries in varbinds
+ * @return ERR_OK when success, ERR_MEM if we're out of memory,
+ *         ERR_CONN if the agent is not running
  *
- * @note the caller is responsible for filling in outvb in the trap_msg
  * @note the use of the enterprise identifier field
  * is per RFC1215.
  * Use .iso.org.dod.internet.mgmt.mib-2.snmp for generic traps
  * and .iso.org.dod.internet.private.enterprises.yourenterprise
  * (sysObjectID) for specific traps.
+ * @note the trap is sent from the calling thread. With SNMP_USE_NETCONN
+ * that must not be the tcpip thread, with SNMP_USE_RAW it must be.
  */
-static err_t
-snmp_send_trap(const struct snmp_obj_id *device_enterprise_oid, s32_t generic_trap, s32_t specific_trap)
+err_t
+snmp_send_trap(const struct snmp_obj_id *eoid, s32_t generic_trap, s32_t specific_trap,
+               const struct snmp_varbind *varbinds, u16_t num_varbinds)
 {
-  LWIP_UNUSED_ARG(device_enterprise_oid);
-  LWIP_UNUSED_ARG(generic_trap);
-  LWIP_UNUSED_ARG(specific_trap);
-  return ERR_OK;
+  struct snmp_trap_dst *td;
+  struct pbuf *p;
+  ip4_addr_t agent_addr;
+  u32_t timestamp;
+  u16_t vbl_len = 0;
+  u16_t pdu_len;
+  u16_t msg_len;
+  u16_t len;
+  u16_t value_len;
+  u8_t len_len;
+  u16_t i;
+  err_t err = ERR_OK;
+
+  if (snmp_traps_handle == NULL) {
+    return ERR_CONN;
+  }
+  if (eoid == NULL) {
+    eoid = snmp_get_device_enterprise_oid();
+  }
+
+  /* sysUpTime is in 1/100 seconds */
+  timestamp = sys_now() / 10;
+
+  /* the agent address is the same for every destination: the default interface */
+  if (netif_default != NULL) {
+    ip4_addr_copy(agent_addr, *netif_ip4_addr(netif_default));
+  } else {
+    ip4_addr_set_zero(&agent_addr);
+  }
+
+  /* count the message from the inside out */
+  for (i = 0; i < num_varbinds; i++) {
+    if (snmp_trap_varbind_cnt(&varbinds[i], &value_len, &len) != ERR_OK) {
+      return ERR_VAL;
+    }
+    snmp_asn1_enc_length_cnt(len, &len_len);
+    vbl_len += 1 + len_len + len;
+  }
+
+  snmp_asn1_enc_oid_cnt(eoid->id, eoid->len, &len);
+  snmp_asn1_enc_length_cnt(len, &len_len);
+  pdu_len = 1 + len_len + len;
+  pdu_len += 1 + 1 + 4;
+  snmp_asn1_enc_s32t_cnt(generic_trap, &len);
+  pdu_len += 1 + 1 + len;
+  snmp_asn1_enc_s32t_cnt(specific_trap, &len);
+  pdu_len += 1 + 1 + len;
+  snmp_asn1_enc_u32t_cnt(timestamp, &len);
+  pdu_len += 1 + 1 + len;
+  snmp_asn1_enc_length_cnt(vbl_len, &len_len);
+  pdu_len += 1 + len_len + vbl_len;
+
+  len = (u16_t)strlen(snmp_get_community_trap());
+  snmp_asn1_enc_length_cnt(len, &len_len);
+  msg_len = 1 + 1 + 1 + 1 + len_len + len;
+  snmp_asn1_enc_length_cnt(pdu_len, &len_len);
+  msg_len += 1 + len_len + pdu_len;
+
+  snmp_asn1_enc_length_cnt(msg_len, &len_len);
+  len = 1 + len_len + msg_len;
+
+  for (i = 0, td = &trap_dst[0]; i < SNMP_TRAP_DESTINATIONS; i++, td++) {
+    if ((td->enable != 0) && !ip_addr_isany(&td->dip)) {
+      p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+      if (p == NULL) {
+        err = ERR_MEM;
+        continue;
+      }
+
+      if (snmp_trap_enc(p, eoid, &agent_addr, generic_trap, specific_trap, timestamp,
+                        varbinds, num_varbinds, vbl_len, pdu_len, msg_len) == ERR_OK) {
+        snmp_stats.outtraps++;
+        snmp_stats.outpkts++;
+        err = snmp_sendto(snmp_traps_handle, p, &td->dip, SNMP_TRAP_PORT);
+      } else {
+        err = ERR_ARG;
+      }
+
+      pbuf_free(p);
+    }
+  }
+
+  return err;
 }
 
-err_t 
+err_t
 snmp_send_trap_generic(s32_t generic_trap)
 {
-  return snmp_send_trap(NULL, generic_trap, 0);
+  static const struct snmp_obj_id oid = { 7, { 1, 3, 6, 1, 2, 1, 11 } };
+  return snmp_send_trap(&oid, generic_trap, 0, NULL, 0);
 }
 
-err_t snmp_send_trap_specific(s32_t specific_trap)
+err_t
+snmp_send_trap_specific(s32_t specific_trap, const struct snmp_varbind *varbinds, u16_t num_varbinds)
 {
-  return snmp_send_trap(NULL, SNMP_GENTRAP_ENTERPRISE_SPECIFIC, specific_trap);
+  return snmp_send_trap(NULL, SNMP_GENTRAP_ENTERPRISE_SPECIFIC, specific_trap, varbinds, num_varbinds);
 }
 
 
@@ -81,6 +81,17 @@
 #define SNTP_RECEIVE_TIME_SIZE      1
 #endif
 
+/* With microseconds and the local transmit time echoed back, take the
+ * round trip out of the server time (RFC 4330 section 5) */
+#if SNTP_CALC_TIME_US && (SNTP_CHECK_RESPONSE >= 2)
+#define SNTP_COMP_ROUNDTRIP         1
+/* microseconds since 1970, signed: the port has no 64-bit lwIP types */
+typedef long long sntp_us_t;
+#define SNTP_US(sec, us)            ((sntp_us_t)(sec) * 1000000 + (us))
+#else
+#define SNTP_COMP_ROUNDTRIP         0
+#endif
+
 
 /* the various debug levels for this file */
 #define SNTP_DEBUG_TRACE        (SNTP_DEBUG | LWIP_DBG_TRACE)
@@ -198,6 +209,51 @@ static ip_addr_t sntp_last_server_address;
 static u32_t sntp_last_timestamp_sent[2];
 #endif /* SNTP_CHECK_RESPONSE >= 2 */
 
+#if SNTP_COMP_ROUNDTRIP
+/** Server receive timestamp of the last response */
+static u32_t sntp_server_receive_timestamp[2];
+/** Local time the last response arrived at */
+static u32_t sntp_local_receive_sec;
+static u32_t sntp_local_receive_us;
+
+/**
+ * Unix seconds of an SNTP seconds field (1900-based, or 2036-based if the MSB is 0)
+ */
+static u32_t
+sntp_unix_secs(u32_t ntp_secs)
+{
+  return (ntp_secs & 0x80000000) ? (ntp_secs - DIFF_SEC_1900_1970) : (ntp_secs + DIFF_SEC_1970_2036);
+}
+
+/**
+ * Move the server transmit time t/us to the time the response arrived:
+ * local receive time + ((T2 - T1) + (T3 - T4)) / 2. A response older than
+ * the receive timeout, or a clock set while it was on its way, is used as is.
+ */
+static void
+sntp_compensate_roundtrip(u32_t *t, u32_t *us)
+{
+  /* the request carried the local time in seconds since 1900 and microseconds */
+  sntp_us_t t1 = SNTP_US(sntp_unix_secs(ntohl(sntp_last_timestamp_sent[0])), ntohl(sntp_last_timestamp_sent[1]));
+  sntp_us_t t2 = SNTP_US(sntp_unix_secs(ntohl(sntp_server_receive_timestamp[0])),
+                         ntohl(sntp_server_receive_timestamp[1]) / 4295);
+  sntp_us_t t3 = SNTP_US(*t, *us);
+  sntp_us_t t4 = SNTP_US(sntp_local_receive_sec, sntp_local_receive_us);
+  sntp_us_t now;
+
+  if ((t4 < t1) || (t4 - t1 > (sntp_us_t)SNTP_RECV_TIMEOUT * 1000)) {
+    LWIP_DEBUGF(SNTP_DEBUG_WARN, ("sntp_compensate_roundtrip: no usable round trip\n"));
+    return;
+  }
+
+  now = t4 + ((t2 - t1) + (t3 - t4)) / 2;
+  LWIP_DEBUGF(SNTP_DEBUG_TRACE, ("sntp_compensate_roundtrip: delay %"S32_F" us\n", (s32_t)((t4 - t1) - (t3 - t2))));
+
+  *t = (u32_t)(now / 1000000);
+  *us = (u32_t)(now % 1000000);
+}
+#endif /* SNTP_COMP_ROUNDTRIP */
+
 /**
  * SNTP processing of received timestamp
  */
@@ -214,6 +270,10 @@ sntp_process(u32_t *receive_timestamp)
 
 #if SNTP_CALC_TIME_US
   u32_t us = ntohl(receive_timestamp[1]) / 4295;
+#if SNTP_COMP_ROUNDTRIP
+  sntp_compensate_roundtrip(&t, &us);
+  tim = t;
+#endif /* SNTP_COMP_ROUNDTRIP */
   SNTP_SET_SYSTEM_TIME_US(t, us);
   /* display local time from GMT time */
   LWIP_DEBUGF(SNTP_DEBUG_TRACE, ("sntp_process: %s, %"U32_F" us", ctime(&tim), us));
@@ -341,6 +401,11 @@ sntp_recv(void *arg, struct udp_pcb* pcb, struct pbuf *p, const ip_addr_t *addr,
   sys_untimeout(sntp_try_next_server, NULL);
   sys_untimeout(sntp_request, NULL);
 
+#if SNTP_COMP_ROUNDTRIP
+  /* arrival time, before the response is parsed */
+  SNTP_GET_SYSTEM_TIME(sntp_local_receive_sec, sntp_local_receive_us);
+#endif /* SNTP_COMP_ROUNDTRIP */
+
   err = ERR_ARG;
 #if SNTP_CHECK_RESPONSE >= 1
   /* check server address and port */
@@ -379,6 +444,9 @@ sntp_recv(void *arg, struct udp_pcb* pcb, struct pbuf *p, const ip_addr_t *addr,
             /* correct answer */
             err = ERR_OK;
             pbuf_copy_partial(p, &receive_timestamp, SNTP_RECEIVE_TIME_SIZE * 4, SNTP_OFFSET_TRANSMIT_TIME);
+#if SNTP_COMP_ROUNDTRIP
+            pbuf_copy_partial(p, &sntp_server_receive_timestamp, 8, SNTP_OFFSET_RECEIVE_TIME);
+#endif /* SNTP_COMP_ROUNDTRIP */
           }
         }
       } else {
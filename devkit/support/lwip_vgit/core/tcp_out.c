@@ -94,6 +94,7 @@
 
 /* Forward declarations.*/
 static err_t tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
+static u8_t tcp_output_segment_busy(struct tcp_seg *seg);
 
 /** Allocate a pbuf and create a tcphdr at p->payload, used for output
  * functions other than the default tcp_output -> tcp_output_segment
@@ -1120,6 +1121,23 @@ tcp_output(struct tcp_pcb *pcb)
   return ERR_OK;
 }
 
+/**
+ * Check whether a segment may not be changed right now: a netif that sends
+ * straight from the pbuf (ethernetif.c) holds a reference to it until the
+ * DMA is done with it, and the headers must not be rewritten meanwhile.
+ * Backported from lwIP 2.x.
+ *
+ * @param seg the tcp_seg to check
+ * @return 1 if the pbuf is still referenced by someone else, 0 if not
+ */
+static u8_t
+tcp_output_segment_busy(struct tcp_seg *seg)
+{
+  /* A driver holding a segment calls pbuf_ref() on it, which only changes
+     the ref count of the first pbuf */
+  return seg->p->ref != 1;
+}
+
 /**
  * Called by tcp_output() to actually send a TCP segment over IP.
  *
@@ -1134,6 +1152,13 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   u32_t *opts;
   struct netif *netif;
 
+  if (tcp_output_segment_busy(seg)) {
+    /* tcp_rexmit*() don't requeue a segment the netif still holds, so this
+       shouldn't happen: leave it to the retransmission timer */
+    LWIP_DEBUGF(TCP_RTO_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_output_segment: segment busy\n"));
+    return ERR_OK;
+  }
+
   /** @bug Exclude retransmitted segments from this count. */
   MIB2_STATS_INC(mib2.tcpoutsegs);
 
@@ -1339,21 +1364,33 @@ tcp_rst(u32_t seqno, u32_t ackno,
 /**
  * Requeue all unacked segments for retransmission
  *
- * Called by tcp_slowtmr() for slow retransmission.
+ * Called by tcp_slowtmr() for slow retransmission, which does the
+ * retransmission with tcp_rexmit_rto_commit() if this succeeds.
  *
  * @param pcb the tcp_pcb for which to re-enqueue all unacked segments
+ * @return ERR_OK if requeued, ERR_VAL if there is nothing to retransmit or
+ *         the netif still holds one of the segments (try again later)
  */
-void
-tcp_rexmit_rto(struct tcp_pcb *pcb)
+err_t
+tcp_rexmit_rto_prepare(struct tcp_pcb *pcb)
 {
   struct tcp_seg *seg;
 
   if (pcb->unacked == NULL) {
-    return;
+    return ERR_VAL;
   }
 
-  /* Move all unacked segments to the head of the unsent queue */
-  for (seg = pcb->unacked; seg->next != NULL; seg = seg->next);
+  /* Move all unacked segments to the head of the unsent queue, unless the
+     netif hasn't sent all of them yet: no point loading a link that is
+     still busy with the first copies */
+  for (seg = pcb->unacked; seg->next != NULL; seg = seg->next) {
+    if (tcp_output_segment_busy(seg)) {
+      return ERR_VAL;
+    }
+  }
+  if (tcp_output_segment_busy(seg)) {
+    return ERR_VAL;
+  }
   /* concatenate unsent queue after unacked queue */
   seg->next = pcb->unsent;
 #if TCP_OVERSIZE_DBGCHECK
@@ -1367,31 +1404,63 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
   /* unacked queue is now empty */
   pcb->unacked = NULL;
 
-  /* increment number of retransmissions */
-  ++pcb->nrtx;
-
   /* Don't take any RTT measurements after retransmitting. */
   pcb->rttest = 0;
 
+  return ERR_OK;
+}
+
+/**
+ * Retransmit the segments requeued by tcp_rexmit_rto_prepare()
+ *
+ * @param pcb the tcp_pcb for which to retransmit the unacked segments
+ */
+void
+tcp_rexmit_rto_commit(struct tcp_pcb *pcb)
+{
+  /* increment number of retransmissions */
+  ++pcb->nrtx;
+
   /* Do the actual retransmission */
   tcp_output(pcb);
 }
 
+/**
+ * Requeue all unacked segments for retransmission and send them
+ *
+ * @param pcb the tcp_pcb for which to re-enqueue all unacked segments
+ */
+void
+tcp_rexmit_rto(struct tcp_pcb *pcb)
+{
+  if (tcp_rexmit_rto_prepare(pcb) == ERR_OK) {
+    tcp_rexmit_rto_commit(pcb);
+  }
+}
+
 /**
  * Requeue the first unacked segment for retransmission
  *
  * Called by tcp_receive() for fast retramsmit.
  *
  * @param pcb the tcp_pcb for which to retransmit the first unacked segment
+ * @return ERR_OK if requeued, ERR_VAL if there is nothing to retransmit or
+ *         the netif still holds the segment
  */
-void
+err_t
 tcp_rexmit(struct tcp_pcb *pcb)
 {
   struct tcp_seg *seg;
   struct tcp_seg **cur_seg;
 
   if (pcb->unacked == NULL) {
-    return;
+    return ERR_VAL;
+  }
+
+  /* Give up if the netif hasn't sent the segment yet, the retransmission
+     timer will try again */
+  if (tcp_output_segment_busy(pcb->unacked)) {
+    return ERR_VAL;
   }
 
   /* Move the first unacked segment to the unsent queue */
@@ -1422,6 +1491,7 @@ tcp_rexmit(struct tcp_pcb *pcb)
   MIB2_STATS_INC(mib2.tcpretranssegs);
   /* No need to call tcp_output: we are always called from tcp_input()
      and thus tcp_output directly returns. */
+  return ERR_OK;
 }
 
 
@@ -1440,7 +1510,9 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
                  "), fast retransmit %"U32_F"\n",
                  (u16_t)pcb->dupacks, pcb->lastack,
                  ntohl(pcb->unacked->tcphdr->seqno)));
-    tcp_rexmit(pcb);
+    if (tcp_rexmit(pcb) != ERR_OK) {
+      return;
+    }
 
     /* Set ssthresh to half of the minimum of the current
      * cwnd and the advertised window */
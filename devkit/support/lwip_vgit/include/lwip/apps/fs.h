@@ -42,6 +42,11 @@ extern "C" {
 #define FS_READ_EOF     -1
 #define FS_READ_DELAYED -2
 
+/** fs_file.flags: the request is HTTP/1.1 */
+#define FS_FILE_FLAGS_HTTP_1_1      0x01
+/** fs_file.flags: the client accepts a persistent connection */
+#define FS_FILE_FLAGS_PERSISTENT    0x02
+
 #if HTTPD_PRECALCULATED_CHECKSUM
 struct fsdata_chksum {
   u32_t offset;
@@ -62,6 +67,7 @@ struct fs_file {
   u8_t http_header_included;
 #if LWIP_HTTPD_CUSTOM_FILES
   u8_t is_custom_file;
+  u8_t flags;
 #endif /* LWIP_HTTPD_CUSTOM_FILES */
 #if LWIP_HTTPD_FILE_STATE
   void *state;
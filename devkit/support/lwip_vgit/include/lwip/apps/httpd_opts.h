@@ -256,6 +256,24 @@
 #define LWIP_HTTPD_DYNAMIC_FILE_READ  0
 #endif
 
+/** Set this to 1 (together with LWIP_HTTPD_CUSTOM_FILES and
+ * LWIP_HTTPD_DYNAMIC_FILE_READ) to let custom files generate their
+ * contents while they are sent, and provide the functions:
+ * - "int fs_read_custom(struct fs_file *file, char *buffer, int count)"
+ *    Called instead of copying from file->data, returns the number of
+ *    bytes written to buffer or FS_READ_EOF.
+ * - "int fs_bytes_left_custom(struct fs_file *file)"
+ *    Returns > 0 while the file has more data; the value is used as a
+ *    hint for the size of the read buffer.
+ * The length of such files need not be known in advance. httpd passes the
+ * request's HTTP version and connection preference in file->flags before
+ * fs_open(); a custom file clears FS_FILE_FLAGS_PERSISTENT to have the
+ * connection closed after its response.
+ */
+#ifndef LWIP_HTTPD_CUSTOM_FILES_READ
+#define LWIP_HTTPD_CUSTOM_FILES_READ  0
+#endif
+
 /** Set this to 1 to include an application state argument per file
  * that is opened. This allows to keep a state per connection/file.
  */
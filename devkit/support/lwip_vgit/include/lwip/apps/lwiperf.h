@@ -57,7 +57,9 @@ enum lwiperf_report_type
 };
 
 /** Prototype of a report function that is called when a session is finished.
-    This report function can show the test results. */
+    This report function can show the test results. It is also called with
+    LWIPERF_TCP_STARTED when a TCP connection is accepted or connected.
+    The addresses are NULL if the connection was reset. */
 typedef void (*lwiperf_report_fn)(void *arg, enum lwiperf_report_type report_type,
   const ip_addr_t* local_addr, u16_t local_port, const ip_addr_t* remote_addr, u16_t remote_port,
   u32_t bytes_transferred, u32_t ms_duration, u32_t bandwidth_kbitpsec);
@@ -66,6 +68,8 @@ typedef void (*lwiperf_report_fn)(void *arg, enum lwiperf_report_type report_typ
 void* lwiperf_start_tcp_server(const ip_addr_t* local_addr, u16_t local_port,
                                lwiperf_report_fn report_fn, void* report_arg);
 void* lwiperf_start_tcp_server_default(lwiperf_report_fn report_fn, void* report_arg);
+void* lwiperf_start_tcp_client(const ip_addr_t* remote_addr, u16_t remote_port, u32_t duration_sec,
+                               lwiperf_report_fn report_fn, void* report_arg);
 void  lwiperf_abort(void* lwiperf_session);
 
 
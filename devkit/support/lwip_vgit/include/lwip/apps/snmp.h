@@ -75,8 +75,10 @@ void snmp_trap_dst_ip_set(u8_t dst_idx, const ip_addr_t *dst);
 #define SNMP_GENTRAP_AUTH_FAILURE 4
 #define SNMP_GENTRAP_EGP_NEIGHBOR_LOSS 5
 #define SNMP_GENTRAP_ENTERPRISE_SPECIFIC 6
+err_t snmp_send_trap(const struct snmp_obj_id* eoid, s32_t generic_trap, s32_t specific_trap,
+                     const struct snmp_varbind *varbinds, u16_t num_varbinds);
 err_t snmp_send_trap_generic(s32_t generic_trap);
-err_t snmp_send_trap_specific(s32_t specific_trap);
+err_t snmp_send_trap_specific(s32_t specific_trap, const struct snmp_varbind *varbinds, u16_t num_varbinds);
 
 #define SNMP_AUTH_TRAPS_DISABLED 0
 #define SNMP_AUTH_TRAPS_ENABLED  1
@@ -143,6 +143,19 @@ union snmp_variant_value
   s32_t s32;
 };
 
+struct snmp_varbind
+{
+  /* object identifier */
+  struct snmp_obj_id oid;
+
+  /* value ASN1 type */
+  u8_t type;
+  /* object value length */
+  u16_t value_len;
+  /* object value */
+  void *value;
+};
+
 
 /**
 SNMP MIB node types
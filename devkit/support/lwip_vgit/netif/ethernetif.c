@@ -44,17 +44,23 @@
 #include "lwip/stats.h"
 #include "lwip/snmp.h"
 #include "lwip/ethip6.h"
+#include "lwip/igmp.h"
 #include "netif/etharp.h"
 #include "netif/ppp/pppoe.h"
 
 #include "main.h"
 #include "stm32f4x7_eth.h"
+#include "ethernetif.h"
+#include "dwt.h"
+#include <string.h>
 
 /* Define those to better describe your network interface. */
 #define IFNAME0 's'
 #define IFNAME1 't'
 
-#define netifINTERFACE_TASK_STACK_SIZE		( 350 )
+/* Received frames are processed up to the application in this task (core
+   locking input), so it needs the stack the tcpip thread has */
+#define netifINTERFACE_TASK_STACK_SIZE		( TCPIP_THREAD_STACKSIZE )
 
 #define netifINTERFACE_TASK_PRIORITY		osPriorityHigh
 
@@ -63,8 +69,82 @@
 /* The time to block waiting for input. */
 #define emacBLOCK_TIME_WAITING_FOR_INPUT	( ( portTickType ) 100 )
 
+/* Extra receive buffers on top of the ones owned by the DMA descriptors. A
+   received frame is passed up the stack in the buffer the DMA wrote it to
+   and the descriptor gets a spare one; the buffer becomes a spare again when
+   the stack frees the pbuf. Frames are copied to the pbuf pool as before
+   while no spare is available or if they span several descriptors. */
+#define ETH_RX_SPARE_BUFNB                  6
+
+/* Receive interrupts are coalesced: descriptors don't interrupt on
+   completion, the DMA raises the receive interrupt once the watchdog
+   (units of 256 HCLK cycles, ~1.5 us at 168 MHz) expires after a frame.
+   The ISR then masks it until the input task has emptied the ring, handing
+   at most ETH_RX_BATCH frames to the stack before letting other tasks at
+   the same priority run. */
+#define ETH_RX_WATCHDOG                     64
+#define ETH_RX_BATCH                        ETH_RXBUFNB
+
+/* The MAC only accepts frames to our address, broadcasts and the multicast
+   groups joined through IGMP. Broadcasts can only be let through as a whole
+   (ARP and DHCP need them), low_level_input drops the ones that are neither
+   ARP nor IPv4 UDP before they take a pbuf. */
+#define ETH_TYPE_OFFSET                     12
+#define ETH_IP_PROTO_OFFSET                 (14 + 9)
+
+#if LWIP_IGMP
+/* Joined multicast groups by MAC address, which several group addresses can
+   share. The first ETH_FILTER_PERFECT_NB use the perfect address filters
+   1-3, the others set their bin of the 64 bin hash filter (which also lets
+   through any other multicast that hashes to the same bin). */
+#define ETH_FILTER_PERFECT_NB               3
+#define ETH_FILTER_GROUPS                   MEMP_NUM_IGMP_GROUP
+
+struct eth_filter_group {
+  u8_t mac[ETHARP_HWADDR_LEN];
+  u8_t refs;
+};
+
+static struct eth_filter_group ethFilterGroups[ETH_FILTER_GROUPS];
+static const uint32_t ethFilterPerfect[ETH_FILTER_PERFECT_NB] = { ETH_MAC_Address1, ETH_MAC_Address2, ETH_MAC_Address3 };
+#endif /* LWIP_IGMP */
+
 static struct netif *s_pxNetIf = NULL;
 xSemaphoreHandle s_xSemaphore = NULL;
+
+struct eth_rx_buffer {
+  struct pbuf_custom pc;        /* must be first: pbuf_free hands us the pbuf */
+  u8_t *data;
+};
+
+/* Rx_Buff backs the first ETH_RXBUFNB buffers, the spares are allocated here */
+static uint32_t Rx_Spare_Buff[ETH_RX_SPARE_BUFNB][ETH_RX_BUF_SIZE / 4];
+static struct eth_rx_buffer rxBuffers[ETH_RXBUFNB + ETH_RX_SPARE_BUFNB];
+static struct eth_rx_buffer *rxDescBuffer[ETH_RXBUFNB];        /* buffer behind each descriptor */
+static struct eth_rx_buffer *rxFreeBuffers[ETH_RX_SPARE_BUFNB];
+static u8_t rxFreeCount;
+
+static struct ethernetif_rx_stats rxStats;
+static volatile uint32_t rxIrqStamp;            /* DWT cycle count at the last RX interrupt */
+static portTickType rxStatsSince;               /* tick count when the stats were cleared */
+static uint32_t rxBusyCycles;                   /* busy time not yet counted in rxStats.busy_us */
+
+/* Transmit descriptors point straight at the pbuf payloads, one descriptor per
+   pbuf of the chain. The chain is referenced by the frame's last descriptor
+   until the DMA hands it back, then low_level_output frees it the next time
+   it runs, or the input task when it wakes up (so at most ETH_TXBUFNB frames
+   are held). Chains with pbufs that may change under the DMA
+   (PBUF_REF/PBUF_ROM) or too many pbufs are copied into the descriptor's own
+   Tx_Buff as before. TCP segments go out in place too: they stay on the
+   unacked queue, and lwIP doesn't retransmit (rewrite the headers of) one
+   whose pbuf is still referenced here, see tcp_output_segment_busy(). */
+static xSemaphoreHandle s_xTxMutex = NULL;
+xSemaphoreHandle s_xTxDoneSemaphore = NULL;    /* given by ETH_IRQHandler */
+static struct pbuf *txPbuf[ETH_TXBUFNB];
+static ETH_DMADESCTypeDef *DMATxDescToClean;
+static u8_t txFreeDesc;
+
+static struct ethernetif_tx_stats txStats;
           
 struct ethernetif {
   struct eth_addr *ethaddr;
@@ -90,6 +170,14 @@ extern ETH_DMA_Rx_Frame_infos *DMA_RX_FRAME_infos;
 /* Forward declarations. */
 static void  ethernetif_input(struct netif *netif);
 static void  arp_timer(void *arg);
+static void  rx_buffers_init(void);
+static void  rx_pbuf_free(struct pbuf *p);
+static u8_t  rx_frame_wanted(const u8_t *frame, u16_t len);
+static void  tx_reclaim(void);
+static void  tx_reclaim_if_idle(void);
+#if LWIP_IGMP
+static err_t ethernetif_igmp_mac_filter(struct netif *netif, const ip4_addr_t *group, u8_t action);
+#endif /* LWIP_IGMP */
 
 /**
  * In this function, the hardware should be initialized.
@@ -122,6 +210,17 @@ low_level_init(struct netif *netif)
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
     netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP;
 
+#ifdef CHECKSUM_BY_HARDWARE
+    /* the MAC inserts and checks the IP, UDP, TCP and ICMP checksums */
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_DISABLE_ALL);
+#endif
+
+#if LWIP_IGMP
+    /* IGMP asks for the multicast groups it joins to be let through */
+    netif->flags |= NETIF_FLAG_IGMP;
+    netif_set_igmp_mac_filter(netif, ethernetif_igmp_mac_filter);
+#endif /* LWIP_IGMP */
+
 #if LWIP_IPV6 && LWIP_IPV6_MLD
     /*
     * For hardware/netifs that implement MAC filtering.
@@ -142,7 +241,20 @@ low_level_init(struct netif *netif)
     /* create binary semaphore used for informing ethernetif of frame reception */
     if (s_xSemaphore == NULL)
     {
-        s_xSemaphore= xSemaphoreCreateCounting(20,0);
+        vSemaphoreCreateBinary(s_xSemaphore);
+        xSemaphoreTake(s_xSemaphore, 0);
+    }
+
+    /* transmit path: serialises low_level_output, and wakes it up when the
+       DMA completes a frame while it is waiting for descriptors */
+    if (s_xTxMutex == NULL)
+    {
+        vSemaphoreCreateBinary(s_xTxMutex);
+    }
+    if (s_xTxDoneSemaphore == NULL)
+    {
+        vSemaphoreCreateBinary(s_xTxDoneSemaphore);
+        xSemaphoreTake(s_xTxDoneSemaphore, 0);
     }
 
     /* initialize MAC address in ethernet MAC */ 
@@ -150,15 +262,22 @@ low_level_init(struct netif *netif)
 
     /* Initialize Tx Descriptors list: Chain Mode */
     ETH_DMATxDescChainInit(DMATxDscrTab, &Tx_Buff[0][0], ETH_TXBUFNB);
+    DMATxDescToClean = DMATxDscrTab;
+    txFreeDesc = ETH_TXBUFNB;
     /* Initialize Rx Descriptors list: Chain Mode  */
     ETH_DMARxDescChainInit(DMARxDscrTab, &Rx_Buff[0][0], ETH_RXBUFNB);
+    rx_buffers_init();
 
-    /* Enable Ethernet Rx interrrupt */
+    /* Cycle counter for the receive path statistics */
+    DWT_CYCCNT_START();
+
+    /* Rx interrupt from the receive watchdog rather than per descriptor */
     { 
         for(i = 0; i < ETH_RXBUFNB; i++)
         {
-            ETH_DMARxDescReceiveITConfig(&DMARxDscrTab[i], ENABLE);
+            ETH_DMARxDescReceiveITConfig(&DMARxDscrTab[i], DISABLE);
         }
+        ETH_SetReceiveWatchdogTimer(ETH_RX_WATCHDOG);
     }
 
 #ifdef CHECKSUM_BY_HARDWARE
@@ -173,7 +292,10 @@ low_level_init(struct netif *netif)
   
     /* create the task that handles the ETH_MAC */
     osThreadDef(TNAME, (os_pthread)ethernetif_input, netifINTERFACE_TASK_PRIORITY, 1, netifINTERFACE_TASK_STACK_SIZE);
-    osThreadCreate(osThread(TNAME), NULL);
+    if (osThreadCreate(osThread(TNAME), NULL) == NULL)
+    {
+        LWIP_ASSERT("ethernetif: no heap for the input task", 0);
+    }
   
     /* Enable MAC and DMA transmission and reception */
     ETH_Start();
@@ -198,31 +320,166 @@ low_level_init(struct netif *netif)
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-    static xSemaphoreHandle xTxSemaphore = NULL;
     struct pbuf *q;
+    ETH_DMADESCTypeDef *first, *last, *desc;
+    uint32_t start = DWT->CYCCNT;
+    uint32_t segments = 0;
+    uint32_t needed;
     uint32_t l = 0;
-    u8 *buffer ;
+    u8_t zero_copy = 1;
+    u8 *buffer;
 
-    if (xTxSemaphore == NULL)
+    for (q = p; q != NULL; q = q->next)
     {
-        vSemaphoreCreateBinary (xTxSemaphore);
-    } 
+        if (q->len == 0)
+        {
+            continue;
+        }
+        segments++;
+        if (q->type != PBUF_RAM && q->type != PBUF_POOL && !(q->flags & PBUF_FLAG_IS_CUSTOM))
+        {
+            zero_copy = 0;
+        }
+    }
+    if (segments == 0 || segments > ETH_TXBUFNB)
+    {
+        zero_copy = 0;
+    }
+    needed = zero_copy ? segments : 1;
 
-    if (xSemaphoreTake(xTxSemaphore, netifGUARD_BLOCK_TIME))
+    if (xSemaphoreTake(s_xTxMutex, netifGUARD_BLOCK_TIME) != pdTRUE)
     {
-        buffer =  (u8 *)(DMATxDescToSet->Buffer1Addr);
-        for(q = p; q != NULL; q = q->next) 
+        txStats.dropped++;
+        LINK_STATS_INC(link.drop);
+        return ERR_OK;
+    }
+
+    /* Wait for the DMA to release enough descriptors instead of dropping
+       the frame while a burst is going out */
+    tx_reclaim();
+    while (txFreeDesc < needed)
+    {
+        txStats.waits++;
+        if (xSemaphoreTake(s_xTxDoneSemaphore, netifGUARD_BLOCK_TIME) != pdTRUE)
+        {
+            break;
+        }
+        tx_reclaim();
+    }
+
+    if (txFreeDesc < needed || (!zero_copy && p->tot_len > ETH_TX_BUF_SIZE))
+    {
+        txStats.dropped++;
+        LINK_STATS_INC(link.drop);
+        xSemaphoreGive(s_xTxMutex);
+        return ERR_OK;
+    }
+
+    first = (ETH_DMADESCTypeDef *)DMATxDescToSet;
+    last = first;
+    desc = first;
+
+    if (zero_copy)
+    {
+        for (q = p; q != NULL; q = q->next)
+        {
+            if (q->len == 0)
+            {
+                continue;
+            }
+            desc->Buffer1Addr = (uint32_t)q->payload;
+            desc->ControlBufferSize = q->len & ETH_DMATxDesc_TBS1;
+            desc->Status &= ~(ETH_DMATxDesc_FS | ETH_DMATxDesc_LS | ETH_DMATxDesc_IC);
+            last = desc;
+            desc = (ETH_DMADESCTypeDef *)desc->Buffer2NextDescAddr;
+        }
+
+        pbuf_ref(p);
+        txPbuf[last - DMATxDscrTab] = p;
+        txStats.zero_copy++;
+    }
+    else
+    {
+        buffer = (u8 *)first->Buffer1Addr;
+        for (q = p; q != NULL; q = q->next)
         {
             memcpy((u8_t*)&buffer[l], q->payload, q->len);
             l = l + q->len;
         }
-        ETH_Prepare_Transmit_Descriptors(l);
-        xSemaphoreGive(xTxSemaphore);
+        first->ControlBufferSize = l & ETH_DMATxDesc_TBS1;
+        first->Status &= ~(ETH_DMATxDesc_FS | ETH_DMATxDesc_LS | ETH_DMATxDesc_IC);
+        desc = (ETH_DMADESCTypeDef *)first->Buffer2NextDescAddr;
+        txStats.copied++;
     }
 
+    first->Status |= ETH_DMATxDesc_FS;
+    last->Status |= ETH_DMATxDesc_LS | ETH_DMATxDesc_IC;
+
+    /* Hand the segments to the DMA back to front so it can't start on a
+       partially set up frame */
+    for (last = (ETH_DMADESCTypeDef *)first->Buffer2NextDescAddr; last != desc; last = (ETH_DMADESCTypeDef *)last->Buffer2NextDescAddr)
+    {
+        last->Status |= ETH_DMATxDesc_OWN;
+    }
+    first->Status |= ETH_DMATxDesc_OWN;
+
+    DMATxDescToSet = desc;
+    txFreeDesc -= needed;
+
+    /* When Tx Buffer unavailable flag is set: clear it and resume transmission */
+    if ((ETH->DMASR & ETH_DMASR_TBUS) != (u32)RESET)
+    {
+        ETH->DMASR = ETH_DMASR_TBUS;
+        ETH->DMATPDR = 0;
+    }
+
+    txStats.frames++;
+    txStats.bytes += p->tot_len;
+    txStats.cycles += DWT->CYCCNT - start;
+
+    xSemaphoreGive(s_xTxMutex);
+
     return ERR_OK;
 }
 
+/**
+ * Take back the descriptors the DMA is done with, dropping the reference to
+ * the pbuf chain they were sending. Called with s_xTxMutex held.
+ */
+static void tx_reclaim(void)
+{
+    uint32_t i;
+
+    while (txFreeDesc < ETH_TXBUFNB && (DMATxDescToClean->Status & ETH_DMATxDesc_OWN) == (uint32_t)RESET)
+    {
+        i = DMATxDescToClean - DMATxDscrTab;
+
+        if (txPbuf[i] != NULL)
+        {
+            pbuf_free(txPbuf[i]);
+            txPbuf[i] = NULL;
+        }
+        DMATxDescToClean->Buffer1Addr = (uint32_t)Tx_Buff[i];
+
+        DMATxDescToClean = (ETH_DMADESCTypeDef *)DMATxDescToClean->Buffer2NextDescAddr;
+        txFreeDesc++;
+    }
+}
+
+/**
+ * Free what the DMA has sent without waiting for the next frame to go out,
+ * so TCP can retransmit those segments. Skipped while low_level_output runs,
+ * it reclaims itself.
+ */
+static void tx_reclaim_if_idle(void)
+{
+    if (xSemaphoreTake(s_xTxMutex, 0) == pdTRUE)
+    {
+        tx_reclaim();
+        xSemaphoreGive(s_xTxMutex);
+    }
+}
+
 /**
  * Should allocate a pbuf and transfer the bytes of the incoming
  * packet from the interface into the pbuf.
@@ -237,57 +494,93 @@ static struct pbuf * low_level_input(struct netif *netif)
     struct pbuf *p, *q;
     u16_t len;
     uint32_t l=0,i =0;
+    uint32_t start = DWT->CYCCNT;
+    uint32_t cycles;
     FrameTypeDef frame;
     u8 *buffer;
     __IO ETH_DMADESCTypeDef *DMARxNextDesc;
+    struct eth_rx_buffer *rx, *spare = NULL;
     
     p = NULL;
     
     /* Get received frame */
     frame = ETH_Get_Received_Frame_interrupt();
     
-    if ((frame.descriptor->Status & ETH_DMARxDesc_ES) == (uint32_t)RESET)
+    if (frame.descriptor == NULL)
+    {
+        return NULL;
+    }
+    
+    if ((frame.descriptor->Status & ETH_DMARxDesc_ES) == (uint32_t)RESET &&
+        !rx_frame_wanted((u8_t *)frame.buffer, frame.length))
+    {
+        /* Broadcast nothing here listens to, recycle the descriptor */
+        rxStats.filtered++;
+    }
+    else if ((frame.descriptor->Status & ETH_DMARxDesc_ES) == (uint32_t)RESET)
     {
         /* Obtain the size of the packet and put it into the "len"
          variable. */
         len = frame.length;
         buffer = (u8 *)frame.buffer;
-        
+
+#if !ETH_PAD_SIZE
+        /* Zero copy: swap a spare buffer into the descriptor and pass the
+           filled one up the stack. It comes back through rx_pbuf_free. */
+        if (DMA_RX_FRAME_infos->Seg_Count == 1)
+        {
+            taskENTER_CRITICAL();
+            if (rxFreeCount > 0)
+            {
+                spare = rxFreeBuffers[--rxFreeCount];
+            }
+            taskEXIT_CRITICAL();
+        }
+
+        if (spare != NULL)
+        {
+            rx = rxDescBuffer[frame.descriptor - DMARxDscrTab];
+            rxDescBuffer[frame.descriptor - DMARxDscrTab] = spare;
+            frame.descriptor->Buffer1Addr = (uint32_t)spare->data;
+
+            p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &rx->pc, rx->data, ETH_RX_BUF_SIZE);
+            rxStats.zero_copy++;
+        }
+        else
+#endif
+        {
 #if ETH_PAD_SIZE
-        len += ETH_PAD_SIZE; /* allow room for Ethernet padding */
+            len += ETH_PAD_SIZE; /* allow room for Ethernet padding */
 #endif
 
-        /* We allocate a pbuf chain of pbufs from the pool. */
-        p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
-        /* Copy received frame from ethernet driver buffer to stack buffer */
-        if (p != NULL) {
+            /* We allocate a pbuf chain of pbufs from the pool. */
+            p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+            /* Copy received frame from ethernet driver buffer to stack buffer */
+            if (p != NULL) {
 
 #if ETH_PAD_SIZE
-            pbuf_header(p, -ETH_PAD_SIZE); /* drop the padding word */
+                pbuf_header(p, -ETH_PAD_SIZE); /* drop the padding word */
 #endif
 
-            /* We iterate over the pbuf chain until we have read the entire
-             * packet into the pbuf. */
-            for (q = p; q != NULL; q = q->next) {
-              /* Read enough bytes to fill this pbuf in the chain. The
-               * available data in the pbuf is given by the q->len
-               * variable.
-               * This does not necessarily have to be a memcpy, you can also preallocate
-               * pbufs for a DMA-enabled MAC and after receiving truncate it to the
-               * actually received size. In this case, ensure the tot_len member of the
-               * pbuf is the sum of the chained pbuf len members.
-               */
-                memcpy((u8_t*)q->payload, (u8_t*)&buffer[l], q->len);
-                l = l + q->len;
-            }
+                /* We iterate over the pbuf chain until we have read the entire
+                 * packet into the pbuf. */
+                for (q = p; q != NULL; q = q->next) {
+                    memcpy((u8_t*)q->payload, (u8_t*)&buffer[l], q->len);
+                    l = l + q->len;
+                }
 
 #if ETH_PAD_SIZE
-            pbuf_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
+                pbuf_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
 #endif
+                rxStats.copied++;
+            }
+        }
 
+        if (p != NULL) {
             LINK_STATS_INC(link.recv);
         } else {
             //drop packet();
+            rxStats.dropped++;
             LINK_STATS_INC(link.memerr);
             LINK_STATS_INC(link.drop);
         }
@@ -324,10 +617,107 @@ static struct pbuf * low_level_input(struct netif *netif)
         /* Resume DMA reception */
         ETH->DMARPDR = 0;
     }
+
+    cycles = DWT->CYCCNT - start;
+    rxStats.frames++;
+    rxStats.cycles += cycles;
+    if (cycles > rxStats.max_cycles)
+    {
+        rxStats.max_cycles = cycles;
+    }
     
   return p;
 }
 
+/**
+ * Whether a frame the MAC accepted is worth passing up the stack: anything
+ * addressed to us or to a joined group, but of the broadcasts only ARP and
+ * IPv4 UDP (DHCP).
+ */
+static u8_t rx_frame_wanted(const u8_t *frame, u16_t len)
+{
+    u16_t type;
+
+    if (len <= ETH_IP_PROTO_OFFSET || memcmp(frame, ethbroadcast.addr, ETHARP_HWADDR_LEN) != 0)
+    {
+        return 1;
+    }
+
+    type = (frame[ETH_TYPE_OFFSET] << 8) | frame[ETH_TYPE_OFFSET + 1];
+
+    return type == ETHTYPE_ARP || (type == ETHTYPE_IP && frame[ETH_IP_PROTO_OFFSET] == IP_PROTO_UDP);
+}
+
+/**
+ * Give every descriptor a buffer from rxBuffers and put the rest on the
+ * free list. Called after ETH_DMARxDescChainInit.
+ */
+static void rx_buffers_init(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < ETH_RXBUFNB + ETH_RX_SPARE_BUFNB; i++)
+    {
+        rxBuffers[i].pc.custom_free_function = rx_pbuf_free;
+        rxBuffers[i].data = (i < ETH_RXBUFNB) ? Rx_Buff[i] : (u8_t *)Rx_Spare_Buff[i - ETH_RXBUFNB];
+    }
+
+    for (i = 0; i < ETH_RXBUFNB; i++)
+    {
+        rxDescBuffer[i] = &rxBuffers[i];
+        DMARxDscrTab[i].Buffer1Addr = (uint32_t)rxBuffers[i].data;
+    }
+
+    for (i = 0; i < ETH_RX_SPARE_BUFNB; i++)
+    {
+        rxFreeBuffers[i] = &rxBuffers[ETH_RXBUFNB + i];
+    }
+    rxFreeCount = ETH_RX_SPARE_BUFNB;
+}
+
+/**
+ * Called by pbuf_free (from whichever task drops the last reference) once
+ * the stack is done with a zero copy receive buffer.
+ */
+static void rx_pbuf_free(struct pbuf *p)
+{
+    taskENTER_CRITICAL();
+    rxFreeBuffers[rxFreeCount++] = (struct eth_rx_buffer *)p;
+    taskEXIT_CRITICAL();
+}
+
+void ethernetif_get_rx_stats(struct ethernetif_rx_stats *out)
+{
+    uint32_t missed;
+
+    taskENTER_CRITICAL();
+    /* Both missed frame counters clear when the register is read */
+    missed = ETH->DMAMFBOCR;
+    rxStats.missed += (missed & ETH_DMAMFBOCR_MFC) + ((missed & ETH_DMAMFBOCR_MFA) >> 17);
+    *out = rxStats;
+    out->spare_buffers = rxFreeCount;
+    out->elapsed_ms = (xTaskGetTickCount() - rxStatsSince) * portTICK_RATE_MS;
+    taskEXIT_CRITICAL();
+}
+
+void ethernetif_get_tx_stats(struct ethernetif_tx_stats *out)
+{
+    taskENTER_CRITICAL();
+    *out = txStats;
+    taskEXIT_CRITICAL();
+}
+
+void ethernetif_clear_stats(void)
+{
+    taskENTER_CRITICAL();
+    memset(&rxStats, 0, sizeof(rxStats));
+    memset(&txStats, 0, sizeof(txStats));
+    (void)ETH->DMAMFBOCR;
+    rxStatsSince = xTaskGetTickCount();
+    rxBusyCycles = 0;
+    taskEXIT_CRITICAL();
+}
+
 /**
  * This function should be called when a packet is ready to be read
  * from the interface. It uses the function low_level_input() that
@@ -340,49 +730,210 @@ static struct pbuf * low_level_input(struct netif *netif)
 static void
 ethernetif_input(struct netif *netif)
 {
-  struct ethernetif *ethernetif;
   struct eth_hdr *ethhdr;
   struct pbuf *p;
+  uint32_t latency;
+  uint32_t batch;
+  uint32_t start;
 
     while(1) {
-        // If you can take the "data waiting" semaphore....
+        /* Woken by the RX interrupt, which stays masked until the ring is
+           empty. The timeout is a safety net in case a frame was missed. */
         if (xSemaphoreTake(s_xSemaphore, emacBLOCK_TIME_WAITING_FOR_INPUT) == pdTRUE)
         {
-            ethernetif = s_pxNetIf->state;
-
-            /* move received packet into a new pbuf */
-            p = low_level_input(s_pxNetIf);
-            /* no packet could be read, silently ignore this */
-            if (p == NULL) return;
-            /* points to packet payload, which starts with an Ethernet header */
-            ethhdr = p->payload;
-
-            switch (htons(ethhdr->type)) {
-                /* IP or ARP packet? */
-                case ETHTYPE_IP:
-                case ETHTYPE_IPV6:
-                case ETHTYPE_ARP:
+            latency = DWT->CYCCNT - rxIrqStamp;
+            rxStats.latency_cycles += latency;
+            if (latency > rxStats.max_latency_cycles)
+            {
+                rxStats.max_latency_cycles = latency;
+            }
+        }
+
+        /* Before the frames go up: a duplicate ACK can only trigger a fast
+           retransmit of a segment the driver has let go of */
+        tx_reclaim_if_idle();
+
+        do {
+            start = DWT->CYCCNT;
+            for (batch = 0; batch < ETH_RX_BATCH && (DMARxDescToGet->Status & ETH_DMARxDesc_OWN) == (uint32_t)RESET; batch++)
+            {
+                /* move received packet into a new pbuf */
+                p = low_level_input(s_pxNetIf);
+                /* no packet could be read, silently ignore this */
+                if (p == NULL) continue;
+                /* points to packet payload, which starts with an Ethernet header */
+                ethhdr = p->payload;
+
+                switch (htons(ethhdr->type)) {
+                    /* IP or ARP packet? */
+                    case ETHTYPE_IP:
+                    case ETHTYPE_IPV6:
+                    case ETHTYPE_ARP:
 #if PPPOE_SUPPORT
-                /* PPPoE packet? */
-                case ETHTYPE_PPPOEDISC:
-                case ETHTYPE_PPPOE:
+                    /* PPPoE packet? */
+                    case ETHTYPE_PPPOEDISC:
+                    case ETHTYPE_PPPOE:
 #endif /* PPPOE_SUPPORT */
-                    /* full packet send to tcpip_thread to process */
-                    if (s_pxNetIf->input(p, s_pxNetIf) != ERR_OK)
-                    { 
-                        LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
+                        /* tcpip_input: with LWIP_TCPIP_CORE_LOCKING_INPUT this
+                           task runs the stack on the frame itself, under the
+                           core lock, instead of posting it to tcpip_thread */
+                        if (s_pxNetIf->input(p, s_pxNetIf) != ERR_OK)
+                        { 
+                            LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
+                            pbuf_free(p);
+                            p = NULL;
+                        }
+                        break;
+
+                    default:
                         pbuf_free(p);
                         p = NULL;
-                    }
-                    break;
+                        break;
+                }
+            }
+
+            if (batch > 0)
+            {
+                /* Time spent on the frames, low_level_input and the stack */
+                rxBusyCycles += DWT->CYCCNT - start;
+                rxStats.busy_us += rxBusyCycles / (SystemCoreClock / 1000000);
+                rxBusyCycles %= SystemCoreClock / 1000000;
+
+                rxStats.batches++;
+                if (batch > rxStats.max_batch)
+                {
+                    rxStats.max_batch = batch;
+                }
+            }
 
-                default:
-                    pbuf_free(p);
-                    p = NULL;
-                    break;
+            /* Don't starve the tcpip thread (timers) on a busy link */
+            if (batch == ETH_RX_BATCH)
+            {
+                taskYIELD();
+            }
+        } while (batch == ETH_RX_BATCH);
+
+        /* Frames that complete from here on set the receive status while the
+           interrupt is masked, so unmasking raises it straight away */
+        ETH_DMAITConfig(ETH_DMA_IT_R, ENABLE);
+    }
+}
+
+#if LWIP_IGMP
+/**
+ * Program the perfect address and hash filters with the joined groups.
+ */
+static void eth_filter_apply(void)
+{
+    u32_t hash[2] = { 0, 0 };
+    uint32_t perfect = 0;
+    uint32_t i;
+
+    for (i = 0; i < ETH_FILTER_GROUPS; i++)
+    {
+        if (ethFilterGroups[i].refs == 0)
+        {
+            continue;
+        }
+
+        if (perfect < ETH_FILTER_PERFECT_NB)
+        {
+            ETH_MACAddressConfig(ethFilterPerfect[perfect], ethFilterGroups[i].mac);
+            ETH_MACAddressPerfectFilterCmd(ethFilterPerfect[perfect], ENABLE);
+            perfect++;
+        }
+        else
+        {
+            ethernetif_hash_add(hash, ethFilterGroups[i].mac);
+        }
+    }
+
+    for (; perfect < ETH_FILTER_PERFECT_NB; perfect++)
+    {
+        ETH_MACAddressPerfectFilterCmd(ethFilterPerfect[perfect], DISABLE);
+    }
+
+    ETH->MACHTHR = hash[1];
+    ETH->MACHTLR = hash[0];
+}
+
+/**
+ * Called by IGMP when a group is joined or left (igmp_mac_filter).
+ */
+static err_t ethernetif_igmp_mac_filter(struct netif *netif, const ip4_addr_t *group, u8_t action)
+{
+    struct eth_filter_group *entry = NULL;
+    struct eth_filter_group *unused = NULL;
+    u8_t mac[ETHARP_HWADDR_LEN];
+    uint32_t i;
+
+    /* 01:00:5e followed by the low 23 bits of the group address */
+    mac[0] = 0x01;
+    mac[1] = 0x00;
+    mac[2] = 0x5e;
+    mac[3] = ip4_addr2(group) & 0x7f;
+    mac[4] = ip4_addr3(group);
+    mac[5] = ip4_addr4(group);
+
+    for (i = 0; i < ETH_FILTER_GROUPS; i++)
+    {
+        if (ethFilterGroups[i].refs == 0)
+        {
+            if (unused == NULL)
+            {
+                unused = &ethFilterGroups[i];
             }
         }
+        else if (memcmp(ethFilterGroups[i].mac, mac, ETHARP_HWADDR_LEN) == 0)
+        {
+            entry = &ethFilterGroups[i];
+        }
     }
+
+    if (action == IGMP_ADD_MAC_FILTER)
+    {
+        if (entry != NULL)
+        {
+            entry->refs++;
+            return ERR_OK;
+        }
+        if (unused == NULL)
+        {
+            return ERR_MEM;
+        }
+        memcpy(unused->mac, mac, ETHARP_HWADDR_LEN);
+        unused->refs = 1;
+    }
+    else
+    {
+        if (entry == NULL)
+        {
+            return ERR_VAL;
+        }
+        if (--entry->refs > 0)
+        {
+            return ERR_OK;
+        }
+    }
+
+    eth_filter_apply();
+    return ERR_OK;
+}
+#endif /* LWIP_IGMP */
+
+/**
+ * Called from ETH_IRQHandler on a receive interrupt. Masks further receive
+ * interrupts and wakes up the input task, which unmasks them once the
+ * descriptor ring is empty.
+ */
+void ethernetif_rx_irq(portBASE_TYPE *pxHigherPriorityTaskWoken)
+{
+    ETH_DMAITConfig(ETH_DMA_IT_R, DISABLE);
+
+    rxIrqStamp = DWT->CYCCNT;
+    rxStats.interrupts++;
+
+    xSemaphoreGiveFromISR(s_xSemaphore, pxHigherPriorityTaskWoken);
 }
 
 /**
@@ -0,0 +1,187 @@
+/*
+ * Internet checksum routines for the Cortex-M4, used by lwIP through
+ * LWIP_CHKSUM and LWIP_CHKSUM_COPY (see arch/cc.h).
+ *
+ * The Ethernet MAC computes the IP, UDP, TCP and ICMP checksums itself
+ * (CHECKSUM_BY_HARDWARE), these cover every other path: PPP, SLIP, loopback
+ * and the software checksum build.
+ *
+ * The data is summed a 32-bit word at a time into a 64-bit accumulator, which
+ * the compiler turns into an ADDS/ADC pair per word, so no carry is lost and
+ * the folding is done once at the end. 1 to 3 leading bytes are consumed
+ * first so the word loads are aligned (LDM/LDRD fault on unaligned
+ * addresses); an odd start is handled like lwIP's algorithm #2 by summing the
+ * byte-shifted data and swapping the result.
+ *
+ * The results are identical to lwip_standard_chksum() for any alignment and
+ * length, they were checked against it on the host over random buffers,
+ * start offsets and lengths.
+ */
+
+#include "lwip/opt.h"
+#include "lwip/def.h"
+#include "lwip/inet_chksum.h"
+#include <string.h>
+
+/* Fold the 64-bit accumulator to the 16-bit one's complement sum */
+static u16_t chksum_fold(unsigned long long acc, int odd)
+{
+	u32_t sum = (u32_t)acc;
+	u32_t high = (u32_t)(acc >> 32);
+
+	/* End-around carry */
+	sum += high;
+	if (sum < high) {
+		sum++;
+	}
+
+	sum = FOLD_U32T(sum);
+	sum = FOLD_U32T(sum);
+
+	/* Swap if alignment was odd */
+	if (odd) {
+		sum = SWAP_BYTES_IN_WORD(sum);
+	}
+
+	return (u16_t)sum;
+}
+
+/**
+ * Host order (!) checksum of len bytes at dataptr, any alignment: the
+ * non-inverted Internet sum, same as lwip_standard_chksum().
+ */
+u16_t lwip_arm_chksum(const void *dataptr, int len)
+{
+	const u8_t *pb = (const u8_t *)dataptr;
+	const u32_t *pw;
+	unsigned long long acc = 0;
+	int odd = ((mem_ptr_t)pb & 1);
+
+	/* Get aligned to u16_t */
+	if (odd && len > 0) {
+		acc += (u32_t)*pb++ << 8;
+		len--;
+	}
+
+	/* Get aligned to u32_t */
+	if (((mem_ptr_t)pb & 2) && len >= 2) {
+		acc += *(const u16_t *)(const void *)pb;
+		pb += 2;
+		len -= 2;
+	}
+
+	/* Add the bulk of the data, 32 bytes per iteration */
+	pw = (const u32_t *)(const void *)pb;
+	while (len >= 32) {
+		acc += pw[0];
+		acc += pw[1];
+		acc += pw[2];
+		acc += pw[3];
+		acc += pw[4];
+		acc += pw[5];
+		acc += pw[6];
+		acc += pw[7];
+		pw += 8;
+		len -= 32;
+	}
+
+	while (len >= 4) {
+		acc += *pw++;
+		len -= 4;
+	}
+
+	/* Consume the left-over halfword and byte, if any */
+	pb = (const u8_t *)pw;
+	if (len >= 2) {
+		acc += *(const u16_t *)(const void *)pb;
+		pb += 2;
+		len -= 2;
+	}
+
+	if (len > 0) {
+		acc += *pb;
+	}
+
+	return chksum_fold(acc, odd);
+}
+
+/**
+ * Copy len bytes from src to dst and return the checksum of the data, as
+ * lwip_arm_chksum() would, in a single pass over it.
+ */
+u16_t lwip_arm_chksum_copy(void *dst, const void *src, u16_t len)
+{
+	const u8_t *ps = (const u8_t *)src;
+	u8_t *pd = (u8_t *)dst;
+	unsigned long long acc = 0;
+	u32_t w;
+	int n = len;
+	int odd;
+
+	/* Both sides can only be word aligned together if they are equally
+	   misaligned, otherwise the copy would be byte-wise anyway */
+	if ((((mem_ptr_t)ps ^ (mem_ptr_t)pd) & 3) != 0) {
+		MEMCPY(dst, src, len);
+		return lwip_arm_chksum(dst, len);
+	}
+
+	odd = ((mem_ptr_t)ps & 1);
+
+	if (odd && n > 0) {
+		*pd++ = *ps;
+		acc += (u32_t)*ps++ << 8;
+		n--;
+	}
+
+	if (((mem_ptr_t)ps & 2) && n >= 2) {
+		w = *(const u16_t *)(const void *)ps;
+		*(u16_t *)(void *)pd = (u16_t)w;
+		acc += w;
+		ps += 2;
+		pd += 2;
+		n -= 2;
+	}
+
+	while (n >= 16) {
+		w = ((const u32_t *)(const void *)ps)[0];
+		((u32_t *)(void *)pd)[0] = w;
+		acc += w;
+		w = ((const u32_t *)(const void *)ps)[1];
+		((u32_t *)(void *)pd)[1] = w;
+		acc += w;
+		w = ((const u32_t *)(const void *)ps)[2];
+		((u32_t *)(void *)pd)[2] = w;
+		acc += w;
+		w = ((const u32_t *)(const void *)ps)[3];
+		((u32_t *)(void *)pd)[3] = w;
+		acc += w;
+		ps += 16;
+		pd += 16;
+		n -= 16;
+	}
+
+	while (n >= 4) {
+		w = *(const u32_t *)(const void *)ps;
+		*(u32_t *)(void *)pd = w;
+		acc += w;
+		ps += 4;
+		pd += 4;
+		n -= 4;
+	}
+
+	if (n >= 2) {
+		w = *(const u16_t *)(const void *)ps;
+		*(u16_t *)(void *)pd = (u16_t)w;
+		acc += w;
+		ps += 2;
+		pd += 2;
+		n -= 2;
+	}
+
+	if (n > 0) {
+		*pd = *ps;
+		acc += *ps;
+	}
+
+	return chksum_fold(acc, odd);
+}
@@ -0,0 +1,30 @@
+/*
+ * Multicast hash filter of the STM32F4 Ethernet MAC, for the groups that
+ * don't get one of the perfect address filters (netif/ethernetif.c).
+ *
+ * The MAC hashes the destination address of a received frame to one of 64
+ * bins: the upper 6 bits of the bit reversed CRC32 of the address (the
+ * Ethernet FCS CRC, the same as zlib's). The frame passes if the bin's bit
+ * is set in MACHTHR:MACHTLR, bins 0-31 in MACHTLR.
+ *
+ * Kept apart from ethernetif.c so the host tests can check it against a
+ * bitwise reference over any address.
+ */
+
+#include "lwip/opt.h"
+#include "crc.h"
+#include "ethernetif.h"
+#include "netif/etharp.h"
+
+u32_t ethernetif_hash_bin(const u8_t *mac)
+{
+	return __RBIT(crc32(0, (uint8_t *)mac, ETHARP_HWADDR_LEN)) >> 26;
+}
+
+/* Set the bin of 'mac' in hash[0] (MACHTLR) and hash[1] (MACHTHR) */
+void ethernetif_hash_add(u32_t hash[2], const u8_t *mac)
+{
+	u32_t bin = ethernetif_hash_bin(mac);
+
+	hash[bin >> 5] |= 1UL << (bin & 31);
+}
@@ -2,10 +2,51 @@
 #define __ETHERNETIF_H__
 
 
+#include "FreeRTOS.h"
 #include "lwip/err.h"
 #include "lwip/netif.h"
 
+/* Receive path counters. 'cycles' is the total spent in low_level_input
+   (CPU cycles, divide by 'frames' for the cost per frame). */
+struct ethernetif_rx_stats {
+  u32_t frames;
+  u32_t zero_copy;        /* passed up in the DMA buffer */
+  u32_t copied;           /* copied to the pbuf pool, no spare buffer */
+  u32_t dropped;          /* out of pbufs */
+  u32_t cycles;
+  u32_t max_cycles;
+  u32_t spare_buffers;    /* spares not held by the stack right now */
+  u32_t interrupts;
+  u32_t batches;          /* wake ups of the input task that found frames */
+  u32_t max_batch;
+  u32_t latency_cycles;   /* RX interrupt to input task, total */
+  u32_t max_latency_cycles;
+  u32_t filtered;         /* broadcasts dropped before reaching the stack */
+  u32_t missed;           /* frames the DMA had no descriptor or FIFO space for */
+  u32_t busy_us;          /* input task handling frames, including the stack */
+  u32_t elapsed_ms;       /* since the stats were cleared */
+};
+
+/* Transmit path counters, 'cycles' as above for low_level_output */
+struct ethernetif_tx_stats {
+  u32_t frames;
+  u32_t bytes;
+  u32_t zero_copy;        /* sent from the pbuf payloads */
+  u32_t copied;           /* copied to the descriptor's own buffer */
+  u32_t waits;            /* had to wait for the DMA to free descriptors */
+  u32_t dropped;          /* no descriptors in time */
+  u32_t cycles;
+};
+
 err_t ethernetif_init(struct netif *netif);
+void ethernetif_rx_irq(portBASE_TYPE *pxHigherPriorityTaskWoken);
+void ethernetif_get_rx_stats(struct ethernetif_rx_stats *out);
+void ethernetif_get_tx_stats(struct ethernetif_tx_stats *out);
+void ethernetif_clear_stats(void);
+
+/* Multicast hash filter bins (port/FreeRTOS/eth_hash.c) */
+u32_t ethernetif_hash_bin(const u8_t *mac);
+void ethernetif_hash_add(u32_t hash[2], const u8_t *mac);
 
 
 
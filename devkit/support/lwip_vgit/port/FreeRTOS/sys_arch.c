@@ -55,14 +55,24 @@ struct timeoutlist
 static struct timeoutlist s_timeoutlist[SYS_THREAD_MAX];
 static u16_t s_nextthread = 0;
 
+static sys_mbox_stats_t s_mbox_stats;
+
 
 /*-----------------------------------------------------------------------------------*/
 //  Creates an empty mailbox.
 err_t sys_mbox_new(sys_mbox_t* mbox, int size)
 {	
-	( void ) size;
+	if ( size <= 0 )
+	{
+		size = archMESG_QUEUE_LENGTH;
+	}
+	
+	*mbox = xQueueCreate( size, sizeof( void * ) );
 	
-	*mbox = xQueueCreate( archMESG_QUEUE_LENGTH, sizeof( void * ) );
+	if ( *mbox != NULL && size > s_mbox_stats.nMaxLength )
+	{
+		s_mbox_stats.nMaxLength = size;
+	}
 
 #if SYS_STATS
      ++lwip_stats.sys.mbox.used;
@@ -100,11 +110,41 @@ void sys_mbox_free(sys_mbox_t* mbox)
 #endif /* SYS_STATS */
 }
 
+/*-----------------------------------------------------------------------------------*/
+//   Records the deepest any mailbox has been, so mailbox sizes can be set from
+//   what the application really queues rather than guessed.
+static void sys_mbox_track_fill(sys_mbox_t* mbox)
+{
+unsigned short nFill = ( unsigned short ) uxQueueMessagesWaiting( *mbox );
+
+	if ( nFill > s_mbox_stats.nMaxFill )
+	{
+		s_mbox_stats.nMaxFill = nFill;
+	}
+}
+
+/*-----------------------------------------------------------------------------------*/
+//   Copies the mailbox occupancy statistics, optionally restarting the
+//   high-water mark and the full count.
+void sys_arch_mbox_stats(sys_mbox_stats_t *stats, int clear)
+{
+	taskENTER_CRITICAL();
+	*stats = s_mbox_stats;
+	if ( clear )
+	{
+		s_mbox_stats.nMaxFill = 0;
+		s_mbox_stats.nPostFull = 0;
+	}
+	taskEXIT_CRITICAL();
+}
+
 /*-----------------------------------------------------------------------------------*/
 //   Posts the "msg" to the mailbox.
 void sys_mbox_post(sys_mbox_t* mbox, void *data)
 {
 	while ( xQueueSendToBack(*mbox, &data, portMAX_DELAY ) != pdTRUE ){}
+	
+	sys_mbox_track_fill( mbox );
 }
 
 
@@ -117,10 +157,12 @@ err_t result;
    if ( xQueueSend( *mbox, &msg, 0 ) == pdPASS )
    {
       result = ERR_OK;
+      sys_mbox_track_fill( mbox );
    }
    else {
       // could not post, queue must be full
       result = ERR_MEM;
+      s_mbox_stats.nPostFull++;
 			
 #if SYS_STATS
       lwip_stats.sys.mbox.err++;
@@ -316,6 +358,57 @@ void sys_sem_set_invalid(sys_sem_t *sem)
     *sem = NULL;
 }
 
+/*-----------------------------------------------------------------------------------*/
+//  Mutexes are FreeRTOS mutexes, not binary semaphores, so a low priority task
+//  holding the TCP/IP core lock inherits the priority of the one waiting for it.
+err_t sys_mutex_new(sys_mutex_t *mutex)
+{
+	*mutex = xSemaphoreCreateMutex();
+
+	if(*mutex == NULL)
+	{
+		return ERR_MEM;
+	}
+
+#if SYS_STATS
+	++lwip_stats.sys.mutex.used;
+	if (lwip_stats.sys.mutex.max < lwip_stats.sys.mutex.used) {
+		lwip_stats.sys.mutex.max = lwip_stats.sys.mutex.used;
+	}
+#endif /* SYS_STATS */
+
+	return ERR_OK;
+}
+
+void sys_mutex_lock(sys_mutex_t *mutex)
+{
+	while( xSemaphoreTake( *mutex, portMAX_DELAY ) != pdTRUE ){}
+}
+
+void sys_mutex_unlock(sys_mutex_t *mutex)
+{
+	xSemaphoreGive( *mutex );
+}
+
+void sys_mutex_free(sys_mutex_t *mutex)
+{
+#if SYS_STATS
+	--lwip_stats.sys.mutex.used;
+#endif /* SYS_STATS */
+
+	vQueueDelete( *mutex );
+}
+
+int sys_mutex_valid(sys_mutex_t *mutex)
+{
+    return (*mutex != NULL);
+}
+
+void sys_mutex_set_invalid(sys_mutex_t *mutex)
+{
+    *mutex = NULL;
+}
+
 /*-----------------------------------------------------------------------------------*/
 // Initialize sys arch
 void sys_init(void)
@@ -334,6 +427,19 @@ void sys_init(void)
 	s_nextthread = 0;
 }
 
+/*-----------------------------------------------------------------------------------*/
+// Milliseconds since the scheduler started, for the lwIP apps' timestamps
+// (SNMP traps, lwiperf); PPP seeds its magic numbers with the jiffies
+u32_t sys_now(void)
+{
+	return xTaskGetTickCount() * portTICK_RATE_MS;
+}
+
+u32_t sys_jiffies(void)
+{
+	return xTaskGetTickCount();
+}
+
 /*-----------------------------------------------------------------------------------*/
 /*
   Returns a pointer to the per-thread sys_timeouts structure. In lwIP,
@@ -393,6 +499,9 @@ sys_thread_t sys_thread_new(const char *name, lwip_thread_fn thread, void *arg,
         // This scheme doesn't allow for threads to be deleted
         s_timeoutlist[s_nextthread++].pid = CreatedTask;
 
+        // Out of heap: the stack would otherwise run on without the thread, unnoticed
+        LWIP_ASSERT("sys_thread_new: no heap for the thread", CreatedTask != NULL);
+
         if(CreatedTask != NULL)
         {
             return CreatedTask;
@@ -404,6 +513,7 @@ sys_thread_t sys_thread_new(const char *name, lwip_thread_fn thread, void *arg,
     }
     else
     {
+        LWIP_ASSERT("sys_thread_new: SYS_THREAD_MAX threads started already", 0);
         return NULL;
     }
 }
@@ -85,6 +85,14 @@ typedef int sys_prot_t;
 
 #endif
 
+/* Word-at-a-time checksums for the paths the MAC does not offload
+   (port/FreeRTOS/chksum.c) */
+u16_t lwip_arm_chksum(const void *dataptr, int len);
+u16_t lwip_arm_chksum_copy(void *dst, const void *src, u16_t len);
+
+#define LWIP_CHKSUM lwip_arm_chksum
+#define LWIP_CHKSUM_COPY(dst, src, len) lwip_arm_chksum_copy(dst, src, len)
+
 #define LWIP_PLATFORM_ASSERT(x) assert_param(x)
 #define LWIP_PLATFORM_DIAG(message) xprintf(message)
 
@@ -41,9 +41,8 @@
 #define SYS_SEM_NULL  (xSemaphoreHandle)0
 #define SYS_DEFAULT_THREAD_STACK_DEPTH	configMINIMAL_STACK_SIZE
 
-#define LWIP_COMPAT_MUTEX 1
-
 typedef xSemaphoreHandle sys_sem_t;
+typedef xSemaphoreHandle sys_mutex_t;
 typedef xQueueHandle sys_mbox_t;
 typedef xTaskHandle sys_thread_t;
 
@@ -55,6 +54,17 @@ typedef struct _sys_arch_state_t
 	unsigned short nTaskCount;
 } sys_arch_state_t;
 
+// Mailbox occupancy. lwIP's SYS_STATS only count how many mailboxes exist,
+// not how full they get.
+typedef struct _sys_mbox_stats_t
+{
+	unsigned short nMaxLength;	// Longest mailbox created
+	unsigned short nMaxFill;	// Most messages ever waiting in one mailbox
+	unsigned long nPostFull;	// Posts refused because the mailbox was full
+} sys_mbox_stats_t;
+
+void sys_arch_mbox_stats(sys_mbox_stats_t *stats, int clear);
+
 
 
 //extern sys_arch_state_t s_sys_arch_state;
@@ -62,7 +72,7 @@ typedef struct _sys_arch_state_t
 //void sys_set_default_state();
 //void sys_set_state(signed char *pTaskName, unsigned short nStackSize);
 
-/* Message queue constants. */
+/* Message queue constants. Length of a mailbox created without a size. */
 #define archMESG_QUEUE_LENGTH	( 6 )
 #endif /* __SYS_RTXC_H__ */
 
@@ -0,0 +1,186 @@
+import os
+import sys
+import math
+import ctypes
+import random
+import argparse
+import tempfile
+import subprocess
+
+# Time beacon simulation (devkit app/inc/time_beacon.h). Dandelions with
+# skewed clocks follow the gateway's beacons: set their clock at each beacon
+# they hear, sample on the beacon schedule and stamp their reports with the
+# sampling instant in whole seconds. The gateway side is app/src/time_beacon.c
+# itself, built for the host as a shared library (host-tests/time_beacon_host.c)
+# and called through ctypes: it stamps the beacons and records the reports,
+# by arrival time in whole milliseconds, the resolution the gateway clock has.
+#
+# Prints, per node, the skew it was given against the drift the gateway
+# measured, and how far apart the nodes sampled. Exits non-zero if a measured
+# drift is off by more than --tolerance.
+
+BEACON_PERIOD_MS = 10 * 60 * 1000       # TIME_BEACON_PERIOD_MS
+
+HOST_TESTS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "host-tests")
+APP = os.path.join(HOST_TESTS, "..", "..", "devkit", "app")
+
+class TimeBeaconNode(ctypes.Structure):
+    # TIME_BEACON_NODE
+    _fields_ = [("offsetS", ctypes.c_int16), ("driftPpm", ctypes.c_int16), ("refBeacon", ctypes.c_uint16),
+                ("refArrivalMs", ctypes.c_uint32), ("refLateMs", ctypes.c_int32)]
+
+class TimeBeaconStats(ctypes.Structure):
+    # TIME_BEACON_STATS
+    _fields_ = [("sent", ctypes.c_uint32), ("skipped", ctypes.c_uint32), ("unmeasured", ctypes.c_uint32),
+                ("sequence", ctypes.c_uint16), ("latencyUs", ctypes.c_uint32), ("lastErrorUs", ctypes.c_int32),
+                ("maxErrorUs", ctypes.c_uint32)]
+
+def build_gateway(out):
+    # The same stubs and include paths as host-tests/run-tests.sh
+    lib = os.path.join(out, "time_beacon_host.so")
+    cc = os.environ.get("CC", "cc").split()
+    subprocess.check_call(cc + ["-std=gnu99", "-O2", "-Wall", "-Wno-unused-function", "-shared", "-fPIC",
+                                "-I" + os.path.join(HOST_TESTS, "stubs"), "-I" + HOST_TESTS,
+                                "-I" + os.path.join(APP, "inc"), "-I" + os.path.join(APP, "src"),
+                                "-o", lib, os.path.join(HOST_TESTS, "time_beacon_host.c"),
+                                os.path.join(HOST_TESTS, "host_os.c")])
+    return lib
+
+def load_gateway(path):
+    lib = ctypes.CDLL(path)
+    lib.TimeBeaconSetSampling.argtypes = [ctypes.c_uint32, ctypes.c_uint32]
+    lib.TimeBeaconSetSampling.restype = ctypes.c_bool
+    lib.TimeBeaconRecordReport.argtypes = [ctypes.c_uint16, ctypes.c_uint32, ctypes.c_uint64]
+    lib.TimeBeaconRecordReport.restype = None
+    lib.TimeBeaconGetNode.argtypes = [ctypes.c_uint16, ctypes.POINTER(TimeBeaconNode)]
+    lib.TimeBeaconGetNode.restype = ctypes.c_bool
+    lib.TimeBeaconGetStats.argtypes = [ctypes.POINTER(TimeBeaconStats)]
+    lib.TimeBeaconGetStats.restype = None
+    lib.HostSetNodes.argtypes = [ctypes.c_uint16]
+    lib.HostSetNodes.restype = None
+    lib.HostStampBeacon.argtypes = [ctypes.c_uint64]
+    lib.HostStampBeacon.restype = ctypes.c_uint64
+    return lib
+
+class Dandelion:
+    def __init__(self, mac, skew_ppm, rng, args):
+        self.mac = mac
+        self.skew = skew_ppm / 1e6
+        self.rng = rng
+        self.args = args
+        self.synced = False
+        self.sync_true = 0.0        # True time of the last beacon heard, s
+        self.sync_local = 0.0       # Node time it was set to
+
+    def local(self, t):
+        return self.sync_local + (t - self.sync_true) * (1 + self.skew)
+
+    def true(self, local):
+        return self.sync_true + (local - self.sync_local) / (1 + self.skew)
+
+    def hear(self, t, stamped):
+        if self.rng.random() < self.args.miss:
+            return
+        # Sync detect interrupt to clock set
+        self.sync_true = t + self.rng.gauss(0, self.args.rx_jitter / 1e6)
+        self.sync_local = stamped
+        self.synced = True
+
+    def samples(self, start, end, epoch_s, period_ms):
+        # Sampling instants in node time between true times start and end, as
+        # (true time sampled, node time ms)
+        if not self.synced:
+            return []
+        period = period_ms / 1000.0
+        n = math.ceil((self.local(start) - epoch_s) / period)
+        out = []
+        while True:
+            local = epoch_s + n * period
+            t = self.true(local)
+            if t >= end:
+                return out
+            out.append((t, int(round(local * 1000))))
+            n += 1
+
+def simulate(args, gateway):
+    rng = random.Random(args.seed)
+    nodes = [Dandelion(0xDA000000 + i, rng.uniform(-args.skew, args.skew), rng, args) for i in range(args.nodes)]
+    epoch_s = 0
+    start = 1700000000.0
+    end = start + args.hours * 3600
+    slots = {}
+
+    gateway.HostSetNodes(len(nodes))
+    if not gateway.TimeBeaconSetSampling(args.period, epoch_s):
+        raise ValueError("sampling period %d ms out of range" % args.period)
+
+    stats = TimeBeaconStats()
+    t = start
+    while t < end:
+        # The radio task reads the gateway clock the TX latency before the
+        # sync word goes out and stamps the beacon with the reading plus its
+        # latency estimate, off by whatever that estimate is off by
+        gateway.TimeBeaconGetStats(ctypes.byref(stats))
+        reading = t - stats.latencyUs / 1e6 + rng.gauss(0, args.stamp_error / 1e6)
+        stamped = gateway.HostStampBeacon(int(math.floor(reading * 1000))) / 1000.0
+        for node in nodes:
+            node.hear(t, stamped)
+
+        next_beacon = min(t + BEACON_PERIOD_MS / 1000.0, end)
+        for slot, node in enumerate(nodes):
+            for sampled, local_ms in node.samples(t, next_beacon, epoch_s, args.period):
+                slots.setdefault(local_ms, []).append(sampled)
+                arrival = sampled + args.tx_delay / 1000.0 + rng.gauss(0, args.tx_jitter / 1e6)
+                gateway.TimeBeaconRecordReport(slot, local_ms // 1000, int(arrival * 1000))
+        t = next_beacon
+
+    return nodes, slots
+
+def report(args, gateway, nodes, slots):
+    worst = 0
+    entry = TimeBeaconNode()
+    print("node        skew ppm  measured ppm  offset s")
+    for slot, node in enumerate(nodes):
+        gateway.TimeBeaconGetNode(slot, ctypes.byref(entry))
+        error = entry.driftPpm - node.skew * 1e6
+        worst = max(worst, abs(error))
+        print("0x%08x  %+8.2f  %+12d  %+8d" % (node.mac, node.skew * 1e6, entry.driftPpm, entry.offsetS))
+
+    spread = [max(times) - min(times) for times in slots.values() if len(times) == len(nodes)]
+    print("drift error: worst %.2f ppm (tolerance %.2f)" % (worst, args.tolerance))
+    if spread:
+        print("sampling spread across nodes: mean %.2f ms, max %.2f ms over %d instants" %
+              (sum(spread) / len(spread) * 1000, max(spread) * 1000, len(spread)))
+    return worst <= args.tolerance
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Simulate time beacons and the gateway drift estimate')
+    parser.add_argument("-n", "--nodes", help="nodes (default 20)", type=int, default=20)
+    parser.add_argument("-s", "--skew", help="node clocks are off by up to this many ppm (default 50)", type=float,
+                        default=50.0)
+    parser.add_argument("-p", "--period", help="sampling period, ms (default 60000)", type=int, default=60000)
+    parser.add_argument("--hours", help="hours simulated (default 6)", type=float, default=6.0)
+    parser.add_argument("--miss", help="chance a node misses a beacon (default 0.1)", type=float, default=0.1)
+    parser.add_argument("--stamp-error", help="beacon stamp error, us standard deviation (default 300)", type=float,
+                        default=300.0)
+    parser.add_argument("--rx-jitter", help="node sync detect to clock set, us standard deviation (default 50)",
+                        type=float, default=50.0)
+    parser.add_argument("--tx-delay", help="sample to report sync word, ms (default 120)", type=float, default=120.0)
+    parser.add_argument("--tx-jitter", help="its jitter, us standard deviation (default 200)", type=float, default=200.0)
+    parser.add_argument("--tolerance", help="largest acceptable drift error, ppm (default 5)", type=float, default=5.0)
+    parser.add_argument("--seed", help="random seed (default 1)", type=int, default=1)
+    parser.add_argument("--lib", help="time_beacon_host.c built as a shared library (default: build it with $CC)")
+    args = parser.parse_args()
+
+    if args.lib:
+        gateway = load_gateway(args.lib)
+    else:
+        with tempfile.TemporaryDirectory() as out:
+            gateway = load_gateway(build_gateway(out))
+
+    tracked = ctypes.c_uint32.in_dll(gateway, "hostTimeBeaconNodes").value
+    if args.nodes < 1 or args.nodes > tracked:
+        parser.error("the gateway tracks the clocks of 1 to %d nodes (TIME_BEACON_NODES)" % tracked)
+
+    nodes, slots = simulate(args, gateway)
+    sys.exit(0 if report(args, gateway, nodes, slots) else 1)
@@ -0,0 +1,178 @@
+import os
+import sys
+import socket
+import argparse
+import threading
+import zlib
+
+# FTP server standing in for the firmware server (devkit app/inc/ftp.h):
+# serves the files of a directory to a gateway's 'fc' / 'fl' / 'fg' / 'ff'
+# console commands, with just the commands the gateway sends. --drop-after
+# cuts data connections after that many bytes, to exercise REST resume;
+# with --short they end there cleanly instead, reported as complete.
+# --no-size answers SIZE as a server without it would. --rate limits the
+# data rate to that of a slower link.
+#
+# Each RETR logs the offset it started at, the bytes sent and the zlib.crc32
+# of the whole file, the one 'fs' prints on the gateway.
+
+class Session(threading.Thread):
+    drops = 0                   # Data connections cut so far, all sessions
+
+    def __init__(self, conn, args):
+        threading.Thread.__init__(self, daemon=True)
+        self.conn = conn
+        self.args = args
+        self.file = conn.makefile('rb')
+        self.passive = None
+        self.rest = 0
+
+    def reply(self, text):
+        print("  > %s" % text)
+        self.conn.sendall((text + "\r\n").encode())
+
+    def path(self, name):
+        name = os.path.basename(name)
+        path = os.path.join(self.args.dir, name)
+        return path if name and os.path.isfile(path) else None
+
+    def data_connection(self):
+        if self.passive is None:
+            self.reply("425 Use PASV first")
+            return None
+        self.passive.settimeout(10)
+        try:
+            data, _ = self.passive.accept()
+        except socket.timeout:
+            data = None
+        self.passive.close()
+        self.passive = None
+        if data is None:
+            self.reply("425 Data connection not opened")
+        return data
+
+    def pasv(self):
+        if self.passive is not None:
+            self.passive.close()
+        self.passive = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.passive.bind((self.conn.getsockname()[0], 0))
+        self.passive.listen(1)
+        host, port = self.passive.getsockname()
+        self.reply("227 Entering Passive Mode (%s,%d,%d)" % (host.replace('.', ','), port >> 8, port & 0xFF))
+
+    def nlst(self):
+        data = self.data_connection()
+        if data is None:
+            return
+        self.reply("150 Here comes the listing")
+        names = sorted(n for n in os.listdir(self.args.dir) if os.path.isfile(os.path.join(self.args.dir, n)))
+        data.sendall(''.join(n + "\r\n" for n in names).encode())
+        data.close()
+        self.reply("226 Listing sent")
+
+    def retr(self, name):
+        path = self.path(name)
+        offset, self.rest = self.rest, 0
+        if path is None:
+            self.reply("550 No such file")
+            return
+        data = self.data_connection()
+        if data is None:
+            return
+        with open(path, 'rb') as f:
+            contents = f.read()
+        self.reply("150 Sending %s from %d" % (name, offset))
+
+        # Drop the first --drops connections --drop-after bytes in
+        limit = len(contents)
+        if self.args.drop_after and Session.drops < self.args.drops:
+            limit = min(limit, offset + self.args.drop_after)
+            Session.drops += 1
+
+        sent = offset
+        chunk = 1460
+        try:
+            while sent < limit:
+                n = min(chunk, limit - sent)
+                data.sendall(contents[sent:sent + n])
+                sent += n
+                if self.args.rate:
+                    threading.Event().wait(n / (self.args.rate * 1024.0))
+        except OSError:
+            pass
+
+        print("  RETR %s from %d: %d bytes, file crc32 0x%08x" %
+              (name, offset, sent - offset, zlib.crc32(contents) & 0xFFFFFFFF))
+
+        if sent < len(contents) and not self.args.short:
+            # Gone without a reply, like a link that went down
+            data.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, b'\x01\x00\x00\x00\x00\x00\x00\x00')
+            data.close()
+            self.conn.close()
+            raise ConnectionAbortedError
+        data.close()
+        self.reply("226 Transfer complete")
+
+    def run(self):
+        print("Connection from %s:%d" % self.conn.getpeername())
+        try:
+            self.reply("220 Firmware stand-in")
+            for line in self.file:
+                line = line.decode(errors='replace').rstrip("\r\n")
+                print("  < %s" % (line if not line.startswith("PASS") else "PASS ****"))
+                verb, _, arg = line.partition(' ')
+                verb = verb.upper()
+                if verb == 'USER':
+                    self.reply("331 Password please")
+                elif verb == 'PASS':
+                    self.reply("230 Logged in")
+                elif verb == 'TYPE':
+                    self.reply("200 Type set to %s" % arg)
+                elif verb == 'PASV':
+                    self.pasv()
+                elif verb == 'NLST':
+                    self.nlst()
+                elif verb == 'SIZE' and self.args.no_size:
+                    self.reply("502 SIZE not implemented")
+                elif verb == 'SIZE':
+                    path = self.path(arg)
+                    self.reply("213 %d" % os.path.getsize(path) if path else "550 No such file")
+                elif verb == 'REST':
+                    self.rest = int(arg) if arg.isdigit() else 0
+                    self.reply("350 Restarting at %d" % self.rest)
+                elif verb == 'RETR':
+                    self.retr(arg)
+                elif verb == 'QUIT':
+                    self.reply("221 Bye")
+                    break
+                else:
+                    self.reply("502 %s not implemented" % verb)
+        except (ConnectionAbortedError, OSError):
+            print("Connection dropped")
+        finally:
+            self.conn.close()
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Minimal FTP server for testing gateway firmware downloads')
+    parser.add_argument("dir", help="directory served")
+    parser.add_argument("-a", "--address", help="address listened on (default 0.0.0.0)", default="0.0.0.0")
+    parser.add_argument("-p", "--port", help="port (default 21)", type=int, default=21)
+    parser.add_argument("--drop-after", help="cut data connections after this many bytes", type=int, default=0)
+    parser.add_argument("--drops", help="how many data connections to cut (default 1)", type=int, default=1)
+    parser.add_argument("--short", help="end cut data connections cleanly, as if the file was complete", action="store_true")
+    parser.add_argument("--no-size", help="do not implement SIZE", action="store_true")
+    parser.add_argument("--rate", help="data rate limit, KB/s", type=float, default=0)
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((args.address, args.port))
+    server.listen(2)
+    print("Serving %s on %s:%d" % (args.dir, args.address, args.port))
+
+    try:
+        while True:
+            conn, _ = server.accept()
+            Session(conn, args).start()
+    except KeyboardInterrupt:
+        sys.exit(0)
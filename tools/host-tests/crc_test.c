@@ -0,0 +1,75 @@
+// CRC32 (app/src/crc.c) against zlib's crc32, for the CRC32_METHOD it is
+// built with: random buffers, start offsets, lengths and seeds, chaining
+// through the crc argument, and the "123456789" check value. Then times it
+// over 256 KB, for comparing the methods against each other.
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include "host_os.h"
+
+// The firmware's crc32 has zlib's name; it is the one called below
+#define crc32 fw_crc32
+#include "crc.c"
+
+#define BUF_SIZE        (70 * 1024)
+#define BENCH_SIZE      (256 * 1024)
+#define BENCH_PASSES    20
+
+static const char* const methodNames[] = {
+    "bitwise", "nibble", "byte", "slice-by-4", "slice-by-8"
+};
+
+static uint8_t buf[BENCH_SIZE];
+
+static double Seconds(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    uint32_t iterations = 20000;
+    double   start;
+    double   elapsed;
+    uint32_t crc = 0;
+
+    srand(1);
+    for(uint32_t i = 0; i < BENCH_SIZE; i++)
+    {
+        buf[i] = rand();
+    }
+
+    CHECK(crc32(0, (uint8_t*)"123456789", 9) == 0xCBF43926);
+    CHECK(crc32(0, buf, 0) == 0);
+
+    for(uint32_t it = 0; it < iterations; it++)
+    {
+        uint32_t off  = rand() % 16;
+        uint32_t len  = rand() % (it < 100 ? BUF_SIZE - 16 : 300);
+        uint32_t seed = rand();
+        uint32_t split = len ? rand() % len : 0;
+
+        CHECK(crc32(seed, buf + off, len) == (uint32_t)crc32_z(seed, buf + off, len));
+
+        // Chained in two pieces, the way the upload and image checks run it
+        CHECK(crc32(crc32(seed, buf + off, split), buf + off + split, len - split) ==
+              (uint32_t)crc32_z(seed, buf + off, len));
+    }
+
+    start = Seconds();
+    for(uint32_t i = 0; i < BENCH_PASSES; i++)
+    {
+        crc = crc32(crc, buf, BENCH_SIZE);
+    }
+    elapsed = Seconds() - start;
+
+    printf("crc32 %-10s: %u random buffers match zlib, %.2f ns/byte on this host (%.0f MB/s, %08x)\n",
+           methodNames[CRC32_METHOD], iterations, elapsed * 1e9 / ((double)BENCH_SIZE * BENCH_PASSES),
+           (double)BENCH_SIZE * BENCH_PASSES / elapsed / 1e6, crc);
+
+    return 0;
+}
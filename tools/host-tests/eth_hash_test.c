@@ -0,0 +1,89 @@
+// Multicast hash filter bins (lwIP port, eth_hash.c) against a bitwise
+// reference written the way the reference manual describes the MAC's hash:
+// the Ethernet CRC32 of the address, bit reversed, upper 6 bits. Checked
+// for every IPv4 multicast MAC (01:00:5e:00:00:00-01:00:5e:7f:ff:ff).
+#include <string.h>
+#include "host_os.h"
+#include "eth_hash.c"
+
+// Bit at a time CRC32, reflected polynomial, as the MAC's FCS logic runs it
+static uint32_t ReferenceCrc(const uint8_t* data, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    while(len--)
+    {
+        crc ^= *data++;
+        for(int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t ReferenceBin(const uint8_t* mac)
+{
+    uint32_t crc  = ReferenceCrc(mac, 6);
+    uint32_t bits = 0;
+
+    for(int bit = 0; bit < 32; bit++)
+    {
+        bits |= ((crc >> bit) & 1) << (31 - bit);
+    }
+
+    return bits >> 26;
+}
+
+int main(void)
+{
+    uint32_t perBin[64];
+    uint8_t  mac[6] = { 0x01, 0x00, 0x5e, 0, 0, 0 };
+
+    memset(perBin, 0, sizeof(perBin));
+
+    for(uint32_t group = 0; group < (1UL << 23); group++)
+    {
+        mac[3] = group >> 16;
+        mac[4] = group >> 8;
+        mac[5] = group;
+
+        uint32_t bin = ethernetif_hash_bin(mac);
+
+        CHECK(bin == ReferenceBin(mac));
+        perBin[bin]++;
+    }
+
+    // Every bin is reachable, and the groups spread evenly over them
+    uint32_t fewest = perBin[0], most = perBin[0];
+
+    for(uint32_t bin = 1; bin < 64; bin++)
+    {
+        fewest = perBin[bin] < fewest ? perBin[bin] : fewest;
+        most   = perBin[bin] > most ? perBin[bin] : most;
+    }
+    CHECK(fewest > 0);
+
+    // Bins 0-31 go to MACHTLR (hash[0]), 32-63 to MACHTHR (hash[1])
+    for(uint32_t group = 0; group < 4096; group++)
+    {
+        u32_t hash[2] = { 0, 0 };
+        uint32_t bin;
+
+        mac[3] = 0;
+        mac[4] = group >> 8;
+        mac[5] = group;
+        bin = ReferenceBin(mac);
+
+        ethernetif_hash_add(hash, mac);
+        CHECK(hash[bin / 32] == 1UL << (bin % 32) && hash[1 - bin / 32] == 0);
+
+        ethernetif_hash_add(hash, mac);
+        CHECK(hash[bin / 32] == 1UL << (bin % 32));
+    }
+
+    printf("eth_hash: all %u IPv4 multicast MACs match, %u to %u per bin\n", 1U << 23, fewest, most);
+
+    return 0;
+}
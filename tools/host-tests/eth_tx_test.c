@@ -0,0 +1,805 @@
+// Ethernet transmit (lwIP netif/ethernetif.c) under lwIP's own TCP, IP and
+// ARP code, with the test as the MAC's transmit DMA and as the peer on the
+// wire. A bulk TCP send goes out of the segment pbufs without a copy and
+// frees them all once acknowledged; the DMA never sees a buffer change while
+// it owns it; and a segment the driver still holds is not retransmitted,
+// neither by a fast retransmit nor by the retransmission timer, until the
+// driver lets go of it. Then the cost of low_level_output per frame and the
+// sender's KB/s on this host, with the segments sent in place and copied.
+//
+// The Ethernet input task is an endless loop and isn't run: the test calls
+// tx_reclaim_if_idle() where the task would, before handing the peer's
+// frames up the stack.
+#include <string.h>
+#include <time.h>
+#include "host_os.h"
+#include "task.h"
+#include "semphr.h"
+#include "lwip/sys.h"
+#include "lwip/timers.h"
+#include "../../devkit/support/lwip_vgit/netif/ethernetif.c"
+#include "lwip/tcpip.h"
+#include "lwip/tcp.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/ip.h"
+#include "lwip/udp.h"
+#include "lwip/igmp.h"
+#include "lwip/dhcp.h"
+
+#define PEER_PORT       5001
+#define PEER_WND        0xFFFF
+#define PEER_QUEUE      32          // frames from the peer not handed up yet
+#define PEER_RANGES     16          // out of order ranges the peer keeps
+#define NO_DROP         0xFFFFFFFF
+#define BULK_SIZE       (256 * 1024)
+#define BENCH_SIZE      (1024 * 1024)
+
+// The Ethernet driver's (stm32f4x7_eth.c) and the board's
+
+ETH_DMADESCTypeDef      DMARxDscrTab[ETH_RXBUFNB], DMATxDscrTab[ETH_TXBUFNB];
+uint8_t                 Rx_Buff[ETH_RXBUFNB][ETH_RX_BUF_SIZE];
+uint8_t                 Tx_Buff[ETH_TXBUFNB][ETH_TX_BUF_SIZE];
+ETH_DMADESCTypeDef*     DMATxDescToSet;
+ETH_DMADESCTypeDef*     DMARxDescToGet;
+ETH_DMA_Rx_Frame_infos* DMA_RX_FRAME_infos;
+ETH_TypeDef             hostEthRegs;
+uint32_t                SystemCoreClock = 168000000;
+
+static const u8_t peerMac[ETHARP_HWADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static struct netif     netif;
+static ip4_addr_t       ourIp, peerIp;
+static struct tcp_pcb*  pcb;
+
+// The DMA: the frame it sends next, and each owned frame as it was when the
+// DMA first saw it, by first descriptor
+static ETH_DMADESCTypeDef*  dmaNext;
+static u8_t                 snapshot[ETH_TXBUFNB][ETH_TX_BUF_SIZE];
+static u16_t                snapshotLen[ETH_TXBUFNB];
+
+static struct
+{
+    u32_t           iss;
+    u32_t           start;          // our first data sequence number
+    u32_t           rcvNxt;
+    u32_t           maxEnd;         // highest sequence number sent so far
+    u32_t           ranges[PEER_RANGES][2];
+    u8_t            rangeCount;
+    u8_t            unacked;        // in order segments not acknowledged yet
+    u32_t           dropAt;         // stream offset of a segment to lose once
+    u32_t           dropped;
+    u32_t           rexmits;
+    u32_t           lastRexmit;     // stream offset
+    struct pbuf*    queue[PEER_QUEUE];
+    u8_t            queued;
+} peer;
+
+static u8_t     appData[BENCH_SIZE];
+static u32_t    appSent;
+static u32_t    appTotal;
+static u8_t     appFlags;
+static double   senderSeconds;
+
+static double Seconds(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static u8_t Pattern(u32_t offset)
+{
+    return (u8_t)(offset * 7 + (offset >> 8));
+}
+
+static u16_t Get16(const u8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static u32_t Get32(const u8_t* p)
+{
+    return ((u32_t)Get16(p) << 16) | Get16(p + 2);
+}
+
+static void Put16(u8_t* p, u16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void Put32(u8_t* p, u32_t v)
+{
+    Put16(p, v >> 16);
+    Put16(p + 2, v);
+}
+
+// The MAC and DMA, for ethernetif.c
+
+void ETH_MACAddressConfig(uint32_t MacAddr, uint8_t* Addr)
+{
+}
+
+void ETH_MACAddressPerfectFilterCmd(uint32_t MacAddr, FunctionalState NewState)
+{
+}
+
+void ETH_DMATxDescChainInit(ETH_DMADESCTypeDef* DMATxDescTab, uint8_t* TxBuff, uint32_t TxBuffCount)
+{
+    for(uint32_t i = 0; i < TxBuffCount; i++)
+    {
+        DMATxDescTab[i].Status = ETH_DMATxDesc_TCH;
+        DMATxDescTab[i].Buffer1Addr = (uint32_t)(uintptr_t)&TxBuff[i * ETH_TX_BUF_SIZE];
+        DMATxDescTab[i].Buffer2NextDescAddr = (uint32_t)(uintptr_t)&DMATxDescTab[(i + 1) % TxBuffCount];
+    }
+
+    DMATxDescToSet = DMATxDescTab;
+    dmaNext = DMATxDescTab;
+}
+
+void ETH_DMARxDescChainInit(ETH_DMADESCTypeDef* DMARxDescTab, uint8_t* RxBuff, uint32_t RxBuffCount)
+{
+    // Nothing is received through the descriptors: the ring stays with the CPU
+    for(uint32_t i = 0; i < RxBuffCount; i++)
+    {
+        DMARxDescTab[i].Status = 0;
+        DMARxDescTab[i].Buffer2NextDescAddr = (uint32_t)(uintptr_t)&DMARxDescTab[(i + 1) % RxBuffCount];
+    }
+
+    DMARxDescToGet = DMARxDescTab;
+}
+
+void ETH_DMATxDescChecksumInsertionConfig(ETH_DMADESCTypeDef* DMATxDesc, uint32_t DMATxDesc_Checksum)
+{
+    DMATxDesc->Status |= DMATxDesc_Checksum;
+}
+
+void ETH_DMARxDescReceiveITConfig(ETH_DMADESCTypeDef* DMARxDesc, FunctionalState NewState)
+{
+}
+
+void ETH_DMAITConfig(uint32_t ETH_DMA_IT, FunctionalState NewState)
+{
+}
+
+void ETH_SetReceiveWatchdogTimer(uint8_t Value)
+{
+}
+
+void ETH_Start(void)
+{
+}
+
+FrameTypeDef ETH_Get_Received_Frame_interrupt(void)
+{
+    FrameTypeDef frame = { 0, 0, NULL };
+
+    return frame;
+}
+
+// lwIP's OS layer, single threaded
+
+sys_prot_t sys_arch_protect(void)
+{
+    return 0;
+}
+
+void sys_arch_unprotect(sys_prot_t pval)
+{
+}
+
+err_t sys_mutex_new(sys_mutex_t* mutex)
+{
+    return ERR_OK;
+}
+
+void sys_mutex_lock(sys_mutex_t* mutex)
+{
+}
+
+void sys_mutex_unlock(sys_mutex_t* mutex)
+{
+}
+
+void sys_timeout(u32_t msecs, sys_timeout_handler handler, void* arg)
+{
+}
+
+void tcp_timer_needed(void)
+{
+}
+
+err_t tcpip_callback_with_block(tcpip_callback_fn function, void* ctx, u8_t block)
+{
+    return ERR_OK;
+}
+
+void dhcp_arp_reply(struct netif* netif, const ip4_addr_t* addr)
+{
+}
+
+void dhcp_network_changed(struct netif* netif)
+{
+}
+
+// The DMA: copy out the frame starting at <desc>, returning its length and
+// the descriptor after it
+static u16_t Gather(ETH_DMADESCTypeDef* desc, u8_t* frame, ETH_DMADESCTypeDef** after)
+{
+    u16_t len = 0;
+    u32_t size;
+
+    for(uint8_t i = 0; i < ETH_TXBUFNB; i++)
+    {
+        CHECK(desc->Status & ETH_DMATxDesc_OWN);
+        CHECK(i > 0 || (desc->Status & ETH_DMATxDesc_FS));
+
+        size = desc->ControlBufferSize & ETH_DMATxDesc_TBS1;
+        CHECK(len + size <= ETH_TX_BUF_SIZE);
+        memcpy(frame + len, (const void*)(uintptr_t)desc->Buffer1Addr, size);
+        len += size;
+
+        if(desc->Status & ETH_DMATxDesc_LS)
+        {
+            *after = (ETH_DMADESCTypeDef*)(uintptr_t)desc->Buffer2NextDescAddr;
+            return len;
+        }
+
+        desc = (ETH_DMADESCTypeDef*)(uintptr_t)desc->Buffer2NextDescAddr;
+    }
+
+    CHECK(0);
+    return 0;
+}
+
+// Take a copy of every frame handed over since the last look
+static void DmaLook(void)
+{
+    ETH_DMADESCTypeDef* desc = dmaNext;
+    uint8_t             i;
+
+    while(desc->Status & ETH_DMATxDesc_OWN)
+    {
+        i = desc - DMATxDscrTab;
+
+        if(snapshotLen[i] == 0)
+        {
+            snapshotLen[i] = Gather(desc, snapshot[i], &desc);
+        }
+        else
+        {
+            u8_t frame[ETH_TX_BUF_SIZE];
+
+            Gather(desc, frame, &desc);
+        }
+
+        if(desc == dmaNext)
+        {
+            break;
+        }
+    }
+}
+
+static void PeerReceive(const u8_t* frame, u16_t len);
+
+// Send up to <max> frames: each must be as it was when the DMA took it
+static uint32_t DmaSend(uint32_t max)
+{
+    u8_t                frame[ETH_TX_BUF_SIZE];
+    ETH_DMADESCTypeDef* after;
+    ETH_DMADESCTypeDef* desc;
+    uint32_t            sent;
+    u16_t               len;
+    uint8_t             i;
+
+    DmaLook();
+
+    for(sent = 0; sent < max && (dmaNext->Status & ETH_DMATxDesc_OWN); sent++)
+    {
+        i = dmaNext - DMATxDscrTab;
+        len = Gather(dmaNext, frame, &after);
+        CHECK(len == snapshotLen[i] && memcmp(frame, snapshot[i], len) == 0);
+        snapshotLen[i] = 0;
+
+        for(desc = dmaNext; desc != after; desc = (ETH_DMADESCTypeDef*)(uintptr_t)desc->Buffer2NextDescAddr)
+        {
+            desc->Status &= ~ETH_DMATxDesc_OWN;
+        }
+        dmaNext = after;
+
+        PeerReceive(frame, len);
+
+        // ETH_IRQHandler, on the frame's last descriptor
+        xSemaphoreGive(s_xTxDoneSemaphore);
+    }
+
+    return sent;
+}
+
+// The DMA keeps sending while low_level_output waits for descriptors
+static void DmaIdle(void)
+{
+    DmaSend(1);
+}
+
+// The peer: answers ARP, accepts the connection, keeps what arrives out of
+// order and acknowledges every second segment, or straight away with a
+// duplicate ACK after a gap
+
+static u8_t* PeerFrame(u16_t type, u16_t len)
+{
+    struct pbuf* p = pbuf_alloc(PBUF_RAW, len, PBUF_RAM);
+    u8_t*        b;
+
+    CHECK(p != NULL && peer.queued < PEER_QUEUE);
+    b = p->payload;
+    memset(b, 0, len);
+    memcpy(b, netif.hwaddr, ETHARP_HWADDR_LEN);
+    memcpy(b + 6, peerMac, ETHARP_HWADDR_LEN);
+    Put16(b + 12, type);
+    peer.queue[peer.queued++] = p;
+
+    return b;
+}
+
+static void PeerArpReply(void)
+{
+    u8_t* b = PeerFrame(ETHTYPE_ARP, 14 + 28);
+
+    Put16(b + 14, 1);
+    Put16(b + 16, ETHTYPE_IP);
+    b[18] = ETHARP_HWADDR_LEN;
+    b[19] = 4;
+    Put16(b + 20, 2);
+    memcpy(b + 22, peerMac, ETHARP_HWADDR_LEN);
+    memcpy(b + 28, &peerIp, 4);
+    memcpy(b + 32, netif.hwaddr, ETHARP_HWADDR_LEN);
+    memcpy(b + 38, &ourIp, 4);
+}
+
+// The IP and TCP checksums are left 0: the netif doesn't check them, the MAC
+// does on the target
+static void PeerSegment(u8_t flags, u32_t seq, u16_t localPort)
+{
+    u8_t  opts = (flags & TCP_SYN) ? 4 : 0;
+    u8_t* b = PeerFrame(ETHTYPE_IP, 14 + 20 + 20 + opts);
+    u8_t* t = b + 34;
+
+    b[14] = 0x45;
+    Put16(b + 16, 20 + 20 + opts);
+    b[22] = 64;
+    b[23] = IP_PROTO_TCP;
+    memcpy(b + 26, &peerIp, 4);
+    memcpy(b + 30, &ourIp, 4);
+
+    Put16(t, PEER_PORT);
+    Put16(t + 2, localPort);
+    Put32(t + 4, seq);
+    Put32(t + 8, peer.rcvNxt);
+    t[12] = (20 + opts) << 2;
+    t[13] = flags | TCP_ACK;
+    Put16(t + 14, PEER_WND);
+
+    if(opts)
+    {
+        t[20] = 2;
+        t[21] = 4;
+        Put16(t + 22, TCP_MSS);
+    }
+
+    peer.unacked = 0;
+}
+
+// Keep [seq, end) and move rcvNxt over whatever is contiguous now
+static void PeerKeep(u32_t seq, u32_t end)
+{
+    bool moved = true;
+
+    if(TCP_SEQ_GT(seq, peer.rcvNxt))
+    {
+        CHECK(peer.rangeCount < PEER_RANGES);
+        peer.ranges[peer.rangeCount][0] = seq;
+        peer.ranges[peer.rangeCount][1] = end;
+        peer.rangeCount++;
+        return;
+    }
+
+    if(TCP_SEQ_GT(end, peer.rcvNxt))
+    {
+        peer.rcvNxt = end;
+    }
+
+    while(moved)
+    {
+        moved = false;
+
+        for(uint8_t i = 0; i < peer.rangeCount; i++)
+        {
+            if(TCP_SEQ_LEQ(peer.ranges[i][0], peer.rcvNxt))
+            {
+                if(TCP_SEQ_GT(peer.ranges[i][1], peer.rcvNxt))
+                {
+                    peer.rcvNxt = peer.ranges[i][1];
+                }
+                peer.ranges[i][0] = peer.ranges[--peer.rangeCount][0];
+                peer.ranges[i][1] = peer.ranges[peer.rangeCount][1];
+                moved = true;
+                break;
+            }
+        }
+    }
+}
+
+static void PeerReceive(const u8_t* frame, u16_t len)
+{
+    const u8_t* tcp;
+    const u8_t* data;
+    u16_t       type = Get16(frame + 12);
+    u16_t       ipLen;
+    u16_t       dataLen;
+    u32_t       seq;
+    u32_t       offset;
+    bool        inOrder;
+
+    CHECK(memcmp(frame + 6, netif.hwaddr, ETHARP_HWADDR_LEN) == 0);
+
+    if(type == ETHTYPE_ARP)
+    {
+        // A request for the peer's address, not a gratuitous one
+        if(Get16(frame + 20) == 1 && memcmp(frame + 38, &peerIp, 4) == 0)
+        {
+            PeerArpReply();
+        }
+        return;
+    }
+
+    CHECK(type == ETHTYPE_IP && frame[23] == IP_PROTO_TCP);
+    CHECK(memcmp(frame, peerMac, ETHARP_HWADDR_LEN) == 0);
+    ipLen = Get16(frame + 16);
+    CHECK(len == 14 + ipLen);
+    tcp = frame + 14 + (frame[14] & 0x0F) * 4;
+    data = tcp + (tcp[12] >> 4) * 4;
+    dataLen = frame + len - data;
+    seq = Get32(tcp + 4);
+
+    if(tcp[13] & TCP_SYN)
+    {
+        peer.start = seq + 1;
+        peer.rcvNxt = seq + 1;
+        peer.maxEnd = seq + 1;
+        PeerSegment(TCP_SYN, peer.iss, Get16(tcp));
+        return;
+    }
+
+    if(dataLen == 0)
+    {
+        return;
+    }
+
+    offset = seq - peer.start;
+    if(TCP_SEQ_LT(seq, peer.maxEnd))
+    {
+        peer.rexmits++;
+        peer.lastRexmit = offset;
+    }
+    if(TCP_SEQ_GT(seq + dataLen, peer.maxEnd))
+    {
+        peer.maxEnd = seq + dataLen;
+    }
+
+    if(offset == peer.dropAt)
+    {
+        peer.dropAt = NO_DROP;
+        peer.dropped++;
+        return;
+    }
+
+    for(u16_t i = 0; i < dataLen; i++)
+    {
+        CHECK(data[i] == Pattern(offset + i));
+    }
+
+    // Out of order, or filling a hole: ACK straight away (RFC 5681 4.2)
+    inOrder = seq == peer.rcvNxt && peer.rangeCount == 0;
+    PeerKeep(seq, seq + dataLen);
+
+    if(!inOrder || ++peer.unacked == 2 || peer.rangeCount > 0)
+    {
+        PeerSegment(0, peer.iss + 1, Get16(tcp));
+    }
+}
+
+// The input task: with <release>, take back what the DMA has sent first,
+// then hand the peer's frames up the stack
+static void PeerDeliver(bool release)
+{
+    double start = Seconds();
+
+    if(release)
+    {
+        tx_reclaim_if_idle();
+    }
+
+    for(u8_t i = 0; i < peer.queued; i++)
+    {
+        CHECK(netif.input(peer.queue[i], &netif) == ERR_OK);
+    }
+    peer.queued = 0;
+
+    senderSeconds += Seconds() - start;
+}
+
+// The application: everything the send buffer takes, in MSS sized writes
+static void AppWrite(void)
+{
+    double start = Seconds();
+    u16_t  n;
+
+    while(appSent < appTotal)
+    {
+        n = LWIP_MIN(LWIP_MIN(tcp_sndbuf(pcb), TCP_MSS), appTotal - appSent);
+        if(n == 0 || tcp_write(pcb, &appData[appSent], n, appFlags) != ERR_OK)
+        {
+            break;
+        }
+        appSent += n;
+    }
+
+    tcp_output(pcb);
+
+    senderSeconds += Seconds() - start;
+}
+
+static u32_t Delivered(void)
+{
+    return peer.rcvNxt - peer.start;
+}
+
+// Send <bytes> more, the DMA sending everything handed to it and the peer's
+// answers going up after each write
+static void Run(u32_t bytes)
+{
+    appTotal = appSent + bytes;
+    CHECK(appTotal <= BENCH_SIZE);
+
+    for(uint32_t pass = 0; Delivered() < appTotal; pass++)
+    {
+        CHECK(pass < 4 * BENCH_SIZE / TCP_MSS);
+        AppWrite();
+        DmaSend(ETH_TXBUFNB * 2);
+
+        // The delayed ACK timer, for an odd segment at the end
+        if(peer.unacked > 0 && peer.queued == 0)
+        {
+            PeerSegment(0, peer.iss + 1, pcb->local_port);
+        }
+        PeerDeliver(true);
+    }
+}
+
+static err_t Connected(void* arg, struct tcp_pcb* tpcb, err_t err)
+{
+    return ERR_OK;
+}
+
+static void Connect(u8_t flags)
+{
+    memset(&peer, 0, sizeof(peer));
+    peer.iss = 0x10000000;
+    peer.dropAt = NO_DROP;
+    appSent = 0;
+    appFlags = flags;
+
+    pcb = tcp_new();
+    CHECK(pcb != NULL);
+    CHECK(tcp_connect(pcb, &peerIp, PEER_PORT, Connected) == ERR_OK);
+
+    // ARP the first time round, then the SYN, the SYN-ACK and the ACK
+    for(uint8_t i = 0; i < 4 && pcb->state != ESTABLISHED; i++)
+    {
+        DmaSend(ETH_TXBUFNB);
+        PeerDeliver(true);
+    }
+
+    CHECK(pcb->state == ESTABLISHED);
+    DmaSend(ETH_TXBUFNB);
+    tx_reclaim_if_idle();
+}
+
+// Everything acknowledged: no segment left, and no pbuf held by the driver
+// once it has taken its descriptors back
+static void Drained(mem_size_t heapUsed)
+{
+    CHECK(pcb->unacked == NULL && pcb->unsent == NULL);
+    tx_reclaim_if_idle();
+
+    for(uint8_t i = 0; i < ETH_TXBUFNB; i++)
+    {
+        CHECK(txPbuf[i] == NULL);
+    }
+
+    CHECK(txFreeDesc == ETH_TXBUFNB);
+    CHECK(lwip_stats.memp[MEMP_TCP_SEG].used == 0);
+    CHECK(lwip_stats.mem.used == heapUsed);
+}
+
+static void Close(void)
+{
+    tcp_abort(pcb);
+    DmaSend(ETH_TXBUFNB);
+    tx_reclaim_if_idle();
+    pcb = NULL;
+}
+
+// A bulk send goes out of the segment pbufs, each freed once acknowledged
+static void TestBulk(void)
+{
+    mem_size_t heapUsed;
+
+    ethernetif_clear_stats();
+    Connect(TCP_WRITE_FLAG_COPY);
+    heapUsed = lwip_stats.mem.used;
+
+    Run(BULK_SIZE);
+    CHECK(Delivered() == BULK_SIZE && peer.rexmits == 0);
+    CHECK(txStats.frames > BULK_SIZE / TCP_MSS && txStats.zero_copy == txStats.frames);
+    CHECK(txStats.copied == 0 && txStats.dropped == 0);
+    Drained(heapUsed);
+    Close();
+}
+
+// A lost segment: three duplicate ACKs retransmit it straight away once the
+// driver has let go of it, but not while it still holds it. Then it is up to
+// the retransmission timer, which waits for the driver too.
+static void TestFastRetransmit(void)
+{
+    mem_size_t heapUsed;
+    u32_t      lost;
+    u32_t      rexmits;
+
+    Connect(TCP_WRITE_FLAG_COPY);
+    heapUsed = lwip_stats.mem.used;
+
+    // Open the congestion window, then lose the first of the next segments
+    Run(64 * 1024);
+    lost = Delivered();
+    peer.dropAt = lost;
+    appTotal = appSent + 5 * TCP_MSS;
+    AppWrite();
+    CHECK(DmaSend(ETH_TXBUFNB) == 5);
+    CHECK(peer.dropped == 1 && peer.queued == 4);
+
+    // Frames up before the input task took the descriptors back
+    PeerDeliver(false);
+    CHECK(txPbuf[(DMATxDescToClean - DMATxDscrTab)] != NULL);
+    CHECK(DmaSend(ETH_TXBUFNB) == 0);
+    CHECK(pcb->nrtx == 0 && !(pcb->flags & TF_INFR));
+
+    for(uint8_t i = 0; i < 30; i++)
+    {
+        tcp_slowtmr();
+    }
+    CHECK(pcb->rtime >= pcb->rto);
+    CHECK(DmaSend(ETH_TXBUFNB) == 0 && pcb->nrtx == 0);
+
+    // Its time out, 100 ms on: the next tick retransmits
+    tx_reclaim_if_idle();
+    tcp_slowtmr();
+    CHECK(pcb->nrtx == 1);
+    CHECK(DmaSend(ETH_TXBUFNB) == 1 && peer.rexmits == 1 && peer.lastRexmit == lost);
+    PeerDeliver(true);
+    CHECK(Delivered() == appTotal);
+    CHECK(pcb->unacked == NULL);
+
+    // The same with the input task first: a fast retransmit
+    Run(64 * 1024);
+    lost = Delivered();
+    rexmits = peer.rexmits;
+    peer.dropAt = lost;
+    appTotal = appSent + 5 * TCP_MSS;
+    AppWrite();
+    CHECK(DmaSend(ETH_TXBUFNB) == 5);
+    PeerDeliver(true);
+    CHECK(pcb->flags & TF_INFR);
+    CHECK(DmaSend(ETH_TXBUFNB) == 1 && peer.rexmits == rexmits + 1 && peer.lastRexmit == lost);
+    PeerDeliver(true);
+    CHECK(Delivered() == appTotal);
+
+    Run(16 * 1024);
+    Drained(heapUsed);
+    Close();
+}
+
+// The DMA stalls with segments in its hands past the retransmission time
+// out: nothing is retransmitted and nothing it owns changes
+static void TestStalledDma(void)
+{
+    ETH_DMADESCTypeDef* toSet;
+
+    Connect(TCP_WRITE_FLAG_COPY);
+    Run(16 * 1024);
+
+    appTotal = appSent + 3 * TCP_MSS;
+    AppWrite();
+    DmaLook();
+    toSet = DMATxDescToSet;
+
+    for(uint8_t i = 0; i < 30; i++)
+    {
+        tcp_slowtmr();
+        PeerDeliver(true);
+    }
+    CHECK(pcb->rtime >= pcb->rto && pcb->nrtx == 0);
+    CHECK(DMATxDescToSet == toSet);
+
+    CHECK(DmaSend(ETH_TXBUFNB) == 3 && peer.rexmits == 0);
+    PeerSegment(0, peer.iss + 1, pcb->local_port);
+    PeerDeliver(true);
+    CHECK(Delivered() == appTotal && pcb->unacked == NULL);
+    Close();
+}
+
+// low_level_output per frame and the sender's KB/s on this host, the
+// application writes and the ACKs going up included, the DMA and the peer
+// not. Copied: the data is PBUF_ROM (no TCP_WRITE_FLAG_COPY), so it is the
+// driver that copies it.
+static void Throughput(u8_t flags)
+{
+    ethernetif_clear_stats();
+    Connect(flags);
+    ethernetif_clear_stats();
+    senderSeconds = 0;
+
+    Run(BENCH_SIZE);
+    CHECK(Delivered() == BENCH_SIZE);
+    CHECK(flags ? txStats.copied == 0 : txStats.copied > BENCH_SIZE / TCP_MSS);
+
+    printf("  %s: %u frames, %u cycles/frame in low_level_output, sender %u KB/s\n",
+           flags ? "in place" : "copied  ", (unsigned)txStats.frames, (unsigned)(txStats.cycles / txStats.frames),
+           (unsigned)(BENCH_SIZE / 1024 / senderSeconds));
+    Close();
+}
+
+int main(int argc, char** argv)
+{
+    ip4_addr_t mask, gw;
+
+    hostVerbose = argc > 1;
+
+    for(u32_t i = 0; i < BENCH_SIZE; i++)
+    {
+        appData[i] = Pattern(i);
+    }
+
+    stats_init();
+    mem_init();
+    memp_init();
+    pbuf_init();
+    netif_init();
+    ip_init();
+    etharp_init();
+    udp_init();
+    tcp_init();
+    igmp_init();
+
+    IP4_ADDR(&ourIp, 192, 168, 1, 10);
+    IP4_ADDR(&peerIp, 192, 168, 1, 2);
+    IP4_ADDR(&mask, 255, 255, 255, 0);
+    IP4_ADDR(&gw, 192, 168, 1, 1);
+    CHECK(netif_add(&netif, &ourIp, &mask, &gw, NULL, ethernetif_init, ethernet_input) != NULL);
+    netif_set_default(&netif);
+    netif_set_up(&netif);
+    hostIdleHook = DmaIdle;
+
+    TestBulk();
+    TestFastRetransmit();
+    TestStalledDma();
+
+    printf("eth_tx: all tests passed, %u KB bulk TCP send on this host:\n", BENCH_SIZE / 1024);
+    Throughput(TCP_WRITE_FLAG_COPY);
+    Throughput(0);
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+// Flash writer (app/src/flash_writer.c) on simulated flash: erase ahead of
+// the data across sector boundaries, back-pressure from the page pool, a
+// read-back verify failure, program and erase errors surfacing at
+// FlashWriterFlush, and the sustained rate for a 256 KB image at the part's
+// typical program and erase times.
+//
+// The writer task runs as hostIdleHook: one Service() pass whenever the
+// producer would block, as it gets the CPU on the target.
+#include <string.h>
+#include "host_os.h"
+#include "flash_writer.c"
+
+#define SECTOR_2        0x08008000
+#define SECTOR_3        0x0800C000
+#define SECTOR_4        0x08010000
+#define SECTOR_5        0x08020000
+#define SECTOR_6        0x08040000
+#define IMAGE_SIZE      (256 * 1024)
+
+static uint8_t image[IMAGE_SIZE];
+
+static void Fresh(void)
+{
+    HostFlashInit();
+    hostFlashTiming = 0;
+    hostIdleHook = NULL;
+    memset(&stats, 0, sizeof(stats));
+}
+
+// Begin, and let the task take the wake-up: the first sector to erase goes
+static bool Begin(uint32_t start, uint32_t size, bool erase)
+{
+    if(!FlashWriterBegin(start, size, erase))
+    {
+        return false;
+    }
+
+    Service();
+
+    return true;
+}
+
+static bool Write(uint32_t address)
+{
+    return FlashWriterWrite(address, &image[address - SECTOR_5], FLASH_WRITER_PAGE_SIZE);
+}
+
+static bool Programmed(uint32_t address, uint32_t len)
+{
+    return memcmp((const void*)(uintptr_t)address, &image[address - SECTOR_5], len) == 0;
+}
+
+static bool Erased(uint32_t address, uint32_t len)
+{
+    for(uint32_t i = 0; i < len; i++)
+    {
+        if(((const uint8_t*)(uintptr_t)address)[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Sectors are erased while idle, lowest first, and ahead of any page that
+// reaches one the idle erase has not
+static void TestEraseAhead(void)
+{
+    Fresh();
+
+    // An old image in sectors 2 to 4
+    memset((void*)SECTOR_2, 0, SECTOR_5 - SECTOR_2);
+
+    // The last KB of sector 2 to the first KB of sector 4
+    CHECK(Begin(SECTOR_3 - 1024, 0x4000 + 2048, true));
+    CHECK(stats.erases == 1 && eraseMask == ((1 << 3) | (1 << 4)));
+    CHECK(Erased(SECTOR_2, 0x4000) && !Erased(SECTOR_3, 4));
+
+    // Pages are range checked against the region
+    CHECK(!FlashWriterWrite(SECTOR_3 - 1032, image, 16));
+    CHECK(!FlashWriterWrite(SECTOR_4 + 1024 - 8, image, 16));
+
+    // A page in sector 2, then one straddling sectors 3 and 4: both are erased
+    // before it is programmed
+    CHECK(FlashWriterWrite(SECTOR_3 - 1024, image, FLASH_WRITER_PAGE_SIZE));
+    CHECK(FlashWriterWrite(SECTOR_4 - 128, image + 256, FLASH_WRITER_PAGE_SIZE));
+    Service();
+    CHECK(stats.erases == 1 && stats.pages == 1);
+    Service();
+    CHECK(stats.erases == 3 && eraseMask == 0 && stats.pages == 2);
+
+    CHECK(memcmp((const void*)(SECTOR_3 - 1024), image, 256) == 0);
+    CHECK(memcmp((const void*)(SECTOR_4 - 128), image + 256, 256) == 0);
+    CHECK(Erased(SECTOR_3, 0x4000 - 128) && Erased(SECTOR_4 + 128, 0x4000 - 128));
+    CHECK(FlashWriterFlush() && FlashWriterWaitErased());
+    CHECK(stats.write_errors == 0);
+}
+
+// With every page buffer queued the producer stalls: it gives up after
+// FLASH_WRITER_PUT_TIMEOUT unless the task frees one meanwhile
+static void TestBackPressure(void)
+{
+    uint32_t address = SECTOR_5;
+
+    Fresh();
+    CHECK(Begin(SECTOR_5, 0x8000, false));
+
+    for(uint8_t i = 0; i < FLASH_WRITER_NUM_PAGES; i++, address += FLASH_WRITER_PAGE_SIZE)
+    {
+        CHECK(Write(address));
+    }
+
+    CHECK(pending == FLASH_WRITER_NUM_PAGES && stats.stalls == 0);
+    CHECK(!Write(address));
+    CHECK(stats.stalls == 1 && stats.pages == 0);
+
+    hostIdleHook = Service;
+    CHECK(Write(address));
+    CHECK(stats.stalls == 2 && stats.pages == 1);
+    CHECK(pending == FLASH_WRITER_NUM_PAGES);
+
+    CHECK(FlashWriterFlush());
+    CHECK(pending == 0 && stats.pages == FLASH_WRITER_NUM_PAGES + 1);
+    CHECK(Programmed(SECTOR_5, (FLASH_WRITER_NUM_PAGES + 1) * FLASH_WRITER_PAGE_SIZE));
+}
+
+// A bit that does not program is caught by the read-back of its page; the
+// pages queued after it are dropped and the failure latches until the next
+// FlashWriterBegin
+static void TestVerifyFailure(void)
+{
+    uint32_t stuck = SECTOR_5 + FLASH_WRITER_PAGE_SIZE + 12;
+
+    Fresh();
+    CHECK(Begin(SECTOR_5, 0x8000, false));
+    hostIdleHook = Service;
+
+    image[stuck - SECTOR_5] |= 0x10;
+    hostFlashStuckAddress = stuck;
+    hostFlashStuckMask = 0x10;
+
+    for(uint32_t i = 0; i < FLASH_WRITER_NUM_PAGES; i++)
+    {
+        CHECK(Write(SECTOR_5 + i * FLASH_WRITER_PAGE_SIZE));
+    }
+
+    CHECK(!FlashWriterFlush());
+    CHECK(stats.write_errors == 1 && stats.pages == 2);
+    CHECK(Programmed(SECTOR_5, FLASH_WRITER_PAGE_SIZE));
+    CHECK(!Write(SECTOR_5 + FLASH_WRITER_NUM_PAGES * FLASH_WRITER_PAGE_SIZE));
+
+    hostFlashStuckAddress = 0;
+    CHECK(Begin(SECTOR_5 + 0x1000, 0x1000, false));
+    CHECK(Write(SECTOR_5 + 0x1000) && FlashWriterFlush());
+    CHECK(Programmed(SECTOR_5 + 0x1000, FLASH_WRITER_PAGE_SIZE));
+}
+
+// Program and erase errors reach whoever flushes or waits next
+static void TestErrorPropagation(void)
+{
+    Fresh();
+    CHECK(Begin(SECTOR_5, 0x8000, false));
+    hostIdleHook = Service;
+
+    hostFlashProgramFails = 1;
+    CHECK(Write(SECTOR_5));
+    CHECK(!FlashWriterFlush());
+    CHECK(stats.write_errors == 1);
+    CHECK(!FlashWriterErase(SECTOR_6) && stats.erases == 0);
+
+    // An idle erase that fails stops the region too
+    hostFlashEraseFails = 1;
+    CHECK(FlashWriterBegin(SECTOR_5, 0x40000, true));
+    CHECK(!FlashWriterWaitErased());
+    CHECK(!Write(SECTOR_5));
+    CHECK(!FlashWriterFlush());
+
+    // The next region starts clean
+    CHECK(Begin(SECTOR_5, 0x40000, true));
+    CHECK(FlashWriterWaitErased());
+    CHECK(Write(SECTOR_5) && FlashWriterFlush());
+}
+
+// A 256 KB image at typical program and erase times, with and without the
+// erase. The producer never waits for data, so the time is all the flash's.
+static void Throughput(bool erase)
+{
+    uint32_t start;
+    uint32_t ms;
+
+    Fresh();
+    hostFlashTiming = 1;
+    start = xTaskGetTickCount();
+
+    CHECK(Begin(SECTOR_5, IMAGE_SIZE, erase));
+    hostIdleHook = Service;
+
+    for(uint32_t offset = 0; offset < IMAGE_SIZE; offset += FLASH_WRITER_PAGE_SIZE)
+    {
+        CHECK(Write(SECTOR_5 + offset));
+    }
+
+    CHECK(FlashWriterFlush());
+    CHECK(Programmed(SECTOR_5, IMAGE_SIZE));
+    CHECK(stats.write_errors == 0 && stats.pages == IMAGE_SIZE / FLASH_WRITER_PAGE_SIZE);
+
+    ms = xTaskGetTickCount() - start;
+    printf("  %s: %u KB in %u ms, %u KB/s (program %u ms, erase %u ms, %u stalls)\n",
+           erase ? "erase + program" : "program only   ", IMAGE_SIZE / 1024, ms, IMAGE_SIZE / 1024 * 1000 / ms,
+           stats.program_ms, stats.erase_ms, stats.stalls);
+}
+
+int main(int argc, char** argv)
+{
+    hostVerbose = argc > 1;
+
+    srand(1);
+    for(uint32_t i = 0; i < IMAGE_SIZE; i++)
+    {
+        image[i] = rand();
+    }
+
+    FlashWriterOSInit();
+
+    TestEraseAhead();
+    TestBackPressure();
+    TestVerifyFailure();
+    TestErrorPropagation();
+
+    printf("flash_writer: all tests passed, 256 KB image at typical x32 times:\n");
+    Throughput(true);
+    Throughput(false);
+
+    return 0;
+}
@@ -0,0 +1,409 @@
+// FTP download (app/src/ftp.c) from tools/ftp-standin.py, over real sockets,
+// into the simulated flash through the flash writer. Each case starts the
+// stand-in on a free port with its own options:
+// - a listing, and an image whose last page is partial, in one go;
+// - data connections cut twice (--drop-after), with and without SIZE: the
+//   REST offsets must be the last whole page before each cut;
+// - a data connection that ends early but cleanly (--short): caught by SIZE
+//   and resumed, or with no SIZE written short and failed by the image check.
+// Every download that succeeds must match the file and its zlib.crc32.
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "host_os.h"
+
+// Both keep their counters in a static 'stats'
+#define stats writerStats
+#include "flash_writer.c"
+#undef stats
+#include "ftp.c"
+
+#define IMAGE_NAME      "SUNFLOWER_1.10.bin"
+#define IMAGE_SIZE      (100 * 1024 + 100)  // The last page is partial
+#define REGION_START    SUNFLOWER_BACKUP_APP_START
+#define DROP_AFTER      40000
+#define DROP_AFTER_ARG  "40000"
+#define MAX_RESTS       8
+#define HEADER_END      offsetof(SUNFLOWER_APP_HEADER, header_crc32)
+#define BODY_START      offsetof(SUNFLOWER_APP_HEADER, crc32_start_mark)
+
+static const char* standin;
+static char        dir[] = "/tmp/ftp-test-XXXXXX";
+static uint8_t     image[IMAGE_SIZE];
+static uint32_t    imageCrc;
+static uint32_t    rests[MAX_RESTS];       // REST offsets sent, this case
+static uint8_t     restCount;
+static uint32_t    cuts[MAX_RESTS];        // Data bytes received before each reset
+static uint8_t     cutCount;
+static pid_t       server;                 // The stand-in, 0 when not running
+static uint32_t    resumedAt[2];           // REST offsets of the dropped download with SIZE
+static uint16_t    recvSizes[] = {1460, 100, 700, 256, 1, 1024};
+static uint8_t     recvNext;
+
+// Firmware ftp.c calls into: running from the main slot, so the backup slot
+// is downloaded to
+
+bool Is_Running_From_Main_Slot(void)
+{
+    return true;
+}
+
+bool Is_Sunflower_Image_Linked(bool main_region)
+{
+    return !main_region;
+}
+
+// The full check of the slot: its header CRCs over what is in flash
+bool Is_Sunflower_Image_Valid(bool main_region)
+{
+    SUNFLOWER_APP_HEADER* header = (SUNFLOWER_APP_HEADER*)REGION_START;
+
+    return !main_region && header->image_size <= SUNFLOWER_IMAGE_SIZE &&
+           header->header_crc32 == crc32(0x00000000, (uint8_t*)REGION_START, HEADER_END) &&
+           header->body_crc32 == crc32(0x00000000, (uint8_t*)REGION_START + BODY_START,
+                                       header->image_size - BODY_START);
+}
+
+bool Is_Dandelion_Image_Valid(void)
+{
+    return false;
+}
+
+void Invalidate_Sunflower_Verify_Cache(bool main_region)
+{
+}
+
+err_t netconn_gethostbyname(const char* name, ip_addr_t* addr)
+{
+    return ERR_VAL;
+}
+
+const char* lwip_strerr(err_t err)
+{
+    return "error";
+}
+
+// netconn over a socket; waiting in recv moves the tick on by the time
+// waited. A reset comes back as ERR_RST, a clean close as ERR_CLSD. What
+// was still in flight when the server reset a data connection is lost, as
+// on a real link, so the cuts are counted where the gateway saw them.
+
+struct netconn* host_netconn_new(int type)
+{
+    struct netconn* c = calloc(1, sizeof(struct netconn));
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    return c;
+}
+
+err_t netconn_connect(struct netconn* conn, ip_addr_t* addr, u16_t port)
+{
+    struct sockaddr_in sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = ip4_addr_get_u32(addr);
+
+    return connect(conn->fd, (struct sockaddr*)&sa, sizeof(sa)) == 0 ? ERR_OK : ERR_CONN;
+}
+
+// Segments of varying size, so pages start and end inside them
+err_t netconn_recv(struct netconn* conn, struct netbuf** buf)
+{
+    struct pollfd   p = { conn->fd, POLLIN, 0 };
+    struct timespec start, end;
+    struct netbuf*  b;
+    int             ready;
+    ssize_t         len;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ready = poll(&p, 1, conn->recv_timeout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    hostTickAdvance((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+
+    if(ready == 0)
+    {
+        return ERR_TIMEOUT;
+    }
+
+    b = malloc(sizeof(struct netbuf));
+    len = recv(conn->fd, b->data, recvSizes[recvNext++ % (sizeof(recvSizes) / sizeof(recvSizes[0]))], 0);
+    if(len < 0 && conn == g_data)
+    {
+        CHECK(cutCount < MAX_RESTS);
+        cuts[cutCount++] = conn->received;
+    }
+    if(len <= 0)
+    {
+        free(b);
+        return len == 0 ? ERR_CLSD : ERR_RST;
+    }
+
+    conn->received += len;
+    b->len = len;
+    *buf = b;
+
+    return ERR_OK;
+}
+
+err_t netconn_write(struct netconn* conn, const void* data, size_t size, u8_t flags)
+{
+    if(size > 5 && memcmp(data, "REST ", 5) == 0)
+    {
+        CHECK(restCount < MAX_RESTS);
+        rests[restCount++] = strtoul((const char*)data + 5, NULL, 10);
+    }
+
+    return send(conn->fd, data, size, MSG_NOSIGNAL) == (ssize_t)size ? ERR_OK : ERR_CONN;
+}
+
+err_t netconn_close(struct netconn* conn)
+{
+    close(conn->fd);
+
+    return ERR_OK;
+}
+
+err_t netconn_delete(struct netconn* conn)
+{
+    free(conn);
+
+    return ERR_OK;
+}
+
+err_t netbuf_data(struct netbuf* buf, void** data, u16_t* len)
+{
+    *data = buf->data;
+    *len = buf->len;
+
+    return ERR_OK;
+}
+
+s8_t netbuf_next(struct netbuf* buf)
+{
+    return -1;
+}
+
+void netbuf_delete(struct netbuf* buf)
+{
+    free(buf);
+}
+
+// Random bytes with a sunflower header carrying their CRCs, as sign-app.py
+// leaves it, saved in the served directory along with an older version
+static void MakeImage(void)
+{
+    SUNFLOWER_APP_HEADER* header = (SUNFLOWER_APP_HEADER*)image;
+    char                  path[64];
+    FILE*                 f;
+
+    srand(1);
+    for(uint32_t i = 0; i < IMAGE_SIZE; i++)
+    {
+        image[i] = rand();
+    }
+
+    header->image_size   = IMAGE_SIZE;
+    header->body_crc32   = crc32(0x00000000, &image[BODY_START], IMAGE_SIZE - BODY_START);
+    header->header_crc32 = crc32(0x00000000, image, HEADER_END);
+    imageCrc = crc32(0x00000000, image, IMAGE_SIZE);
+
+    CHECK(mkdtemp(dir) != NULL);
+
+    snprintf(path, sizeof(path), "%s/%s", dir, IMAGE_NAME);
+    CHECK((f = fopen(path, "wb")) != NULL && fwrite(image, 1, IMAGE_SIZE, f) == IMAGE_SIZE);
+    fclose(f);
+
+    snprintf(path, sizeof(path), "%s/SUNFLOWER_1.9.bin", dir);
+    CHECK((f = fopen(path, "wb")) != NULL && fwrite(image, 1, 1000, f) == 1000);
+    fclose(f);
+}
+
+static void RemoveImage(void)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, IMAGE_NAME);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/SUNFLOWER_1.9.bin", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+// Start the stand-in with <options> and log in to it
+static void Serve(const char* const* options)
+{
+    struct sockaddr_in sa;
+    socklen_t          salen = sizeof(sa);
+    ip_addr_t          addr;
+    char               port[8];
+    const char*        argv[16] = {"python3", standin, dir, "-a", "127.0.0.1", "-p", port};
+    int                fd = socket(AF_INET, SOCK_STREAM, 0);
+    int                argc = 7;
+
+    // A free port
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(fd, (struct sockaddr*)&sa, sizeof(sa)) == 0 && getsockname(fd, (struct sockaddr*)&sa, &salen) == 0);
+    close(fd);
+    snprintf(port, sizeof(port), "%u", ntohs(sa.sin_port));
+
+    while(*options != NULL)
+    {
+        argv[argc++] = *options++;
+    }
+
+    fflush(stdout);
+    server = fork();
+    CHECK(server >= 0);
+    if(server == 0)
+    {
+        if(!hostVerbose)
+        {
+            dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+        }
+        execvp("python3", (char* const*)argv);
+        _exit(127);
+    }
+
+    IP4_ADDR(&addr, 127, 0, 0, 1);
+    for(int tries = 0; !FTP_Connect(&addr, ntohs(sa.sin_port)); tries++)
+    {
+        CHECK(tries < 100);
+        usleep(50000);
+    }
+
+    restCount = 0;
+    cutCount = 0;
+    memset(&stats, 0, sizeof(stats));
+    HostFlashInit();
+}
+
+// Also run at exit, so a failed CHECK doesn't leave the stand-in behind
+static void Stop(void)
+{
+    FTP_Disconnect();
+
+    if(server > 0)
+    {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+        server = 0;
+    }
+}
+
+static void CheckDownload(uint32_t resumes)
+{
+    CHECK(stats.downloads == 1 && stats.failures == 0 && stats.resumes == resumes);
+    CHECK(stats.last_bytes == IMAGE_SIZE && stats.last_crc == imageCrc);
+    CHECK(memcmp((const void*)REGION_START, image, IMAGE_SIZE) == 0);
+}
+
+// The last whole page before <bytes>
+static uint32_t Page(uint32_t bytes)
+{
+    return bytes / FLASH_WRITER_PAGE_SIZE * FLASH_WRITER_PAGE_SIZE;
+}
+
+// The newest image by version number, in one go
+static void TestListAndGet(void)
+{
+    static const char* const options[] = {NULL};
+    char                     sunflower[FTP_NAME_LEN];
+    char                     dandelion[FTP_NAME_LEN];
+
+    Serve(options);
+
+    CHECK(FTP_GetFwVersions(sunflower, dandelion, FTP_NAME_LEN));
+    CHECK(strcmp(sunflower, IMAGE_NAME) == 0 && dandelion[0] == '\0');
+    CHECK(FTP_Get(sunflower, SUNFLOWER_DEVICE));
+    CheckDownload(0);
+    CHECK(restCount == 0 && transfer.file_size == IMAGE_SIZE);
+
+    Stop();
+}
+
+// The first two data connections are reset DROP_AFTER bytes in: each is
+// resumed on a new control connection from the last whole page received
+static void TestDropped(bool size)
+{
+    static const char* const withSize[] = {"--drop-after", DROP_AFTER_ARG, "--drops", "2", NULL};
+    static const char* const noSize[] = {"--drop-after", DROP_AFTER_ARG, "--drops", "2", "--no-size", NULL};
+
+    Serve(size ? withSize : noSize);
+
+    CHECK(FTP_Get(IMAGE_NAME, SUNFLOWER_DEVICE));
+    CheckDownload(2);
+    CHECK(transfer.file_size == (size ? IMAGE_SIZE : 0));
+    CHECK(cutCount == 2 && cuts[0] <= DROP_AFTER && cuts[1] <= DROP_AFTER);
+    CHECK(restCount == 2 && rests[0] == Page(cuts[0]) && rests[1] == Page(rests[0] + cuts[1]));
+
+    if(size)
+    {
+        memcpy(resumedAt, rests, sizeof(resumedAt));
+    }
+
+    Stop();
+}
+
+// The first data connection ends DROP_AFTER bytes in, with a 226 as if the
+// file was complete. SIZE shows it is short and it is resumed on the same
+// control connection; without SIZE the image check fails it.
+static void TestShort(bool size)
+{
+    static const char* const withSize[] = {"--drop-after", DROP_AFTER_ARG, "--short", NULL};
+    static const char* const noSize[] = {"--drop-after", DROP_AFTER_ARG, "--short", "--no-size", NULL};
+
+    Serve(size ? withSize : noSize);
+
+    if(size)
+    {
+        CHECK(FTP_Get(IMAGE_NAME, SUNFLOWER_DEVICE));
+        CheckDownload(1);
+        CHECK(restCount == 1 && rests[0] == Page(DROP_AFTER) && g_connected);
+    }
+    else
+    {
+        CHECK(!FTP_Get(IMAGE_NAME, SUNFLOWER_DEVICE));
+        CHECK(stats.downloads == 0 && stats.failures == 1 && stats.resumes == 0 && restCount == 0);
+        CHECK(stats.last_bytes == DROP_AFTER && stats.last_crc == crc32(0x00000000, image, DROP_AFTER));
+        CHECK(memcmp((const void*)REGION_START, image, DROP_AFTER) == 0);
+        CHECK(*(uint32_t*)(REGION_START + DROP_AFTER) == 0xFFFFFFFF);
+    }
+
+    Stop();
+}
+
+int main(int argc, char** argv)
+{
+    CHECK(argc > 1);
+    standin = argv[1];
+    hostVerbose = argc > 2;
+
+    MakeImage();
+    atexit(RemoveImage);
+    atexit(Stop);
+    HostFlashInit();
+    FlashWriterOSInit();
+    hostIdleHook = Service;
+
+    TestListAndGet();
+    TestDropped(true);
+    TestDropped(false);
+    TestShort(true);
+    TestShort(false);
+
+    printf("ftp: %u byte image, resumed at %u and %u after resets, crc32 0x%08x, all tests passed\n",
+           IMAGE_SIZE, resumedAt[0], resumedAt[1], imageCrc);
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+// Upload session journal (app/src/fw_session.c) through the real flash
+// writer on simulated flash: resume with the same and a different key, a
+// bitmap word lost in the writer queue at a reset, a full sector wrapping
+// round, a torn record header, and a closed session.
+//
+// The writer task runs as hostIdleHook, one Service() pass whenever the
+// caller would block.
+#include <string.h>
+#include "host_os.h"
+#include "flash_writer.c"
+#include "fw_session.c"
+
+static const FW_SESSION_KEY keyA = {0xDA000001, SUNFLOWER_IMAGE_START, 200 * 1024, 0x1234ABCD};
+static const FW_SESSION_KEY keyB = {0xDA000001, SUNFLOWER_IMAGE_START, 200 * 1024, 0x1234ABCE};
+
+static void Fresh(void)
+{
+    HostFlashInit();
+    hostIdleHook = Service;
+    current = NULL;
+    memset(&stats, 0, sizeof(stats));
+}
+
+// The gateway resets: whatever is still in the writer queue never reaches
+// flash, and the session is forgotten until it is resumed
+static void Reset(void)
+{
+    osEvent event;
+
+    while((event = osMessageGet(workQ, 0)).status == osEventMessage)
+    {
+        if(event.value.p != NULL)
+        {
+            osMessagePut(freeQ, (uint32_t)event.value.p, 0);
+        }
+    }
+
+    pending = 0;
+    failed  = false;
+    current = NULL;
+    memset(missing, 0, sizeof(missing));
+}
+
+static bool Start(const FW_SESSION_KEY* key)
+{
+    FW_SESSION_KEY copy = *key;
+
+    return FwSessionStart(&copy);
+}
+
+static bool Resume(const FW_SESSION_KEY* key, uint32_t* out)
+{
+    FW_SESSION_KEY copy = *key;
+
+    return FwSessionResume(&copy, out);
+}
+
+static bool Missing(const uint32_t* bitmap, uint16_t chunk)
+{
+    return (bitmap[chunk / 32] & (1UL << (chunk % 32))) != 0;
+}
+
+static void MarkDone(uint16_t first, uint16_t count)
+{
+    for(uint16_t chunk = first; chunk < first + count; chunk++)
+    {
+        FwSessionMarkDone(chunk);
+    }
+}
+
+// Only the session with the same device, region, size and CRC resumes, with
+// the chunks synced before the reset done
+static void TestResumeKey(void)
+{
+    uint32_t out[FW_SESSION_BITMAP_WORDS];
+
+    Fresh();
+    CHECK(!Resume(&keyA, out));
+    CHECK(Start(&keyA));
+    MarkDone(0, 100);
+    CHECK(FwSessionSync() && FlashWriterFlush());
+    Reset();
+
+    CHECK(!Resume(&keyB, out) && current == NULL);
+    CHECK(Resume(&keyA, out) && current == &records[0]);
+
+    for(uint16_t chunk = 0; chunk < FW_SESSION_MAX_CHUNKS; chunk++)
+    {
+        CHECK(Missing(out, chunk) == (chunk >= 100));
+    }
+
+    // A new image replaces it
+    CHECK(Start(&keyB) && current == &records[1]);
+    CHECK(records[0].closed == 0);
+    Reset();
+    CHECK(!Resume(&keyA, out));
+    CHECK(Resume(&keyB, out) && Missing(out, 0));
+}
+
+// A bitmap word queued behind image data that the writer has not programmed
+// yet is lost at a reset: its chunks are sent again, never skipped
+static void TestQueuedWordLost(void)
+{
+    uint32_t out[FW_SESSION_BITMAP_WORDS];
+
+    Fresh();
+    CHECK(Start(&keyA));
+    MarkDone(0, 32);
+    CHECK(FwSessionSync() && FlashWriterFlush());
+
+    hostIdleHook = NULL;
+    MarkDone(32, 40);
+    CHECK(FwSessionSync());
+    CHECK(pending == 2 && dirty == 0);
+    CHECK(records[0].missing[1] == FLASH_ERASED_WORD && records[0].missing[2] == FLASH_ERASED_WORD);
+
+    Reset();
+    hostIdleHook = Service;
+    CHECK(Resume(&keyA, out));
+    CHECK(!Missing(out, 31) && Missing(out, 32) && Missing(out, 71));
+
+    // Once programmed it sticks
+    MarkDone(32, 40);
+    CHECK(FwSessionSync() && FlashWriterFlush());
+    Reset();
+    CHECK(Resume(&keyA, out) && !Missing(out, 71) && Missing(out, 72));
+}
+
+// When the sector is full the next session erases it and starts at record 0
+static void TestWrap(void)
+{
+    uint32_t out[FW_SESSION_BITMAP_WORDS];
+    uint32_t erases;
+
+    Fresh();
+
+    for(uint32_t i = 0; i < FW_SESSION_MAX_RECORDS; i++)
+    {
+        CHECK(Start((i & 1) ? &keyB : &keyA));
+    }
+
+    CHECK(LastRecord() == FW_SESSION_MAX_RECORDS - 1 && stats.erases == 0);
+    MarkDone(0, 10);
+    FwSessionClose();
+    CHECK(Start(&keyA));
+    CHECK(stats.erases == 1);
+    CHECK(LastRecord() == 0 && current == &records[0] && RecordValid(&records[0]));
+    CHECK(records[1].magic == FLASH_ERASED_WORD);
+
+    Reset();
+    CHECK(Resume(&keyA, out) && Missing(out, 0));
+
+    // A sector that cannot be erased fails the start
+    for(uint32_t i = 1; i < FW_SESSION_MAX_RECORDS; i++)
+    {
+        CHECK(Start(&keyB));
+    }
+    erases = hostFlashErases;
+    hostFlashEraseFails = 1;
+    CHECK(!Start(&keyA) && current == NULL);
+    CHECK(hostFlashErases == erases && LastRecord() == FW_SESSION_MAX_RECORDS - 1);
+}
+
+// A header whose CRC did not make it to flash is not resumed, and the next
+// session goes after it
+static void TestTornHeader(void)
+{
+    uint32_t out[FW_SESSION_BITMAP_WORDS];
+
+    Fresh();
+    CHECK(Start(&keyA));
+    CHECK(FlashWriterFlush());
+    Reset();
+
+    // Programming stopped half way through the CRC word
+    records[0].crc32 |= 0x0000FFFF;
+    CHECK(LastRecord() == 0 && !RecordValid(&records[0]));
+    CHECK(!Resume(&keyA, out));
+
+    CHECK(Start(&keyA) && current == &records[1]);
+    Reset();
+    CHECK(Resume(&keyA, out) && current == &records[1]);
+}
+
+// Close syncs the bitmap first, then the record cannot be resumed
+static void TestClose(void)
+{
+    uint32_t out[FW_SESSION_BITMAP_WORDS];
+
+    Fresh();
+    CHECK(Start(&keyA));
+    MarkDone(0, 5);
+    FwSessionClose();
+    CHECK(current == NULL && pending == 0);
+    CHECK(records[0].closed == 0 && records[0].missing[0] == 0xFFFFFFE0);
+
+    Reset();
+    CHECK(!Resume(&keyA, out));
+
+    // Marking and syncing without a session does nothing
+    FwSessionMarkDone(7);
+    CHECK(FwSessionSync() && pending == 0);
+    FwSessionClose();
+    CHECK(records[0].missing[0] == 0xFFFFFFE0);
+}
+
+int main(int argc, char** argv)
+{
+    hostVerbose = argc > 1;
+
+    FlashWriterOSInit();
+
+    TestResumeKey();
+    TestQueuedWordLost();
+    TestWrap();
+    TestTornHeader();
+    TestClose();
+
+    printf("fw_session: %u records per sector, all tests passed\n", (unsigned)FW_SESSION_MAX_RECORDS);
+
+    return 0;
+}
@@ -0,0 +1,390 @@
+// Firmware upload protocol (app/src/fw_upload.c) with the real flash writer
+// and session journal on simulated flash. CHUNK frames are fed split and
+// coalesced at arbitrary boundaries, out of order, duplicated and outside the
+// window, checking the cumulative WINDOW_ACK after every segment. Then a
+// signed 256 KB image goes end to end over a loopback socket from a sender
+// process keeping a window of chunks in flight, at the typical program and
+// erase times of the part.
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "host_os.h"
+#include "flash_writer.c"
+#include "fw_session.c"
+#include "fw_upload.c"
+
+#define IMAGE_SIZE      SUNFLOWER_IMAGE_SIZE
+#define IMAGE_CHUNKS    (IMAGE_SIZE / TCP_FW_PAYLOAD_BYTES)
+#define REGION_START    SUNFLOWER_BACKUP_APP_START
+#define SENDER_WINDOW   16              // Chunks in flight from the loopback sender
+
+static uint8_t  image[IMAGE_SIZE];
+static uint8_t  sent[4096];             // What the gateway answered, without a socket
+static uint16_t sentLen;
+
+// Firmware the upload calls into: running from the main slot, so the
+// backup slot is updated
+
+bool Is_Running_From_Main_Slot(void)
+{
+    return true;
+}
+
+bool Is_Sunflower_Image_Linked(bool main_region)
+{
+    return !main_region;
+}
+
+bool Is_Sunflower_Image_Valid(bool main_region)
+{
+    return false;
+}
+
+bool Is_Dandelion_Image_Valid(void)
+{
+    return false;
+}
+
+void Invalidate_Sunflower_Verify_Cache(bool main_region)
+{
+}
+
+// netconn: answers go to the socket, or to sent[] without one
+
+err_t netconn_write(struct netconn* conn, const void* data, size_t size, u8_t flags)
+{
+    if(conn->fd >= 0)
+    {
+        return send(conn->fd, data, size, MSG_NOSIGNAL) == (ssize_t)size ? ERR_OK : ERR_CONN;
+    }
+
+    CHECK(sentLen + size <= sizeof(sent));
+    memcpy(&sent[sentLen], data, size);
+    sentLen += size;
+
+    return ERR_OK;
+}
+
+// Random bytes with a sunflower header carrying their CRCs, as sign-app.py
+// leaves it
+static void MakeImage(void)
+{
+    SUNFLOWER_APP_HEADER* header = (SUNFLOWER_APP_HEADER*)image;
+
+    srand(1);
+    for(uint32_t i = 0; i < IMAGE_SIZE; i++)
+    {
+        image[i] = rand();
+    }
+
+    header->image_size   = IMAGE_SIZE;
+    header->body_crc32   = crc32(0x00000000, &image[sunflowerLayout.body_start], IMAGE_SIZE - sunflowerLayout.body_start);
+    header->header_crc32 = crc32(0x00000000, image, sunflowerLayout.header_end);
+}
+
+static uint16_t ChunkFrame(uint8_t* out, uint16_t seq, const uint8_t* payload)
+{
+    out[0] = CHUNK;
+    out[1] = SUNFLOWER_DEVICE;
+    out[2] = seq & 0xFF;
+    out[3] = seq >> 8;
+    memcpy(&out[4], payload, TCP_FW_PAYLOAD_BYTES);
+
+    return FW_CHUNK_FRAME_BYTES;
+}
+
+static uint16_t Chunks(uint8_t* out, const uint16_t* seqs, uint16_t count)
+{
+    uint16_t len = 0;
+
+    for(uint16_t i = 0; i < count; i++)
+    {
+        len += ChunkFrame(&out[len], seqs[i], &image[seqs[i] * TCP_FW_PAYLOAD_BYTES]);
+    }
+
+    return len;
+}
+
+// Feed <len> bytes as one segment and return what the gateway answered
+static uint16_t Input(struct netconn* conn, uint8_t* data, uint16_t len, uint8_t* answer)
+{
+    sentLen = 0;
+    CHECK(FwUploadInput(conn, data, len));
+    memcpy(answer, sent, sentLen);
+
+    return sentLen;
+}
+
+static bool WindowAck(const uint8_t* answer, uint16_t len, uint16_t seq)
+{
+    return len == FW_WINDOW_ACK_BYTES && answer[0] == WINDOW_ACK && answer[1] == (seq & 0xFF) && answer[2] == (seq >> 8);
+}
+
+static void Start(struct netconn* conn)
+{
+    uint8_t start[2] = {START, SUNFLOWER_DEVICE};
+    uint8_t answer[8];
+
+    FwUploadReset();
+    CHECK(Input(conn, start, sizeof(start), answer) == 1 && answer[0] == TCP_ACK);
+}
+
+static bool InFlash(uint16_t seq)
+{
+    return memcmp((const void*)(uintptr_t)(REGION_START + seq * TCP_FW_PAYLOAD_BYTES),
+                  &image[seq * TCP_FW_PAYLOAD_BYTES], TCP_FW_PAYLOAD_BYTES) == 0;
+}
+
+// 64 chunks in order, cut into segments of 1 to 600 bytes: every segment
+// that completes a frame is answered with one WINDOW_ACK for all of them
+static void TestSplitAndCoalesced(struct netconn* conn)
+{
+    static uint8_t stream[64 * FW_CHUNK_FRAME_BYTES];
+    uint16_t       seqs[64];
+    uint8_t        answer[64];
+    uint32_t       len;
+    uint32_t       fed = 0;
+    uint16_t       acks = 0;
+
+    for(uint16_t i = 0; i < 64; i++)
+    {
+        seqs[i] = i;
+    }
+    len = Chunks(stream, seqs, 64);
+
+    Start(conn);
+    srand(2);
+
+    while(fed < len)
+    {
+        uint16_t segment = 1 + rand() % 600;
+        uint16_t before  = fed / FW_CHUNK_FRAME_BYTES;
+        uint16_t answered;
+
+        segment = (segment < len - fed) ? segment : len - fed;
+        answered = Input(conn, &stream[fed], segment, answer);
+        fed += segment;
+
+        if(fed / FW_CHUNK_FRAME_BYTES > before)
+        {
+            CHECK(WindowAck(answer, answered, fed / FW_CHUNK_FRAME_BYTES));
+            acks++;
+        }
+        else
+        {
+            CHECK(answered == 0);
+        }
+    }
+
+    CHECK(next_chunk == 64 && acks < 64);
+
+    // The same again in one segment is all duplicates: one ack, nothing written
+    CHECK(FlashWriterFlush());
+    len = stats.pages;
+    CHECK(WindowAck(answer, Input(conn, stream, sizeof(stream), answer), 64));
+    CHECK(FlashWriterFlush() && stats.pages == len);
+
+    for(uint16_t seq = 0; seq < 64; seq++)
+    {
+        CHECK(InFlash(seq));
+    }
+}
+
+// The ack stays at the first hole; duplicates are acknowledged but not
+// rewritten; chunks past the image and unknown commands are NACKed without
+// losing the frames around them
+static void TestOutOfOrder(struct netconn* conn)
+{
+    static const uint16_t first[] = {0, 1, 3, 4};
+    static const uint16_t hole[] = {2};
+    static const uint16_t next[] = {5};
+    static const uint16_t last[] = {6};
+    uint8_t               stream[8 * FW_CHUNK_FRAME_BYTES];
+    uint8_t               answer[64];
+    uint8_t               end = END;
+    uint16_t              len;
+    uint16_t              answered;
+
+    Start(conn);
+
+    len = Chunks(stream, first, 4);
+    CHECK(WindowAck(answer, Input(conn, stream, len, answer), 2));
+    CHECK(WindowAck(answer, Input(conn, stream, 2 * FW_CHUNK_FRAME_BYTES, answer), 2));
+
+    len = Chunks(stream, hole, 1);
+    CHECK(WindowAck(answer, Input(conn, stream, len, answer), 5));
+
+    // A retransmission of chunk 1 with other data in it
+    len = ChunkFrame(stream, 1, &image[40 * TCP_FW_PAYLOAD_BYTES]);
+    CHECK(WindowAck(answer, Input(conn, stream, len, answer), 5));
+
+    // Chunk 1024 is past the end of the image
+    len = ChunkFrame(stream, IMAGE_CHUNKS, image);
+    len += Chunks(&stream[len], next, 1);
+    answered = Input(conn, stream, len, answer);
+    CHECK(answered == 1 + FW_WINDOW_ACK_BYTES && answer[0] == TCP_NACK);
+    CHECK(WindowAck(&answer[1], FW_WINDOW_ACK_BYTES, 6));
+
+    stream[0] = 0xEE;
+    len = 1 + Chunks(&stream[1], last, 1);
+    answered = Input(conn, stream, len, answer);
+    CHECK(answered == 1 + FW_WINDOW_ACK_BYTES && answer[0] == TCP_NACK);
+    CHECK(WindowAck(&answer[1], FW_WINDOW_ACK_BYTES, 7));
+
+    CHECK(Input(conn, &end, 1, answer) == 1 && answer[0] == TCP_ACK);
+
+    for(uint16_t seq = 0; seq < 7; seq++)
+    {
+        CHECK(InFlash(seq));
+    }
+}
+
+// The host side of the upload: START, the image with SENDER_WINDOW chunks in
+// flight, END, VALIDATE and EXIT_MODE. Exits 0 if the gateway acked it all.
+static int Sender(uint16_t port)
+{
+    struct sockaddr_in sa;
+    uint8_t            frame[FW_CHUNK_FRAME_BYTES];
+    uint8_t            cmd[2] = {START, SUNFLOWER_DEVICE};
+    uint8_t            answer[FW_WINDOW_ACK_BYTES];
+    uint16_t           sentSeq = 0;
+    uint16_t           ackedSeq = 0;
+    int                fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 ||
+       send(fd, cmd, 2, 0) != 2 || recv(fd, answer, 1, MSG_WAITALL) != 1 || answer[0] != TCP_ACK)
+    {
+        return 1;
+    }
+
+    while(ackedSeq < IMAGE_CHUNKS)
+    {
+        while(sentSeq < IMAGE_CHUNKS && sentSeq - ackedSeq < SENDER_WINDOW)
+        {
+            ChunkFrame(frame, sentSeq, &image[sentSeq * TCP_FW_PAYLOAD_BYTES]);
+            if(send(fd, frame, sizeof(frame), 0) != sizeof(frame))
+            {
+                return 2;
+            }
+            sentSeq++;
+        }
+
+        if(recv(fd, answer, FW_WINDOW_ACK_BYTES, MSG_WAITALL) != FW_WINDOW_ACK_BYTES || answer[0] != WINDOW_ACK)
+        {
+            return 3;
+        }
+        ackedSeq = answer[1] | (answer[2] << 8);
+    }
+
+    cmd[0] = END;
+    if(send(fd, cmd, 1, 0) != 1 || recv(fd, answer, 1, MSG_WAITALL) != 1 || answer[0] != TCP_ACK)
+    {
+        return 4;
+    }
+
+    cmd[0] = VALIDATE;
+    if(send(fd, cmd, 2, 0) != 2 || recv(fd, answer, 1, MSG_WAITALL) != 1 || answer[0] != TCP_ACK)
+    {
+        return 5;
+    }
+
+    cmd[0] = EXIT_MODE;
+    if(send(fd, cmd, 1, 0) != 1 || recv(fd, answer, 1, MSG_WAITALL) != 1 || answer[0] != TCP_ACK)
+    {
+        return 6;
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+// The gateway side: every recv() is one segment for FwUploadInput
+static void TestLoopback(void)
+{
+    struct sockaddr_in sa;
+    socklen_t          salen = sizeof(sa);
+    struct netconn     conn;
+    struct timespec    begin, end;
+    uint8_t            segment[1460];
+    uint32_t           startTick;
+    uint32_t           ms, wallUs;
+    ssize_t            len;
+    int                status;
+    int                server = socket(AF_INET, SOCK_STREAM, 0);
+    pid_t              pid;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(server, (struct sockaddr*)&sa, sizeof(sa)) == 0 && listen(server, 1) == 0);
+    CHECK(getsockname(server, (struct sockaddr*)&sa, &salen) == 0);
+
+    fflush(stdout);
+    pid = fork();
+    CHECK(pid >= 0);
+    if(pid == 0)
+    {
+        close(server);
+        exit(Sender(ntohs(sa.sin_port)));
+    }
+
+    HostFlashInit();
+    memset(&stats, 0, sizeof(stats));
+    hostFlashTiming = 1;
+    FwUploadReset();
+
+    conn.fd = accept(server, NULL, NULL);
+    CHECK(conn.fd >= 0);
+    close(server);
+
+    startTick = xTaskGetTickCount();
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    do
+    {
+        len = recv(conn.fd, segment, sizeof(segment), 0);
+    } while(len > 0 && FwUploadInput(&conn, segment, len));
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms = xTaskGetTickCount() - startTick;
+    wallUs = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_nsec - begin.tv_nsec) / 1000;
+
+    CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(conn.fd);
+
+    CHECK(memcmp((const void*)REGION_START, image, IMAGE_SIZE) == 0);
+    CHECK(ImageCrcComplete(&image_crc) && image_crc.body_crc == ((SUNFLOWER_APP_HEADER*)image)->body_crc32);
+    CHECK(stats.write_errors == 0 && stats.erases == 2);
+
+    printf("  256 KB over loopback: %u ms on the simulated flash, %u KB/s (program %u ms, erase %u ms, %u stalls), %u ms on this host\n",
+           ms, IMAGE_SIZE / 1024 * 1000 / ms, stats.program_ms, stats.erase_ms, stats.stalls, wallUs / 1000);
+}
+
+int main(int argc, char** argv)
+{
+    struct netconn capture = { -1, 0 };
+
+    hostVerbose = argc > 1;
+
+    MakeImage();
+    HostFlashInit();
+    FlashWriterOSInit();
+    hostIdleHook = Service;
+
+    TestSplitAndCoalesced(&capture);
+    TestOutOfOrder(&capture);
+
+    printf("fw_upload: all tests passed, %u chunk window from the sender:\n", SENDER_WINDOW);
+    TestLoopback();
+
+    return 0;
+}
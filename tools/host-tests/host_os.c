@@ -0,0 +1,460 @@
+// Host runtime for the tests: the single threaded CMSIS-RTOS stand-in, the
+// tick, the debug printers and a simulated STM32F4 flash mapped at the
+// addresses the firmware uses.
+#include "stm32f4xx.h"
+#include "stm32f4xx_flash.h"
+#include "cmsis_os.h"
+#include "task.h"
+#include "queue.h"
+#include "debug.h"
+#include "xprintf.h"
+#include "dwt.h"
+#include "host_os.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HOST_QUEUE_MAX      64
+#define HOST_IDLE_PASSES    8       // hostIdleHook calls before a wait on an empty queue or semaphore times out
+
+// Typical STM32F407 times at x32 parallelism (datasheet, flash memory
+// programming characteristics)
+#define FLASH_WORD_US       16
+#define FLASH_ERASE_16K_MS  250
+#define FLASH_ERASE_64K_MS  550
+#define FLASH_ERASE_128K_MS 1000
+
+struct host_queue {
+    uint32_t items[HOST_QUEUE_MAX];
+    uint32_t size;
+    uint32_t head;
+    uint32_t count;
+};
+
+FLASH_TypeDef   hostFlashRegs = { FLASH_CR_LOCK, 0 };
+int             hostVerbose;
+uint32_t        hostFlashPrograms;
+uint32_t        hostFlashErases;
+int32_t         hostFlashPowerCut = -1;
+uint32_t        hostFlashEraseFails;
+uint32_t        hostFlashProgramFails;
+uint32_t        hostFlashStuckAddress;
+uint32_t        hostFlashStuckMask;
+int             hostFlashTiming;
+void            (*hostIdleHook)(void);
+
+static TickType_t   tick;
+static uint32_t     busyUs;         // Flash busy time not yet on the tick
+static int          idle;           // In hostIdleHook
+static uint8_t*     flash;
+
+static void     FlashBusy(uint32_t us);
+static bool     ProgramDone(void);
+static void     Idle(void);
+
+// Sector layout of the STM32F407: 4 x 16k, 64k, then 128k sectors
+static const uint32_t sectorStart[] = {
+    0x08000000, 0x08004000, 0x08008000, 0x0800C000, 0x08010000, 0x08020000, 0x08040000, 0x08060000,
+    0x08080000, 0x080A0000, 0x080C0000, 0x080E0000, 0x08100000
+};
+
+// Reserve the flash range at its real address, erased
+void HostFlashInit(void)
+{
+    if(flash == NULL)
+    {
+        flash = mmap((void*)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+        if(flash != (uint8_t*)HOST_FLASH_BASE)
+        {
+            perror("mmap flash");
+            exit(2);
+        }
+    }
+
+    memset(flash, 0xFF, HOST_FLASH_SIZE);
+    hostFlashRegs.CR = FLASH_CR_LOCK;
+    hostFlashPowerCut = -1;
+    hostFlashEraseFails = 0;
+    hostFlashProgramFails = 0;
+    hostFlashStuckAddress = 0;
+}
+
+void FLASH_Unlock(void)
+{
+    hostFlashRegs.CR &= ~FLASH_CR_LOCK;
+}
+
+void FLASH_Lock(void)
+{
+    hostFlashRegs.CR |= FLASH_CR_LOCK;
+}
+
+void FLASH_ClearFlag(uint32_t flags)
+{
+    hostFlashRegs.SR &= ~flags;
+}
+
+// Programming only clears bits. After hostFlashPowerCut more words the power
+// is "cut": every later write is lost until the test remounts.
+FLASH_Status FLASH_ProgramWord(uint32_t address, uint32_t data)
+{
+    assert((hostFlashRegs.CR & FLASH_CR_LOCK) == 0);
+    assert(address % 4 == 0 && address >= HOST_FLASH_BASE && address < HOST_FLASH_BASE + HOST_FLASH_SIZE);
+
+    if(hostFlashPowerCut == 0)
+    {
+        return FLASH_ERROR_PROGRAM;
+    }
+    if(hostFlashPowerCut > 0)
+    {
+        hostFlashPowerCut--;
+    }
+
+    *(volatile uint32_t*)(uintptr_t)address &= data;
+    hostFlashPrograms++;
+
+    return ProgramDone() ? FLASH_COMPLETE : FLASH_ERROR_PROGRAM;
+}
+
+// The flash writer stores to the flash itself with PG set and waits on this
+// after every unit
+FLASH_Status FLASH_WaitForLastOperation(void)
+{
+    if((hostFlashRegs.CR & FLASH_CR_PG) == 0)
+    {
+        return FLASH_COMPLETE;
+    }
+
+    assert((hostFlashRegs.CR & FLASH_CR_LOCK) == 0);
+    hostFlashPrograms++;
+
+    return ProgramDone() ? FLASH_COMPLETE : FLASH_ERROR_PROGRAM;
+}
+
+FLASH_Status FLASH_EraseSector(uint32_t sector, uint8_t voltageRange)
+{
+    uint32_t index = sector >> 3;
+
+    assert((hostFlashRegs.CR & FLASH_CR_LOCK) == 0);
+    assert(index + 1 < sizeof(sectorStart) / sizeof(sectorStart[0]));
+
+    if(hostFlashPowerCut == 0)
+    {
+        return FLASH_ERROR_OPERATION;
+    }
+    if(hostFlashEraseFails > 0)
+    {
+        hostFlashEraseFails--;
+        return FLASH_ERROR_OPERATION;
+    }
+
+    memset((void*)(uintptr_t)sectorStart[index], 0xFF, sectorStart[index + 1] - sectorStart[index]);
+    hostFlashErases++;
+
+    switch(sectorStart[index + 1] - sectorStart[index])
+    {
+        case 0x4000:  FlashBusy(FLASH_ERASE_16K_MS * 1000);  break;
+        case 0x10000: FlashBusy(FLASH_ERASE_64K_MS * 1000);  break;
+        default:      FlashBusy(FLASH_ERASE_128K_MS * 1000); break;
+    }
+
+    return FLASH_COMPLETE;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return tick;
+}
+
+void hostTickAdvance(TickType_t ms)
+{
+    tick += ms;
+}
+
+osMessageQId osMessageCreate(uint32_t size, void* thread)
+{
+    struct host_queue* q = calloc(1, sizeof(struct host_queue));
+
+    assert(size <= HOST_QUEUE_MAX);
+    q->size = size;
+
+    return q;
+}
+
+osStatus osMessagePut(osMessageQId q, uint32_t info, uint32_t millisec)
+{
+    if(q->count == q->size)
+    {
+        return osErrorResource;
+    }
+
+    q->items[(q->head + q->count++) % q->size] = info;
+
+    return osOK;
+}
+
+osEvent osMessageGet(osMessageQId q, uint32_t millisec)
+{
+    osEvent event;
+
+    for(uint8_t i = 0; i < HOST_IDLE_PASSES && q->count == 0 && millisec != 0; i++)
+    {
+        Idle();
+    }
+
+    if(q->count == 0)
+    {
+        event.status = osEventTimeout;
+        event.value.p = NULL;
+        return event;
+    }
+
+    event.status = osEventMessage;
+    event.value.p = (void*)(uintptr_t)q->items[q->head];
+    q->head = (q->head + 1) % q->size;
+    q->count--;
+
+    return event;
+}
+
+uint32_t uxQueueMessagesWaiting(osMessageQId q)
+{
+    return q->count;
+}
+
+osMutexId osMutexCreate(int* def)
+{
+    return def;
+}
+
+osStatus osMutexWait(osMutexId mutex, uint32_t millisec)
+{
+    return osOK;
+}
+
+osStatus osMutexRelease(osMutexId mutex)
+{
+    return osOK;
+}
+
+osSemaphoreId osSemaphoreCreate(int* def, int32_t count)
+{
+    *def = count;
+    return def;
+}
+
+int32_t osSemaphoreWait(osSemaphoreId semaphore, uint32_t millisec)
+{
+    for(uint8_t i = 0; i < HOST_IDLE_PASSES && *semaphore == 0 && millisec != 0; i++)
+    {
+        Idle();
+    }
+
+    if(*semaphore == 0)
+    {
+        return osErrorOS;
+    }
+
+    (*semaphore)--;
+
+    return osOK;
+}
+
+osStatus osSemaphoreRelease(osSemaphoreId semaphore)
+{
+    (*semaphore)++;
+
+    return osOK;
+}
+
+osStatus osDelay(uint32_t millisec)
+{
+    tick += millisec;
+    Idle();
+
+    return osOK;
+}
+
+// DWT->CYCCNT reads the time stamp counter (stubs/dwt.h)
+DWT_Type* HostDwt(void)
+{
+    static DWT_Type dwt;
+
+#if defined(__x86_64__) || defined(__i386__)
+    dwt.CYCCNT = (uint32_t)__builtin_ia32_rdtsc();
+#endif
+
+    return &dwt;
+}
+
+static void Print(const char* prefix, const char* fmt, va_list args)
+{
+    if(hostVerbose)
+    {
+        printf("%s", prefix);
+        vprintf(fmt, args);
+    }
+}
+
+void ERR(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Print("ERROR: ", fmt, args);
+    va_end(args);
+}
+
+void WARN(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Print("WARN: ", fmt, args);
+    va_end(args);
+}
+
+void INFO(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Print("INFO: ", fmt, args);
+    va_end(args);
+}
+
+void DEBUG(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Print("DEBUG: ", fmt, args);
+    va_end(args);
+}
+
+void xprintf(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Print("", fmt, args);
+    va_end(args);
+}
+
+// ChaN's xatoi: skips leading spaces, takes decimal, 0x hex, 0b binary or 0
+// octal up to the next space or the end, fails on any other character
+int xatoi(char** str, long* res)
+{
+    unsigned long val = 0;
+    uint8_t       radix;
+    char          c;
+    int           negative = 0;
+
+    *res = 0;
+
+    while(**str == ' ')
+    {
+        (*str)++;
+    }
+
+    c = **str;
+    if(c == '-')
+    {
+        negative = 1;
+        c = *(++(*str));
+    }
+
+    if(c == '0')
+    {
+        c = *(++(*str));
+        switch(c)
+        {
+            case 'x': radix = 16; c = *(++(*str)); break;
+            case 'b': radix = 2;  c = *(++(*str)); break;
+            default:
+                if(c <= ' ')
+                {
+                    return 1;
+                }
+                if(c < '0' || c > '9')
+                {
+                    return 0;
+                }
+                radix = 8;
+        }
+    }
+    else
+    {
+        if(c < '0' || c > '9')
+        {
+            return 0;
+        }
+        radix = 10;
+    }
+
+    while(c > ' ')
+    {
+        if(c >= 'a')
+        {
+            c -= 0x20;
+        }
+        c -= '0';
+        if(c >= 17)
+        {
+            c -= 7;
+            if(c <= 9)
+            {
+                return 0;
+            }
+        }
+        if(c >= radix)
+        {
+            return 0;
+        }
+        val = val * radix + c;
+        c = *(++(*str));
+    }
+
+    *res = negative ? -(long)val : (long)val;
+
+    return 1;
+}
+
+// Local function implementations
+
+void FlashBusy(uint32_t us)
+{
+    if(hostFlashTiming)
+    {
+        busyUs += us;
+        tick += busyUs / 1000;
+        busyUs %= 1000;
+    }
+}
+
+// One word programmed: its time, stuck bits and injected failures
+bool ProgramDone(void)
+{
+    FlashBusy(FLASH_WORD_US);
+
+    if(hostFlashStuckAddress != 0)
+    {
+        *(volatile uint32_t*)(uintptr_t)hostFlashStuckAddress &= ~hostFlashStuckMask;
+    }
+
+    if(hostFlashProgramFails > 0)
+    {
+        hostFlashProgramFails--;
+        return false;
+    }
+
+    return true;
+}
+
+void Idle(void)
+{
+    if(hostIdleHook != NULL && !idle)
+    {
+        idle = 1;
+        hostIdleHook();
+        idle = 0;
+    }
+}
@@ -0,0 +1,39 @@
+// Host runtime shared by the tests, see host_os.c
+#ifndef __HOST_OS_H
+#define __HOST_OS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define HOST_FLASH_BASE     0x08000000UL
+#define HOST_FLASH_SIZE     (1024 * 1024)
+
+// Fail the test with the location unless cond holds
+#define CHECK(cond)                                                                 \
+    do {                                                                            \
+        if(!(cond))                                                                 \
+        {                                                                           \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);          \
+            exit(1);                                                                \
+        }                                                                           \
+    } while(0)
+
+extern int      hostVerbose;            // Print the firmware's xprintf and debug output
+extern uint32_t hostFlashPrograms;      // Words programmed so far
+extern uint32_t hostFlashErases;
+extern int32_t  hostFlashPowerCut;      // Words programmed before the power goes, -1 never
+extern uint32_t hostFlashEraseFails;    // Erases to fail from now on, leaving the sector as it was
+extern uint32_t hostFlashProgramFails;  // Programming operations to report as failed from now on
+extern uint32_t hostFlashStuckAddress;  // Word whose hostFlashStuckMask bits read 0 once programmed, 0 for none
+extern uint32_t hostFlashStuckMask;
+extern int      hostFlashTiming;        // Program and erase take their typical STM32F407 x32 times on the tick
+
+// Runs whatever the other tasks would while the caller blocks: called by
+// osDelay(), and by osMessageGet() and osSemaphoreWait() with a timeout on an
+// empty queue or semaphore
+extern void     (*hostIdleHook)(void);
+
+void HostFlashInit(void);
+
+#endif // __HOST_OS_H
@@ -0,0 +1,211 @@
+// MQTT client (app/src/mqtt_client.c) against the scripted broker in
+// mqtt_test_broker.py, which starts this program once it is listening and
+// passes its port. Two sessions over real sockets: the broker drops the
+// first one after three publishes and acks the publishes of the second out
+// of order. The broker checks the packets and that every report in the log
+// arrives; this side checks the log acks and the commands the broker sent.
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "host_os.h"
+#include "mqtt_client.c"
+
+#define LOG_REPORTS     40
+#define CORRUPT_SEQ     7               // Fails to read back, so it is skipped
+#define RECV_CHUNK      7               // Bytes per netbuf, splits the broker's packets
+
+static uint32_t ackedSeq;
+static uint32_t polling;
+static bool     valveOpen[8];
+
+// Firmware the client calls into
+
+uint32_t RadioGetMACAddress(void)
+{
+    return 0xabcd1234;
+}
+
+uint32_t GetUnixTime(void)
+{
+    return time(NULL);
+}
+
+void OpenValve(uint8_t valve)
+{
+    valveOpen[valve] = true;
+}
+
+void CloseValve(uint8_t valve)
+{
+    valveOpen[valve] = false;
+}
+
+void SendToBroadcast(uint8_t* data, uint8_t size)
+{
+    polling = ((generic_message_t*)data)->payload.sensor_cmd.sensor_polling_period;
+    vPortFree(data);
+}
+
+// Node 0x100 sent seqs 1-4, node 0x101 seqs 5-9 and so on
+bool ReportLogRead(uint32_t seq, generic_message_t* report)
+{
+    if(seq == 0 || seq > LOG_REPORTS || seq == CORRUPT_SEQ)
+    {
+        return false;
+    }
+
+    memset(report, 0, sizeof(generic_message_t));
+    report->src = 0x100 + seq / 5;
+    report->payload.sensor_message.timestamp = time(NULL) - 3;
+    report->payload.sensor_message.moisture0 = seq;
+
+    return true;
+}
+
+void ReportLogAck(uint32_t seq)
+{
+    ackedSeq = seq > ackedSeq ? seq : ackedSeq;
+
+    // Everything is in: end the session the way the console does
+    if(ackedSeq == LOG_REPORTS)
+    {
+        MqttEnable(false);
+    }
+}
+
+uint32_t ReportLogFirstUnacked(void)
+{
+    return ackedSeq + 1;
+}
+
+uint32_t ReportLogNextSeq(void)
+{
+    return LOG_REPORTS + 1;
+}
+
+// netconn over a socket; waiting in recv moves the tick on by the time waited
+
+struct netconn* host_netconn_new(int type)
+{
+    struct netconn* c = calloc(1, sizeof(struct netconn));
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    return c;
+}
+
+err_t netconn_connect(struct netconn* conn, ip_addr_t* addr, u16_t port)
+{
+    struct sockaddr_in sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = ip4_addr_get_u32(addr);
+
+    return connect(conn->fd, (struct sockaddr*)&sa, sizeof(sa)) == 0 ? ERR_OK : ERR_CONN;
+}
+
+err_t netconn_recv(struct netconn* conn, struct netbuf** buf)
+{
+    struct pollfd   p = { conn->fd, POLLIN, 0 };
+    struct timespec start, end;
+    struct netbuf*  b;
+    int             ready;
+    ssize_t         len;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ready = poll(&p, 1, conn->recv_timeout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    hostTickAdvance((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+
+    if(ready == 0)
+    {
+        return ERR_TIMEOUT;
+    }
+
+    b = malloc(sizeof(struct netbuf));
+    len = recv(conn->fd, b->data, RECV_CHUNK, 0);
+    if(len <= 0)
+    {
+        free(b);
+        return ERR_CLSD;
+    }
+
+    b->len = len;
+    *buf = b;
+
+    return ERR_OK;
+}
+
+err_t netconn_write(struct netconn* conn, const void* data, size_t size, u8_t flags)
+{
+    return send(conn->fd, data, size, MSG_NOSIGNAL) == (ssize_t)size ? ERR_OK : ERR_CONN;
+}
+
+err_t netconn_close(struct netconn* conn)
+{
+    close(conn->fd);
+
+    return ERR_OK;
+}
+
+err_t netconn_delete(struct netconn* conn)
+{
+    free(conn);
+
+    return ERR_OK;
+}
+
+err_t netbuf_data(struct netbuf* buf, void** data, u16_t* len)
+{
+    *data = buf->data;
+    *len = buf->len;
+
+    return ERR_OK;
+}
+
+s8_t netbuf_next(struct netbuf* buf)
+{
+    return -1;
+}
+
+void netbuf_delete(struct netbuf* buf)
+{
+    free(buf);
+}
+
+int main(int argc, char** argv)
+{
+    CHECK(argc > 1);
+    hostVerbose = argc > 2;
+
+    MqttOSInit();
+    CHECK(MqttSetBroker("127.0.0.1", atoi(argv[1])));
+    MqttEnable(true);
+
+    // Dropped by the broker part way: accepted, but counted as a failure
+    CHECK(Session());
+    CHECK(stats.connects == 1 && stats.failures == 1);
+    CHECK(ackedSeq < LOG_REPORTS);
+
+    // Runs until the last report is acked, then disconnects cleanly
+    CHECK(Session());
+    CHECK(stats.connects == 2 && stats.failures == 1);
+    CHECK(ackedSeq == LOG_REPORTS);
+
+    CHECK(valveOpen[3]);
+    CHECK(polling == 5000);
+    CHECK(stats.commands == 2);
+
+    if(hostVerbose)
+    {
+        MqttPrintStatus();
+    }
+    printf("mqtt_client: %u reports acked over %u sessions, %u publishes\n", ackedSeq, stats.connects, stats.publishes);
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+import sys
+import socket
+import struct
+import argparse
+import subprocess
+
+# Scripted MQTT 3.1.1 broker for mqtt_client_test.c: listens on a free
+# loopback port, runs the test with the port as its first argument and
+# serves it two sessions. The first is dropped after three publishes, the
+# second has its publishes acked two at a time in reverse order (the one
+# with the last report straight away), and its SUBSCRIBE is answered with a
+# valve command at QoS 1, a polling command at QoS 0 and a publish too large
+# for the client, which it has to skip.
+# Exits non-zero if a packet is malformed, a report goes to the wrong node's
+# topic, a report is missing or the test fails.
+
+GATEWAY = b'abcd1234'
+REPORTS = 40
+CORRUPT_SEQ = 7                 # Not readable from the test's log, never published
+DROP_AFTER = 3                  # Publishes in the first session
+
+def encode_length(n):
+    out = b''
+    while True:
+        byte = n % 128
+        n //= 128
+        out += bytes([byte | (0x80 if n else 0)])
+        if not n:
+            return out
+
+def packet(header, body):
+    return bytes([header]) + encode_length(len(body)) + body
+
+def string(s):
+    return struct.pack('!H', len(s)) + s
+
+def read_exact(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+def read_packet(sock):
+    header = read_exact(sock, 1)
+    if header is None:
+        return None, None
+    length, shift = 0, 0
+    while True:
+        byte = read_exact(sock, 1)
+        if byte is None:
+            return None, None
+        length += (byte[0] & 0x7f) << shift
+        shift += 7
+        if not byte[0] & 0x80:
+            break
+    body = read_exact(sock, length)
+    if body is None:
+        return None, None
+    return header[0], body
+
+def field(body, offset):
+    n = struct.unpack('!H', body[offset:offset + 2])[0]
+    return body[offset + 2:offset + 2 + n], offset + 2 + n
+
+class Broker:
+    def __init__(self, verbose):
+        self.verbose = verbose
+        self.seen = set()
+        self.errors = []
+
+    def log(self, text):
+        if self.verbose:
+            print("  broker: %s" % text)
+
+    def check(self, cond, text):
+        if not cond:
+            self.errors.append(text)
+            print("  broker: %s" % text)
+
+    def connect(self, sock, body):
+        self.check(body[:7] == b'\x00\x04MQTT\x04', "bad protocol name or level %r" % body[:7])
+        # Clean session, will at QoS 1, retained
+        self.check(body[7] == 0x2e, "connect flags 0x%02x" % body[7])
+        keepalive = struct.unpack('!H', body[8:10])[0]
+        client_id, offset = field(body, 10)
+        will_topic, offset = field(body, offset)
+        will_message, offset = field(body, offset)
+        self.check(offset == len(body), "trailing bytes in CONNECT")
+        self.check(client_id == b'sunflower-' + GATEWAY, "client id %r" % client_id)
+        self.check(will_topic == b'sunflower/' + GATEWAY + b'/status' and will_message == b'offline',
+                   "will %r %r" % (will_topic, will_message))
+        self.log("CONNECT %s keepalive %d" % (client_id.decode(), keepalive))
+        sock.sendall(packet(0x20, b'\x00\x00'))
+
+    def subscribe(self, sock, header, body, commands):
+        self.check(header == 0x82, "SUBSCRIBE header 0x%02x" % header)
+        topic, offset = field(body, 2)
+        self.check(topic == b'sunflower/' + GATEWAY + b'/cmd/+', "subscribed to %r" % topic)
+        self.log("SUBSCRIBE %s QoS %d" % (topic.decode(), body[offset]))
+        sock.sendall(packet(0x90, body[:2] + b'\x01'))
+        if not commands:
+            return
+        sock.sendall(packet(0x32, string(b'sunflower/' + GATEWAY + b'/cmd/valve') + b'\x12\x34' + b'open 3'))
+        sock.sendall(packet(0x30, string(b'sunflower/' + GATEWAY + b'/cmd/polling') + b'5000'))
+        sock.sendall(packet(0x30, string(b'other/topic') + b'x' * 400))
+
+    def publish(self, header, body):
+        topic, offset = field(body, 0)
+        if not header & 0x06:
+            self.check(topic == b'sunflower/' + GATEWAY + b'/status' and body[offset:] == b'online' and header & 1,
+                       "status %r %r" % (topic, body[offset:]))
+            self.log("STATUS %s" % body[offset:].decode())
+            return None, False
+        packet_id = body[offset:offset + 2]
+        node = int(topic.split(b'/')[2], 16)
+        seqs = [int(line.split(',')[0]) for line in body[offset + 2:].decode().strip().split('\n')]
+        for seq in seqs:
+            self.check(node == 0x100 + seq // 5, "report %d under node %x" % (seq, node))
+            self.seen.add(seq)
+        self.log("PUBLISH %s id %s reports %s" % (topic.decode(), packet_id.hex(), seqs))
+        return packet_id, REPORTS in seqs
+
+    def session(self, sock, number):
+        publishes = 0
+        pending = []
+
+        while True:
+            header, body = read_packet(sock)
+            if header is None:
+                self.log("closed by the client")
+                return
+            kind = header & 0xf0
+            if kind == 0x10:
+                self.connect(sock, body)
+            elif kind == 0x80:
+                self.subscribe(sock, header, body, number == 2)
+            elif kind == 0x40:
+                self.check(body == b'\x12\x34', "PUBACK for %s" % body.hex())
+            elif kind == 0x30:
+                packet_id, last = self.publish(header, body)
+                if packet_id is None:
+                    continue
+                publishes += 1
+                if number == 1 and publishes == DROP_AFTER:
+                    self.log("dropping the connection")
+                    return
+                pending.append(packet_id)
+                if len(pending) == 2 or last:
+                    for packet_id in reversed(pending):
+                        sock.sendall(packet(0x40, packet_id))
+                    pending = []
+            elif kind == 0xc0:
+                sock.sendall(packet(0xd0, b''))
+            elif kind == 0xe0:
+                self.log("DISCONNECT")
+            else:
+                self.check(False, "unexpected packet 0x%02x" % header)
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Scripted MQTT broker for the MQTT client host test')
+    parser.add_argument("test", help="mqtt_client_test binary")
+    parser.add_argument("-v", "--verbose", help="print the packets and the client's output", action='store_true')
+    args = parser.parse_args()
+
+    server = socket.socket()
+    server.bind(("127.0.0.1", 0))
+    server.listen(1)
+    server.settimeout(30)
+
+    broker = Broker(args.verbose)
+    test = subprocess.Popen([args.test, str(server.getsockname()[1])] + (["-v"] if args.verbose else []))
+
+    try:
+        for number in (1, 2):
+            sock, _ = server.accept()
+            sock.settimeout(30)
+            broker.session(sock, number)
+            sock.close()
+    except socket.timeout:
+        broker.check(False, "timed out")
+        test.kill()
+
+    missing = set(range(1, REPORTS + 1)) - broker.seen - {CORRUPT_SEQ}
+    broker.check(not missing, "reports never published: %s" % sorted(missing))
+    broker.check(test.wait() == 0, "mqtt_client_test failed")
+
+    sys.exit(1 if broker.errors else 0)
@@ -0,0 +1,241 @@
+// Report log (app/src/report_log.c) on simulated flash: append, read back,
+// acknowledge, remount, rotate over unacknowledged reports, reclaim, and
+// power cuts in the middle of a record and of a sector header.
+#include "host_os.h"
+#include "report_log.c"
+
+#define PER_SECTOR      REPORT_LOG_RECORDS_PER_SECTOR
+
+static generic_message_t MakeReport(uint32_t n)
+{
+    generic_message_t report;
+
+    memset(&report, 0, sizeof(report));
+    report.cmd = 0x42;
+    report.src = 0x1000 + n;
+    report.payload.sensor_message.timestamp = 1600000000 + n;
+    report.payload.sensor_message.moisture0 = (uint16_t)n;
+
+    return report;
+}
+
+static void Append(uint32_t count)
+{
+    for(uint32_t i = 0; i < count; i++)
+    {
+        generic_message_t report = MakeReport(nextSeq);
+
+        WriteRecord(&report);
+    }
+}
+
+static bool ReadsBack(uint32_t seq)
+{
+    generic_message_t report;
+    generic_message_t expected = MakeReport(seq);
+
+    return ReportLogRead(seq, &report) && memcmp(&report, &expected, sizeof(report)) == 0;
+}
+
+// Forget the RAM state, as after a reset
+static void Remount(void)
+{
+    hostFlashPowerCut = -1;
+    memset(&stats, 0, sizeof(stats));
+    Mount();
+}
+
+static void Fresh(void)
+{
+    HostFlashInit();
+    Remount();
+}
+
+static void TestFormatAndAppend(void)
+{
+    Fresh();
+    CHECK(nextSeq == 1 && ackSeq == 0 && sectorValid[0]);
+    CHECK(ReportLogFirstUnacked() == 1);
+
+    Append(100);
+    CHECK(ReportLogNextSeq() == 101 && stats.appended == 100);
+
+    for(uint32_t seq = 1; seq <= 100; seq++)
+    {
+        CHECK(ReadsBack(seq));
+    }
+
+    generic_message_t report;
+    CHECK(!ReportLogRead(0, &report));
+    CHECK(!ReportLogRead(101, &report));
+}
+
+static void TestAckSurvivesRemount(void)
+{
+    Fresh();
+    Append(100);
+
+    ReportLogAck(40);
+    ReportLogAck(30);           // Going backwards is ignored
+    ReportLogAck(1000);         // Clamped to the last written
+    CHECK(ackSeq == 100);
+
+    Fresh();
+    Append(100);
+    ReportLogAck(40);
+    Remount();
+
+    CHECK(nextSeq == 101 && ackSeq == 40);
+    CHECK(ReportLogFirstUnacked() == 41);
+    CHECK(ReadsBack(41) && ReadsBack(100));
+}
+
+// Writing past three sectors' worth drops the oldest sector, acknowledged or not
+static void TestRotationOverwritesOldest(void)
+{
+    uint32_t total = 3 * PER_SECTOR + 10;
+    int8_t   oldest;
+
+    Fresh();
+    Append(total);
+
+    CHECK(nextSeq == total + 1);
+    CHECK(stats.overwritten == PER_SECTOR);
+
+    oldest = OldestSector();
+    CHECK(oldest >= 0 && Header(oldest)->first_seq == PER_SECTOR + 1);
+    CHECK(ReportLogFirstUnacked() == PER_SECTOR + 1);
+    CHECK(!ReadsBack(1) && !ReadsBack(PER_SECTOR));
+    CHECK(ReadsBack(PER_SECTOR + 1) && ReadsBack(total));
+
+    Remount();
+    CHECK(nextSeq == total + 1);
+    CHECK(ReportLogFirstUnacked() == PER_SECTOR + 1);
+    CHECK(ReadsBack(total));
+}
+
+// Acknowledged sectors are erased while idle, so the next rotation doesn't wait
+static void TestReclaim(void)
+{
+    uint32_t erases;
+
+    Fresh();
+    Append(2 * PER_SECTOR + 5);
+
+    ReportLogAck(PER_SECTOR - 1);
+    erases = hostFlashErases;
+    Reclaim();
+    CHECK(sectorValid[0] && hostFlashErases == erases);
+
+    ReportLogAck(PER_SECTOR);
+    Reclaim();
+    CHECK(!sectorValid[0] && sectorErased[0]);
+    CHECK(ReportLogFirstUnacked() == PER_SECTOR + 1);
+
+    // Filling the head rotates into the reclaimed sector without another erase
+    erases = hostFlashErases;
+    Append(PER_SECTOR);
+    CHECK(headSector == 0 && hostFlashErases == erases);
+    CHECK(stats.overwritten == 0);
+}
+
+// A record cut off half way reads as corrupt; the ones around it are fine
+static void TestTornRecord(void)
+{
+    generic_message_t report = MakeReport(11);
+
+    Fresh();
+    Append(10);
+
+    hostFlashPowerCut = 3;
+    WriteRecord(&report);
+    CHECK(stats.write_errors == 1);
+
+    Remount();
+    CHECK(nextSeq == 12);
+    CHECK(ReadsBack(10));
+    CHECK(!ReadsBack(11) && stats.crc_errors == 1);
+
+    Append(5);
+    CHECK(ReadsBack(12) && ReadsBack(16));
+}
+
+// A sector header cut off before its CRC word is ignored at mount
+static void TestTornHeader(void)
+{
+    Fresh();
+    Append(PER_SECTOR);
+
+    // The next record rotates: ack word, then the four header words
+    hostFlashPowerCut = 3;
+    Append(1);
+
+    Remount();
+    CHECK(headSector == 0 && nextSeq == PER_SECTOR + 1);
+    CHECK(!sectorValid[1]);
+    CHECK(ReadsBack(PER_SECTOR));
+
+    Append(3);
+    CHECK(headSector == 1 && Header(1)->first_seq == PER_SECTOR + 1);
+    CHECK(ReadsBack(PER_SECTOR + 3));
+}
+
+// A sector that fails to erase stops the log instead of letting the head
+// sector overflow into the next one; the next record tries again
+static void TestEraseFailure(void)
+{
+    Fresh();
+    Append(PER_SECTOR);
+
+    hostFlashEraseFails = 1;
+    Append(1);
+    CHECK(stats.dropped == 1 && stats.write_errors == 1);
+    CHECK(headSector == 0 && headUsed == PER_SECTOR && nextSeq == PER_SECTOR + 1);
+    CHECK(Header(1)->magic == FLASH_ERASED_WORD);
+
+    Append(1);
+    CHECK(headSector == 1 && Header(1)->first_seq == PER_SECTOR + 1);
+    CHECK(ReadsBack(PER_SECTOR) && ReadsBack(PER_SECTOR + 1));
+}
+
+// Past the last ack slot in the head header, acks stay in RAM until the next rotation
+static void TestAckTableFull(void)
+{
+    Fresh();
+    Append(REPORT_LOG_ACK_SLOTS + 10);
+
+    for(uint32_t seq = 1; seq <= REPORT_LOG_ACK_SLOTS + 5; seq++)
+    {
+        ReportLogAck(seq);
+    }
+
+    CHECK(headAckSlots == REPORT_LOG_ACK_SLOTS);
+    CHECK(stats.unsaved_acks == 6);
+
+    Remount();
+    CHECK(ackSeq == REPORT_LOG_ACK_SLOTS - 1);
+
+    // The rotation carries the current ack into the new header
+    ReportLogAck(REPORT_LOG_ACK_SLOTS + 5);
+    Append(PER_SECTOR);
+    Remount();
+    CHECK(ackSeq == REPORT_LOG_ACK_SLOTS + 5);
+}
+
+int main(int argc, char** argv)
+{
+    hostVerbose = argc > 1;
+
+    TestFormatAndAppend();
+    TestAckSurvivesRemount();
+    TestRotationOverwritesOldest();
+    TestReclaim();
+    TestTornRecord();
+    TestTornHeader();
+    TestEraseFailure();
+    TestAckTableFull();
+
+    printf("report_log: %d records per sector, all tests passed\n", (int)PER_SECTOR);
+
+    return 0;
+}
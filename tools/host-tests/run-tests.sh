@@ -0,0 +1,68 @@
+#!/bin/sh
+# Build the host tests against the firmware sources and run them.
+# Needs a C compiler and python3; the CRC test also needs zlib. Pass -v to see the
+# firmware's console output.
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+APP="$HERE/../../devkit/app"
+LWIP="$HERE/../../devkit/support/lwip_vgit"
+OUT="${OUT:-${TMPDIR:-/tmp}/sunflower-host-tests}"
+CC="${CC:-cc}"
+CFLAGS="-std=gnu99 -O2 -g -Wall -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast -Wno-unused-function
+        -I$HERE/stubs -I$HERE -I$APP/inc -I$APP/src -I$APP/../common/inc
+        -I$LWIP/include -I$LWIP/include/ipv4 -I$LWIP/port/FreeRTOS"
+
+mkdir -p "$OUT"
+
+build()
+{
+    name=$1
+    shift
+    $CC $CFLAGS -o "$OUT/$name" "$@"
+}
+
+build report_log_test "$HERE/report_log_test.c" "$HERE/host_os.c" "$APP/src/crc.c"
+"$OUT/report_log_test" "$@"
+
+# Every CRC32_METHOD, 0 to 4 (crc.h)
+for method in 0 1 2 3 4
+do
+    build crc_test_$method -DCRC32_METHOD=$method "$HERE/crc_test.c" -lz
+    "$OUT/crc_test_$method"
+done
+
+build eth_hash_test "$HERE/eth_hash_test.c" "$APP/src/crc.c"
+"$OUT/eth_hash_test"
+
+build chksum_test "$HERE/chksum_test.c" "$LWIP/port/FreeRTOS/chksum.c" "$LWIP/core/def.c"
+"$OUT/chksum_test"
+
+# The Ethernet driver under the lwIP core, the DMA and the peer simulated
+build eth_tx_test -no-pie -Wno-unused-variable "$HERE/eth_tx_test.c" "$HERE/host_os.c" "$APP/src/crc.c" \
+      "$LWIP/core/tcp.c" "$LWIP/core/tcp_in.c" "$LWIP/core/tcp_out.c" "$LWIP/core/pbuf.c" "$LWIP/core/mem.c" "$LWIP/core/memp.c" \
+      "$LWIP/core/netif.c" "$LWIP/core/def.c" "$LWIP/core/inet_chksum.c" "$LWIP/core/stats.c" "$LWIP/core/udp.c" "$LWIP/core/raw.c" \
+      "$LWIP/core/ipv4/ip4.c" "$LWIP/core/ipv4/ip4_addr.c" "$LWIP/core/ipv4/icmp.c" "$LWIP/core/ipv4/igmp.c" "$LWIP/core/ipv4/ip_frag.c" \
+      "$LWIP/netif/etharp.c" "$LWIP/port/FreeRTOS/chksum.c" "$LWIP/port/FreeRTOS/eth_hash.c"
+"$OUT/eth_tx_test" "$@"
+
+# -no-pie: the firmware keeps page buffer addresses in 32-bit queue entries
+build flash_writer_test -no-pie "$HERE/flash_writer_test.c" "$HERE/host_os.c"
+"$OUT/flash_writer_test" "$@"
+
+build fw_session_test -no-pie "$HERE/fw_session_test.c" "$HERE/host_os.c" "$APP/src/crc.c"
+"$OUT/fw_session_test" "$@"
+
+build fw_upload_test -no-pie "$HERE/fw_upload_test.c" "$HERE/host_os.c" "$APP/src/crc.c" "$LWIP/core/def.c"
+"$OUT/fw_upload_test" "$@"
+
+build ftp_test -no-pie "$HERE/ftp_test.c" "$HERE/host_os.c" "$APP/src/fw_upload.c" "$APP/src/fw_session.c" "$APP/src/crc.c" \
+      "$LWIP/core/ipv4/ip4_addr.c" "$LWIP/core/def.c"
+"$OUT/ftp_test" "$HERE/../ftp-standin.py" "$@"
+
+build mqtt_client_test "$HERE/mqtt_client_test.c" "$HERE/host_os.c" "$LWIP/core/ipv4/ip4_addr.c" "$LWIP/core/def.c"
+python3 "$HERE/mqtt_test_broker.py" "$OUT/mqtt_client_test" "$@"
+
+# The gateway side of tools/beacon-sim.py
+build time_beacon_host.so -shared -fPIC "$HERE/time_beacon_host.c" "$HERE/host_os.c"
+python3 "$HERE/../beacon-sim.py" --lib "$OUT/time_beacon_host.so"
@@ -0,0 +1,18 @@
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define pvPortMalloc(size)      malloc(size)
+#define vPortFree(ptr)          free(ptr)
+
+typedef uint32_t TickType_t;
+typedef uint32_t portTickType;
+typedef long     portBASE_TYPE;
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define portTICK_RATE_MS    1
+
+#endif // INC_FREERTOS_H
@@ -0,0 +1,43 @@
+// Host build stand-in for lwIP's port/arch/cc.h: the same names with the
+// host's fixed width types (u32_t is unsigned long on the target, 32 bits)
+#ifndef __CC_H__
+#define __CC_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint8_t     u8_t;
+typedef int8_t      s8_t;
+typedef uint16_t    u16_t;
+typedef int16_t     s16_t;
+typedef uint32_t    u32_t;
+typedef int32_t     s32_t;
+typedef uintptr_t   mem_ptr_t;
+typedef int         sys_prot_t;
+
+#define U16_F "hu"
+#define S16_F "d"
+#define X16_F "hx"
+#define U32_F "u"
+#define S32_F "d"
+#define X32_F "x"
+#define SZT_F "zu"
+
+#include <endian.h>          // BYTE_ORDER, LITTLE_ENDIAN
+
+#define PACK_STRUCT_BEGIN
+#define PACK_STRUCT_STRUCT __attribute__ ((__packed__))
+#define PACK_STRUCT_END
+#define PACK_STRUCT_FIELD(x) x
+
+u16_t lwip_arm_chksum(const void *dataptr, int len);
+u16_t lwip_arm_chksum_copy(void *dst, const void *src, u16_t len);
+
+#define LWIP_CHKSUM lwip_arm_chksum
+#define LWIP_CHKSUM_COPY(dst, src, len) lwip_arm_chksum_copy(dst, src, len)
+
+#define LWIP_PLATFORM_ASSERT(x) do { printf("Assertion \"%s\" failed\n", x); abort(); } while(0)
+#define LWIP_PLATFORM_DIAG(message) printf message
+
+#endif /* __CC_H__ */
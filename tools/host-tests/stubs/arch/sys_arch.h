@@ -0,0 +1,14 @@
+// Host build stand-in for lwIP's port/arch/sys_arch.h: the same type names,
+// for the headers of sources that include lwip/sys.h and don't call it
+#ifndef __SYS_RTXC_H__
+#define __SYS_RTXC_H__
+
+#define SYS_MBOX_NULL   NULL
+#define SYS_SEM_NULL    NULL
+
+typedef void*   sys_sem_t;
+typedef void*   sys_mutex_t;
+typedef void*   sys_mbox_t;
+typedef void*   sys_thread_t;
+
+#endif /* __SYS_RTXC_H__ */
@@ -0,0 +1,88 @@
+// Single threaded host stand-in for CMSIS-RTOS: queues hold one pointer each,
+// mutexes never block, waits on an empty queue or semaphore run hostIdleHook
+// instead, timers never fire and threads are never started
+#ifndef _CMSIS_OS_H
+#define _CMSIS_OS_H
+
+#include <stdint.h>
+
+#define osWaitForever       0xFFFFFFFF
+
+typedef enum
+{
+    osOK            = 0,
+    osEventMessage  = 0x10,
+    osEventTimeout  = 0x40,
+    osErrorResource = 0x81,
+    osErrorOS       = 0xFF
+} osStatus;
+
+typedef struct
+{
+    osStatus status;
+    union
+    {
+        uint32_t v;
+        void*    p;
+    } value;
+} osEvent;
+
+typedef enum
+{
+    osTimerOnce     = 0,
+    osTimerPeriodic = 1
+} os_timer_type;
+
+typedef enum
+{
+    osPriorityIdle          = -3,
+    osPriorityLow           = -2,
+    osPriorityBelowNormal   = -1,
+    osPriorityNormal        = 0,
+    osPriorityAboveNormal   = 1,
+    osPriorityHigh          = 2,
+    osPriorityRealtime      = 3
+} osPriority;
+
+typedef void (*os_pthread)(void const* argument);
+
+typedef struct host_queue*  osMessageQId;
+typedef int*                osMutexId;
+typedef int*                osSemaphoreId;
+typedef int*                osTimerId;
+typedef int*                osThreadId;
+
+#define osMessageQDef(name, size, type)     static const uint32_t os_messageQ_def_##name = (size)
+#define osMessageQ(name)                    (os_messageQ_def_##name)
+#define osMutexDef(name)                    static int os_mutex_def_##name
+#define osMutex(name)                       (&os_mutex_def_##name)
+#define osSemaphoreDef(name)                static int os_semaphore_def_##name
+#define osSemaphore(name)                   (&os_semaphore_def_##name)
+#define osTimerDef(name, function)          static int os_timer_def_##name
+#define osTimer(name)                       (&os_timer_def_##name)
+#define osTimerCreate(def, type, argument)  ((osTimerId)(def))
+#define osThreadDef(name, thread, priority, instances, stacksz) static int os_thread_def_##name
+#define osThread(name)                      (&os_thread_def_##name)
+
+osMessageQId    osMessageCreate(uint32_t size, void* thread);
+osStatus        osMessagePut(osMessageQId queue, uint32_t info, uint32_t millisec);
+osEvent         osMessageGet(osMessageQId queue, uint32_t millisec);
+osMutexId       osMutexCreate(int* def);
+osStatus        osMutexWait(osMutexId mutex, uint32_t millisec);
+osStatus        osMutexRelease(osMutexId mutex);
+osSemaphoreId   osSemaphoreCreate(int* def, int32_t count);
+int32_t         osSemaphoreWait(osSemaphoreId semaphore, uint32_t millisec);
+osStatus        osSemaphoreRelease(osSemaphoreId semaphore);
+osStatus        osDelay(uint32_t millisec);
+
+static inline osStatus osTimerStart(osTimerId timer, uint32_t millisec)
+{
+    return osOK;
+}
+
+static inline osThreadId osThreadCreate(int* def, void* argument)
+{
+    return def;
+}
+
+#endif // _CMSIS_OS_H
@@ -0,0 +1,46 @@
+// Host build stand-in for lwIP's netconn API, over BSD sockets: only what
+// the MQTT client, the firmware upload and the FTP client use. The tests
+// implement it, one netbuf per recv(), and set how much a recv() may return
+// to split the peer's data at odd places. The types at the end are for
+// core/memp.c, which sizes the API message pools.
+#ifndef __LWIP_API_H__
+#define __LWIP_API_H__
+
+#include "lwip/opt.h"
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+
+#define NETCONN_TCP         0x10
+#define NETCONN_COPY        0x01
+
+struct netconn {
+    int fd;
+    int recv_timeout;
+    u32_t received;         // Bytes recv()ed so far
+};
+
+struct netbuf {
+    u8_t  data[1536];
+    u16_t len;
+};
+
+#define netconn_new(type)               host_netconn_new(type)
+#define netconn_set_recvtimeout(c, ms)  ((c)->recv_timeout = (ms))
+
+struct netconn* host_netconn_new(int type);
+err_t           netconn_gethostbyname(const char* name, ip_addr_t* addr);
+err_t           netconn_connect(struct netconn* conn, ip_addr_t* addr, u16_t port);
+err_t           netconn_recv(struct netconn* conn, struct netbuf** buf);
+err_t           netconn_write(struct netconn* conn, const void* data, size_t size, u8_t flags);
+err_t           netconn_close(struct netconn* conn);
+err_t           netconn_delete(struct netconn* conn);
+err_t           netbuf_data(struct netbuf* buf, void** data, u16_t* len);
+s8_t            netbuf_next(struct netbuf* buf);
+void            netbuf_delete(struct netbuf* buf);
+
+enum netconn_type;
+enum netconn_evt { NETCONN_EVT_RCVPLUS, NETCONN_EVT_RCVMINUS, NETCONN_EVT_SENDPLUS, NETCONN_EVT_SENDMINUS, NETCONN_EVT_ERROR };
+enum netconn_igmp { NETCONN_JOIN, NETCONN_LEAVE };
+typedef void (*netconn_callback)(struct netconn*, enum netconn_evt, u16_t len);
+
+#endif /* __LWIP_API_H__ */
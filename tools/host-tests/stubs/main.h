@@ -0,0 +1,14 @@
+// Host build stand-in for the firmware's main.h: the board's MAC address
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include "stm32f4xx.h"
+
+#define MAC_ADDR0   2
+#define MAC_ADDR1   0
+#define MAC_ADDR2   0
+#define MAC_ADDR3   0
+#define MAC_ADDR4   0
+#define MAC_ADDR5   0
+
+#endif // __MAIN_H
@@ -0,0 +1,8 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "cmsis_os.h"
+
+uint32_t uxQueueMessagesWaiting(osMessageQId queue);
+
+#endif // QUEUE_H
@@ -0,0 +1,43 @@
+// The radio packet definitions live in the dandelion (field node) project.
+// This stand-in only has the fields the modules under test touch.
+#ifndef RADIO_PACKETS_H
+#define RADIO_PACKETS_H
+
+#include <stdint.h>
+
+#define SENSOR_CMD      0x07
+
+typedef struct __attribute__((packed))
+{
+    uint32_t timestamp;
+    uint16_t moisture0;
+    uint16_t moisture1;
+    uint16_t moisture2;
+    int16_t  chip_temp;
+    uint16_t temp0;
+    uint16_t temp1;
+    uint16_t temp2;
+    uint16_t humid;
+    uint16_t air_temp;
+} sensor_message_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t sensor_polling_period;
+    uint8_t  valid_fields;
+} sensor_cmd_t;
+
+typedef struct
+{
+    uint8_t  cmd;
+    uint32_t src;
+    uint32_t dst;
+    union
+    {
+        sensor_message_t sensor_message;
+        sensor_cmd_t     sensor_cmd;
+        uint8_t          raw[32];
+    } payload;
+} generic_message_t;
+
+#endif // RADIO_PACKETS_H
@@ -0,0 +1,27 @@
+// Host build stand-in for FreeRTOS semphr.h: binary semaphores over the
+// CMSIS-RTOS ones in host_os.c, so a take with a timeout runs hostIdleHook
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include <stdlib.h>
+#include "FreeRTOS.h"
+#include "cmsis_os.h"
+
+typedef osSemaphoreId xSemaphoreHandle;
+
+#define vSemaphoreCreateBinary(s)           ((s) = osSemaphoreCreate(calloc(1, sizeof(int)), 1))
+#define xSemaphoreGiveFromISR(s, woken)     xSemaphoreGive(s)
+
+static inline portBASE_TYPE xSemaphoreTake(xSemaphoreHandle s, portTickType ticks)
+{
+    return osSemaphoreWait(s, ticks) == osOK ? pdTRUE : pdFALSE;
+}
+
+static inline portBASE_TYPE xSemaphoreGive(xSemaphoreHandle s)
+{
+    *s = 1;
+
+    return pdTRUE;
+}
+
+#endif // SEMAPHORE_H
@@ -0,0 +1,13 @@
+// The sensor conversions live in the dandelion (field node) project; these
+// stand-ins only need to be deterministic
+#ifndef SENSOR_CONVERSIONS_H
+#define SENSOR_CONVERSIONS_H
+
+#include <stdint.h>
+
+#define Moisture_To_Float(raw)          ((raw) / 10.0f)
+#define TMP102_To_Float(raw)            ((raw) / 16.0f)
+#define HTU21D_Humid_To_Float(raw)      ((raw) / 100.0f)
+#define HTU21D_Temp_To_Float(raw)       ((raw) / 100.0f)
+
+#endif // SENSOR_CONVERSIONS_H
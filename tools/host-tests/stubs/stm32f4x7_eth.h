@@ -0,0 +1,74 @@
+// Host build stand-in for the STM32F4x7 Ethernet driver header: descriptors,
+// the bits ethernetif.c uses and the driver calls, which eth_tx_test.c
+// implements as the MAC and its DMA
+#ifndef __STM32F4x7_ETH_H
+#define __STM32F4x7_ETH_H
+
+#include "stm32f4xx.h"
+
+#define ETH_MAX_PACKET_SIZE     1524
+#define ETH_RX_BUF_SIZE         ETH_MAX_PACKET_SIZE
+#define ETH_TX_BUF_SIZE         ETH_MAX_PACKET_SIZE
+#define ETH_RXBUFNB             5
+#define ETH_TXBUFNB             5
+
+typedef struct
+{
+    __IO uint32_t   Status;
+    uint32_t        ControlBufferSize;
+    uint32_t        Buffer1Addr;
+    uint32_t        Buffer2NextDescAddr;
+    uint32_t        ExtendedStatus;
+    uint32_t        Reserved1;
+    uint32_t        TimeStampLow;
+    uint32_t        TimeStampHigh;
+} ETH_DMADESCTypeDef;
+
+typedef struct
+{
+    u32                         length;
+    u32                         buffer;
+    __IO ETH_DMADESCTypeDef*    descriptor;
+} FrameTypeDef;
+
+typedef struct
+{
+    __IO ETH_DMADESCTypeDef*    FS_Rx_Desc;
+    __IO ETH_DMADESCTypeDef*    LS_Rx_Desc;
+    __IO uint32_t               Seg_Count;
+} ETH_DMA_Rx_Frame_infos;
+
+#define ETH_DMATxDesc_OWN                       ((uint32_t)0x80000000)
+#define ETH_DMATxDesc_IC                        ((uint32_t)0x40000000)
+#define ETH_DMATxDesc_LS                        ((uint32_t)0x20000000)
+#define ETH_DMATxDesc_FS                        ((uint32_t)0x10000000)
+#define ETH_DMATxDesc_TCH                       ((uint32_t)0x00100000)
+#define ETH_DMATxDesc_TBS1                      ((uint32_t)0x00001FFF)
+#define ETH_DMATxDesc_ChecksumTCPUDPICMPFull    ((uint32_t)0x00C00000)
+
+#define ETH_DMARxDesc_OWN                       ((uint32_t)0x80000000)
+#define ETH_DMARxDesc_ES                        ((uint32_t)0x00008000)
+
+#define ETH_DMASR_TBUS                          ((uint32_t)0x00000004)
+#define ETH_DMASR_RBUS                          ((uint32_t)0x00000080)
+#define ETH_DMAMFBOCR_MFC                       ((uint32_t)0x0000FFFF)
+#define ETH_DMAMFBOCR_MFA                       ((uint32_t)0x0FFE0000)
+#define ETH_DMA_IT_R                            ((uint32_t)0x00000040)
+
+#define ETH_MAC_Address0                        ((uint32_t)0x00000000)
+#define ETH_MAC_Address1                        ((uint32_t)0x00000008)
+#define ETH_MAC_Address2                        ((uint32_t)0x00000010)
+#define ETH_MAC_Address3                        ((uint32_t)0x00000018)
+
+void            ETH_MACAddressConfig(uint32_t MacAddr, uint8_t* Addr);
+void            ETH_MACAddressPerfectFilterCmd(uint32_t MacAddr, FunctionalState NewState);
+void            ETH_DMARxDescChainInit(ETH_DMADESCTypeDef* DMARxDescTab, uint8_t* RxBuff, uint32_t RxBuffCount);
+void            ETH_DMATxDescChainInit(ETH_DMADESCTypeDef* DMATxDescTab, uint8_t* TxBuff, uint32_t TxBuffCount);
+void            ETH_DMATxDescChecksumInsertionConfig(ETH_DMADESCTypeDef* DMATxDesc, uint32_t DMATxDesc_Checksum);
+void            ETH_DMARxDescReceiveITConfig(ETH_DMADESCTypeDef* DMARxDesc, FunctionalState NewState);
+void            ETH_DMAITConfig(uint32_t ETH_DMA_IT, FunctionalState NewState);
+void            ETH_SetReceiveWatchdogTimer(uint8_t Value);
+void            ETH_Start(void);
+FrameTypeDef    ETH_Get_Received_Frame_interrupt(void);
+
+#endif // __STM32F4x7_ETH_H
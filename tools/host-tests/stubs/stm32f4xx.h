@@ -0,0 +1,63 @@
+// Host build stand-in for the CMSIS device header: only what the modules
+// under test use
+#ifndef __STM32F4xx_H
+#define __STM32F4xx_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
+
+#define __IO                volatile
+
+typedef uint32_t    u32;
+typedef uint8_t     u8;
+
+typedef enum { RESET = 0, SET = !RESET } FlagStatus;
+typedef enum { DISABLE = 0, ENABLE = !DISABLE } FunctionalState;
+
+extern uint32_t     SystemCoreClock;
+
+#define assert_param(expr)  assert(expr)
+
+static inline uint32_t __RBIT(uint32_t value)
+{
+    uint32_t result = 0;
+
+    for(int i = 0; i < 32; i++, value >>= 1)
+    {
+        result = (result << 1) | (value & 1);
+    }
+
+    return result;
+}
+
+typedef struct
+{
+    __IO uint32_t CR;
+    __IO uint32_t SR;
+} FLASH_TypeDef;
+
+extern FLASH_TypeDef        hostFlashRegs;
+#define FLASH               (&hostFlashRegs)
+#define FLASH_BASE          0x08000000UL
+#define FLASH_CR_PG         0x00000001UL
+#define FLASH_CR_PSIZE_0    0x00000100UL
+#define FLASH_CR_PSIZE_1    0x00000200UL
+#define FLASH_CR_LOCK       0x80000000UL
+
+// The Ethernet registers ethernetif.c touches, see stm32f4x7_eth.h
+typedef struct
+{
+    __IO uint32_t MACHTHR;
+    __IO uint32_t MACHTLR;
+    __IO uint32_t DMASR;
+    __IO uint32_t DMATPDR;
+    __IO uint32_t DMARPDR;
+    __IO uint32_t DMAMFBOCR;
+} ETH_TypeDef;
+
+extern ETH_TypeDef          hostEthRegs;
+#define ETH                 (&hostEthRegs)
+
+#endif // __STM32F4xx_H
@@ -0,0 +1,50 @@
+// Host flash: see host_flash.c
+#ifndef __STM32F4xx_FLASH_H
+#define __STM32F4xx_FLASH_H
+
+#include "stm32f4xx.h"
+
+typedef enum
+{
+    FLASH_BUSY = 1,
+    FLASH_ERROR_RD,
+    FLASH_ERROR_PGS,
+    FLASH_ERROR_PGP,
+    FLASH_ERROR_PGA,
+    FLASH_ERROR_WRP,
+    FLASH_ERROR_PROGRAM,
+    FLASH_ERROR_OPERATION,
+    FLASH_COMPLETE
+} FLASH_Status;
+
+#define FLASH_Sector_0      ((uint16_t)0x0000)
+#define FLASH_Sector_1      ((uint16_t)0x0008)
+#define FLASH_Sector_2      ((uint16_t)0x0010)
+#define FLASH_Sector_3      ((uint16_t)0x0018)
+#define FLASH_Sector_4      ((uint16_t)0x0020)
+#define FLASH_Sector_5      ((uint16_t)0x0028)
+#define FLASH_Sector_6      ((uint16_t)0x0030)
+#define FLASH_Sector_7      ((uint16_t)0x0038)
+
+#define VoltageRange_3      ((uint8_t)0x02)
+
+#define FLASH_PSIZE_BYTE        ((uint32_t)0x00000000)
+#define FLASH_PSIZE_HALF_WORD   ((uint32_t)0x00000100)
+#define FLASH_PSIZE_WORD        ((uint32_t)0x00000200)
+#define FLASH_PSIZE_DOUBLE_WORD ((uint32_t)0x00000300)
+
+#define FLASH_FLAG_EOP      0x01
+#define FLASH_FLAG_OPERR    0x02
+#define FLASH_FLAG_WRPERR   0x10
+#define FLASH_FLAG_PGAERR   0x20
+#define FLASH_FLAG_PGPERR   0x40
+#define FLASH_FLAG_PGSERR   0x80
+
+void         FLASH_Unlock(void);
+void         FLASH_Lock(void);
+void         FLASH_ClearFlag(uint32_t flags);
+FLASH_Status FLASH_ProgramWord(uint32_t address, uint32_t data);
+FLASH_Status FLASH_EraseSector(uint32_t sector, uint8_t voltageRange);
+FLASH_Status FLASH_WaitForLastOperation(void);
+
+#endif // __STM32F4xx_FLASH_H
@@ -0,0 +1,16 @@
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+#include "FreeRTOS.h"
+
+#define vTaskSuspendAll()       ((void)0)
+#define xTaskResumeAll()        ((void)1)
+#define taskENTER_CRITICAL()    ((void)0)
+#define taskEXIT_CRITICAL()     ((void)0)
+#define taskYIELD()             ((void)0)
+
+// Milliseconds, advanced by the tests with hostTickAdvance()
+TickType_t xTaskGetTickCount(void);
+void       hostTickAdvance(TickType_t ms);
+
+#endif // INC_TASK_H
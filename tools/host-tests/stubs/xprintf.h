@@ -0,0 +1,7 @@
+#ifndef _XPRINTF_H
+#define _XPRINTF_H
+
+void xprintf(const char* fmt, ...);
+int  xatoi(char** str, long* res);
+
+#endif // _XPRINTF_H
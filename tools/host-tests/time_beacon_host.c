@@ -0,0 +1,69 @@
+// Time beacons (app/src/time_beacon.c) as a shared library, for
+// tools/beacon-sim.py to load with ctypes. The simulation sets the gateway
+// clock, stamps beacons through TimeBeaconStamp() and hands node reports to
+// TimeBeaconRecordReport() by network table slot, one slot per node.
+#include <string.h>
+#include "host_os.h"
+#include "time_beacon.c"
+
+const uint32_t hostTimeBeaconNodes = TIME_BEACON_NODES;
+
+static uint64_t nowMs;
+static uint16_t nodeCount;
+
+// Firmware time_beacon.c calls into
+
+bool TimeSyncValid(void)
+{
+    return nowMs != 0;
+}
+
+uint64_t TimeSyncNowMs(void)
+{
+    return nowMs;
+}
+
+void SendToBroadcast(uint8_t* data, uint8_t size)
+{
+    vPortFree(data);
+}
+
+int32_t RadioNextDevice(uint16_t position)
+{
+    return position < nodeCount ? position : -1;
+}
+
+uint32_t RadioGetDeviceMAC(uint16_t position)
+{
+    return position < nodeCount ? 0xDA000000 + position : 0;
+}
+
+// Called from the simulation
+
+// Nodes in network table slots 0 to <count> - 1
+void HostSetNodes(uint16_t count)
+{
+    nodeCount = count;
+
+    for(uint16_t slot = 0; slot < count; slot++)
+    {
+        TimeBeaconResetNode(slot);
+    }
+}
+
+// Stamp a beacon with the gateway clock reading <ms>, as the radio task does
+// just before the frame goes to the radio. Returns the time stamped in it,
+// the gateway time at its sync word, in ms.
+uint64_t HostStampBeacon(uint64_t ms)
+{
+    generic_message_t msg;
+    TIME_BEACON       beacon;
+
+    nowMs = ms;
+    memset(&msg, 0, sizeof(msg));
+    msg.cmd = TIME_BEACON_CMD;
+    TimeBeaconStamp((uint8_t*)&msg, sizeof(msg), 0);
+    memcpy(&beacon, &msg.payload, sizeof(TIME_BEACON));
+
+    return (uint64_t)beacon.timeS * 1000 + beacon.timeMs;
+}
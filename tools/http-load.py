@@ -0,0 +1,146 @@
+import sys
+import time
+import json
+import socket
+import argparse
+import threading
+import http.client
+
+# Load test for the gateway's JSON API (devkit app/inc/http_api.h). Runs a
+# number of concurrent clients, each sending GETs back to back over one
+# keep-alive connection (or a new connection per request with --close), and
+# reports the request rate, the latency and the errors. Every response body
+# must parse as JSON. Afterwards the gateway's own counters are read back from
+# /api/stats to show the lwIP heap high-water mark the run reached.
+
+DEFAULT_PATHS = "/api/nodes,/api/readings,/api/stats,/api/valves"
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+class Results:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = []
+        self.bytes = 0
+        self.busy = 0
+        self.errors = 0
+        self.connects = 0
+
+    def add(self, latency, size):
+        with self.lock:
+            self.latencies.append(latency)
+            self.bytes += size
+
+    def count(self, attr):
+        with self.lock:
+            setattr(self, attr, getattr(self, attr) + 1)
+
+def client(args, paths, results, stop):
+    conn = None
+    i = 0
+
+    while not stop.is_set():
+        path = paths[i % len(paths)]
+        i += 1
+
+        try:
+            if conn is None:
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+                results.count("connects")
+
+            start = time.time()
+            conn.request("GET", path, headers={"Connection": "close"} if args.close else {})
+            response = conn.getresponse()
+            body = response.read()
+            latency = (time.time() - start) * 1000
+
+            if response.status == 503:
+                results.count("busy")
+            elif response.status != 200:
+                results.count("errors")
+            else:
+                json.loads(body.decode())
+                results.add(latency, len(body))
+
+            if args.close or response.will_close:
+                conn.close()
+                conn = None
+        except (socket.error, http.client.HTTPException, ValueError) as e:
+            if args.verbose:
+                print("%s: %s" % (path, e))
+            results.count("errors")
+            if conn is not None:
+                conn.close()
+            conn = None
+
+    if conn is not None:
+        conn.close()
+
+def gateway_stats(args):
+    try:
+        conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+        conn.request("GET", "/api/stats", headers={"Connection": "close"})
+        stats = json.loads(conn.getresponse().read().decode())
+        conn.close()
+        return stats
+    except (socket.error, http.client.HTTPException, ValueError):
+        return None
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Measure GET/s the gateway HTTP API sustains with concurrent clients')
+    parser.add_argument("host", help="gateway address")
+    parser.add_argument("-p", "--port", help="HTTP port (default 80)", type=int, default=80)
+    parser.add_argument("-c", "--clients", help="concurrent clients (default 3)", type=int, default=3)
+    parser.add_argument("-d", "--duration", help="seconds to run (default 10)", type=int, default=10)
+    parser.add_argument("--paths", help="comma separated paths to cycle through (default %s)" % DEFAULT_PATHS,
+                        action="store", default=DEFAULT_PATHS)
+    parser.add_argument("--close", help="open a new connection for every request", action="store_true")
+    parser.add_argument("--timeout", help="seconds before a request fails (default 5)", type=float, default=5.0)
+    parser.add_argument("-v", "--verbose", help="print every failed request", action="store_true")
+    args = parser.parse_args()
+
+    paths = args.paths.split(",")
+    results = Results()
+    stop = threading.Event()
+
+    threads = [threading.Thread(target=client, args=(args, paths[i % len(paths):] + paths[:i % len(paths)], results, stop))
+               for i in range(args.clients)]
+
+    start = time.time()
+    for t in threads:
+        t.start()
+
+    try:
+        time.sleep(args.duration)
+    except KeyboardInterrupt:
+        pass
+
+    stop.set()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+
+    ok = len(results.latencies)
+    print("%d clients, %s, %.1f s" % (args.clients, "new connection per request" if args.close else "keep-alive", elapsed))
+    print("  %d responses (%.1f GET/s), %d bytes (%.1f kB/s) over %d connections" %
+          (ok, ok / elapsed, results.bytes, results.bytes / elapsed / 1024, results.connects))
+    print("  %d busy (503), %d errors" % (results.busy, results.errors))
+    if ok:
+        print("  latency ms: avg %.1f, p50 %.1f, p99 %.1f, max %.1f" %
+              (sum(results.latencies) / ok, percentile(results.latencies, 50), percentile(results.latencies, 99),
+               max(results.latencies)))
+
+    stats = gateway_stats(args)
+    if stats is not None:
+        heap = stats["lwip"]["heap"]
+        http = stats["http"]
+        print("  gateway: lwIP heap %d of %d bytes used, max %d, %d errors; %d responses at once at most" %
+              (heap["used"], heap["size"], heap["max"], heap["err"], http["max_connections"]))
+    else:
+        print("  gateway statistics not available")
+
+    sys.exit(1 if results.errors else 0)
@@ -0,0 +1,180 @@
+import re
+import sys
+import time
+import socket
+import argparse
+import subprocess
+
+# TCP throughput benchmark for the gateway (devkit app/inc/net_perf.h). Starts
+# an iperf2 session on the gateway over its TCP command port, runs the host
+# side with the iperf2 binary, and prints the gateway's result: bytes, time,
+# throughput, the CPU load over the run and the lwIP heap and pool
+# high-water marks it reached.
+#
+#  rx   the gateway runs the server, the host sends ('iperf -c')
+#  tx   the host runs 'iperf -s', the gateway sends for 10 s
+#
+# --baseline runs the same host side against another iperf2 server (a host
+# build, a PC on the same switch) so a change to the netif or lwipopts can be
+# told apart from the network the gateway sits on.
+
+COMMAND_PORT = 1337
+IPERF_PORT = 5001
+CLIENT_SECONDS = 10   # NET_PERF_CLIENT_SECONDS
+
+RESULT_LINE = re.compile(r"^iperf (rx|tx) (\S+) bytes=(\d+) ms=(\d+) kbps=(\d+) cpu=(\d+) remote=(\S+)$")
+POOL_LINE = re.compile(r"^memp (\S+) num=(\d+) max=(\d+) err=(\d+)$")
+HEAP_LINE = re.compile(r"^mem HEAP max=(\d+) err=(\d+)$")
+
+class Gateway:
+    def __init__(self, host, timeout):
+        self.sock = socket.create_connection((host, COMMAND_PORT), timeout=timeout)
+        self.read_reply(b"\r\n")     # banner
+
+    def local_address(self):
+        return self.sock.getsockname()[0]
+
+    def read_reply(self, end):
+        data = b""
+        while not data.endswith(end):
+            chunk = self.sock.recv(1024)
+            if not chunk:
+                break
+            data += chunk
+        return data.decode(errors="replace")
+
+    def command(self, cmd):
+        # Every reply ends with a blank line
+        self.sock.sendall(cmd.encode())
+        lines = []
+        for line in self.read_reply(b"\r\n\n").splitlines():
+            if line.startswith("IPERF: "):
+                lines.append(line[len("IPERF: "):])
+        return lines
+
+    def close(self):
+        self.sock.close()
+
+def parse_results(lines):
+    results = {}
+    current = None
+
+    for line in lines:
+        m = RESULT_LINE.match(line)
+        if m:
+            current = {"end": m.group(2), "bytes": int(m.group(3)), "ms": int(m.group(4)), "kbps": int(m.group(5)),
+                       "cpu": int(m.group(6)), "remote": m.group(7), "pools": []}
+            results[m.group(1)] = current
+            continue
+
+        m = HEAP_LINE.match(line)
+        if m and current is not None:
+            current["heap_max"], current["heap_err"] = int(m.group(1)), int(m.group(2))
+            continue
+
+        m = POOL_LINE.match(line)
+        if m and current is not None:
+            current["pools"].append((m.group(1), int(m.group(2)), int(m.group(3)), int(m.group(4))))
+
+    return results
+
+def print_result(direction, result):
+    print("gateway %s: %s, %d bytes in %d ms, %d kbit/s, CPU %d%%" %
+          (direction, result["end"], result["bytes"], result["ms"], result["kbps"], result["cpu"]))
+    print("  lwIP heap max %d bytes, %d errors" % (result.get("heap_max", 0), result.get("heap_err", 0)))
+    for name, num, high, err in result["pools"]:
+        if high > 0 or err > 0:
+            print("  %-16s %3d of %3d%s" % (name, high, num, ", %d errors" % err if err else ""))
+
+def host_client(host, seconds, tradeoff):
+    cmd = ["iperf", "-c", host, "-p", str(IPERF_PORT), "-t", str(seconds), "-f", "k"]
+    if tradeoff:
+        cmd.append("-r")
+    return subprocess.run(cmd, capture_output=True, text=True, timeout=seconds * 3 + 30).stdout
+
+def host_rate(output):
+    # First "... <rate> Kbits/sec" of the iperf report: the host sending, or the only direction
+    rates = re.findall(r"([\d.]+) Kbits/sec", output)
+    return float(rates[0]) if rates else None
+
+def wait_result(gateway, direction, timeout):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        results = parse_results(gateway.command("i"))
+        if direction in results and results[direction]["end"] != "running":
+            return results[direction]
+        time.sleep(1)
+    return None
+
+def run_rx(args, gateway):
+    if gateway.command("is")[0] != "OK":
+        print("gateway: could not start the iperf server (session already running?)")
+        return False
+
+    try:
+        output = host_client(args.host, args.time, args.tradeoff)
+        print("host client: %s kbit/s" % host_rate(output))
+        if args.verbose:
+            print(output)
+
+        ok = True
+        for direction in ["rx", "tx"] if args.tradeoff else ["rx"]:
+            result = wait_result(gateway, direction, args.time + 15)
+            if result is None:
+                print("gateway %s: no result" % direction)
+                ok = False
+            else:
+                print_result(direction, result)
+                ok = ok and result["end"] == "done"
+        return ok
+    finally:
+        gateway.command("ix")
+
+def run_tx(args, gateway):
+    server = subprocess.Popen(["iperf", "-s", "-p", str(IPERF_PORT), "-f", "k"], stdout=subprocess.PIPE,
+                              stderr=subprocess.STDOUT, text=True)
+    try:
+        time.sleep(0.5)
+        if gateway.command("ic %s %d" % (gateway.local_address(), IPERF_PORT))[0] != "OK":
+            print("gateway: could not start the iperf client (session already running?)")
+            return False
+
+        result = wait_result(gateway, "tx", CLIENT_SECONDS + 15)
+        if result is None:
+            print("gateway tx: no result")
+            return False
+
+        print_result("tx", result)
+        return result["end"] == "done"
+    finally:
+        server.terminate()
+        output = server.communicate()[0]
+        print("host server: %s kbit/s" % host_rate(output))
+        if args.verbose:
+            print(output)
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Measure the gateway TCP throughput with iperf2')
+    parser.add_argument("host", help="gateway address")
+    parser.add_argument("direction", help="rx: host sends to the gateway, tx: gateway sends to the host",
+                        choices=["rx", "tx"])
+    parser.add_argument("-t", "--time", help="seconds the host sends for in rx tests (default 10)", type=int, default=10)
+    parser.add_argument("-r", "--tradeoff", help="rx test: the gateway sends back afterwards (iperf -r)",
+                        action="store_true")
+    parser.add_argument("--baseline", help="also run the host client against the iperf server at this address",
+                        action="store")
+    parser.add_argument("--timeout", help="seconds before a command fails (default 5)", type=float, default=5.0)
+    parser.add_argument("-v", "--verbose", help="print the iperf output", action="store_true")
+    args = parser.parse_args()
+
+    gateway = Gateway(args.host, args.timeout)
+    try:
+        ok = run_rx(args, gateway) if args.direction == "rx" else run_tx(args, gateway)
+    finally:
+        gateway.close()
+
+    if args.baseline:
+        output = host_client(args.baseline, args.time, False)
+        print("baseline %s: %s kbit/s" % (args.baseline, host_rate(output)))
+
+    sys.exit(0 if ok else 1)
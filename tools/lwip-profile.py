@@ -0,0 +1,239 @@
+import sys
+import re
+import math
+import time
+import argparse
+
+# Turns lwIP memory statistics recorded from the gateway (the 'nm' console
+# command or the 'n' TCP command, see sunflower-interface.py --net_stats) into
+# a lwipopts_mem.h memory profile. Every pool is sized from its high-water
+# mark plus a margin, checked against the lower bounds lwIP's sanity checks
+# enforce, and the total must fit the RAM budget given on the command line.
+#
+# Build with USE_LWIP_MEM_PROFILE defined to use the generated profile.
+
+STAT_LINE = re.compile(r"^(?:NSTAT:\s*)?(limits|mem|memp|mbox|sem|mutex|heap)\s+(\S+)((?:\s+\w+=\d+)+)\s*$")
+
+# memp pool name -> lwipopts.h option setting its number of elements
+POOL_OPTIONS = {
+    "RAW_PCB":          "MEMP_NUM_RAW_PCB",
+    "UDP_PCB":          "MEMP_NUM_UDP_PCB",
+    "TCP_PCB":          "MEMP_NUM_TCP_PCB",
+    "TCP_PCB_LISTEN":   "MEMP_NUM_TCP_PCB_LISTEN",
+    "TCP_SEG":          "MEMP_NUM_TCP_SEG",
+    "REASSDATA":        "MEMP_NUM_REASSDATA",
+    "FRAG_PBUF":        "MEMP_NUM_FRAG_PBUF",
+    "NETBUF":           "MEMP_NUM_NETBUF",
+    "NETCONN":          "MEMP_NUM_NETCONN",
+    "TCPIP_MSG_API":    "MEMP_NUM_TCPIP_MSG_API",
+    "TCPIP_MSG_INPKT":  "MEMP_NUM_TCPIP_MSG_INPKT",
+    "ARP_QUEUE":        "MEMP_NUM_ARP_QUEUE",
+    "IGMP_GROUP":       "MEMP_NUM_IGMP_GROUP",
+    "SYS_TIMEOUT":      "MEMP_NUM_SYS_TIMEOUT",
+    "PBUF_REF/ROM":     "MEMP_NUM_PBUF",
+    "PBUF_POOL":        "PBUF_POOL_SIZE",
+}
+
+MBOX_OPTIONS = ["TCPIP_MBOX_SIZE", "DEFAULT_UDP_RECVMBOX_SIZE", "DEFAULT_TCP_RECVMBOX_SIZE", "DEFAULT_ACCEPTMBOX_SIZE"]
+
+# lwIP heap: two struct mem markers plus alignment slack around MEM_SIZE
+MEM_HEAP_OVERHEAD = 20
+MEM_SIZE_ROUND = 256
+
+# FreeRTOS queue header plus heap_4 block header, per mailbox
+MBOX_OVERHEAD = 84
+MBOX_ENTRY_SIZE = 4
+
+def parse_stats(filenames):
+    stats = {}
+    samples = 0
+
+    for filename in filenames:
+        f = open(filename, "r")
+        for line in f:
+            m = STAT_LINE.match(line.strip())
+            if not m:
+                continue
+
+            kind, name, fields = m.groups()
+            values = dict((k, int(v)) for k, v in (kv.split("=") for kv in fields.split()))
+
+            if kind == "limits":
+                samples += 1
+
+            key = (kind, name)
+            if key not in stats:
+                stats[key] = values
+                continue
+
+            # Keep the worst case over all samples; sizes come from the latest
+            for k, v in values.items():
+                if k in ("max", "err", "fill"):
+                    stats[key][k] = max(stats[key].get(k, 0), v)
+                else:
+                    stats[key][k] = v
+        f.close()
+
+    return stats, samples
+
+def size_from_peak(num, peak, err, margin):
+    need = peak
+    if err:
+        # The pool ran dry so the real demand is unknown: grow it by the
+        # number of failures, at most doubling it
+        need = max(peak, num) + min(err, num)
+
+    if need == 0:
+        return 1
+
+    return max(int(math.ceil(need * (1.0 + margin))), need + 1)
+
+def build_profile(stats, args):
+    limits = stats.get(("limits", "LWIP"))
+    if limits is None:
+        raise ValueError("no 'limits' line found, record the stats with the 'n' command of a current build")
+
+    keep = set(args.keep)
+    minimum = {}
+    for m in args.min:
+        name, value = m.split("=")
+        minimum[name] = int(value)
+
+    floors = {
+        "RAW_PCB":          1,
+        "UDP_PCB":          1,
+        "TCP_PCB":          1,
+        "TCPIP_MSG_API":    1,
+        "ARP_QUEUE":        1,
+        "IGMP_GROUP":       2,
+        "TCP_SEG":          limits["seg"],
+        "PBUF_POOL":        limits["wnd"],
+        "SYS_TIMEOUT":      limits["timeouts"],
+    }
+
+    options = []    # (option, value, comment)
+    warnings = []
+    pools = {}
+
+    # lwIP heap
+    mem = stats[("mem", "HEAP")]
+    if "MEM_SIZE" in keep:
+        mem_size = mem["num"]
+    else:
+        mem_size = size_from_peak(mem["num"], mem["max"], mem["err"], args.margin)
+        mem_size = max(mem_size, minimum.get("MEM_SIZE", 0))
+        mem_size = int(math.ceil(float(mem_size) / MEM_SIZE_ROUND)) * MEM_SIZE_ROUND
+    if mem["err"]:
+        warnings.append("lwIP heap ran out %d times" % mem["err"])
+    options.append(("MEM_SIZE", mem_size, "peak %d of %d bytes" % (mem["max"], mem["num"])))
+
+    for (kind, name), pool in sorted(stats.items()):
+        if kind != "memp":
+            continue
+
+        if pool["err"]:
+            warnings.append("%s ran out %d times" % (name, pool["err"]))
+
+        if name not in POOL_OPTIONS or name in keep:
+            pools[name] = (pool["num"], pool["size"])
+            continue
+
+        num = size_from_peak(pool["num"], pool["max"], pool["err"], args.margin)
+        num = max(num, floors.get(name, 0), minimum.get(name, 0))
+        pools[name] = (num, pool["size"])
+
+    # A netconn always sits on a PCB, more netconns than PCBs is rejected
+    if "NETCONN" in pools and "NETCONN" not in keep:
+        pcbs = sum(pools[p][0] for p in ("RAW_PCB", "UDP_PCB", "TCP_PCB", "TCP_PCB_LISTEN") if p in pools)
+        pools["NETCONN"] = (min(pools["NETCONN"][0], pcbs), pools["NETCONN"][1])
+
+    if "REASSDATA" in pools and pools["REASSDATA"][0] > limits["reass"]:
+        pools["REASSDATA"] = (limits["reass"], pools["REASSDATA"][1])
+
+    for name in sorted(pools):
+        if name in POOL_OPTIONS and name not in keep:
+            pool = stats[("memp", name)]
+            options.append((POOL_OPTIONS[name], pools[name][0], "peak %d of %d" % (pool["max"], pool["num"])))
+
+    # Mailboxes all take the same length
+    mbox = stats[("mbox", "QUEUE")]
+    mbox_len = mbox["num"]
+    if "MBOX" not in keep:
+        if mbox["err"]:
+            warnings.append("mailboxes were full %d times" % mbox["err"])
+            mbox_len = size_from_peak(mbox["num"], mbox["num"], mbox["err"], args.margin)
+        else:
+            mbox_len = size_from_peak(mbox["num"], mbox["fill"], 0, args.margin)
+        mbox_len = max(mbox_len, minimum.get("MBOX", 0))
+        for option in MBOX_OPTIONS:
+            options.append((option, mbox_len, "deepest fill %d of %d" % (mbox["fill"], mbox["num"])))
+
+    # Static lwIP RAM against the budget
+    lwip_bytes = mem_size + MEM_HEAP_OVERHEAD + sum(num * size for num, size in pools.values())
+
+    # Mailboxes come out of the FreeRTOS heap: move its peak by the change
+    heap = stats[("heap", "RTOS")]
+    heap_peak = heap["max"] + mbox["max"] * (mbox_len - mbox["num"]) * MBOX_ENTRY_SIZE
+
+    return options, pools, lwip_bytes, mem_size, heap, heap_peak, warnings
+
+def write_profile(out, options, args, lwip_bytes, heap, heap_peak):
+    out.write("#ifndef __LWIPOPTS_MEM_H__\n")
+    out.write("#define __LWIPOPTS_MEM_H__\n\n")
+    out.write("/* lwIP memory profile generated by tools/lwip-profile.py on %s\n" % time.strftime("%Y-%m-%d %H:%M"))
+    out.write("   from %s\n" % ", ".join(args.logs))
+    out.write("   margin %d%%, %d of %d bytes of lwIP RAM, FreeRTOS heap peak %d of %d bytes. */\n\n" %
+              (int(args.margin * 100), lwip_bytes, args.budget, heap_peak, heap["num"]))
+
+    for option, value, comment in options:
+        out.write("#define %-27s %-6d /* %s */\n" % (option, value, comment))
+
+    out.write("\n#endif /* __LWIPOPTS_MEM_H__ */\n")
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Generate a lwIP memory profile from recorded high-water marks')
+    parser.add_argument("logs", help="files holding recorded 'nm' / 'n' output, several samples each", nargs="+")
+    parser.add_argument("--budget", help="RAM available to the lwIP heap and pools, in bytes", type=int, required=True)
+    parser.add_argument("--margin", help="headroom over the high-water marks (default 0.25)", type=float, default=0.25)
+    parser.add_argument("--keep", help="keep the current size of a pool (pool name, MEM_SIZE or MBOX)", action="append", default=[])
+    parser.add_argument("--min", help="lower bound for a pool, as NAME=N (pool name, MEM_SIZE or MBOX)", action="append", default=[])
+    parser.add_argument("-o", "--output", help="profile to write (default stdout), e.g. devkit/app/inc/lwipopts_mem.h", action="store", default=None)
+    args = parser.parse_args()
+
+    stats, samples = parse_stats(args.logs)
+    if not samples:
+        print("No lwIP statistics found in %s" % ", ".join(args.logs))
+        sys.exit(1)
+
+    try:
+        options, pools, lwip_bytes, mem_size, heap, heap_peak, warnings = build_profile(stats, args)
+    except (KeyError, ValueError) as e:
+        print("Incomplete statistics: %s" % e)
+        sys.exit(1)
+
+    sys.stderr.write("%d samples\n" % samples)
+    for w in warnings:
+        sys.stderr.write("warning: %s\n" % w)
+
+    sys.stderr.write("%-27s %6s %6s %8s\n" % ("pool", "num", "size", "bytes"))
+    sys.stderr.write("%-27s %6s %6d %8d\n" % ("MEM_SIZE", "", mem_size, mem_size + MEM_HEAP_OVERHEAD))
+    for name in sorted(pools, key=lambda p: -pools[p][0] * pools[p][1]):
+        num, size = pools[name]
+        sys.stderr.write("%-27s %6d %6d %8d\n" % (name, num, size, num * size))
+    sys.stderr.write("lwIP RAM: %d of %d bytes\n" % (lwip_bytes, args.budget))
+    sys.stderr.write("FreeRTOS heap peak: %d of %d bytes\n" % (heap_peak, heap["num"]))
+
+    if heap_peak > heap["num"]:
+        sys.stderr.write("The mailboxes do not fit the FreeRTOS heap (configTOTAL_HEAP_SIZE)\n")
+        sys.exit(1)
+
+    if lwip_bytes > args.budget:
+        sys.stderr.write("The profile does not fit the budget: %d bytes over\n" % (lwip_bytes - args.budget))
+        sys.exit(1)
+
+    if args.output:
+        out = open(args.output, "w")
+        write_profile(out, options, args, lwip_bytes, heap, heap_peak)
+        out.close()
+    else:
+        write_profile(sys.stdout, options, args, lwip_bytes, heap, heap_peak)
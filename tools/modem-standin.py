@@ -0,0 +1,182 @@
+import os
+import sys
+import time
+import tty
+import select
+import argparse
+import subprocess
+
+# Cellular modem stand-in for the gateway's PPP link (devkit app/inc/cellular.h):
+# answers the AT commands the gateway dials with on a serial port, and on ATD
+# runs pppd behind CONNECT, bridged to the port through a pty. The host end of
+# the link gets --local, the gateway --remote and --dns as its DNS server; VJ
+# header compression is left on, as pppd has it by default.
+#
+# pppd needs root. With --pty the stand-in opens a pty of its own instead of
+# a serial port and prints its name, for trying the AT exchange by hand
+# (e.g. 'picocom /dev/pts/N').
+#
+# Like a modem without a DCD line, the gateway only learns the link went down
+# from LCP; the NO CARRIER sent when pppd exits is for whoever is watching.
+
+GUARD_S = 1.0                   # Silence needed around "+++"
+
+class Modem:
+    def __init__(self, fd, args):
+        self.fd = fd
+        self.args = args
+        self.echo = True
+        self.line = b''
+        self.pppd = None
+        self.master = None
+
+    def send(self, data):
+        os.write(self.fd, data)
+
+    def reply(self, text):
+        print("  > %s" % text)
+        self.send(("\r\n%s\r\n" % text).encode())
+
+    def command(self, cmd):
+        print("  < %s" % cmd)
+        upper = cmd.upper()
+        if not upper.startswith("AT"):
+            return
+        if upper.startswith("ATD"):
+            self.dial()
+        elif upper.startswith("ATE"):
+            self.echo = upper[3:4] != '0'
+            self.reply("OK")
+        elif upper.startswith("ATH"):
+            self.hangup()
+            self.reply("OK")
+        elif upper.startswith("AT+CGDCONT="):
+            print("  APN %s" % cmd.split(',')[2] if cmd.count(',') >= 2 else "  no APN")
+            self.reply("OK")
+        else:
+            # AT, ATZ, AT&F, AT+CSQ and the rest: nothing to do
+            self.reply("OK")
+
+    def dial(self):
+        self.hangup()
+        self.master, slave = os.openpty()
+        tty.setraw(self.master)
+        options = ["nodetach", "noauth", "local", "nocrtscts", "115200", os.ttyname(slave),
+                   "%s:%s" % (self.args.local, self.args.remote), "ms-dns", self.args.dns,
+                   "lcp-echo-interval", "30", "lcp-echo-failure", "4"]
+        if self.args.debug:
+            options.append("debug")
+        try:
+            self.pppd = subprocess.Popen([self.args.pppd] + options + self.args.pppd_opt)
+        except OSError as e:
+            print("  could not run %s: %s" % (self.args.pppd, e))
+            os.close(self.master)
+            os.close(slave)
+            self.master = None
+            self.reply("NO CARRIER")
+            return
+        os.close(slave)
+        self.reply("CONNECT 115200")
+        print("  pppd %d running, %s:%s" % (self.pppd.pid, self.args.local, self.args.remote))
+
+    def hangup(self):
+        if self.pppd is not None:
+            self.pppd.terminate()
+            self.pppd.wait()
+            self.pppd = None
+        if self.master is not None:
+            os.close(self.master)
+            self.master = None
+
+    def command_mode(self, data):
+        for c in data:
+            if self.echo:
+                self.send(bytes([c]))
+            if c in (0x0D, 0x0A):
+                if self.line:
+                    self.command(self.line.decode(errors='replace').strip())
+                self.line = b''
+            elif len(self.line) < 128:
+                self.line += bytes([c])
+
+    def run(self):
+        escape = b''
+        quiet = time.time()
+
+        while True:
+            fds = [self.fd] + ([self.master] if self.master is not None else [])
+            ready, _, _ = select.select(fds, [], [], 0.2)
+
+            # Escape to command mode: "+++" with a second of silence around it
+            if escape == b'+++' and time.time() - quiet >= GUARD_S:
+                print("  escape")
+                self.hangup()
+                self.reply("OK")
+                escape = b''
+
+            if self.pppd is not None and self.pppd.poll() is not None:
+                print("  pppd exited with %d" % self.pppd.returncode)
+                self.pppd = None
+                self.hangup()
+                self.reply("NO CARRIER")
+
+            if self.fd in ready:
+                data = os.read(self.fd, 4096)
+                if not data:
+                    break
+                if self.master is None:
+                    self.command_mode(data)
+                elif (data.strip(b'+') == b'' and len(escape + data) <= 3 and
+                      (escape or time.time() - quiet >= GUARD_S)):
+                    # Held back until the guard time says what it was
+                    escape += data
+                else:
+                    os.write(self.master, escape + data)
+                    escape = b''
+                quiet = time.time()
+
+            if self.master is not None and self.master in ready:
+                try:
+                    self.send(os.read(self.master, 4096))
+                except OSError:
+                    pass
+
+def open_serial(args):
+    if args.pty:
+        master, slave = os.openpty()
+        tty.setraw(master)
+        tty.setraw(slave)
+        print("Modem on %s" % os.ttyname(slave))
+        return master, slave
+
+    import serial
+    port = serial.Serial(args.device, args.baud, rtscts=False, timeout=0)
+    print("Modem on %s at %d baud" % (args.device, args.baud))
+    return port.fileno(), port
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='AT modem stand-in running pppd, for testing the gateway cellular link')
+    parser.add_argument("device", nargs='?', help="serial port wired to the gateway's modem USART, e.g. /dev/ttyUSB0")
+    parser.add_argument("-b", "--baud", help="baud rate (default 115200)", type=int, default=115200)
+    parser.add_argument("--pty", help="open a pty instead of a serial port", action='store_true')
+    parser.add_argument("--local", help="host address on the link (default 10.64.64.1)", default="10.64.64.1")
+    parser.add_argument("--remote", help="gateway address on the link (default 10.64.64.2)", default="10.64.64.2")
+    parser.add_argument("--dns", help="DNS server handed to the gateway (default 8.8.8.8)", default="8.8.8.8")
+    parser.add_argument("--pppd", help="pppd binary (default pppd)", default="pppd")
+    parser.add_argument("--pppd-opt", help="extra pppd option, repeat as needed", action='append', default=[])
+    parser.add_argument("--debug", help="run pppd with debug logging", action='store_true')
+    args = parser.parse_args()
+
+    if not args.pty and not args.device:
+        parser.error("a serial device or --pty is needed")
+
+    fd, keep = open_serial(args)
+    modem = Modem(fd, args)
+
+    try:
+        modem.run()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        modem.hangup()
+    sys.exit(0)
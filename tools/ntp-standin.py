@@ -0,0 +1,82 @@
+import sys
+import time
+import socket
+import struct
+import argparse
+
+# Stand-in SNTP server for the gateway's time discipline (devkit
+# app/inc/time_sync.h), for testing without a route to pool.ntp.org. Answers
+# with the host clock, optionally shifted by --offset and running --skew ppm
+# fast, so the gateway stepping, shifting and trimming its RTC can be watched
+# with the 'tp' console command. Point the gateway here with 'tn <ip>' and
+# ask for a response now with 'ts'.
+#
+# The gateway sends its RTC time in the request (seconds and microseconds),
+# so every request prints how far the gateway was from the time served.
+
+NTP_PORT = 123
+DIFF_1900_1970 = 2208988800
+REFERENCE_ID = 0x4C4F434C   # "LOCL", a local clock
+
+PACKET = struct.Struct("!BBBbIII8s8s8s8s")
+
+class Clock:
+    def __init__(self, offset, skew):
+        self.start = time.time()
+        self.offset = offset
+        self.skew = skew
+
+    def now(self):
+        real = time.time()
+        return real + self.offset + (real - self.start) * self.skew / 1e6
+
+def ntp_timestamp(t):
+    secs = int(t)
+    return struct.pack("!II", (secs + DIFF_1900_1970) & 0xFFFFFFFF, int((t - secs) * (1 << 32)) & 0xFFFFFFFF)
+
+def gateway_time(timestamp):
+    # The gateway sends microseconds in the fraction field
+    secs, us = struct.unpack("!II", timestamp)
+    return secs - DIFF_1900_1970 + us / 1e6
+
+def serve(sock, clock, verbose):
+    while True:
+        data, addr = sock.recvfrom(512)
+        received = clock.now()
+
+        if len(data) < PACKET.size:
+            continue
+
+        fields = PACKET.unpack(data[:PACKET.size])
+        mode = fields[0] & 0x07
+        if mode != 3:
+            continue
+
+        client_transmit = fields[10]
+        reply = PACKET.pack((4 << 3) | 4, 1, fields[2], -20, 0, 0, REFERENCE_ID, ntp_timestamp(received),
+                            client_transmit, ntp_timestamp(received), ntp_timestamp(clock.now()))
+        sock.sendto(reply, addr)
+
+        ahead = gateway_time(client_transmit) - received
+        print("%s  %s  gateway %+.3f s" % (time.strftime("%H:%M:%S", time.gmtime(received)), addr[0], ahead))
+        if verbose:
+            print("  served %.6f" % received)
+        sys.stdout.flush()
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Answer SNTP requests for testing the gateway clock')
+    parser.add_argument("-p", "--port", help="UDP port (default 123, the gateway always uses it)", type=int,
+                        default=NTP_PORT)
+    parser.add_argument("-o", "--offset", help="seconds to add to the host time (default 0)", type=float, default=0.0)
+    parser.add_argument("-s", "--skew", help="ppm the served clock runs fast (negative: slow)", type=float, default=0.0)
+    parser.add_argument("-v", "--verbose", help="print the time served", action="store_true")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", args.port))
+
+    print("serving SNTP on port %d, offset %+.3f s, skew %+.1f ppm" % (args.port, args.offset, args.skew))
+    try:
+        serve(sock, Clock(args.offset, args.skew), args.verbose)
+    except KeyboardInterrupt:
+        pass
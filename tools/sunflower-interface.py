@@ -5,10 +5,19 @@ import string
 import psycopg2
 import datetime
 import argparse
+from struct import pack, unpack
+from bisect import bisect_left
+import zlib
 
 DANDELION_DEVICE = 1
 SUNFLOWER_DEVICE = 2
 
+FW_CHUNK_BYTES = 256
+
+# Number of CHUNK frames kept in flight before waiting for a WINDOW_ACK.
+# 8 x 260 bytes stays inside the gateway's TCP receive window (2 * MSS).
+FW_UPLOAD_WINDOW = 8
+
 class FR1_PAYLOAD(Structure):
     _pack_ = True
     _fields_ = [("report_id", c_ubyte), 
@@ -84,6 +93,40 @@ class FR7_END(Structure):
     def __init__(self):
         self.report_id = 0x07
 
+class FR8_CHUNK(Structure):
+    _pack_ = True
+    _fields_ = [("report_id", c_ubyte), 
+                ("device_type", c_ubyte),
+                ("seq", c_ubyte * 2),
+                ("payload", c_ubyte * FW_CHUNK_BYTES)]
+    
+    def __init__(self):
+        self.report_id = 0x08
+        
+    def set_device(self, type):
+        self.device_type = type
+    
+    def set_seq(self, seq):
+        self.seq[1] = (seq >> 8) & 0xFF
+        self.seq[0] = seq & 0xFF
+
+class FR10_RESUME(Structure):
+    _pack_ = True
+    _fields_ = [("report_id", c_ubyte), 
+                ("device_type", c_ubyte),
+                ("image_size", c_ubyte * 4),
+                ("image_crc", c_ubyte * 4)]
+    
+    def __init__(self):
+        self.report_id = 0x0A
+        
+    def set_device(self, type):
+        self.device_type = type
+    
+    def set_image(self, image):
+        memmove(self.image_size, pack("<I", len(image)), 4)
+        memmove(self.image_crc, pack("<I", zlib.crc32(image) & 0xFFFFFFFF), 4)
+
 class SensorReport():
     moist1   = 0.0
     moist2   = 0.0
@@ -125,9 +168,16 @@ class SunflowerTCP:
     def get_report_buffer(self):
         self.sock.sendall("r\r\n");
         
-        data = self.sock.recv(1024)
+        # Reports are streamed from the gateway's flash log, terminated by the
+        # sequence number of the last report sent
+        data = ""
+        while "RSEQ: " not in data or not data.split("RSEQ: ")[1].strip():
+            data += self.sock.recv(1024)
         print(data)
         
+        data, last_seq = data.split("RSEQ: ")
+        last_seq = int(last_seq.split()[0])
+        
         strings = data.split("DREP:  ")
         
         reports = []
@@ -152,9 +202,23 @@ class SunflowerTCP:
             
             reports.append(rep_buff)
             
-        return reports
+        return reports, last_seq
+    
+    def ack_reports(self, seq):
+        self.sock.sendall("ra %d\r\n" % seq)
+        
     def set_timestamp(self, timestamp):
         self.sock.sendall("ts %d\r\n" % timestamp)
+    
+    def get_net_stats(self):
+        self.sock.sendall("n\r\n")
+        
+        # The FreeRTOS heap is the last statistic, the reply ends with a blank line
+        data = ""
+        while "NSTAT: heap" not in data or "\r\n\n" not in data.split("NSTAT: heap")[1]:
+            data += self.sock.recv(1024)
+        
+        return [l.strip() for l in data.splitlines() if l.startswith("NSTAT: ")]
         
     def send_tcp_payload(self, fr):
         tcp_buffer = (c_ubyte * sizeof(fr))()
@@ -172,6 +236,98 @@ class SunflowerTCP:
             
         return (ord(data) == 5)
     
+    def resume_session(self, device, image):
+        # Start an upload, or pick up an interrupted one of the same file. The
+        # gateway answers with SESSION (0xB, chunks[2], bitmap) where bit n is
+        # set if chunk n still has to be sent. Returns the list of those chunks.
+        fr = FR10_RESUME()
+        fr.set_device(device)
+        fr.set_image(image)
+        self.sock.sendall(string_at(byref(fr), sizeof(fr)))
+        
+        rx = self.sock.recv(3)
+        if ord(rx[0]) != 0x0B:
+            print "Gateway refused the upload session!"
+            exit()
+        while len(rx) < 3:
+            rx += self.sock.recv(3 - len(rx))
+        
+        chunks = ord(rx[1]) | (ord(rx[2]) << 8)
+        bitmap = ""
+        while len(bitmap) < (chunks + 7) / 8:
+            bitmap += self.sock.recv((chunks + 7) / 8 - len(bitmap))
+        
+        missing = [seq for seq in range(chunks) if ord(bitmap[seq / 8]) & (1 << (seq % 8))]
+        if len(missing) < chunks:
+            print "Resuming upload, %d of %d chunks already on the gateway" % (chunks - len(missing), chunks)
+        
+        return missing
+    
+    def upload_image(self, device, image, window=FW_UPLOAD_WINDOW, chunks=None):
+        # Stream the image as sequenced CHUNK frames, keeping up to 'window'
+        # chunks unacknowledged. The gateway answers with cumulative
+        # WINDOW_ACKs (0x9, first chunk it is still missing) and a NACK (0x6)
+        # on failure. 'chunks' lists the seqs to send, default all of them.
+        image = bytearray(image)
+        image += "\0" * (-len(image) % FW_CHUNK_BYTES)
+        if chunks is None:
+            chunks = range(len(image) / FW_CHUNK_BYTES)
+        
+        fr = FR8_CHUNK()
+        fr.set_device(device)
+        
+        start = time.time()
+        next_seq = 0
+        acked = 0
+        rx = ""
+        while acked < len(chunks):
+            while next_seq < len(chunks) and next_seq - acked < window:
+                seq = chunks[next_seq]
+                fr.set_seq(seq)
+                memmove(fr.payload, str(image[seq * FW_CHUNK_BYTES:(seq + 1) * FW_CHUNK_BYTES]), FW_CHUNK_BYTES)
+                self.sock.sendall(string_at(byref(fr), sizeof(fr)))
+                next_seq += 1
+            
+            rx += self.sock.recv(64)
+            while rx:
+                if ord(rx[0]) == 6:
+                    print "NAK received at chunk %d!" % (acked)
+                    exit()
+                elif ord(rx[0]) == 9:
+                    if len(rx) < 3:
+                        break
+                    acked = max(acked, bisect_left(chunks, ord(rx[1]) | (ord(rx[2]) << 8)))
+                    rx = rx[3:]
+                else:
+                    print "Unexpected byte 0x%02x from gateway" % (ord(rx[0]))
+                    rx = rx[1:]
+            
+            print "Wrote %d of %d chunks" % (acked, len(chunks))
+        
+        elapsed = time.time() - start
+        sent = len(chunks) * FW_CHUNK_BYTES
+        print "Uploaded %d bytes in %.2f s (%.1f KB/s)" % (sent, elapsed, sent / 1024.0 / max(elapsed, 0.001))
+    
+    def validate_image(self, device):
+        # The gateway checks the CRCs it accumulated during the upload against
+        # the ones sign-app.py put in the image header
+        fr = FR3_VALIDATE()
+        fr.set_device(device)
+        tcp_buffer = (c_ubyte * sizeof(fr))()
+        memmove(tcp_buffer, byref(fr), sizeof(fr))
+        self.sock.sendall(tcp_buffer)
+        
+        return self.get_tcp_ack()
+    
+    def get_update_slot(self):
+        self.sock.sendall("mu\r\n")
+        
+        data = ""
+        while "USLOT: " not in data or "\n" not in data.split("USLOT: ")[1]:
+            data += self.sock.recv(100)
+        
+        return int(data.split("USLOT: ")[1].split()[0], 16)
+    
     def enter_fw_update_mode(self):
         self.sock.sendall("mf\r\n")
         
@@ -195,56 +351,42 @@ def sunflower_image_memory_test(sf):
     fr.set_device(SUNFLOWER_DEVICE)
     sf.send_tcp_payload(fr)
     
-    time.sleep(0.5)
-    
-    address = 0x00000000
-    while address < SunflowerTCP.sunflower_image_size:
-        fr = FR1_PAYLOAD()
-        fr.set_device(SUNFLOWER_DEVICE)
-        fr.set_address(address)
-        for j in range(0, len(fr.payload)):
-            fr.payload[j] = 1 << 2
-        
-        sf.send_tcp_payload(fr)
-        
-        address += len(fr.payload)
-        
-        print "Wrote address %d" % (address)
+    sf.upload_image(SUNFLOWER_DEVICE, chr(1 << 2) * SunflowerTCP.sunflower_image_size)
     
     sf.exit_fw_update_mode()
 
-def sunflower_image_download(sf, filename):
+def sunflower_image_download(sf, filenames):
 
+    # Sunflower images run in place, so the gateway can only take an image
+    # linked for the slot it isn't running from (devkit.bin or devkit_slot_b.bin)
+    slot = sf.get_update_slot()
+    sunflower_fw = None
+    for filename in filenames:
+        image = open(filename, "rb").read()
+        reset_vector = unpack("<I", image[4:8])[0]
+        if slot <= reset_vector < slot + SunflowerTCP.sunflower_image_size:
+            sunflower_fw = image
+            print "Sending %s for slot 0x%08x" % (filename, slot)
+    
+    if sunflower_fw is None:
+        print "None of the images is linked for slot 0x%08x!" % (slot)
+        exit()
+    
     sf.enter_fw_update_mode()
     
     time.sleep(0.5)
     
-    fr = FR2_START()
-    fr.set_device(SUNFLOWER_DEVICE)
-    sf.send_tcp_payload(fr)
+    if len(sunflower_fw) > SunflowerTCP.sunflower_image_size:
+        print "Image is larger than %d bytes!" % (SunflowerTCP.sunflower_image_size)
+        exit()
     
-    time.sleep(0.5)
+    missing = sf.resume_session(SUNFLOWER_DEVICE, sunflower_fw)
+    sf.upload_image(SUNFLOWER_DEVICE, sunflower_fw, chunks=missing)
     
-    sunflower_fw = open(filename, "rb")
-    
-    address = 0x00000000
-    while address < SunflowerTCP.sunflower_image_size:
-        fr = FR1_PAYLOAD()
-        fr.set_device(SUNFLOWER_DEVICE)
-        fr.set_address(address)
-        fw_bytes = bytearray(sunflower_fw.read(len(fr.payload)))
-        
-        # pad the fw_bytes array out to the required length
-        fw_bytes += "\0" * (len(fr.payload) - len(fw_bytes))
-        
-        for j in range(0, len(fr.payload)):
-            fr.payload[j] = fw_bytes[j]
-        
-        sf.send_tcp_payload(fr)
-        
-        address += len(fr.payload)
-        
-        print "Wrote address %d" % (address)
+    if not sf.validate_image(SUNFLOWER_DEVICE):
+        print "Image failed validation!"
+    else:
+        print "Image validated"
     
     sf.exit_fw_update_mode()
     
@@ -258,21 +400,7 @@ def dandelion_image_memory_test(sf):
     fr.set_device(DANDELION_DEVICE)
     sf.send_tcp_payload(fr)
     
-    time.sleep(0.5)
-    
-    address = 0x00000000
-    while address < SunflowerTCP.dandelion_image_size:
-        fr = FR1_PAYLOAD()
-        fr.set_device(DANDELION_DEVICE)
-        fr.set_address(address)
-        for j in range(0, len(fr.payload)):
-            fr.payload[j] = 1 << 2
-        
-        sf.send_tcp_payload(fr)
-        
-        address += len(fr.payload)
-        
-        print "Wrote address %d" % (address)
+    sf.upload_image(DANDELION_DEVICE, chr(1 << 2) * SunflowerTCP.dandelion_image_size)
     
     sf.exit_fw_update_mode()
 
@@ -282,32 +410,18 @@ def dandelion_image_download(sf, filename):
     
     time.sleep(0.5)
     
-    fr = FR2_START()
-    fr.set_device(DANDELION_DEVICE)
-    sf.send_tcp_payload(fr)
+    dandelion_fw = open(filename, "rb").read()
+    if len(dandelion_fw) > SunflowerTCP.dandelion_image_size:
+        print "Image is larger than %d bytes!" % (SunflowerTCP.dandelion_image_size)
+        exit()
     
-    time.sleep(0.5)
+    missing = sf.resume_session(DANDELION_DEVICE, dandelion_fw)
+    sf.upload_image(DANDELION_DEVICE, dandelion_fw, chunks=missing)
     
-    dandelion_fw = open(filename, "rb")
-    
-    address = 0x00000000
-    while address < SunflowerTCP.dandelion_image_size:
-        fr = FR1_PAYLOAD()
-        fr.set_device(DANDELION_DEVICE)
-        fr.set_address(address)
-        fw_bytes = bytearray(dandelion_fw.read(len(fr.payload)))
-        
-        # pad the fw_bytes array out to the required length
-        fw_bytes += "\0" * (len(fr.payload) - len(fw_bytes))
-        
-        for j in range(0, len(fr.payload)):
-            fr.payload[j] = fw_bytes[j]
-        
-        sf.send_tcp_payload(fr)
-        
-        address += len(fr.payload)
-        
-        print "Wrote address %d" % (address)
+    if not sf.validate_image(DANDELION_DEVICE):
+        print "Image failed validation!"
+    else:
+        print "Image validated"
     
     sf.exit_fw_update_mode()
     
@@ -324,7 +438,9 @@ if __name__ == '__main__':
     parser.add_argument("--dandelion_upgrade", help="Send a dandelion update to Sunflower", action="store", required=False)
     parser.add_argument("--dandelion_test", help="Perform a test dandelion upgrade", action="store_true", required=False)
     parser.add_argument("--sunflower_test", help="Perform a test sunflower upgrade", action="store_true", required=False)
-    parser.add_argument("--sunflower_upgrade", help="Send a sunflower update to Sunflower", action="store", required=False)
+    parser.add_argument("--net_stats", help="Append the lwIP memory statistics to a log for lwip-profile.py", action="store", required=False)
+    parser.add_argument("--net_stats_period", help="Keep sampling the lwIP memory statistics every X seconds", action="store", default="0", required=False)
+    parser.add_argument("--sunflower_upgrade", help="Send a sunflower update to Sunflower (the main and slot B builds, the right one is picked)", action="store", nargs="+", required=False)
     args = parser.parse_args()
     
     print("Connecting to Sunflower...")
@@ -356,7 +472,7 @@ if __name__ == '__main__':
     
         while True:
             time.sleep(2)
-            reports = sf.get_report_buffer()
+            reports, last_seq = sf.get_report_buffer()
             print "Report transact:"
             print(reports)
             for rep in reports:
@@ -374,9 +490,24 @@ if __name__ == '__main__':
 					conn.commit()
 					time.sleep(5)
 					sf.close_valve(1)
+            
+            # Everything up to last_seq is in the database: let the gateway reclaim it
+            sf.ack_reports(last_seq)
                 
         conn.close()        
     
+    if args.net_stats:
+        while True:
+            log = open(args.net_stats, "a")
+            log.write("# %s\n" % datetime.datetime.now().strftime('%Y-%m-%d %H:%M:%S'))
+            for line in sf.get_net_stats():
+                log.write(line + "\n")
+            log.close()
+            
+            if not int(args.net_stats_period):
+                break
+            time.sleep(int(args.net_stats_period))
+    
     if args.dandelion_test:
         dandelion_image_memory_test(sf)
     
@@ -0,0 +1,205 @@
+import sys
+import time
+import socket
+import struct
+import argparse
+
+# Reference collector for the gateway's UDP telemetry exporter (devkit
+# app/inc/telemetry.h). Listens on a unicast port or joins a multicast group,
+# checks the datagram sequence numbers for loss, duplication and reordering,
+# and measures how long reports take to get here:
+#
+#  age      time a report waited on the gateway for its datagram to fill
+#  transit  network delay of a datagram above the fastest one seen, from the
+#           gateway's uptime stamp against the local clock
+#
+# Enable the exporter on the gateway with the 'ee' console command and point
+# it here with 'ec <ip> <port>'.
+
+TELEMETRY_MAGIC = 0x5346544D
+TELEMETRY_VERSION = 1
+
+HEADER = struct.Struct("!IBBHIIII")
+AGE = struct.Struct("!I")
+
+# A sequence number this far behind the highest one seen, or an uptime this
+# many ms behind the latest, is a gateway reboot rather than a late datagram
+RESTART_GAP = 1000
+RESTART_UPTIME_MS = 10000
+
+# Sequence numbers remembered to tell duplicates from late datagrams
+SEEN_WINDOW = 4096
+
+def now_ms():
+    return int(time.time() * 1000)
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+class Stats:
+    def __init__(self):
+        self.datagrams = 0
+        self.reports = 0
+        self.bytes = 0
+        self.lost = 0
+        self.duplicates = 0
+        self.reordered = 0
+        self.restarts = 0
+        self.invalid = 0
+        self.gateway_dropped = 0
+        self.ages = []
+        self.transits = []
+
+    def expected(self):
+        return self.datagrams + self.lost - self.duplicates
+
+class Receiver:
+    def __init__(self, args):
+        self.args = args
+        self.total = Stats()
+        self.period = Stats()
+        self.highest = None
+        self.seen = set()
+        self.min_offset = None
+        self.last_uptime = None
+
+    def restart(self):
+        self.highest = None
+        self.seen = set()
+        self.min_offset = None
+        for s in (self.total, self.period):
+            s.restarts += 1
+
+    def count(self, attr, n=1):
+        for s in (self.total, self.period):
+            setattr(s, attr, getattr(s, attr) + n)
+
+    def track_seq(self, seq):
+        if self.highest is None:
+            self.highest = seq
+        elif seq > self.highest:
+            self.count("lost", seq - self.highest - 1)
+            self.highest = seq
+        elif seq in self.seen:
+            self.count("duplicates")
+            return False
+        else:
+            # Counted as lost when the gap opened
+            self.count("reordered")
+            self.count("lost", -1)
+
+        self.seen.add(seq)
+        if len(self.seen) > SEEN_WINDOW:
+            self.seen = set(s for s in self.seen if self.highest - s < SEEN_WINDOW / 2)
+        return True
+
+    def input(self, data, sender, received):
+        if len(data) < HEADER.size:
+            self.count("invalid")
+            return
+
+        magic, version, count, record_size, seq, uptime, unix_time, dropped = HEADER.unpack_from(data)
+        if magic != TELEMETRY_MAGIC or version != TELEMETRY_VERSION or len(data) != HEADER.size + count * record_size:
+            self.count("invalid")
+            return
+
+        if self.highest is not None and seq < self.highest and \
+           (self.highest - seq > RESTART_GAP or self.last_uptime - uptime > RESTART_UPTIME_MS):
+            self.restart()
+        if self.last_uptime is None or uptime > self.last_uptime or self.highest is None:
+            self.last_uptime = uptime
+
+        if not self.track_seq(seq):
+            return
+
+        # One-way delay can't be measured without synchronised clocks: the
+        # fastest datagram seen is the baseline, transit is the excess over it
+        offset = received - uptime
+        if self.min_offset is None or offset < self.min_offset:
+            self.min_offset = offset
+        transit = offset - self.min_offset
+
+        ages = [AGE.unpack_from(data, HEADER.size + i * record_size)[0] for i in range(count)]
+
+        for s in (self.total, self.period):
+            s.datagrams += 1
+            s.reports += count
+            s.bytes += len(data)
+            s.gateway_dropped = dropped
+            s.ages.extend(ages)
+            s.transits.append(transit)
+
+        if self.args.verbose:
+            print("%s seq %d: %d reports, gateway time %d, age max %d ms, transit +%d ms" %
+                  (sender[0], seq, count, unix_time, max(ages) if ages else 0, transit))
+
+        if self.args.dump:
+            for i in range(count):
+                start = HEADER.size + i * record_size + AGE.size
+                print("  %s" % " ".join("%02x" % ord(data[j:j + 1]) for j in range(start, HEADER.size + (i + 1) * record_size)))
+
+def print_stats(title, s):
+    expected = s.expected()
+    print("%s: %d datagrams, %d reports (%.1f per datagram), %d bytes" %
+          (title, s.datagrams, s.reports, float(s.reports) / s.datagrams if s.datagrams else 0, s.bytes))
+    print("  lost %d of %d (%.2f%%), %d duplicates, %d reordered, %d gateway restarts, %d invalid, gateway dropped %d" %
+          (s.lost, expected, 100.0 * s.lost / expected if expected else 0, s.duplicates, s.reordered, s.restarts,
+           s.invalid, s.gateway_dropped))
+    if s.ages:
+        print("  age ms: avg %d, p50 %d, p99 %d, max %d" %
+              (sum(s.ages) / len(s.ages), percentile(s.ages, 50), percentile(s.ages, 99), max(s.ages)))
+    if s.transits:
+        print("  transit ms above baseline: avg %d, p50 %d, p99 %d, max %d" %
+              (sum(s.transits) / len(s.transits), percentile(s.transits, 50), percentile(s.transits, 99), max(s.transits)))
+
+def open_socket(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+
+    if args.group:
+        sock.bind(("", args.port))
+        mreq = struct.pack("4s4s", socket.inet_aton(args.group), socket.inet_aton(args.interface))
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+    else:
+        sock.bind((args.interface, args.port))
+
+    sock.settimeout(1.0)
+    return sock
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Receive gateway UDP telemetry and measure loss and latency')
+    parser.add_argument("-p", "--port", help="UDP port (default 4270)", type=int, default=4270)
+    parser.add_argument("-g", "--group", help="multicast group to join, e.g. 239.255.83.70", action="store", default=None)
+    parser.add_argument("-i", "--interface", help="local address to listen on / join the group from", action="store", default="0.0.0.0")
+    parser.add_argument("--period", help="seconds between statistics (default 10)", type=int, default=10)
+    parser.add_argument("--duration", help="stop after this many seconds (default run until interrupted)", type=int, default=0)
+    parser.add_argument("-v", "--verbose", help="print every datagram", action="store_true")
+    parser.add_argument("--dump", help="hex dump every report", action="store_true")
+    args = parser.parse_args()
+
+    sock = open_socket(args)
+    receiver = Receiver(args)
+    start = time.time()
+    next_print = start + args.period
+
+    print("Listening on %s port %d" % (args.group or args.interface, args.port))
+
+    try:
+        while not args.duration or time.time() - start < args.duration:
+            try:
+                data, sender = sock.recvfrom(2048)
+                receiver.input(data, sender, now_ms())
+            except socket.timeout:
+                pass
+
+            if time.time() >= next_print:
+                print_stats("Last %d s" % args.period, receiver.period)
+                receiver.period = Stats()
+                next_print += args.period
+    except KeyboardInterrupt:
+        pass
+
+    print_stats("Total", receiver.total)